@@ -1,27 +1,31 @@
 #version 330 core
 
 layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexColor;
-layout(location = 2) in vec2 vertexUV;
-layout(location = 3) in vec3 vertexNormal;
+layout(location = 1) in vec2 vertexUV;
+layout(location = 2) in vec3 vertexNormal;
+
+// Per-instance attributes
+layout(location = 4) in mat4 instanceModelMatrix; // Occupies locations 4-7
+layout(location = 8) in float instanceTextureLayer;
+layout(location = 9) in vec2 instanceUVScale;
 
-out vec3 fragColor;
 out vec2 fragUV;
 out vec3 fragPosition;
 out vec3 fragNormal;
-out vec4 fragPosLightSpace;
+flat out float fragTextureLayer;
 
-uniform mat4 MVP;
-uniform mat4 modelMatrix;
-uniform mat3 normalMatrix;
-uniform mat4 lightSpaceMatrix;
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
 
 void main() {
-    vec4 worldPosition = modelMatrix * vec4(vertexPosition, 1.0);
-    gl_Position = MVP * vec4(vertexPosition, 1.0);
-    fragColor = vertexColor;
-    fragUV = vertexUV;
+    vec4 worldPosition = instanceModelMatrix * vec4(vertexPosition, 1.0);
+    mat3 normalMatrix = transpose(inverse(mat3(instanceModelMatrix)));
+
+    gl_Position = vpMatrix * worldPosition;
+    fragUV = vertexUV * instanceUVScale;
     fragPosition = vec3(worldPosition);
     fragNormal = normalize(normalMatrix * vertexNormal);
-    fragPosLightSpace = lightSpaceMatrix * worldPosition;
+    fragTextureLayer = instanceTextureLayer;
 }
@@ -2,8 +2,8 @@
 
 // Input
 layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexColor;
-layout(location = 2) in vec2 vertexUV;
+layout(location = 1) in vec2 vertexUV;
+layout(location = 3) in vec3 vertexColor;
 
 // Output data, to be interpolated for each fragment
 out vec3 color;
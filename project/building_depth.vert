@@ -0,0 +1,18 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 4) in mat4 instanceModelMatrix; // Occupies locations 4-7
+
+#ifdef CAMERA_DEPTH
+layout(std140) uniform CameraBlock {
+    mat4 depthMatrix;
+    vec3 cameraPosition;
+};
+#else
+layout(std140) uniform ShadowBlock {
+    mat4 depthMatrix;
+};
+#endif
+
+void main() {
+    gl_Position = depthMatrix * instanceModelMatrix * vec4(aPos, 1.0);
+}
@@ -1,9 +1,21 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 lightSpaceMatrix;
+// With CAMERA_DEPTH the program lays down the camera's depth for the shadow
+// mask prepass and takes the camera matrix instead of the light's
+#ifdef CAMERA_DEPTH
+layout(std140) uniform CameraBlock {
+    mat4 depthMatrix;
+    vec3 cameraPosition;
+};
+#else
+layout(std140) uniform ShadowBlock {
+    mat4 depthMatrix;
+};
+#endif
+
 uniform mat4 modelMatrix;
 
 void main() {
-    gl_Position = lightSpaceMatrix * modelMatrix * vec4(aPos, 1.0);
+    gl_Position = depthMatrix * modelMatrix * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,10 @@
+#version 330 core
+
+out vec2 UV;
+
+// One triangle covering the whole target, generated from the vertex index
+void main() {
+    vec2 corner = vec2(float((gl_VertexID & 1) << 2), float((gl_VertexID & 2) << 1)) - 1.0;
+    UV = corner * 0.5 + 0.5;
+    gl_Position = vec4(corner, 0.0, 1.0);
+}
@@ -0,0 +1,83 @@
+// Spot and point lights of render/local_lights.h, shadowed through tiles of
+// one atlas. Included by every receiver after its #version line; the program
+// has to point shadowAtlas at the unit the atlas is bound to.
+
+struct LocalLight {
+    vec4 positionRange;  // xyz position, w range
+    vec4 directionType;  // xyz spot direction, w 1 for spot, 2 for point
+    vec4 colorIntensity;
+    vec4 coneShadow;     // Cosines of the outer and inner cone, first shadow tile or -1
+};
+
+// Filled once per frame by FrameUniforms::updateLocalLights
+layout(std140) uniform LocalLightBlock {
+    LocalLight lights[8];
+    mat4 shadowMatrices[24];
+    vec4 shadowTiles[24]; // Offset and size in atlas UV, w 1 once rendered
+    int lightCount;
+};
+
+uniform sampler2DShadow shadowAtlas;
+
+// Shadow factor of a local light; a point light's tile is picked by the major
+// axis of the light-to-fragment vector, in the face order of local_lights.cpp
+float localShadow(LocalLight light, vec3 position, vec3 normal) {
+    int tile = int(light.coneShadow.z);
+    if (tile < 0) {
+        return 0.0;
+    }
+    vec3 toFragment = position - light.positionRange.xyz;
+    float halfAngleTan = 1.0;
+    if (light.directionType.w > 1.5) {
+        vec3 axis = abs(toFragment);
+        if (axis.x >= axis.y && axis.x >= axis.z) {
+            tile += toFragment.x > 0.0 ? 0 : 1;
+        } else if (axis.y >= axis.z) {
+            tile += toFragment.y > 0.0 ? 2 : 3;
+        } else {
+            tile += toFragment.z > 0.0 ? 4 : 5;
+        }
+    } else {
+        halfAngleTan = sqrt(1.0 - light.coneShadow.x * light.coneShadow.x) / light.coneShadow.x;
+    }
+    vec4 region = shadowTiles[tile];
+    if (region.w == 0.0) {
+        return 0.0; // Not rendered yet
+    }
+
+    // Offset along the normal by about a texel of the tile at this distance
+    float texelWorld = 2.0 * length(toFragment) * halfAngleTan / (region.z * textureSize(shadowAtlas, 0).x);
+    vec4 lightSpace = shadowMatrices[tile] * vec4(position + normal * 1.5 * texelWorld, 1.0);
+    vec3 projCoords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+    if (projCoords.z > 1.0 || any(lessThan(projCoords.xy, vec2(0.0))) || any(greaterThan(projCoords.xy, vec2(1.0)))) {
+        return 0.0;
+    }
+
+    // Keep the bilinear footprint inside the tile
+    vec2 halfTexel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+    vec2 uv = clamp(region.xy + projCoords.xy * region.z, region.xy + halfTexel, region.xy + region.z - halfTexel);
+    return 1.0 - texture(shadowAtlas, vec3(uv, projCoords.z - 0.00005));
+}
+
+// Diffuse light of every local light, with a smooth falloff to zero at its range
+vec3 localLighting(vec3 position, vec3 normal) {
+    vec3 total = vec3(0.0);
+    for (int i = 0; i < lightCount; i++) {
+        LocalLight light = lights[i];
+        vec3 toLight = light.positionRange.xyz - position;
+        float distance = length(toLight);
+        if (distance >= light.positionRange.w) {
+            continue;
+        }
+        vec3 L = toLight / distance;
+        float falloff = 1.0 - distance * distance / (light.positionRange.w * light.positionRange.w);
+        float intensity = light.colorIntensity.w * falloff * falloff * max(dot(normal, L), 0.0);
+        if (light.directionType.w < 1.5) {
+            intensity *= smoothstep(light.coneShadow.x, light.coneShadow.y, dot(-L, light.directionType.xyz));
+        }
+        if (intensity > 0.0) {
+            total += (1.0 - localShadow(light, position, normal)) * intensity * light.colorIntensity.rgb;
+        }
+    }
+    return total;
+}
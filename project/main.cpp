@@ -19,7 +19,30 @@
 #include "objects/sun.h"
 #include "utils/lightInfo.h"
 #include "objects/MyBot.h"
+#include "objects/building_batch.h"
 #include "particles/particle.h"
+#include "particles/particle_kernel.h"
+#include "particles/particle_manager.h"
+#include "particles/particle_sort.h"
+#include "render/render_stats.h"
+#include "render/gl_state.h"
+#include "render/frame_uniforms.h"
+#include "render/render_queue.h"
+#include "render/geometry_pool.h"
+#include "render/frustum_culling.h"
+#include "render/spatial_index.h"
+#include "render/occlusion_culling.h"
+#include "render/occlusion_queries.h"
+#include "render/shadow_frustum.h"
+#include "render/shadow_cache.h"
+#include "render/cascaded_shadow_map.h"
+#include "render/shadow_filter.h"
+#include "render/shadow_mask.h"
+#include "render/local_lights.h"
+#include "render/worker_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
 
@@ -64,46 +87,22 @@ static float viewDistance = 300.0f;
 
 static float lightSpeed = 100.0f; // Movement speed for the light source
 
-// Shadow mapping parameters
-const unsigned int SHADOW_WIDTH = 4096, SHADOW_HEIGHT = 4096;
-GLuint depthMapFBO;
-GLuint depthMap;
+// Shadow mapping parameters: the view is split into SHADOW_CASCADES slices,
+// each with its own square depth map
+const int SHADOW_CASCADES = 4;
+const GLsizei SHADOW_CASCADE_SIZE = 1024;
 
 
 
-static GLuint LoadTextureTileBox(const char *texture_file_path) {
-    int w, h, channels;
-    uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, 3);
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    // To tile textures on a box, we set wrapping to repeat
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    if (img) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    } else {
-        std::cout << "Failed to load texture " << texture_file_path << std::endl;
-    }
-    stbi_image_free(img);
-
-    return texture;
-}
-
 static void saveDepthTexture(GLuint fbo, std::string filename) {
-	int width = SHADOW_WIDTH; // Shadow map width
-	int height = SHADOW_HEIGHT; // Shadow map height
+	int width = SHADOW_CASCADE_SIZE; // Shadow map width
+	int height = SHADOW_CASCADE_SIZE; // Shadow map height
 	int channels = 3;
 
 	std::vector<float> depth(width * height);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, fbo);
 	glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	std::vector<unsigned char> img(width * height * 3);
 	for (int i = 0; i < width * height; ++i) {
@@ -113,394 +112,179 @@ static void saveDepthTexture(GLuint fbo, std::string filename) {
 	stbi_write_png(filename.c_str(), width, height, channels, img.data(), width * channels);
 }
 bool saveDepthMap = false;
-
-
-
-
-struct Building {
-	glm::vec3 position;		// Position of the box
-	glm::vec3 scale;		// Size of the box in each axis
-
-	GLfloat vertex_buffer_data[72] = {	// Vertex definition for a canonical box
-		// Front face
-		-1.0f, -1.0f, 1.0f,
-		1.0f, -1.0f, 1.0f,
-		1.0f, 1.0f, 1.0f,
-		-1.0f, 1.0f, 1.0f,
-
-		// Back face
-		1.0f, -1.0f, -1.0f,
-		-1.0f, -1.0f, -1.0f,
-		-1.0f, 1.0f, -1.0f,
-		1.0f, 1.0f, -1.0f,
-
-		// Left face
-		-1.0f, -1.0f, -1.0f,
-		-1.0f, -1.0f, 1.0f,
-		-1.0f, 1.0f, 1.0f,
-		-1.0f, 1.0f, -1.0f,
-
-		// Right face
-		1.0f, -1.0f, 1.0f,
-		1.0f, -1.0f, -1.0f,
-		1.0f, 1.0f, -1.0f,
-		1.0f, 1.0f, 1.0f,
-
-		// Top face
-		-1.0f, 1.0f, 1.0f,
-		1.0f, 1.0f, 1.0f,
-		1.0f, 1.0f, -1.0f,
-		-1.0f, 1.0f, -1.0f,
-
-		// Bottom face
-		-1.0f, -1.0f, -1.0f,
-		1.0f, -1.0f, -1.0f,
-		1.0f, -1.0f, 1.0f,
-		-1.0f, -1.0f, 1.0f,
-	};
-
-	GLfloat normal_buffer_data[72] = {
-		// Front face
-		0.0f, 0.0f, 1.0f,
-		0.0f, 0.0f, 1.0f,
-		0.0f, 0.0f, 1.0f,
-		0.0f, 0.0f, 1.0f,
-		// Back face
-		0.0f, 0.0f, -1.0f,
-		0.0f, 0.0f, -1.0f,
-		0.0f, 0.0f, -1.0f,
-		0.0f, 0.0f, -1.0f,
-		// Other faces...
-		-1.0f, 0.0f, 0.0f,
-		-1.0f, 0.0f, 0.0f,
-		-1.0f, 0.0f, 0.0f,
-		-1.0f, 0.0f, 0.0f,
-		 // Other faces...
-		 1.0f, 0.0f, 0.0f,
-		 1.0f, 0.0f, 0.0f,
-		 1.0f, 0.0f, 0.0f,
-		 1.0f, 0.0f, 0.0f,
-
-		 0.0f, 1.0f, 0.0f,
-		 0.0f, 1.0f, 0.0f,
-		 0.0f, 1.0f, 0.0f,
-		 0.0f, 1.0f, 0.0f,
-
-		0.0f, -1.0f, 0.0f,
-		0.0f, -1.0f, 0.0f,
-		0.0f, -1.0f, 0.0f,
-		0.0f, -1.0f, 0.0f,
-	};
-
-	GLfloat color_buffer_data[72] = {
-		// Front, red
-		1.0f, 0.0f, 0.0f,
-		1.0f, 0.0f, 0.0f,
-		1.0f, 0.0f, 0.0f,
-		1.0f, 0.0f, 0.0f,
-
-		// Back, yellow
-		1.0f, 1.0f, 0.0f,
-		1.0f, 1.0f, 0.0f,
-		1.0f, 1.0f, 0.0f,
-		1.0f, 1.0f, 0.0f,
-
-		// Left, green
-		0.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f,
-
-		// Right, cyan
-		0.0f, 1.0f, 1.0f,
-		0.0f, 1.0f, 1.0f,
-		0.0f, 1.0f, 1.0f,
-		0.0f, 1.0f, 1.0f,
-
-		// Top, blue
-		0.0f, 0.0f, 1.0f,
-		0.0f, 0.0f, 1.0f,
-		0.0f, 0.0f, 1.0f,
-		0.0f, 0.0f, 1.0f,
-
-		// Bottom, magenta
-		1.0f, 0.0f, 1.0f,
-		1.0f, 0.0f, 1.0f,
-		1.0f, 0.0f, 1.0f,
-		1.0f, 0.0f, 1.0f,
-	};
-
-	GLuint index_buffer_data[36] = {		// 12 triangle faces of a box
-		0, 1, 2,
-		0, 2, 3,
-
-		4, 5, 6,
-		4, 6, 7,
-
-		8, 9, 10,
-		8, 10, 11,
-
-		12, 13, 14,
-		12, 14, 15,
-
-		16, 17, 18,
-		16, 18, 19,
-
-		20, 21, 22,
-		20, 22, 23,
+bool occlusionCulling = true; // Toggled with C
+bool occlusionQueriesEnabled = false; // Toggled with G
+ShadowTechnique shadowTechnique = SHADOW_PCF; // Cycled with V
+ShadowMaskMode shadowMaskMode = SHADOW_MASK_OFF; // Cycled with M
+ParticleSimulation particleSimulation = PARTICLES_CPU; // Cycled with T
+const int ParticleCounts[] = {500, 10000, 100000, 1000000}; // Per system, cycled with N
+int particleCountIndex = 0;
+bool fireworkRequested = false; // Set with B
+const int ParticleSortIntervals[] = {1, 4, 16, 0}; // Frames per full depth sort, 0 for none; cycled with R
+int particleSortIndex = 0;
+
+// Picks the count buildings nearest to the camera among those in view; close
+// buildings cover the most screen and make the best occluders
+static void selectOccluders(const BoundingVolumeHierarchy &cityIndex, const std::vector<BoundingBox> &buildingBounds,
+							const Frustum &frustum, const glm::vec3 &cameraPosition, size_t count,
+							std::vector<uint32_t> &candidates, std::vector<BoundingBox> &occluders) {
+	candidates.clear();
+	cityIndex.queryFrustum(frustum, candidates);
+	auto closer = [&](uint32_t a, uint32_t b) {
+		return DistanceSquared(buildingBounds[a], cameraPosition) < DistanceSquared(buildingBounds[b], cameraPosition);
 	};
-
-    // TODO: Define UV buffer data
-    // ---------------------------
-    // ---------------------------
-	GLfloat uv_buffer_data[48] = {
-		// Front
-		0.0f, 1.0f,
-		1.0f, 1.0f,
-		1.0f, 0.0f,
-		0.0f, 0.0f,
-		// Back
-		0.0f, 1.0f,
-		1.0f, 1.0f,
-		1.0f, 0.0f,
-		0.0f, 0.0f,
-		// Left
-		0.0f, 1.0f,
-		1.0f, 1.0f,
-		1.0f, 0.0f,
-		0.0f, 0.0f,
-		// Right
-		0.0f, 1.0f,
-		1.0f, 1.0f,
-		1.0f, 0.0f,
-		0.0f, 0.0f,
-		// Top - we do not want texture the top
-		0.0f, 0.0f,
-		0.0f, 0.0f,
-		0.0f, 0.0f,
-		0.0f, 0.0f,
-		// Bottom - we do not want texture the bottom
-		0.0f, 0.0f,
-		0.0f, 0.0f,
-		0.0f, 0.0f,
-		0.0f, 0.0f,
-		};
-
-	// OpenGL buffers
-	GLuint vertexArrayID;
-	GLuint vertexBufferID;
-	GLuint indexBufferID;
-	GLuint colorBufferID;
-	GLuint uvBufferID;
-	GLuint textureID;
-
-	// Shader variable IDs
-	GLuint mvpMatrixID;
-	GLuint textureSamplerID;
-	GLuint programID;
-	GLuint lightPositionID;
-	GLuint lightColorID;
-	GLuint lightIntensityID;
-	GLuint cameraPositionID;
-	GLuint normalBufferID;
-	// Shader variable IDs for shadow mapping
-	GLuint lightSpaceMatrixID;
-	GLuint shadowMapID;
-
-	void initialize(glm::vec3 position, glm::vec3 scale) {
-		// Define scale of the building geometry
-		this->position = position;
-		this->scale = scale;
-
-		// Create a vertex array object
-		glGenVertexArrays(1, &vertexArrayID);
-		glBindVertexArray(vertexArrayID);
-
-		// Create a vertex buffer object to store the vertex data
-		glGenBuffers(1, &vertexBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
-
-		// Create a vertex buffer object to store the color data
-        // TODO:
-		glGenBuffers(1, &colorBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(color_buffer_data), color_buffer_data, GL_STATIC_DRAW);
-
-		glGenBuffers(1, &normalBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(normal_buffer_data), normal_buffer_data, GL_STATIC_DRAW);
-
-		/*
-		 *Typically, texture coordinates are stored in an array in pairs,
-		 *where each pair corresponds to the (u, v) coordinates that map a texture to a polygon in computer graphics.
-		 *In the format where each pair is stored as [u0, v0, u1, v1, ..., un, vn], the u values usually represent
-		 *the horizontal component of the texture mapping, and the v values represent the vertical component.
-		 *
-		 *By multiplying every second element by 5, which corresponds to
-		 *all the v components (given the starting index of 1 and the stride of 2),
-		 *the loop is scaling the vertical component of these texture coordinates.
-		 */
-		for (int i = 0; i < 24; ++i) uv_buffer_data[2*i+1] *= 5;
-		// TODO: Create a vertex buffer object to store the UV data
-		// --------------------------------------------------------
-        // --------------------------------------------------------
-		glGenBuffers(1, &uvBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data,
-	GL_STATIC_DRAW);
-
-		// Create an index buffer object to store the index data that defines triangle faces
-		glGenBuffers(1, &indexBufferID);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
-
-		// Create and compile our GLSL program from the shaders
-		programID = LoadShadersFromFile("../project/box.vert", "../project/box.frag");
-		if (programID == 0)
-		{
-			std::cerr << "Failed to load shaders." << std::endl;
-		}
-
-		// Get a handle for our "MVP" uniform
-		mvpMatrixID = glGetUniformLocation(programID, "MVP");
-
-        // --------------------
-        // --------------------
-		textureID = LoadTextureTileBox("../project/skyscraper1.png");
-
-        // -------------------------------------
-        // -------------------------------------
-		textureSamplerID = glGetUniformLocation(programID,"textureSampler");
-		lightPositionID = glGetUniformLocation(programID, "lightPosition");
-		lightColorID = glGetUniformLocation(programID, "lightColor");
-		lightIntensityID = glGetUniformLocation(programID, "lightIntensity");
-		cameraPositionID = glGetUniformLocation(programID, "cameraPosition");
-		// After loading the shader program
-		lightSpaceMatrixID = glGetUniformLocation(programID, "lightSpaceMatrix");
-		shadowMapID = glGetUniformLocation(programID, "shadowMap");
-
-
+	if (candidates.size() > count) {
+		std::nth_element(candidates.begin(), candidates.begin() + count, candidates.end(), closer);
+		candidates.resize(count);
 	}
-
-	void render(glm::mat4 cameraMatrix, glm::mat4 lightSpaceMatrix, GLuint depthMap) {
-		glUseProgram(programID);
-
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-
-		// Set the light space matrix uniform
-		glUniformMatrix4fv(lightSpaceMatrixID, 1, GL_FALSE, &lightSpaceMatrix[0][0]);
-
-		// Bind the depth map to texture unit 1
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, depthMap);
-		glUniform1i(shadowMapID, 1);
-
-		// ----------------------
-		// Create the model transformation matrix
-		glm::mat4 modelMatrix = glm::mat4(1.0f);
-		modelMatrix = glm::translate(modelMatrix, position); // Translate to the building's position
-		modelMatrix = glm::scale(modelMatrix, scale);        // Scale to the building's dimensions
-
-        // -----------------------
-
-		// Set model-view-projection matrix
-		glm::mat4 mvp = cameraMatrix * modelMatrix;
-
-
-		glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
-
-		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
-		glUniformMatrix4fv(glGetUniformLocation(programID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
-		glUniformMatrix3fv(glGetUniformLocation(programID, "normalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
-
-		// TODO: Enable UV buffer and texture sampler
-		// ------------------------------------------
-        // ------------------------------------------
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glUniform1i(textureSamplerID, 0);
-
-		glEnableVertexAttribArray(3);
-		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-
-		glUniform3fv(lightPositionID, 1, &lightPosition[0]);
-		glUniform3fv(lightColorID, 1, &lightColor[0]);
-		glUniform1f(lightIntensityID, lightIntensity);
-		glUniform3fv(cameraPositionID, 1, &cameraPosition[0]);
-
-		// Pass light direction to the shader
-		glUniform3fv(glGetUniformLocation(programID, "lightDirection"), 1, &lightDirection[0]);
-
-
-
-		// Draw the box
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			36,    			   // number of indices
-			GL_UNSIGNED_INT,   // type
-			(void*)0           // element array buffer offset
-		);
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-        //glDisableVertexAttribArray(2);
+	occluders.clear();
+	for (uint32_t index : candidates) {
+		occluders.push_back(buildingBounds[index]);
 	}
+}
 
-	void renderDepth(GLuint shaderProgramID, glm::mat4 lightSpaceMatrix) {
-		glUseProgram(shaderProgramID);
-
-		// Set uniforms
-		glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
-
-		glm::mat4 modelMatrix = glm::mat4(1.0f);
-		modelMatrix = glm::translate(modelMatrix, position);
-		modelMatrix = glm::scale(modelMatrix, scale);
-
-		glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+static double millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
 
-		glBindVertexArray(vertexArrayID);
+// Times the spatial index against brute force on synthetic cities laid out like
+// generateBuildingBlock; started with --bench-spatial
+static int runSpatialBenchmark() {
+	const int queryCount = 1000;
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<float> height_dist(30.0f, 150.0f);
+	std::uniform_real_distribution<float> unit_dist(0.0f, 1.0f);
+
+	for (int buildingCount : {400, 10000, 100000}) {
+		int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(buildingCount))));
+		float spacing = 50.0f, extent = side * spacing;
+		std::vector<BoundingBox> boxes;
+		CullingSet brute;
+		for (int i = 0; i < buildingCount; i++) {
+			float height = height_dist(gen);
+			glm::vec3 position((i % side) * spacing - 0.5f * extent, height, (i / side) * spacing - 0.5f * extent);
+			glm::vec3 scale(16.0f, height, 16.0f);
+			boxes.push_back(BoundingBox(position - scale, position + scale));
+			brute.add(boxes.back());
+		}
 
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		auto start = std::chrono::high_resolution_clock::now();
+		BoundingVolumeHierarchy bvh;
+		bvh.build(boxes);
+		double buildMs = millisecondsSince(start);
+
+		// Street-level camera in the middle of the city looking down a street
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 4500.0f);
+		Frustum frustum(projection * glm::lookAt(glm::vec3(25.0f, 15.0f, 25.0f), glm::vec3(25.0f, 15.0f, -1000.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+
+		std::vector<uint32_t> results;
+		size_t bruteHits = 0, bvhHits = 0;
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < 100; i++) {
+			results.clear();
+			bruteHits = brute.cull(frustum, results);
+		}
+		double bruteFrustumMs = millisecondsSince(start) / 100;
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < 100; i++) {
+			results.clear();
+			bvh.queryFrustum(frustum, results);
+			bvhHits = results.size();
+		}
+		double bvhFrustumMs = millisecondsSince(start) / 100;
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+		std::vector<glm::vec3> points(queryCount);
+		for (glm::vec3 &point : points) {
+			point = glm::vec3((unit_dist(gen) - 0.5f) * extent, 20.0f, (unit_dist(gen) - 0.5f) * extent);
+		}
+		size_t sphereHits = 0, bruteSphereHits = 0;
+		start = std::chrono::high_resolution_clock::now();
+		for (const glm::vec3 &point : points) {
+			results.clear();
+			bvh.querySphere(point, 75.0f, results);
+			sphereHits += results.size();
+		}
+		double bvhSphereMs = millisecondsSince(start) / queryCount;
+		start = std::chrono::high_resolution_clock::now();
+		for (const glm::vec3 &point : points) {
+			for (const BoundingBox &box : boxes) {
+				bruteSphereHits += DistanceSquared(box, point) <= 75.0f * 75.0f;
+			}
+		}
+		double bruteSphereMs = millisecondsSince(start) / queryCount;
+
+		size_t boxHits = 0;
+		start = std::chrono::high_resolution_clock::now();
+		for (const glm::vec3 &point : points) {
+			results.clear();
+			bvh.queryBox(BoundingBox(point - glm::vec3(50.0f), point + glm::vec3(50.0f)), results);
+			boxHits += results.size();
+		}
+		double bvhBoxMs = millisecondsSince(start) / queryCount;
+
+		const size_t k = 8;
+		bool nearestMatches = true;
+		std::vector<std::pair<float, uint32_t>> ranked(boxes.size());
+		start = std::chrono::high_resolution_clock::now();
+		for (const glm::vec3 &point : points) {
+			results.clear();
+			bvh.queryNearest(point, k, results);
+		}
+		double bvhNearestMs = millisecondsSince(start) / queryCount;
+		start = std::chrono::high_resolution_clock::now();
+		for (const glm::vec3 &point : points) {
+			for (uint32_t i = 0; i < boxes.size(); i++) {
+				ranked[i] = std::make_pair(DistanceSquared(boxes[i], point), i);
+			}
+			std::partial_sort(ranked.begin(), ranked.begin() + k, ranked.end());
+		}
+		double bruteNearestMs = millisecondsSince(start) / queryCount;
+		// Ties aside, the k-th distance must agree with the exhaustive search
+		results.clear();
+		bvh.queryNearest(points.back(), k, results);
+		nearestMatches = results.size() == k && DistanceSquared(boxes[results.back()], points.back()) == ranked[k - 1].first;
+
+		printf("%6d buildings: BVH %d nodes, depth %d, built in %.2f ms\n", buildingCount, (int)bvh.nodeCount(), bvh.depth(), buildMs);
+		printf("    frustum: %.4f ms BVH vs %.4f ms SIMD brute force (%d vs %d visible)\n", bvhFrustumMs, bruteFrustumMs, (int)bvhHits, (int)bruteHits);
+		printf("    sphere r=75: %.4f ms BVH vs %.4f ms brute force (%d vs %d hits)\n", bvhSphereMs, bruteSphereMs, (int)sphereHits, (int)bruteSphereHits);
+		printf("    box 100^3: %.4f ms BVH (%d hits)\n", bvhBoxMs, (int)boxHits);
+		printf("    %d-nearest: %.4f ms BVH vs %.4f ms brute force (%s)\n", (int)k, bvhNearestMs, bruteNearestMs, nearestMatches ? "match" : "MISMATCH");
+
+		// Dynamic objects wandering through the same area
+		UniformGrid grid(50.0f);
+		std::vector<uint32_t> handles;
+		std::vector<glm::vec3> walkers(points.begin(), points.end());
+		for (const glm::vec3 &walker : walkers) {
+			handles.push_back(grid.insert(BoundingBox(walker - glm::vec3(5.0f), walker + glm::vec3(5.0f))));
+		}
+		start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < 100; frame++) {
+			for (size_t i = 0; i < walkers.size(); i++) {
+				walkers[i].z += 0.5f;
+				grid.update(handles[i], BoundingBox(walkers[i] - glm::vec3(5.0f), walkers[i] + glm::vec3(5.0f)));
+			}
+		}
+		double gridUpdateMs = millisecondsSince(start) / 100;
+		size_t gridHits = 0;
+		start = std::chrono::high_resolution_clock::now();
+		for (const glm::vec3 &point : points) {
+			results.clear();
+			grid.querySphere(point, 75.0f, results);
+			gridHits += results.size();
+		}
+		double gridSphereMs = millisecondsSince(start) / queryCount;
+		printf("    grid: %.4f ms to refit %d objects, %.4f ms per sphere query (%d hits)\n",
+			   gridUpdateMs, (int)walkers.size(), gridSphereMs, (int)gridHits);
+	}
+	return 0;
+}
 
-		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0);
 
-		glDisableVertexAttribArray(0);
-	}
 
-	void cleanup() {
-		glDeleteBuffers(1, &vertexBufferID);
-		glDeleteBuffers(1, &colorBufferID);
-		glDeleteBuffers(1, &indexBufferID);
-		glDeleteVertexArrays(1, &vertexArrayID);
-		//glDeleteBuffers(1, &uvBufferID);
-		//glDeleteTextures(1, &textureID);
-		glDeleteProgram(programID);
-	}
-};
 
-void generateBuildingBlock(float x0, float z0, int rows, int cols, float spacing, std::vector<Building> &buildings, std::mt19937 &gen, std::uniform_real_distribution<> &height_dist, std::uniform_real_distribution<> &offset_dist) {
+void generateBuildingBlock(float x0, float z0, int rows, int cols, float spacing, BuildingBatch &buildings, std::mt19937 &gen, std::uniform_real_distribution<> &height_dist, std::uniform_real_distribution<> &offset_dist) {
 	for (int i = 0; i < rows; ++i) {
 		for (int j = 0; j < cols; ++j) {
-			Building b;
-
 			// Randomize position with slight offset
 			float x = x0 + i * spacing + offset_dist(gen);
 			float z = z0 + j * spacing + offset_dist(gen);
@@ -510,8 +294,8 @@ void generateBuildingBlock(float x0, float z0, int rows, int cols, float spacing
 			float height = height_dist(gen);
 			glm::vec3 scale = glm::vec3(16.0f, height, 16.0f);
 			position.y = height;
-			b.initialize(position, scale);
-			buildings.push_back(b);
+			// Pick a facade; the batch wraps the layer to the facades it loads
+			buildings.addBuilding(position, scale, static_cast<float>(gen() % 1024));
 		}
 	}
 }
@@ -522,20 +306,20 @@ void setupFrustum() {
 	glGenVertexArrays(1, &frustumVAO);
 	glGenBuffers(1, &frustumVBO);
 
-	glBindVertexArray(frustumVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, frustumVBO);
+	glState.bindVertexArray(frustumVAO);
+	glState.bindBuffer(GL_ARRAY_BUFFER, frustumVBO);
 
 	// Allocate buffer space (no data yet, as the frustum will update dynamically)
 	glBufferData(GL_ARRAY_BUFFER, 24 * sizeof(glm::vec3), nullptr, GL_DYNAMIC_DRAW);
 
 	// Enable vertex attribute
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-	glEnableVertexAttribArray(0);
+	glState.enableVertexAttribArray(0);
 
-	glBindVertexArray(0);
+	glState.bindVertexArray(0);
 }
 
-void renderFrustum(const glm::mat4& lightProjection, const glm::mat4& lightView, const glm::mat4& vpMatrix, GLuint shaderProgram) {
+void renderFrustum(const glm::mat4& lightProjection, const glm::mat4& lightView, GLuint shaderProgram) {
 	// Frustum corners in light's NDC space
 	std::vector<glm::vec4> frustumCorners = {
 		{-1.0f, -1.0f, -1.0f, 1.0f}, {1.0f, -1.0f, -1.0f, 1.0f},
@@ -564,21 +348,153 @@ void renderFrustum(const glm::mat4& lightProjection, const glm::mat4& lightView,
 	}
 
 	// Update VBO with the transformed corners
-	glBindBuffer(GL_ARRAY_BUFFER, frustumVBO);
+	glState.bindBuffer(GL_ARRAY_BUFFER, frustumVBO);
 	glBufferSubData(GL_ARRAY_BUFFER, 0, worldCorners.size() * sizeof(glm::vec3), worldCorners.data());
 
 	// Render the frustum
-	glUseProgram(shaderProgram);
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "vpMatrix"), 1, GL_FALSE, &vpMatrix[0][0]);
+	glState.useProgram(shaderProgram);
 
-	glBindVertexArray(frustumVAO);
+	glState.bindVertexArray(frustumVAO);
 	glDrawArrays(GL_LINES, 0, 24); // 24 vertices for the lines
-	glBindVertexArray(0);
+	glState.bindVertexArray(0);
+	renderStats.drawCalls++;
+}
+
+
+// Times every particle update kernel the CPU supports on one core, and checks
+// the SIMD results against the scalar ones; started with --bench-particles
+static int runParticleBenchmark() {
+	const size_t count = 1000000;
+	const int frames = 100;
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<float> unit_dist(0.0f, 1.0f);
+	std::vector<float> initialLife(count), offsets(3 * count);
+	for (size_t i = 0; i < count; i++) {
+		initialLife[i] = unit_dist(gen);
+	}
+	for (float &offset : offsets) {
+		offset = (unit_dist(gen) - 0.5f) * 2.0f;
+	}
+
+	ParticlePath path;
+	path.start = glm::vec3(-500.0f, 200.0f, -500.0f);
+	path.delta = glm::vec3(1000.0f, 0.0f, 1000.0f);
+	path.lifeStep = 0.0016f;
+
+	std::vector<float> reference;
+	for (int kernel = 0; kernel < PARTICLE_KERNEL_COUNT; kernel++) {
+		ParticleKernel particleKernel = static_cast<ParticleKernel>(kernel);
+		if (!ParticleKernelSupported(particleKernel)) {
+			printf("%8s: not supported\n", ParticleKernelName(particleKernel));
+			continue;
+		}
+		std::vector<float> life(initialLife), positions(3 * count);
+		ParticleStreams streams = {life.data(), offsets.data(), offsets.data() + count, offsets.data() + 2 * count,
+								   positions.data(), positions.data() + count, positions.data() + 2 * count, count};
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < frames; frame++) {
+			path.phase = std::fmod(frame * 0.016f, 6.2831853f);
+			UpdateParticles(streams, path, particleKernel);
+		}
+		double frameMs = millisecondsSince(start) / frames;
+
+		float maxError = 0.0f;
+		if (reference.empty()) {
+			reference = positions;
+		}
+		for (size_t i = 0; i < positions.size(); i++) {
+			maxError = std::max(maxError, std::abs(positions[i] - reference[i]));
+		}
+		printf("%8s: %.3f ms per frame for %d particles (%.2f ns each), max difference from scalar %g\n",
+			   ParticleKernelName(particleKernel), frameMs, (int)count, frameMs * 1e6 / count, maxError);
+	}
+	printf("Selected kernel: %s\n", ParticleKernelName(BestParticleKernel()));
+	return 0;
 }
 
+// Times the particle depth sort against particle count: the radix sort on one
+// thread and on the worker pool, and std::sort for reference; also checks how
+// far the order is off after a frame of movement. Started with --bench-sort
+static int runSortBenchmark() {
+	const int frames = 20;
+	const glm::vec3 viewPosition(0.0f, 15.0f, 300.0f);
+	WorkerPool workers;
+	workers.start();
+	printf("Worker pool: %d threads besides the caller\n", workers.size());
+
+	for (size_t count : {10000, 100000, 1000000}) {
+		std::mt19937 gen(1234);
+		std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f), jitter(-0.05f, 0.05f);
+		std::vector<float> positions(3 * count), moved(3 * count);
+		for (size_t i = 0; i < positions.size(); i++) {
+			// One frame of drift along x and z, as along the particle paths, plus some noise
+			positions[i] = coordinate(gen);
+			moved[i] = positions[i] + (i / count == 1 ? 0.0f : 1.5f) + jitter(gen);
+		}
+		const float *x = positions.data(), *y = x + count, *z = y + count;
+		const float *movedX = moved.data(), *movedY = movedX + count, *movedZ = movedY + count;
+
+		ParticleDepthSort depthSort;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < frames; frame++) {
+			depthSort.sort(x, y, z, count, viewPosition, NULL);
+		}
+		double singleMs = millisecondsSince(start) / frames;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < frames; frame++) {
+			depthSort.sort(x, y, z, count, viewPosition, &workers);
+		}
+		double pooledMs = millisecondsSince(start) / frames;
+
+		// The order must be back to front up to the 16-bit key quantization
+		std::vector<float> distance(count);
+		float farthest = 0.0f;
+		for (size_t i = 0; i < count; i++) {
+			distance[i] = glm::length(glm::vec3(x[i], y[i], z[i]) - viewPosition);
+			farthest = std::max(farthest, distance[i]);
+		}
+		const std::vector<uint32_t> &order = depthSort.order();
+		float worstInversion = 0.0f;
+		for (size_t i = 1; i < count; i++) {
+			worstInversion = std::max(worstInversion, distance[order[i]] - distance[order[i - 1]]);
+		}
+
+		// Between full sorts the previous order is drawn as is
+		float staleInversion = 0.0f;
+		for (size_t i = 1; i < count; i++) {
+			float nearer = glm::length(glm::vec3(movedX[order[i]], movedY[order[i]], movedZ[order[i]]) - viewPosition);
+			float farther = glm::length(glm::vec3(movedX[order[i - 1]], movedY[order[i - 1]], movedZ[order[i - 1]]) - viewPosition);
+			staleInversion = std::max(staleInversion, nearer - farther);
+		}
+
+		std::vector<uint32_t> reference(count);
+		start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < count; i++) {
+			reference[i] = static_cast<uint32_t>(i);
+		}
+		std::sort(reference.begin(), reference.end(), [&](uint32_t a, uint32_t b) { return distance[a] > distance[b]; });
+		double referenceMs = millisecondsSince(start);
+
+		printf("%7d particles: radix %.3f ms on one thread, %.3f ms pooled; std::sort %.3f ms; "
+			   "worst inversion %.3f (key step %.3f), %.3f a frame later\n",
+			   (int)count, singleMs, pooledMs, referenceMs, worstInversion, farthest / 65535.0f, staleInversion);
+	}
+	return 0;
+}
 
-int main(void)
+int main(int argc, char **argv)
 {
+	if (argc > 1 && strcmp(argv[1], "--bench-spatial") == 0) {
+		return runSpatialBenchmark();
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-particles") == 0) {
+		return runParticleBenchmark();
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-sort") == 0) {
+		return runSortBenchmark();
+	}
+
 	// Initialise GLFW
 	if (!glfwInit())
 	{
@@ -615,50 +531,113 @@ int main(void)
 		return -1;
 	}
 
+	// Reuse linked program binaries from previous runs when the driver supports it
+	double startupBegin = glfwGetTime();
+	InitShaderBinaryCache("shader_cache");
 
 	// Background
 	glClearColor(0.2f, 0.2f, 0.25f, 0.0f);
 
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-
-	// Create the depth framebuffer
-	glGenFramebuffers(1, &depthMapFBO);
-
-	// Create the depth texture
-	glGenTextures(1, &depthMap);
-	glBindTexture(GL_TEXTURE_2D, depthMap);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-				 SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	float borderColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-	// Attach the depth texture as the framebuffer's depth buffer
-	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	GLuint depthShaderProgramID = LoadShadersFromFile("../project/depth.vert", "../project/depth.frag");
-	GLuint botDepthShaderProgramID = LoadShadersFromFile("../project/model/bot_depth.vert", "../project/depth.frag");
-	GLuint flagDepthShaderProgramID = LoadShadersFromFile("../project/objects/flag_depth.vert", "../project/depth.frag");
-	GLuint frustumShaderProgramID = LoadShadersFromFile("../project/frustum.vert", "../project/frustum.frag");
+	glState.enable(GL_DEPTH_TEST);
+	glState.enable(GL_CULL_FACE);
+
+	// Shadow cascades, one layer of a depth texture array each
+	CascadedShadowMap shadowCascades;
+	shadowCascades.initialize(SHADOW_CASCADES, SHADOW_CASCADE_SIZE);
+
+	// Static casters are kept in a second set of depth maps that is copied into
+	// the cascades each frame and only redrawn when a light matrix changes
+	ShadowCache shadowCache;
+	shadowCache.initialize(SHADOW_CASCADE_SIZE, shadowCascades.count());
+
+	// Moment maps for the VSM and EVSM techniques
+	ShadowFilter shadowFilter;
+	shadowFilter.initialize(SHADOW_CASCADE_SIZE, shadowCascades.count());
+
+	// Screen-space shadow term shared by all receivers
+	ShadowMask shadowMask;
+	shadowMask.initialize(1024, 768);
+
+	// Street lamps and other local lights, shadowed through one atlas
+	LocalLights localLights;
+	localLights.initialize();
+	for (float z : {150.0f, -150.0f, -480.0f}) {
+		for (float x : {-120.0f, 120.0f}) {
+			localLights.add(Light::spot(glm::vec3(x, 45.0f, z), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(1.0f, 0.8f, 0.5f), 1.5f,
+										150.0f, glm::radians(35.0f), glm::radians(50.0f)));
+		}
+	}
+	localLights.add(Light::point(glm::vec3(0.0f, 30.0f, -470.0f), glm::vec3(0.5f, 0.6f, 1.0f), 1.2f, 200.0f));
+	localLights.add(Light::point(glm::vec3(30.0f, 20.0f, 30.0f), glm::vec3(1.0f, 0.6f, 0.3f), 1.0f, 80.0f));
+
+	// Camera, light and shadow state shared by every program, uploaded once per frame
+	FrameUniforms frameUniforms;
+	frameUniforms.initialize();
+
+	GLuint depthShaderProgramID = AcquireShaderProgram("../project/depth.vert", "../project/depth.frag");
+	GLuint botDepthShaderProgramID = AcquireShaderProgram("../project/model/bot_depth.vert", "../project/depth.frag");
+	GLuint flagDepthShaderProgramID = AcquireShaderProgram("../project/objects/flag_depth.vert", "../project/depth.frag");
+	GLuint buildingDepthShaderProgramID = AcquireShaderProgram("../project/building_depth.vert", "../project/depth.frag");
+	// The same depth programs reading the camera block, for the shadow mask prepass
+	GLuint prepassShaderProgramID = AcquireShaderProgram("../project/depth.vert", "../project/depth.frag", {"CAMERA_DEPTH"});
+	GLuint botPrepassShaderProgramID = AcquireShaderProgram("../project/model/bot_depth.vert", "../project/depth.frag", {"CAMERA_DEPTH"});
+	GLuint flagPrepassShaderProgramID = AcquireShaderProgram("../project/objects/flag_depth.vert", "../project/depth.frag", {"CAMERA_DEPTH"});
+	GLuint buildingPrepassShaderProgramID = AcquireShaderProgram("../project/building_depth.vert", "../project/depth.frag", {"CAMERA_DEPTH"});
+	GLuint frustumShaderProgramID = AcquireShaderProgram("../project/frustum.vert", "../project/frustum.frag");
 
 	setupFrustum(); // Call during initialization
 
-	// Create particle system
-	GLuint particleShaderProgram = LoadShadersFromFile("../project/particles/particle.vert", "../project/particles/particle.frag");
+	// Particles streaming along two fixed paths, drawn apart from the pool below
+	GLuint particleShaderProgram = AcquireShaderProgram("../project/particles/particle.vert", "../project/particles/particle.frag");
 	ParticleSystem particleSystem(500, particleShaderProgram);
 	particleSystem.initialize(glm::vec3(-500, 200, -500), glm::vec3(500, 200, 500));
 	ParticleSystem particleSystem2(500, particleShaderProgram);
 	particleSystem2.initialize(glm::vec3(-500, 200, 500), glm::vec3(500, 200, -500));
 
+	// Emitters sharing one pooled buffer: a spark fountain and a smoke column
+	// in front of the camera, and a firework launched with B
+	const int particleCapacities[PARTICLE_BLEND_COUNT] = {4096, 16384};
+	ParticleManager particleManager;
+	particleManager.initialize(particleCapacities, particleShaderProgram);
+	EmitterDesc sparks;
+	sparks.position = glm::vec3(-40.0f, 2.0f, 150.0f);
+	sparks.speed = 60.0f;
+	sparks.spread = 0.25f;
+	sparks.acceleration = glm::vec3(0.0f, -60.0f, 0.0f);
+	sparks.rate = 800.0f;
+	sparks.lifetime = 1.5f;
+	sparks.lifetimeVariance = 0.5f;
+	sparks.size = 3.0f;
+	sparks.startColor = glm::vec4(1.0f, 0.8f, 0.3f, 1.0f);
+	sparks.endColor = glm::vec4(1.0f, 0.2f, 0.0f, 0.0f);
+	sparks.blend = PARTICLE_BLEND_ADDITIVE;
+	particleManager.addEmitter(sparks);
+	EmitterDesc smoke;
+	smoke.position = glm::vec3(40.0f, 2.0f, 150.0f);
+	smoke.shape = EMITTER_SPHERE;
+	smoke.extent = glm::vec3(4.0f);
+	smoke.speed = 8.0f;
+	smoke.acceleration = glm::vec3(2.0f, 1.0f, 0.0f); // Drifts with the wind
+	smoke.rate = 120.0f;
+	smoke.lifetime = 5.0f;
+	smoke.lifetimeVariance = 2.0f;
+	smoke.size = 10.0f;
+	smoke.startColor = glm::vec4(0.5f, 0.5f, 0.5f, 0.6f);
+	smoke.endColor = glm::vec4(0.8f, 0.8f, 0.8f, 0.0f);
+	particleManager.addEmitter(smoke);
+	EmitterDesc firework;
+	firework.position = glm::vec3(0.0f, 120.0f, 0.0f);
+	firework.spread = 3.1415927f; // Every direction
+	firework.speed = 50.0f;
+	firework.acceleration = glm::vec3(0.0f, -20.0f, 0.0f);
+	firework.lifetime = 2.0f;
+	firework.lifetimeVariance = 1.0f;
+	firework.size = 3.0f;
+	firework.startColor = glm::vec4(0.4f, 1.0f, 0.5f, 1.0f);
+	firework.endColor = glm::vec4(0.1f, 0.3f, 1.0f, 0.0f);
+	firework.blend = PARTICLE_BLEND_ADDITIVE;
+	int fireworkEmitter = particleManager.addEmitter(firework);
+
 	SkyBox skybox;
 	skybox.initialize(glm::vec3(0,0,0), glm::vec3(2500, 2500, 2500));
 
@@ -675,10 +654,10 @@ int main(void)
 	flag.initialize(flagPosition, flagScale, "../project/ireland_flag.jpg");
 
 	MyBot bot;
-	bot.initialize("../project/model/scene.gltf", sunLightInfo, glm::vec3(-100.0f, 0.0f, -500.0f));
+	bot.initialize("../project/model/scene.gltf", glm::vec3(-100.0f, 0.0f, -500.0f));
 
 	MyBot bot2;
-	bot2.initialize("../project/model/scene.gltf", sunLightInfo, glm::vec3(100.0f, 0.0f, -500.0f));
+	bot2.initialize("../project/model/scene.gltf", glm::vec3(100.0f, 0.0f, -500.0f));
 
 	// Seed random number generator for varied building sizes and positions
 	std::srand(static_cast<unsigned int>(std::time(0)));
@@ -695,7 +674,7 @@ int main(void)
 	std::mt19937 gen(rd());
 	std::uniform_real_distribution<> height_dist(30.0f, 150.0f);
 	std::uniform_real_distribution<> offset_dist(-5.0f, 5.0f);
-	std::vector<Building> buildings;
+	BuildingBatch buildings;
 
 	// Block 1 (Bottom-left corner)
 	float x0_1 = -halfFloor + margin;
@@ -717,10 +696,49 @@ int main(void)
 	float z0_4 = halfFloor - margin - (cols - 1) * spacing;
 	generateBuildingBlock(x0_4, z0_4, rows, cols, spacing, buildings, gen, height_dist, offset_dist);
 
+	// Upload the whole city once, sharing a single mesh, program and facade texture array
+	buildings.initialize("../project/facades");
+
+	// Spatial index of the scene: a BVH over the static city, queried for
+	// occluders, and a grid for everything that moves, queried for the casters
+	// of the local light tiles
+	auto indexStart = std::chrono::high_resolution_clock::now();
+	std::vector<BoundingBox> buildingBounds;
+	for (int i = 0; i < buildings.count(); i++) {
+		buildingBounds.push_back(BoundingBox(buildings.positions[i] - buildings.scales[i], buildings.positions[i] + buildings.scales[i]));
+	}
+	BoundingVolumeHierarchy cityIndex;
+	cityIndex.build(buildingBounds);
+	UniformGrid dynamicIndex(50.0f);
+	uint32_t botHandle = dynamicIndex.insert(bot.getBounds());
+	uint32_t bot2Handle = dynamicIndex.insert(bot2.getBounds());
+	dynamicIndex.insert(flag.getBounds()); // The cloth waves in place
+	printf("City BVH: %d buildings, %d nodes, depth %d, built in %.2f ms\n", (int)cityIndex.size(),
+		   (int)cityIndex.nodeCount(), cityIndex.depth(), millisecondsSince(indexStart));
+
 	// In your main program
 	Sun sun;
 	sun.initialize(lightPosition, 30.0f, lightColor, "../project/sun.vert", "../project/sun.frag");
 
+	// Hardware queries on buildings and bots, read back a frame or two late;
+	// set up before the stats below, since it acquires its proxy program
+	OcclusionQueries occlusionQueries;
+	occlusionQueries.initialize();
+	buildings.enableOcclusionQueries(occlusionQueries);
+	bot.enableOcclusionQueries(occlusionQueries);
+	bot2.enableOcclusionQueries(occlusionQueries);
+
+	PrintShaderRegistryStats();
+	staticGeometry.printStats("Static");
+	skinnedGeometry.printStats("Skinned");
+
+	// A warm start is one where every program came out of the binary cache
+	ShaderCacheStats shaderCacheStats = GetShaderCacheStats();
+	bool warmStart = shaderCacheStats.binaryHits > 0 && shaderCacheStats.compiled == 0;
+	printf("Startup time: %.2f ms (%s, %d programs from cache, %d compiled, %d stale binaries, %.2f ms building programs)\n",
+		   (glfwGetTime() - startupBegin) * 1000.0, warmStart ? "warm" : "cold",
+		   shaderCacheStats.binaryHits, shaderCacheStats.compiled, shaderCacheStats.binaryRejected, shaderCacheStats.buildMs);
+
     // ---------------------------
 
 	// Camera setup
@@ -733,11 +751,49 @@ int main(void)
 	glm::float32 zNear = 0.1f;
 	glm::float32 zFar = 4500.0f;
 	projectionMatrix = glm::perspective(glm::radians(FoV), 4.0f / 3.0f, zNear, zFar);
+	shadowCascades.updateSplits(zNear, zFar);
 
 	int frameCount = 0;
 	float fpsTimeAccumulator = 0.0f;
+	long drawCallAccumulator = 0, instanceAccumulator = 0;
+	long uniformUploadAccumulator = 0, uniformSkipAccumulator = 0;
+	long stateChangeAccumulator = 0, stateFilterAccumulator = 0;
+	long packetAccumulator = 0;
+	long visibleAccumulator = 0, culledAccumulator = 0, occludedAccumulator = 0;
+	long depthDrawAccumulator = 0, depthInstanceAccumulator = 0;
+	long shadowFullAccumulator = 0, shadowIncrementalAccumulator = 0, shadowTileAccumulator = 0;
+	long queryAccumulator = 0, queryVisibleAccumulator = 0, queryOccludedAccumulator = 0, conditionalAccumulator = 0;
+	double cullingTimeAccumulator = 0.0, occlusionTimeAccumulator = 0.0, particleTimeAccumulator = 0.0, particleSortAccumulator = 0.0;
 	char windowTitle[128];
 
+	// Draw packets are collected per frame and issued sorted by state and depth
+	RenderQueue staticDepthQueue, depthQueue, prepassQueue, sceneQueue;
+
+	// Scene packets and buildings hidden behind nearby buildings are skipped;
+	// occluders are rasterized on the worker threads
+	WorkerPool workers;
+	workers.start();
+	OcclusionCuller occlusionCuller;
+	occlusionCuller.initialize(&workers);
+	sceneQueue.setOcclusionCuller(&occlusionCuller);
+	sceneQueue.setCullingStats(&renderStats); // The culling line reports what the camera sees
+	std::vector<uint32_t> occluderCandidates;
+	std::vector<BoundingBox> occluderBoxes;
+	const size_t occluderCount = 32;
+	printf("Occlusion culling: %s, %d worker threads (toggle with C)\n", occlusionCulling ? "on" : "off", workers.size());
+
+	printf("Occlusion queries: %s (toggle with G)\n", occlusionQueriesEnabled ? "on" : "off");
+	printf("Shadow filtering: %s (cycle with V)\n", ShadowTechniqueName(shadowTechnique));
+	printf("Shadow mask: %s (cycle with M)\n", ShadowMaskModeName(shadowMaskMode));
+	printf("Particles: %d per system, %s simulation (cycle with T, cycle count with N)\n",
+		   ParticleCounts[particleCountIndex], ParticleSimulationName(particleSimulation));
+	printf("Particle pool: %d particles (firework with B)\n", particleManager.capacity());
+	if (ParticleSortIntervals[particleSortIndex] > 0) {
+		printf("Particle depth sort: every %d frames (cycle with R)\n", ParticleSortIntervals[particleSortIndex]);
+	} else {
+		printf("Particle depth sort: off (cycle with R)\n");
+	}
+
 	do
 	{
 		// Time management for consistent speed
@@ -752,13 +808,83 @@ int main(void)
 		// Calculate FPS once per second
 		if (fpsTimeAccumulator >= 1.0f) {
 			int fps = static_cast<int>(frameCount / fpsTimeAccumulator);
+			float frameTimeMs = 1000.0f * fpsTimeAccumulator / frameCount;
+			long drawCalls = drawCallAccumulator / frameCount;
+			long instances = instanceAccumulator / frameCount;
+			long uniformUploads = uniformUploadAccumulator / frameCount;
+			long uniformSkips = uniformSkipAccumulator / frameCount;
+			long stateChanges = stateChangeAccumulator / frameCount;
+			long stateFiltered = stateFilterAccumulator / frameCount;
+			long packets = packetAccumulator / frameCount;
+			long visible = visibleAccumulator / frameCount;
+			long culled = culledAccumulator / frameCount;
+			double cullingTimeMs = cullingTimeAccumulator / frameCount;
+			long occluded = occludedAccumulator / frameCount;
+			double occlusionTimeMs = occlusionTimeAccumulator / frameCount;
+			double particleTimeMs = particleTimeAccumulator / frameCount;
+			double particleSortMs = particleSortAccumulator / frameCount;
+			long depthDraws = depthDrawAccumulator / frameCount;
+			long depthInstances = depthInstanceAccumulator / frameCount;
+			long shadowFull = shadowFullAccumulator; // Totals over the last second
+			long shadowIncremental = shadowIncrementalAccumulator;
+			long shadowTiles = shadowTileAccumulator;
+			long queries = queryAccumulator / frameCount;
+			long queryVisible = queryVisibleAccumulator / frameCount;
+			long queryOccluded = queryOccludedAccumulator / frameCount;
+			long conditional = conditionalAccumulator / frameCount;
 			frameCount = 0; // Reset frame counter
 			fpsTimeAccumulator = 0.0f; // Reset time accumulator
+			drawCallAccumulator = 0;
+			instanceAccumulator = 0;
+			uniformUploadAccumulator = 0;
+			uniformSkipAccumulator = 0;
+			stateChangeAccumulator = 0;
+			stateFilterAccumulator = 0;
+			packetAccumulator = 0;
+			visibleAccumulator = 0;
+			culledAccumulator = 0;
+			cullingTimeAccumulator = 0.0;
+			occludedAccumulator = 0;
+			occlusionTimeAccumulator = 0.0;
+			particleTimeAccumulator = 0.0;
+			particleSortAccumulator = 0.0;
+			depthDrawAccumulator = 0;
+			depthInstanceAccumulator = 0;
+			shadowFullAccumulator = 0;
+			shadowIncrementalAccumulator = 0;
+			shadowTileAccumulator = 0;
+			queryAccumulator = 0;
+			queryVisibleAccumulator = 0;
+			queryOccludedAccumulator = 0;
+			conditionalAccumulator = 0;
 
 			// Update window title with FPS
 			snprintf(windowTitle, sizeof(windowTitle), "Final Project - FPS: %d", fps);
 			glfwSetWindowTitle(window, windowTitle);
+			std::cout << "Frame time: " << frameTimeMs << " ms, draw calls: " << drawCalls << " (" << packets << " packets, " << instances << " instances)"
+					  << ", uniform uploads: " << uniformUploads << " (" << uniformSkips << " skipped)"
+					  << ", state changes: " << stateChanges << " (" << stateFiltered << " filtered)" << std::endl;
+			std::cout << "Culling: " << visible << " visible, " << culled << " culled in " << cullingTimeMs << " ms"
+					  << ", " << occluded << " occluded in " << occlusionTimeMs << " ms" << std::endl;
+			std::cout << "Shadow cascades:";
+			for (int cascade = 0; cascade < shadowCascades.count(); cascade++) {
+				glm::vec3 shadowSize = shadowCascades.frustum(cascade).getSize();
+				std::cout << " to " << shadowCascades.splitFar(cascade) << " (" << shadowSize.x << " x " << shadowSize.y << " x " << shadowSize.z << "),";
+			}
+			std::cout << " " << depthDraws << " depth pass draw calls (" << depthInstances << " instances), "
+					  << shadowFull << " full and " << shadowIncremental << " incremental updates, "
+					  << ShadowTechniqueName(shadowTechnique) << " filtering, mask " << ShadowMaskModeName(shadowMaskMode) << std::endl;
+			std::cout << "Shadow atlas: " << localLights.count() << " lights, " << localLights.tileCount() << " tiles, "
+					  << static_cast<int>(localLights.atlasUsage() * 100.0f) << "% used, " << shadowTiles << " tile updates" << std::endl;
+			std::cout << "Particles: " << particleSystem.size() + particleSystem2.size() << ", " << ParticleSimulationName(particleSimulation) << " simulation"
+					  << ", pool " << particleManager.aliveCount() << " of " << particleManager.capacity() << " alive ("
+					  << particleManager.droppedCount() << " spawns dropped), update " << particleTimeMs << " ms, sort " << particleSortMs << " ms" << std::endl;
+			if (occlusionQueriesEnabled) {
+				std::cout << "Occlusion queries: " << queries << " issued, " << queryVisible << " visible, " << queryOccluded << " occluded"
+						  << ", " << conditional << " conditional draws" << std::endl;
+			}
 		}
+		renderStats.reset();
 
 		// Print the current camera position
 		std::cout << "Camera Position: ("
@@ -811,87 +937,215 @@ int main(void)
 		sun.updatePosition(lightPosition);
 		sunLightInfo.position = lightPosition;
 
-		// 1. Render depth map from light's point of view
-		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-		glClear(GL_DEPTH_BUFFER_BIT);
-
-		glUseProgram(depthShaderProgramID);
-
-		// Compute light's view and projection matrices
-		float near_plane = 10.0f, far_plane = 1800.0f;
-		float orthoSize = 1000.0f; // Current size
-		glm::mat4 lightProjection = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, near_plane, far_plane);
-		glm::mat4 lightView = glm::lookAt(lightPosition, lightLookAt, glm::vec3(0.0f, 1.0f, 0.0f));
-		glm::mat4 lightSpaceMatrix = lightProjection * lightView;
-
-		// Set the uniform for the light space matrix
-		glUniformMatrix4fv(glGetUniformLocation(depthShaderProgramID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+		// The camera matrix is needed first to fit the light frustum to the view
+		viewMatrix = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
+		glm::mat4 vp = projectionMatrix * viewMatrix;
 
-		// Render the flagpole depth
-		flag.renderPoleDepth(depthShaderProgramID, lightSpaceMatrix);
-		flag.renderFlagDepth(flagDepthShaderProgramID, lightSpaceMatrix);
-		// Render the scene (buildings and floor) from the light's perspective
-		for (Building& building : buildings) {
-			building.renderDepth(depthShaderProgramID, lightSpaceMatrix);
+		// Fit each cascade's light projection to its slice of the view, around
+		// the visible receivers and the casters over them; the floor only receives
+		glm::mat4 cascadeMatrices[CascadedShadowMap::MaxCascades];
+		float cascadeSplits[CascadedShadowMap::MaxCascades];
+		for (int cascade = 0; cascade < shadowCascades.count(); cascade++) {
+			glm::mat4 sliceProjection = glm::perspective(glm::radians(FoV), 4.0f / 3.0f,
+														 shadowCascades.splitNear(cascade), shadowCascades.splitFar(cascade));
+			ShadowFrustum &shadowFrustum = shadowCascades.frustum(cascade);
+			shadowFrustum.begin(lightPosition, lightLookAt, sliceProjection * viewMatrix);
+			shadowFrustum.add(floor.getBounds(), SHADOW_RECEIVER);
+			for (const BoundingBox &box : buildingBounds) {
+				shadowFrustum.add(box, SHADOW_CASTER | SHADOW_RECEIVER);
+			}
+			shadowFrustum.add(bot.getBounds(), SHADOW_CASTER | SHADOW_RECEIVER);
+			shadowFrustum.add(bot2.getBounds(), SHADOW_CASTER | SHADOW_RECEIVER);
+			shadowFrustum.add(flag.getBounds(), SHADOW_CASTER | SHADOW_RECEIVER);
+			shadowFrustum.add(flag.getPoleBounds(), SHADOW_CASTER | SHADOW_RECEIVER);
+			shadowFrustum.fit(SHADOW_CASCADE_SIZE);
+			cascadeMatrices[cascade] = shadowFrustum.getMatrix();
+			cascadeSplits[cascade] = shadowCascades.splitFar(cascade);
 		}
-		bot.renderDepth(botDepthShaderProgramID, lightSpaceMatrix);
-		bot2.renderDepth(botDepthShaderProgramID, lightSpaceMatrix);
 
-		floor.renderDepth(depthShaderProgramID, lightSpaceMatrix);
+		// Receivers pick their cascade from the cascade uniform block
+		frameUniforms.updateCascades(cascadeMatrices, cascadeSplits, shadowCascades.count(), shadowTechnique,
+									 shadowMaskMode != SHADOW_MASK_OFF);
+
+		// 1. Render each cascade from light's point of view; the depth shaders
+		// read its matrix from the shadow uniform block. Static casters are
+		// redrawn into the cache only when the light matrix changed; the queues
+		// cull casters outside the fitted light frustum.
+		glState.viewport(0, 0, SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE);
+		for (int cascade = 0; cascade < shadowCascades.count(); cascade++) {
+			const glm::mat4 &lightSpaceMatrix = cascadeMatrices[cascade];
+			frameUniforms.updateShadow(lightSpaceMatrix);
+			if (shadowCache.beginUpdate(cascade, lightSpaceMatrix)) {
+				staticDepthQueue.begin(lightPosition, lightSpaceMatrix);
+				flag.submitPoleDepth(staticDepthQueue, depthShaderProgramID);
+				buildings.submitDepth(staticDepthQueue, buildingDepthShaderProgramID);
+				staticDepthQueue.execute();
+			}
+			shadowCache.copyTo(cascade, shadowCascades.framebuffer(cascade));
+
+			// Dynamic casters go on top of the copy, grouped by program
+			depthQueue.begin(lightPosition, lightSpaceMatrix);
+			flag.submitFlagDepth(depthQueue, flagDepthShaderProgramID);
+			bot.submitDepth(depthQueue, botDepthShaderProgramID);
+			bot2.submitDepth(depthQueue, botDepthShaderProgramID);
+			depthQueue.execute();
+
+			// The moments are blurred once here instead of filtered by every receiver
+			if (shadowTechnique != SHADOW_PCF) {
+				shadowFilter.update(shadowCascades.texture(), cascade, shadowTechnique);
+			}
+		}
+		GLuint shadowTexture = shadowTechnique == SHADOW_PCF ? shadowCascades.texture() : shadowFilter.texture();
+
+		// 2. Render the local light tiles due this frame into the atlas; tiles of
+		// lights out of view or far away are small or gone, and tiles that no
+		// moving caster can touch keep their depth from earlier frames
+		localLights.update(vp, cameraPosition, 768.0f, glm::radians(FoV), dynamicIndex);
+		for (int tile = 0; tile < localLights.scheduledCount(); tile++) {
+			const glm::mat4 &tileMatrix = localLights.beginTile(tile);
+			frameUniforms.updateShadow(tileMatrix);
+			depthQueue.begin(lightPosition, tileMatrix);
+			flag.submitPoleDepth(depthQueue, depthShaderProgramID);
+			flag.submitFlagDepth(depthQueue, flagDepthShaderProgramID);
+			buildings.submitDepth(depthQueue, buildingDepthShaderProgramID);
+			bot.submitDepth(depthQueue, botDepthShaderProgramID);
+			bot2.submitDepth(depthQueue, botDepthShaderProgramID);
+			depthQueue.execute();
+			renderStats.shadowTileUpdates++;
+		}
+		localLights.endTiles();
+		LocalLightBlock localLightBlock;
+		localLights.fillBlock(localLightBlock);
+		frameUniforms.updateLocalLights(localLightBlock);
+		depthDrawAccumulator += renderStats.drawCalls;
+		depthInstanceAccumulator += renderStats.instancesDrawn;
+		shadowFullAccumulator += renderStats.shadowFullUpdates;
+		shadowIncrementalAccumulator += renderStats.shadowIncrementalUpdates;
+		shadowTileAccumulator += renderStats.shadowTileUpdates;
 
 		// Unbind the framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
 		if (saveDepthMap) {
-			saveDepthTexture(depthMapFBO, "depth_map.png");
-			std::cout << "Depth map saved to depth_map.png" << std::endl;
+			for (int cascade = 0; cascade < shadowCascades.count(); cascade++) {
+				std::string filename = "depth_map_" + std::to_string(cascade) + ".png";
+				saveDepthTexture(shadowCascades.framebuffer(cascade), filename);
+				std::cout << "Depth map saved to " << filename << std::endl;
+			}
 			saveDepthMap = false; // Reset the flag after saving
 		}
 
 
 		// Reset viewport
-		glViewport(0, 0, 1024, 768);
+		glState.viewport(0, 0, 1024, 768);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// Calculate light direction (if it changes over time)
 		lightDirection = glm::normalize(lightLookAt - lightPosition);
 		sunLightInfo.direction = lightDirection;
+		frameUniforms.updateLight(sunLightInfo);
 
-		// Update view and projection matrices
-		viewMatrix = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
-		glm::mat4 vp = projectionMatrix * viewMatrix;
+		frameUniforms.updateCamera(vp, cameraPosition);
 
-		// Render the skybox, floor, buildings, and sun
-		glDepthFunc(GL_LEQUAL);
-		glm::mat4 skyboxModel = glm::translate(glm::mat4(1.0f), cameraPosition);
-		skybox.render(vp * skyboxModel);
-		glDepthFunc(GL_LESS);
-
-		floor.render(vp, lightSpaceMatrix, depthMap, sunLightInfo, cameraPosition);
-		// Render the flagpole
-		flag.renderPole(vp, sunLightInfo, cameraPosition, lightSpaceMatrix, depthMap);
-		flag.render(vp, sunLightInfo, cameraPosition);
-		for (Building& building : buildings) {
-			building.render(vp, lightSpaceMatrix, depthMap);
-		}
-		glEnable(GL_BLEND);                         // Enable blending for transparency
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // Set blending function
-		glEnable(GL_PROGRAM_POINT_SIZE);            // Allow control of point size in shaders
-		// Update particles
+		// Rasterize the nearest buildings in view as occluders for the scene queue
+		occlusionCuller.setEnabled(occlusionCulling);
+		if (occlusionCulling) {
+			selectOccluders(cityIndex, buildingBounds, Frustum(vp), cameraPosition, occluderCount, occluderCandidates, occluderBoxes);
+			occlusionCuller.renderOccluders(vp, occluderBoxes);
+		}
+
+		// Update particles and animations before queueing them
+		if (particleSystem.size() != ParticleCounts[particleCountIndex]) {
+			particleSystem.resize(ParticleCounts[particleCountIndex], glm::vec3(-500, 200, -500), glm::vec3(500, 200, 500));
+			particleSystem2.resize(ParticleCounts[particleCountIndex], glm::vec3(-500, 200, 500), glm::vec3(500, 200, -500));
+		}
+		particleSystem.setSimulation(particleSimulation);
+		particleSystem2.setSimulation(particleSimulation);
 		particleSystem.update(deltaTime, glm::vec3(-500, 200, -500), glm::vec3(500, 200, 500));
 		particleSystem2.update(deltaTime, glm::vec3(-500, 200, 500), glm::vec3(500, 200, -500));
-		// Render particles
-		particleSystem.render(projectionMatrix * viewMatrix);
-		particleSystem2.render(projectionMatrix * viewMatrix);
-		glDisable(GL_BLEND);                         // Enable blending for transparency
-		glDisable(GL_PROGRAM_POINT_SIZE);            // Allow control of point size in shaders
+		if (fireworkRequested) {
+			particleManager.burst(fireworkEmitter, 3000);
+			fireworkRequested = false;
+		}
+		particleManager.update(deltaTime);
+		particleSystem.setDepthSortInterval(ParticleSortIntervals[particleSortIndex]);
+		particleSystem2.setDepthSortInterval(ParticleSortIntervals[particleSortIndex]);
+		particleSystem.sortByDepth(cameraPosition, &workers);
+		particleSystem2.sortByDepth(cameraPosition, &workers);
+		if (ParticleSortIntervals[particleSortIndex] > 0) {
+			particleManager.sortByDepth(cameraPosition, &workers); // Its order lasts one frame
+		}
 		bot.update(currentFrame);    // Pass the current time to update animations
-		bot.render(vp, sunLightInfo, lightSpaceMatrix, depthMap);
 		bot2.update(currentFrame);
-		bot2.render(vp, sunLightInfo, lightSpaceMatrix, depthMap);
+		dynamicIndex.update(botHandle, bot.getBounds());
+		dynamicIndex.update(bot2Handle, bot2.getBounds());
+
+		// With the shadow mask, the receivers' depth is laid down first with the
+		// camera variants of the depth programs, and the shadow term is evaluated
+		// once per pixel of it
+		if (shadowMaskMode != SHADOW_MASK_OFF) {
+			shadowMask.beginPrepass();
+			prepassQueue.begin(cameraPosition, vp);
+			floor.submitDepth(prepassQueue, prepassShaderProgramID);
+			flag.submitPoleDepth(prepassQueue, prepassShaderProgramID);
+			flag.submitFlagDepth(prepassQueue, flagPrepassShaderProgramID);
+			buildings.submitDepth(prepassQueue, buildingPrepassShaderProgramID);
+			bot.submitDepth(prepassQueue, botPrepassShaderProgramID);
+			bot2.submitDepth(prepassQueue, botPrepassShaderProgramID);
+			prepassQueue.execute();
+			shadowMask.render(shadowTexture, vp, shadowMaskMode == SHADOW_MASK_HALF);
+			glState.activeTexture(ShadowMask::TextureUnit);
+			glState.bindTexture(GL_TEXTURE_2D, shadowMask.texture());
+			glState.activeTexture(GL_TEXTURE0);
+		}
+		glState.activeTexture(GL_TEXTURE3);
+		glState.bindTexture(GL_TEXTURE_2D, localLights.atlasTexture());
+		glState.activeTexture(GL_TEXTURE0);
 
-		sun.render(vp);
-		renderFrustum(lightProjection, lightView, projectionMatrix * viewMatrix, frustumShaderProgramID);
+		// Collect the query results that finished since the last frame
+		occlusionQueries.setEnabled(occlusionQueriesEnabled);
+		occlusionQueries.beginFrame();
+
+		// Queue the scene; the queue orders opaque geometry front to back, then the
+		// skybox, then blended particles back to front
+		sceneQueue.begin(cameraPosition, vp);
+		glm::mat4 skyboxModel = glm::translate(glm::mat4(1.0f), cameraPosition);
+		skybox.submit(sceneQueue, vp * skyboxModel);
+		floor.submit(sceneQueue, shadowTexture);
+		flag.submit(sceneQueue, shadowTexture);
+		buildings.submit(sceneQueue, shadowTexture);
+		particleSystem.submit(sceneQueue);
+		particleSystem2.submit(sceneQueue);
+		particleManager.submit(sceneQueue);
+		bot.submit(sceneQueue, shadowTexture);
+		bot2.submit(sceneQueue, shadowTexture);
+		sun.submit(sceneQueue, vp);
+		sceneQueue.execute();
+
+		// Test the proxies of objects due for a query against the finished scene
+		occlusionQueries.issueQueries(cameraPosition);
+
+		for (int cascade = 0; cascade < shadowCascades.count(); cascade++) {
+			renderFrustum(shadowCascades.frustum(cascade).getProjection(), shadowCascades.frustum(cascade).getView(), frustumShaderProgramID);
+		}
+
+		drawCallAccumulator += renderStats.drawCalls;
+		instanceAccumulator += renderStats.instancesDrawn;
+		uniformUploadAccumulator += renderStats.uniformUploads;
+		uniformSkipAccumulator += renderStats.uniformUploadsSkipped;
+		stateChangeAccumulator += renderStats.stateChanges;
+		stateFilterAccumulator += renderStats.stateChangesFiltered;
+		packetAccumulator += renderStats.packetsSubmitted;
+		visibleAccumulator += renderStats.objectsVisible;
+		culledAccumulator += renderStats.objectsCulled;
+		cullingTimeAccumulator += renderStats.cullingTime;
+		occludedAccumulator += renderStats.objectsOccluded;
+		occlusionTimeAccumulator += renderStats.occlusionTime;
+		particleTimeAccumulator += renderStats.particleTime;
+		particleSortAccumulator += renderStats.particleSortTime;
+		queryAccumulator += renderStats.queriesIssued;
+		queryVisibleAccumulator += renderStats.queriesVisible;
+		queryOccludedAccumulator += renderStats.queriesOccluded;
+		conditionalAccumulator += renderStats.conditionalDraws;
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
@@ -900,16 +1154,36 @@ int main(void)
 	while (!glfwWindowShouldClose(window));
 
 	// Clean up
-	for (Building building : buildings) {
-		building.cleanup();
-	}
+	occlusionQueries.cleanup();
+	shadowCache.cleanup();
+	shadowCascades.cleanup();
+	shadowFilter.cleanup();
+	shadowMask.cleanup();
+	localLights.cleanup();
+	buildings.cleanup();
 
 	skybox.cleanup();
 	flag.cleanup();
 	floor.cleanup();
 	sun.cleanup();
 	bot.cleanup();
+	bot2.cleanup();
 	particleSystem.cleanup();
+	particleSystem2.cleanup();
+	particleManager.cleanup();
+	ReleaseShaderProgram(depthShaderProgramID);
+	ReleaseShaderProgram(botDepthShaderProgramID);
+	ReleaseShaderProgram(flagDepthShaderProgramID);
+	ReleaseShaderProgram(buildingDepthShaderProgramID);
+	ReleaseShaderProgram(prepassShaderProgramID);
+	ReleaseShaderProgram(botPrepassShaderProgramID);
+	ReleaseShaderProgram(flagPrepassShaderProgramID);
+	ReleaseShaderProgram(buildingPrepassShaderProgramID);
+	ReleaseShaderProgram(frustumShaderProgramID);
+	ReleaseShaderProgram(particleShaderProgram);
+	frameUniforms.cleanup();
+	staticGeometry.cleanup();
+	skinnedGeometry.cleanup();
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 
@@ -927,6 +1201,49 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 	if (key == GLFW_KEY_P && action == GLFW_PRESS) {
 		saveDepthMap = true; // Set the flag to save the depth map
 	}
+	// 'C' switches software occlusion culling to compare draw counts and CPU cost
+	if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+		occlusionCulling = !occlusionCulling;
+		std::cout << "Occlusion culling " << (occlusionCulling ? "on" : "off") << std::endl;
+	}
+	// 'G' switches hardware occlusion queries
+	if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+		occlusionQueriesEnabled = !occlusionQueriesEnabled;
+		std::cout << "Occlusion queries " << (occlusionQueriesEnabled ? "on" : "off") << std::endl;
+	}
+	// 'V' cycles the shadow filtering technique
+	if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+		shadowTechnique = static_cast<ShadowTechnique>((shadowTechnique + 1) % SHADOW_TECHNIQUE_COUNT);
+		std::cout << "Shadow filtering: " << ShadowTechniqueName(shadowTechnique) << std::endl;
+	}
+	// 'M' cycles the screen-space shadow mask
+	if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+		shadowMaskMode = static_cast<ShadowMaskMode>((shadowMaskMode + 1) % SHADOW_MASK_MODE_COUNT);
+		std::cout << "Shadow mask: " << ShadowMaskModeName(shadowMaskMode) << std::endl;
+	}
+	// 'T' cycles where the particle motion is computed
+	if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		particleSimulation = static_cast<ParticleSimulation>((particleSimulation + 1) % PARTICLE_SIMULATION_COUNT);
+		std::cout << "Particle simulation: " << ParticleSimulationName(particleSimulation) << std::endl;
+	}
+	// 'B' launches a firework from the particle pool
+	if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+		fireworkRequested = true;
+	}
+	// 'R' cycles how often the particles are depth sorted
+	if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+		particleSortIndex = (particleSortIndex + 1) % (sizeof(ParticleSortIntervals) / sizeof(ParticleSortIntervals[0]));
+		if (ParticleSortIntervals[particleSortIndex] > 0) {
+			std::cout << "Particle depth sort: every " << ParticleSortIntervals[particleSortIndex] << " frames" << std::endl;
+		} else {
+			std::cout << "Particle depth sort: off" << std::endl;
+		}
+	}
+	// 'N' cycles the number of particles per system
+	if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+		particleCountIndex = (particleCountIndex + 1) % (sizeof(ParticleCounts) / sizeof(ParticleCounts[0]));
+		std::cout << "Particles per system: " << ParticleCounts[particleCountIndex] << std::endl;
+	}
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
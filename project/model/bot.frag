@@ -2,21 +2,90 @@
 
 in vec3 worldPosition;       // Position of the fragment in world space
 in vec3 worldNormal;         // Normal at the fragment in world space
-in vec4 fragPosLightSpace;   // Position of the fragment in light space
+in vec3 shadowPosition;      // Position of the fragment in world space, for the shadow lookup
 
 out vec3 finalColor;         // Output color
 
-uniform vec3 lightPosition;  // Light source position in world space
-uniform vec3 lightIntensity; // Light intensity
-uniform sampler2D shadowMap; // Shadow map texture
+layout(std140) uniform LightBlock {
+    vec3 lightDirection;
+    float lightIntensity;
+    vec3 lightPosition;
+    vec3 lightColor;
+};
+
+uniform vec3 pointLightIntensity; // Radiant intensity of the point light at lightPosition
+uniform sampler2DArray shadowMap; // Shadow map texture, one layer per cascade
+
+// Shadow cascades; cascadeSplits holds the far view depth of each
+layout(std140) uniform CascadeBlock {
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
+    int cascadeCount;
+    int shadowTechnique; // 0: PCF, 1: VSM, 2: EVSM
+    int useShadowMask;
+};
+
+// Shadow term of the visible surface at each pixel, see shadow_mask.frag
+uniform sampler2D shadowMask;
+
+#include "../local_lighting.glsl"
+
+// Position in the clip space of the cascade covering the fragment; the
+// cascade is chosen by view depth and returned in layer
+vec4 cascadePosition(vec3 position, out float layer) {
+    float viewDepth = 1.0 / gl_FragCoord.w;
+    int cascade = 0;
+    while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    layer = float(cascade);
+    return cascadeMatrices[cascade] * vec4(position, 1.0);
+}
+
+// Exponents of the EVSM warp, as in shadow_moments.frag
+const vec2 EVSMExponents = vec2(40.0, 5.0);
+
+// Upper bound on the lit fraction from the mean and mean square of the
+// occluder depth (Chebyshev); its tail is cut off to reduce light bleeding
+float chebyshevUpperBound(vec2 moments, float depth, float minVariance) {
+    if (depth <= moments.x) {
+        return 1.0;
+    }
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    return clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+}
+
+// Shadow factor from one filtered fetch of the VSM or EVSM moments
+float momentShadow(vec3 projCoords, float layer) {
+    vec4 moments = texture(shadowMap, vec3(projCoords.xy, layer));
+    if (shadowTechnique == 1) {
+        return 1.0 - chebyshevUpperBound(moments.xy, projCoords.z, 0.00002);
+    }
+    float warped = 2.0 * projCoords.z - 1.0;
+    float positive = exp(EVSMExponents.x * warped);
+    float negative = -exp(-EVSMExponents.y * warped);
+    // The minimum variance is scaled by the slope of each warp
+    float positiveVariance = 0.00002 * EVSMExponents.x * EVSMExponents.x * positive * positive;
+    float negativeVariance = 0.00002 * EVSMExponents.y * EVSMExponents.y * negative * negative;
+    return 1.0 - min(chebyshevUpperBound(moments.xy, positive, positiveVariance),
+                     chebyshevUpperBound(moments.zw, negative, negativeVariance));
+}
+
+float calculateShadow(vec3 position) {
+    if (useShadowMask != 0) {
+        return 0.6 * texelFetch(shadowMask, ivec2(gl_FragCoord.xy), 0).r;
+    }
+    float layer;
+    vec4 fragPosLightSpace = cascadePosition(position, layer);
 
-float calculateShadow(vec4 fragPosLightSpace) {
     // Transform to normalized device coordinates (NDC)
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     projCoords = projCoords * 0.5 + 0.5; // Transform to [0, 1] range
 
     // Sample the closest depth from the shadow map
-    float closestDepth = texture(shadowMap, projCoords.xy).r;
+    float closestDepth = texture(shadowMap, vec3(projCoords.xy, layer)).r;
 
     // Current fragment depth in light space
     float currentDepth = projCoords.z;
@@ -28,6 +97,9 @@ float calculateShadow(vec4 fragPosLightSpace) {
     if (projCoords.z > 1.0 || projCoords.z < 0.0 || projCoords.x < 0.0 || projCoords.x > 1.0 || projCoords.y < 0.0 || projCoords.y > 1.0) {
         return 0.6; // Fully shadowed
     }
+    if (shadowTechnique != 0) {
+        return 0.6 * momentShadow(projCoords, layer);
+    }
 
     return shadow;
 }
@@ -40,12 +112,15 @@ void main()
     lightDir = normalize(lightDir);
 
     // Calculate shadow factor
-    float shadow = calculateShadow(fragPosLightSpace);
+    float shadow = calculateShadow(shadowPosition);
 
     // Compute diffuse lighting with shadow
-    vec3 lighting = lightIntensity * clamp(dot(lightDir, worldNormal), 0.0, 1.0) / lightDist;
+    vec3 lighting = pointLightIntensity * clamp(dot(lightDir, worldNormal), 0.0, 1.0) / lightDist;
     lighting *= (1.0 - shadow); // Attenuate light by shadow factor
 
+    // Street lamps; worldPosition is before the model transform, so use the shadow position
+    lighting += localLighting(shadowPosition, normalize(worldNormal));
+
     // Tone mapping
     vec3 toneMapped = lighting / (1.0 + lighting);
 
@@ -7,14 +7,18 @@ layout(location = 3) in uvec4 inJoints;    // Joint indices (as unsigned integer
 layout(location = 4) in vec4 inWeights;    // Joint weights
 
 // Uniforms
-uniform mat4 MVP;                  // Model-View-Projection matrix
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
+uniform mat4 modelMatrix;          // Model matrix
 uniform mat4 jointMatrices[50];    // Array of joint matrices
-uniform mat4 lightSpaceMatrix;     // Light space matrix for shadow mapping
 
 // Outputs to the fragment shader
 out vec3 worldPosition;            // Vertex position in world space
 out vec3 worldNormal;              // Vertex normal in world space
-out vec4 fragPosLightSpace;        // Vertex position in light space
+out vec3 shadowPosition;           // Vertex position in world space, for the shadow lookup
 
 void main() {
     // Skinning transformation
@@ -44,9 +48,9 @@ void main() {
     worldPosition = vec3(skinnedPosition);
     worldNormal = normalize(skinnedNormal);
 
-    // Transform position to light space
-    fragPosLightSpace = lightSpaceMatrix * skinnedPosition;
+    // The cascades are fitted in world space
+    shadowPosition = vec3(modelMatrix * skinnedPosition);
 
     // Transform to clip space
-    gl_Position = MVP * skinnedPosition;
+    gl_Position = vpMatrix * modelMatrix * skinnedPosition;
 }
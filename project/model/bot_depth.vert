@@ -6,7 +6,17 @@ layout(location = 3) in uvec4 inJoints;  // Joint indices
 layout(location = 4) in vec4 inWeights;  // Joint weights
 
 // Uniforms
-uniform mat4 lightSpaceMatrix;
+#ifdef CAMERA_DEPTH
+layout(std140) uniform CameraBlock {
+    mat4 depthMatrix;
+    vec3 cameraPosition;
+};
+#else
+layout(std140) uniform ShadowBlock {
+    mat4 depthMatrix;
+};
+#endif
+
 uniform mat4 modelMatrix;
 uniform mat4 jointMatrices[50]; // Adjust size as per your skinning requirements
 
@@ -26,7 +36,7 @@ void main() {
 
     // Apply model and light space transformations
     vec4 worldPosition = modelMatrix * skinnedPosition;
-    fragPosLightSpace = lightSpaceMatrix * worldPosition;
+    fragPosLightSpace = depthMatrix * worldPosition;
 
     gl_Position = fragPosLightSpace;
 }
@@ -1,22 +1,23 @@
 #include "MyBot.h"
 #include <render/shader.h>
+#include <render/shader_program.h>
+#include <render/geometry_pool.h>
+#include <render/gl_state.h>
 #include <iostream>
 #include <cmath>
 #include <sstream>
+#include <cstring>
+#include <algorithm>
 #define TINYGLTF_IMPLEMENTATION
 #include <tinygltf-2.9.3/tiny_gltf.h>
 
-#define BUFFER_OFFSET(i) ((char *)NULL + (i))
-
-// Global lighting and rendering parameters (you might want to make these configurable)
-static glm::vec3 lightIntensity(5e6f, 5e6f, 5e6f);
-static glm::vec3 lightPosition(-275.0f, 500.0f, 800.0f);
+// Radiant intensity of the point light the bot shader places at the sun's position
+static glm::vec3 pointLightIntensity(5e6f, 5e6f, 5e6f);
 
 MyBot::MyBot()
 	: loopStartTime(0.5f), loopEndTime(2.5f), useLooping(true),
-	  programID(0), mvpMatrixID(0), jointMatricesID(0),
-	  lightPositionID(0), lightIntensityID(0),
-	  position(0.0f, 0.0f, -500.0f), speed(3.0f) {} // Initial position and speed
+	  programID(0), program(NULL), modelMatrixID(-1), jointMatricesID(-1),
+	  position(0.0f, 0.0f, -500.0f), hasMeshBounds(false), occlusionQueries(NULL), queryHandle(-1), speed(3.0f) {} // Initial position and speed
 
 
 MyBot::~MyBot() {
@@ -24,7 +25,7 @@ MyBot::~MyBot() {
 }
 
 
-bool MyBot::initialize(const char* modelPath, Light lightInfo, glm::vec3 pos) {
+bool MyBot::initialize(const char* modelPath, glm::vec3 pos) {
     // Load model
     if (!loadModel(model, modelPath)) {
         return false;
@@ -41,21 +42,25 @@ bool MyBot::initialize(const char* modelPath, Light lightInfo, glm::vec3 pos) {
     // Prepare animation data
     animationObjects = prepareAnimation(model);
 
-	lightPosition = lightInfo.position;
-
     // Create and compile GLSL program from shaders
     // Modify shader paths as needed
-    programID = LoadShadersFromFile("../project/model/bot.vert", "../project/model/bot.frag");
+    programID = AcquireShaderProgram("../project/model/bot.vert", "../project/model/bot.frag");
     if (programID == 0) {
         std::cerr << "Failed to load shaders." << std::endl;
         return false;
     }
 
     // Get handles for GLSL variables
-    mvpMatrixID = glGetUniformLocation(programID, "MVP");
-    lightPositionID = glGetUniformLocation(programID, "lightPosition");
-    lightIntensityID = glGetUniformLocation(programID, "lightIntensity");
-    jointMatricesID = glGetUniformLocation(programID, "jointMatrices");
+    program = GetShaderProgram(programID);
+    modelMatrixID = program->location("modelMatrix");
+    jointMatricesID = program->location("jointMatrices");
+
+    // Constant for the lifetime of the program; the light position comes from the frame uniforms
+    program->use();
+    program->setVec3("pointLightIntensity", pointLightIntensity);
+    program->setInt("shadowMap", 1);
+    program->setInt("shadowMask", 2);
+    program->setInt("shadowAtlas", 3);
 
     return true;
 }
@@ -115,8 +120,9 @@ void MyBot::update(float time) {
 
 }
 
-void MyBot::renderDepth(GLuint shadowShaderProgramID, glm::mat4 lightSpaceMatrix) {
-	glUseProgram(shadowShaderProgramID);
+void MyBot::renderDepth(GLuint shadowShaderProgramID) {
+	ShaderProgram *depthProgram = GetShaderProgram(shadowShaderProgramID);
+	depthProgram->use();
 
 	// Compute the model matrix for the bot
 	glm::mat4 modelMatrix = glm::mat4(1.0f);
@@ -124,11 +130,10 @@ void MyBot::renderDepth(GLuint shadowShaderProgramID, glm::mat4 lightSpaceMatrix
 	modelMatrix = glm::scale(modelMatrix, glm::vec3(0.25f, 0.25f, 0.25f)); // Apply scaling
 
 	// Pass uniforms to the shader
-	glUniformMatrix4fv(glGetUniformLocation(shadowShaderProgramID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
-	glUniformMatrix4fv(glGetUniformLocation(shadowShaderProgramID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+	depthProgram->setMat4("modelMatrix", modelMatrix);
 
 	// Pass the joint matrices for skinning
-	glUniformMatrix4fv(glGetUniformLocation(shadowShaderProgramID, "jointMatrices"), skinObjects[0].jointMatrices.size(), GL_FALSE, glm::value_ptr(skinObjects[0].jointMatrices[0]));
+	depthProgram->setMat4Array("jointMatrices", skinObjects[0].jointMatrices.data(), skinObjects[0].jointMatrices.size());
 
 	// Draw the bot model
 	drawModel(primitiveObjects, model);
@@ -136,40 +141,73 @@ void MyBot::renderDepth(GLuint shadowShaderProgramID, glm::mat4 lightSpaceMatrix
 
 
 
-void MyBot::render(glm::mat4 cameraMatrix, Light lightInfo, glm::mat4 lightSpaceMatrix, GLuint shadowMapID) {
-	glUseProgram(programID);
+void MyBot::render(GLuint shadowMapID) {
+	// May query the proxy box first, so it comes before any program state
+	if (occlusionQueries) {
+		occlusionQueries->beginDraw(queryHandle, getBounds());
+	}
 
-	lightPosition = lightInfo.position;
+	program->use();
 
 	// Model matrix
 	glm::mat4 modelMatrix = glm::mat4(1.0f);
 	modelMatrix = glm::translate(modelMatrix, position); // Apply translation
 	modelMatrix = glm::scale(modelMatrix, glm::vec3(0.25f, 0.25f, 0.25f)); // Apply scaling
 
-	// MVP matrix
-	glm::mat4 mvp = cameraMatrix * modelMatrix;
-	glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
+	program->setMat4(modelMatrixID, modelMatrix);
 
-	// Pass light space matrix and shadow map
-	glUniformMatrix4fv(glGetUniformLocation(programID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
-	glActiveTexture(GL_TEXTURE1); // Bind shadow map to texture unit 1
-	glBindTexture(GL_TEXTURE_2D, shadowMapID);
-	glUniform1i(glGetUniformLocation(programID, "shadowMap"), 1);
+	// Bind shadow map to texture unit 1
+	glState.activeTexture(GL_TEXTURE1);
+	glState.bindTexture(GL_TEXTURE_2D_ARRAY, shadowMapID);
 
 	// Pass animation data for linear blend skinning
-	glUniformMatrix4fv(jointMatricesID, skinObjects[0].jointMatrices.size(), GL_FALSE, glm::value_ptr(skinObjects[0].jointMatrices[0]));
-
-	// Pass light data
-	glUniform3fv(lightPositionID, 1, &lightPosition[0]);
-	glUniform3fv(lightIntensityID, 1, &lightIntensity[0]);
+	program->setMat4Array(jointMatricesID, skinObjects[0].jointMatrices.data(), skinObjects[0].jointMatrices.size());
 
 	// Draw the bot model
 	drawModel(primitiveObjects, model);
+
+	if (occlusionQueries) {
+		occlusionQueries->endDraw(queryHandle);
+	}
+}
+
+
+BoundingBox MyBot::getBounds() const {
+	glm::mat4 modelMatrix = glm::mat4(1.0f);
+	modelMatrix = glm::translate(modelMatrix, position);
+	modelMatrix = glm::scale(modelMatrix, glm::vec3(0.25f, 0.25f, 0.25f));
+
+	// Skinning moves vertices away from the bind pose; grow the box by a quarter
+	// of its largest dimension on every side
+	glm::vec3 size = meshBounds.max - meshBounds.min;
+	glm::vec3 padding(0.25f * std::max(size.x, std::max(size.y, size.z)));
+	return BoundingBox(meshBounds.min - padding, meshBounds.max + padding).transformed(modelMatrix);
 }
 
+void MyBot::enableOcclusionQueries(OcclusionQueries &queries) {
+	occlusionQueries = &queries;
+	queryHandle = queries.add();
+}
+
+void MyBot::submit(RenderQueue &queue, GLuint shadowMapID) {
+	queue.submit(PASS_OPAQUE, programID, 0, skinnedGeometry.vertexArray(), getBounds(),
+				 [](void *object, GLuint argument) { static_cast<MyBot *>(object)->render(argument); }, this, shadowMapID);
+}
+
+void MyBot::submitDepth(RenderQueue &queue, GLuint shadowShaderProgramID) {
+	queue.submit(PASS_DEPTH, shadowShaderProgramID, 0, skinnedGeometry.vertexArray(), getBounds(),
+				 [](void *object, GLuint argument) { static_cast<MyBot *>(object)->renderDepth(argument); }, this, shadowShaderProgramID);
+}
 
 void MyBot::cleanup() {
-    glDeleteProgram(programID);
+    // Safe to call twice: the destructor calls it again after an explicit cleanup
+    for (const PrimitiveObject &primitiveObject : primitiveObjects) {
+        skinnedGeometry.free(primitiveObject.geometry);
+    }
+    primitiveObjects.clear();
+    ReleaseShaderProgram(programID);
+    programID = 0;
+    program = NULL;
 }
 
 void MyBot::setPlaybackSpeed(float speed) {
@@ -513,90 +551,115 @@ bool MyBot::loadModel(tinygltf::Model &model, const char *filename) {
 	return res;
 }
 
-void MyBot::bindMesh(std::vector<PrimitiveObject> &primitiveObjects,
-              tinygltf::Model &model, tinygltf::Mesh &mesh) {
-
-    std::map<int, GLuint> vbos;
-    for (size_t i = 0; i < model.bufferViews.size(); ++i) {
-        const tinygltf::BufferView &bufferView = model.bufferViews[i];
-
-        int target = bufferView.target;
-
-        if (bufferView.target == 0) {
-            continue;
-        }
+// One vertex of the skinned geometry pool: position (0), normal (1), UV (2),
+// joints (3), weights (4)
+struct SkinnedVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 uv;
+    uint16_t joints[4];
+    glm::vec4 weights;
+};
+static_assert(sizeof(SkinnedVertex) == 56, "SkinnedVertex must match the skinned geometry format");
+
+// Address of element index of an accessor, honouring interleaved buffer views
+static const unsigned char *AccessorElement(const tinygltf::Model &model, const tinygltf::Accessor &accessor, size_t index) {
+    const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
+    size_t byteStride = accessor.ByteStride(bufferView);
+    return &model.buffers[bufferView.buffer].data[bufferView.byteOffset + accessor.byteOffset + index * byteStride];
+}
 
-        const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
-        GLuint vbo;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(target, vbo);
-        glBufferData(target, bufferView.byteLength,
-                     &buffer.data.at(0) + bufferView.byteOffset, GL_STATIC_DRAW);
+// Component c of element index converted to float, normalizing integer data when flagged
+static float ReadAccessorFloat(const tinygltf::Model &model, const tinygltf::Accessor &accessor, size_t index, int c) {
+    const unsigned char *element = AccessorElement(model, accessor, index);
+    switch (accessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        return accessor.normalized ? element[c] / 255.0f : element[c];
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+        uint16_t value;
+        memcpy(&value, element + c * sizeof(value), sizeof(value));
+        return accessor.normalized ? value / 65535.0f : value;
+    }
+    default: {
+        float value;
+        memcpy(&value, element + c * sizeof(value), sizeof(value));
+        return value;
+    }
+    }
+}
 
-        vbos[i] = vbo;
+// Component c of element index as an unsigned integer (joint and index data)
+static uint32_t ReadAccessorUint(const tinygltf::Model &model, const tinygltf::Accessor &accessor, size_t index, int c) {
+    const unsigned char *element = AccessorElement(model, accessor, index);
+    switch (accessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        return element[c];
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+        uint16_t value;
+        memcpy(&value, element + c * sizeof(value), sizeof(value));
+        return value;
     }
+    default: {
+        uint32_t value;
+        memcpy(&value, element + c * sizeof(value), sizeof(value));
+        return value;
+    }
+    }
+}
+
+void MyBot::bindMesh(std::vector<PrimitiveObject> &primitiveObjects,
+              tinygltf::Model &model, tinygltf::Mesh &mesh) {
 
     for (size_t i = 0; i < mesh.primitives.size(); ++i) {
 
         tinygltf::Primitive primitive = mesh.primitives[i];
         tinygltf::Accessor indexAccessor = model.accessors[primitive.indices];
 
-        GLuint vao;
-        glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
+        // Repack the primitive into the skinned pool's vertex layout
+        std::vector<SkinnedVertex> vertices(model.accessors[primitive.attributes["POSITION"]].count);
 
         for (auto &attrib : primitive.attributes) {
-            tinygltf::Accessor accessor = model.accessors[attrib.second];
-            int byteStride =
-                accessor.ByteStride(model.bufferViews[accessor.bufferView]);
-            glBindBuffer(GL_ARRAY_BUFFER, vbos[accessor.bufferView]);
-
-            int size = 1;
-            if (accessor.type != TINYGLTF_TYPE_SCALAR) {
-                size = accessor.type;
-            }
+            const tinygltf::Accessor &accessor = model.accessors[attrib.second];
+            size_t count = std::min(accessor.count, vertices.size());
 
             if (attrib.first.compare("POSITION") == 0) {
-                int vaa = 0;
-                glEnableVertexAttribArray(vaa);
-                glVertexAttribPointer(vaa, size, accessor.componentType,
-                                      accessor.normalized ? GL_TRUE : GL_FALSE,
-                                      byteStride, BUFFER_OFFSET(accessor.byteOffset));
+                for (size_t v = 0; v < count; ++v)
+                    for (int c = 0; c < 3; ++c) vertices[v].position[c] = ReadAccessorFloat(model, accessor, v, c);
+                // glTF requires min and max on POSITION accessors
+                if (accessor.minValues.size() >= 3 && accessor.maxValues.size() >= 3) {
+                    glm::vec3 low(accessor.minValues[0], accessor.minValues[1], accessor.minValues[2]);
+                    glm::vec3 high(accessor.maxValues[0], accessor.maxValues[1], accessor.maxValues[2]);
+                    meshBounds = hasMeshBounds ? BoundingBox(glm::min(meshBounds.min, low), glm::max(meshBounds.max, high))
+                                               : BoundingBox(low, high);
+                    hasMeshBounds = true;
+                }
             } else if (attrib.first.compare("NORMAL") == 0) {
-                int vaa = 1;
-                glEnableVertexAttribArray(vaa);
-                glVertexAttribPointer(vaa, size, accessor.componentType,
-                                      accessor.normalized ? GL_TRUE : GL_FALSE,
-                                      byteStride, BUFFER_OFFSET(accessor.byteOffset));
+                for (size_t v = 0; v < count; ++v)
+                    for (int c = 0; c < 3; ++c) vertices[v].normal[c] = ReadAccessorFloat(model, accessor, v, c);
             } else if (attrib.first.compare("TEXCOORD_0") == 0) {
-                int vaa = 2;
-                glEnableVertexAttribArray(vaa);
-                glVertexAttribPointer(vaa, size, accessor.componentType,
-                                      accessor.normalized ? GL_TRUE : GL_FALSE,
-                                      byteStride, BUFFER_OFFSET(accessor.byteOffset));
+                for (size_t v = 0; v < count; ++v)
+                    for (int c = 0; c < 2; ++c) vertices[v].uv[c] = ReadAccessorFloat(model, accessor, v, c);
             } else if (attrib.first.compare("JOINTS_0") == 0) {
-                int vaa = 3; // Attribute location for JOINTS_0
-                glEnableVertexAttribArray(vaa);
-                glVertexAttribIPointer(vaa, size, accessor.componentType,
-                                       byteStride, BUFFER_OFFSET(accessor.byteOffset));
+                for (size_t v = 0; v < count; ++v)
+                    for (int c = 0; c < 4; ++c) vertices[v].joints[c] = static_cast<uint16_t>(ReadAccessorUint(model, accessor, v, c));
             } else if (attrib.first.compare("WEIGHTS_0") == 0) {
-                int vaa = 4; // Attribute location for WEIGHTS_0
-                glEnableVertexAttribArray(vaa);
-                glVertexAttribPointer(vaa, size, accessor.componentType,
-                                      accessor.normalized ? GL_TRUE : GL_FALSE,
-                                      byteStride, BUFFER_OFFSET(accessor.byteOffset));
+                for (size_t v = 0; v < count; ++v)
+                    for (int c = 0; c < 4; ++c) vertices[v].weights[c] = ReadAccessorFloat(model, accessor, v, c);
             } else {
                 std::cout << "Unrecognized attribute: " << attrib.first << std::endl;
             }
         }
 
-        // Record VAO for later use
+        std::vector<GLuint> indices(indexAccessor.count);
+        for (size_t n = 0; n < indices.size(); ++n) {
+            indices[n] = ReadAccessorUint(model, indexAccessor, n, 0);
+        }
+
+        // Record the pool allocation for later use
         PrimitiveObject primitiveObject;
-        primitiveObject.vao = vao;
-        primitiveObject.vbos = vbos;
+        primitiveObject.geometry = skinnedGeometry.allocate(vertices.data(), static_cast<GLsizei>(vertices.size()),
+                                                            indices.data(), static_cast<GLsizei>(indices.size()));
         primitiveObjects.push_back(primitiveObject);
-
-        glBindVertexArray(0);
     }
 }
 
@@ -628,26 +691,14 @@ void MyBot::bindMesh(std::vector<PrimitiveObject> &primitiveObjects,
 		return primitiveObjects;
 	}
 
-	void MyBot::drawMesh(const std::vector<PrimitiveObject> &primitiveObjects,
-				tinygltf::Model &model, tinygltf::Mesh &mesh) {
+	void MyBot::drawMesh(const std::vector<PrimitiveObject> &primitiveObjects, tinygltf::Mesh &mesh) {
 
 		for (size_t i = 0; i < mesh.primitives.size(); ++i)
 		{
-			GLuint vao = primitiveObjects[i].vao;
-			std::map<int, GLuint> vbos = primitiveObjects[i].vbos;
-
-			glBindVertexArray(vao);
-
-			tinygltf::Primitive primitive = mesh.primitives[i];
-			tinygltf::Accessor indexAccessor = model.accessors[primitive.indices];
-
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbos.at(indexAccessor.bufferView));
-
-			glDrawElements(primitive.mode, indexAccessor.count,
-						indexAccessor.componentType,
-						BUFFER_OFFSET(indexAccessor.byteOffset));
-
-			glBindVertexArray(0);
+			if (primitiveObjects[i].geometry < 0) {
+				continue;
+			}
+			skinnedGeometry.draw(primitiveObjects[i].geometry, mesh.primitives[i].mode);
 		}
 	}
 
@@ -655,7 +706,7 @@ void MyBot::bindMesh(std::vector<PrimitiveObject> &primitiveObjects,
 						tinygltf::Model &model, tinygltf::Node &node) {
 		// Draw the mesh at the node, and recursively do so for children nodes
 		if ((node.mesh >= 0) && (node.mesh < model.meshes.size())) {
-			drawMesh(primitiveObjects, model, model.meshes[node.mesh]);
+			drawMesh(primitiveObjects, model.meshes[node.mesh]);
 		}
 		for (size_t i = 0; i < node.children.size(); i++) {
 			drawModelNodes(primitiveObjects, model, model.nodes[node.children[i]]);
@@ -1,13 +1,16 @@
 #ifndef MYBOT_H
 #define MYBOT_H
 
-#include "utils/lightInfo.h"
 #include <glad/gl.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <render/shader_program.h>
+#include <render/render_queue.h>
+#include <render/frustum_culling.h>
+#include <render/occlusion_queries.h>
 
 #include <tinygltf-2.9.3/tiny_gltf.h>
 
@@ -23,16 +26,25 @@ public:
     ~MyBot();
 
     // Initialize the bot (load model, prepare buffers, etc.)
-    bool initialize(const char* modelPath, Light lightInfo, glm::vec3 pos);
+    bool initialize(const char* modelPath, glm::vec3 pos);
 
     void setPosition(const glm::vec3& newPosition);
 
     // Update animation state
     void update(float time);
 
-    // Render the bot
-    void render(glm::mat4 cameraMatrix, Light lightInfo, glm::mat4 lightSpaceMatrix, GLuint shadowMapID);
-    void renderDepth(GLuint shadowShaderProgramID, glm::mat4 lightSpaceMatrix);
+    // Render the bot; camera, light and light-space matrix come from the frame uniform blocks
+    void render(GLuint shadowMapID);
+    void renderDepth(GLuint shadowShaderProgramID);
+    void submit(RenderQueue &queue, GLuint shadowMapID);
+    void submitDepth(RenderQueue &queue, GLuint shadowShaderProgramID);
+
+    // World box around the bind pose, padded for animated limbs
+    BoundingBox getBounds() const;
+
+    // Registers the bot with queries; render() then draws it conditionally
+    // while its last query found it hidden
+    void enableOcclusionQueries(OcclusionQueries &queries);
 
     // Cleanup resources
     void cleanup();
@@ -49,8 +61,7 @@ public:
 private:
     // Nested structs for managing bot components
     struct PrimitiveObject {
-        GLuint vao;
-        std::map<int, GLuint> vbos;
+        int geometry; // Handle in the skinned geometry pool
     };
 
     struct SkinObject {
@@ -81,8 +92,7 @@ private:
 
     std::vector<PrimitiveObject> bindModel(tinygltf::Model &model);
 
-    void drawMesh(const std::vector<PrimitiveObject> &primitiveObjects,
-                  tinygltf::Model &model, tinygltf::Mesh &mesh);
+    void drawMesh(const std::vector<PrimitiveObject> &primitiveObjects, tinygltf::Mesh &mesh);
 
     void drawModelNodes(const std::vector<PrimitiveObject>& primitiveObjects,
                         tinygltf::Model &model, tinygltf::Node &node);
@@ -122,12 +132,15 @@ private:
     std::vector<SkinObject> skinObjects;
     std::vector<AnimationObject> animationObjects;
     glm::vec3 position; // Current position of the bot
+    BoundingBox meshBounds; // Model-space bounds from the POSITION accessors
+    bool hasMeshBounds;
+    OcclusionQueries *occlusionQueries;
+    int queryHandle;
     float speed;        // Speed of movement
 
-    GLuint mvpMatrixID;
-    GLuint jointMatricesID;
-    GLuint lightPositionID;
-    GLuint lightIntensityID;
+    ShaderProgram *program;
+    GLint modelMatrixID;
+    GLint jointMatricesID;
 
     // Animation parameters
     float loopStartTime;
@@ -0,0 +1,319 @@
+#include "building_batch.h"
+#include <render/shader.h>
+#include <render/shader_program.h>
+#include <render/gl_state.h>
+#include <render/texture_array.h>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+const GLfloat BuildingBatch::vertex_buffer_data[72] = {	// Vertex definition for a canonical box
+	// Front face
+	-1.0f, -1.0f, 1.0f,
+	1.0f, -1.0f, 1.0f,
+	1.0f, 1.0f, 1.0f,
+	-1.0f, 1.0f, 1.0f,
+
+	// Back face
+	1.0f, -1.0f, -1.0f,
+	-1.0f, -1.0f, -1.0f,
+	-1.0f, 1.0f, -1.0f,
+	1.0f, 1.0f, -1.0f,
+
+	// Left face
+	-1.0f, -1.0f, -1.0f,
+	-1.0f, -1.0f, 1.0f,
+	-1.0f, 1.0f, 1.0f,
+	-1.0f, 1.0f, -1.0f,
+
+	// Right face
+	1.0f, -1.0f, 1.0f,
+	1.0f, -1.0f, -1.0f,
+	1.0f, 1.0f, -1.0f,
+	1.0f, 1.0f, 1.0f,
+
+	// Top face
+	-1.0f, 1.0f, 1.0f,
+	1.0f, 1.0f, 1.0f,
+	1.0f, 1.0f, -1.0f,
+	-1.0f, 1.0f, -1.0f,
+
+	// Bottom face
+	-1.0f, -1.0f, -1.0f,
+	1.0f, -1.0f, -1.0f,
+	1.0f, -1.0f, 1.0f,
+	-1.0f, -1.0f, 1.0f,
+};
+
+const GLfloat BuildingBatch::normal_buffer_data[72] = {
+	// Front face
+	0.0f, 0.0f, 1.0f,
+	0.0f, 0.0f, 1.0f,
+	0.0f, 0.0f, 1.0f,
+	0.0f, 0.0f, 1.0f,
+	// Back face
+	0.0f, 0.0f, -1.0f,
+	0.0f, 0.0f, -1.0f,
+	0.0f, 0.0f, -1.0f,
+	0.0f, 0.0f, -1.0f,
+	// Left face
+	-1.0f, 0.0f, 0.0f,
+	-1.0f, 0.0f, 0.0f,
+	-1.0f, 0.0f, 0.0f,
+	-1.0f, 0.0f, 0.0f,
+	// Right face
+	1.0f, 0.0f, 0.0f,
+	1.0f, 0.0f, 0.0f,
+	1.0f, 0.0f, 0.0f,
+	1.0f, 0.0f, 0.0f,
+	// Top face
+	0.0f, 1.0f, 0.0f,
+	0.0f, 1.0f, 0.0f,
+	0.0f, 1.0f, 0.0f,
+	0.0f, 1.0f, 0.0f,
+	// Bottom face
+	0.0f, -1.0f, 0.0f,
+	0.0f, -1.0f, 0.0f,
+	0.0f, -1.0f, 0.0f,
+	0.0f, -1.0f, 0.0f,
+};
+
+const GLfloat BuildingBatch::uv_buffer_data[48] = {
+	// Front
+	0.0f, 1.0f,
+	1.0f, 1.0f,
+	1.0f, 0.0f,
+	0.0f, 0.0f,
+	// Back
+	0.0f, 1.0f,
+	1.0f, 1.0f,
+	1.0f, 0.0f,
+	0.0f, 0.0f,
+	// Left
+	0.0f, 1.0f,
+	1.0f, 1.0f,
+	1.0f, 0.0f,
+	0.0f, 0.0f,
+	// Right
+	0.0f, 1.0f,
+	1.0f, 1.0f,
+	1.0f, 0.0f,
+	0.0f, 0.0f,
+	// Top - we do not want texture the top
+	0.0f, 0.0f,
+	0.0f, 0.0f,
+	0.0f, 0.0f,
+	0.0f, 0.0f,
+	// Bottom - we do not want texture the bottom
+	0.0f, 0.0f,
+	0.0f, 0.0f,
+	0.0f, 0.0f,
+	0.0f, 0.0f,
+};
+
+const GLuint BuildingBatch::index_buffer_data[36] = {		// 12 triangle faces of a box
+	0, 1, 2,
+	0, 2, 3,
+
+	4, 5, 6,
+	4, 6, 7,
+
+	8, 9, 10,
+	8, 10, 11,
+
+	12, 13, 14,
+	12, 14, 15,
+
+	16, 17, 18,
+	16, 18, 19,
+
+	20, 21, 22,
+	20, 22, 23,
+};
+
+void BuildingBatch::addBuilding(glm::vec3 position, glm::vec3 scale, float textureLayer) {
+	positions.push_back(position);
+	scales.push_back(scale);
+
+	BuildingInstance instance;
+	instance.modelMatrix = glm::mat4(1.0f);
+	instance.modelMatrix = glm::translate(instance.modelMatrix, position); // Translate to the building's position
+	instance.modelMatrix = glm::scale(instance.modelMatrix, scale);        // Scale to the building's dimensions
+	instance.textureLayer = textureLayer;
+	instance.uvScale = glm::vec2(1.0f, 5.0f); // Repeat the facade five times vertically
+	instances.push_back(instance);
+}
+
+void BuildingBatch::initialize(const char* facadeDirectory) {
+	// Every facade image becomes one layer of a single array texture
+	int layerCount = 0;
+	textureID = LoadTextureArrayFromDirectory(facadeDirectory, &layerCount);
+	for (BuildingInstance &instance : instances) {
+		instance.textureLayer = layerCount > 0 ? std::fmod(instance.textureLayer, static_cast<float>(layerCount)) : 0.0f;
+	}
+
+	boundsCenter = glm::vec3(0.0f);
+	instanceBounds.clear();
+	instanceBounds.reserve(positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		boundsCenter += positions[i] / static_cast<float>(positions.size());
+		instanceBounds.add(BoundingBox(positions[i] - scales[i], positions[i] + scales[i]));
+	}
+
+	// The cube lives in the shared static geometry pool
+	const VertexFormat &cubeFormat = staticGeometry.format();
+	mesh.initialize(staticGeometry, cubeFormat.interleave(24, {vertex_buffer_data, uv_buffer_data, normal_buffer_data, NULL}),
+					index_buffer_data, 36);
+
+	// Per-instance attributes: the model matrix takes four vec4 slots (4-7),
+	// followed by the texture layer (8) and the UV scale (9)
+	VertexFormat instanceFormat(1);
+	instanceFormat.add(4, 4).add(5, 4).add(6, 4).add(7, 4).add(8, 1).add(9, 2);
+	createStream(sceneStream, instanceFormat);
+	createStream(shadowStream, instanceFormat);
+
+	// Shared program for every building
+	programID = AcquireShaderProgram("../project/box.vert", "../project/box.frag");
+	if (programID == 0) {
+		std::cerr << "Failed to load building shaders." << std::endl;
+	}
+
+	// Everything else the shader reads comes from the frame uniform blocks
+	program = GetShaderProgram(programID);
+	program->use();
+	program->setInt("textureSampler", 0);
+	program->setInt("shadowMap", 1);
+	program->setInt("shadowMask", 2);
+	program->setInt("shadowAtlas", 3);
+}
+
+void BuildingBatch::render(GLuint depthMap) {
+	if (instances.empty()) {
+		return;
+	}
+
+	program->use();
+
+	glState.activeTexture(GL_TEXTURE0);
+	glState.bindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+
+	// Bind the depth map to texture unit 1
+	glState.activeTexture(GL_TEXTURE1);
+	glState.bindTexture(GL_TEXTURE_2D_ARRAY, depthMap);
+
+	mesh.drawInstanced(sceneStream.vertexArrayID, sceneStream.count);
+}
+
+void BuildingBatch::renderDepth(GLuint shaderProgramID) {
+	if (instances.empty()) {
+		return;
+	}
+
+	glState.useProgram(shaderProgramID);
+
+	mesh.drawInstanced(shadowStream.vertexArrayID, shadowStream.count);
+}
+
+void BuildingBatch::createStream(InstanceStream &stream, const VertexFormat &instanceFormat) {
+	glGenBuffers(1, &stream.bufferID);
+	glState.bindBuffer(GL_ARRAY_BUFFER, stream.bufferID);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(BuildingInstance), NULL, GL_STREAM_DRAW);
+	// A VAO of its own combines the pool's vertices with the instance stream
+	stream.vertexArrayID = staticGeometry.createVertexArray(instanceFormat, stream.bufferID);
+	stream.count = 0;
+}
+
+void BuildingBatch::enableOcclusionQueries(OcclusionQueries &queries) {
+	occlusionQueries = &queries;
+	queryHandles.clear();
+	for (size_t i = 0; i < instances.size(); i++) {
+		queryHandles.push_back(queries.add());
+	}
+}
+
+void BuildingBatch::updateStream(InstanceStream &stream, const RenderQueue &queue, OcclusionQueries *queries) {
+	visibleInstances.clear();
+	instanceBounds.cull(queue.getFrustum(), visibleInstances, queue.getCullingStats());
+
+	const OcclusionCuller *occlusion = queue.getOcclusionCuller();
+	if (occlusion && occlusion->isEnabled()) {
+		size_t kept = 0;
+		for (uint32_t index : visibleInstances) {
+			if (occlusion->isVisible(BoundingBox(positions[index] - scales[index], positions[index] + scales[index]))) {
+				visibleInstances[kept++] = index;
+			}
+		}
+		visibleInstances.resize(kept);
+	}
+
+	if (queries && queries->isEnabled()) {
+		size_t kept = 0;
+		for (uint32_t index : visibleInstances) {
+			if (queries->isVisible(queryHandles[index], BoundingBox(positions[index] - scales[index], positions[index] + scales[index]))) {
+				visibleInstances[kept++] = index;
+			}
+		}
+		visibleInstances.resize(kept);
+	}
+
+	const glm::vec3 &viewPosition = queue.getViewPosition();
+	instanceOrder.resize(visibleInstances.size());
+	for (size_t i = 0; i < visibleInstances.size(); i++) {
+		glm::vec3 offset = positions[visibleInstances[i]] - viewPosition;
+		float distanceSquared = glm::dot(offset, offset);
+		uint32_t distanceBits;
+		std::memcpy(&distanceBits, &distanceSquared, sizeof(distanceBits));
+		instanceOrder[i].key = distanceBits;
+		instanceOrder[i].index = visibleInstances[i];
+	}
+	RadixSortByKey(instanceOrder, sortScratch);
+
+	sortedInstances.resize(instanceOrder.size());
+	for (size_t i = 0; i < instanceOrder.size(); i++) {
+		sortedInstances[i] = instances[instanceOrder[i].index];
+	}
+	stream.count = static_cast<GLsizei>(sortedInstances.size());
+	if (stream.count > 0) {
+		// The depth stream is refilled for every cascade and atlas tile while
+		// the draw of the previous pass may still read it. Orphaning gives each
+		// upload fresh storage instead of stalling on that draw.
+		glState.bindBuffer(GL_ARRAY_BUFFER, stream.bufferID);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(BuildingInstance), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sortedInstances.size() * sizeof(BuildingInstance), sortedInstances.data());
+	}
+}
+
+void BuildingBatch::submit(RenderQueue &queue, GLuint depthMap) {
+	if (instances.empty()) {
+		return;
+	}
+	updateStream(sceneStream, queue, occlusionQueries);
+	if (sceneStream.count == 0) {
+		return;
+	}
+	queue.submit(PASS_OPAQUE, programID, textureID, sceneStream.vertexArrayID, boundsCenter,
+				 [](void *object, GLuint argument) { static_cast<BuildingBatch *>(object)->render(argument); }, this, depthMap);
+}
+
+void BuildingBatch::submitDepth(RenderQueue &queue, GLuint shaderProgramID) {
+	if (instances.empty()) {
+		return;
+	}
+	updateStream(shadowStream, queue, NULL);
+	if (shadowStream.count == 0) {
+		return;
+	}
+	queue.submit(PASS_DEPTH, shaderProgramID, 0, shadowStream.vertexArrayID, boundsCenter,
+				 [](void *object, GLuint argument) { static_cast<BuildingBatch *>(object)->renderDepth(argument); }, this, shaderProgramID);
+}
+
+void BuildingBatch::cleanup() {
+	for (InstanceStream *stream : {&sceneStream, &shadowStream}) {
+		staticGeometry.releaseVertexArray(stream->vertexArrayID);
+		glDeleteBuffers(1, &stream->bufferID);
+		stream->count = 0;
+	}
+	mesh.cleanup();
+	glDeleteTextures(1, &textureID);
+	ReleaseShaderProgram(programID);
+}
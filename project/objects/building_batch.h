@@ -0,0 +1,81 @@
+#ifndef BUILDING_BATCH_H
+#define BUILDING_BATCH_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+#include <render/shader_program.h>
+#include <render/render_queue.h>
+#include <render/geometry_pool.h>
+#include <render/frustum_culling.h>
+#include <render/occlusion_queries.h>
+
+// Per-building data streamed to the GPU as instanced vertex attributes
+struct BuildingInstance {
+    glm::mat4 modelMatrix;  // Translation and scale of the unit cube
+    float textureLayer;     // Layer of the facade texture array
+    glm::vec2 uvScale;      // Facade tiling along U and V
+};
+static_assert(sizeof(BuildingInstance) == 19 * sizeof(float), "BuildingInstance must match its vertex format");
+
+// Draws the whole city from one shared unit cube with a single instanced
+// draw call per pass, instead of one VAO/program/texture per building.
+class BuildingBatch {
+public:
+    std::vector<glm::vec3> positions; // Centre of each building
+    std::vector<glm::vec3> scales;    // Half extents of each building
+
+    // textureLayer is wrapped to the number of facades found by initialize()
+    void addBuilding(glm::vec3 position, glm::vec3 scale, float textureLayer = 0.0f);
+    // Loads every image in facadeDirectory as one layer of a texture array
+    void initialize(const char* facadeDirectory);
+    void render(GLuint depthMap);
+    void renderDepth(GLuint shaderProgramID);
+
+    // Queue one packet per pass. Each pass culls the buildings against the
+    // queue's frustum and occlusion culler and uploads the survivors to its own instance stream,
+    // nearest first, so the city also gets early-Z rejection.
+    void submit(RenderQueue &queue, GLuint depthMap);
+    void submitDepth(RenderQueue &queue, GLuint shaderProgramID);
+    void cleanup();
+
+    // Registers every building with queries; while they are enabled the scene
+    // pass also leaves out buildings whose last query found them hidden. The
+    // city is one instanced draw, so there is no per-building conditional render.
+    void enableOcclusionQueries(OcclusionQueries &queries);
+
+    int count() const { return static_cast<int>(instances.size()); }
+
+private:
+    static const GLfloat vertex_buffer_data[72];
+    static const GLfloat normal_buffer_data[72];
+    static const GLfloat uv_buffer_data[48];
+    static const GLuint index_buffer_data[36];
+
+    // Visible instances of one pass, in draw order
+    struct InstanceStream {
+        GLuint bufferID = 0;
+        GLuint vertexArrayID = 0;
+        GLsizei count = 0;
+    };
+
+    std::vector<BuildingInstance> instances;
+    CullingSet instanceBounds;
+    std::vector<uint32_t> visibleInstances;
+    std::vector<BuildingInstance> sortedInstances; // Upload order, nearest building first
+    std::vector<SortEntry> instanceOrder, sortScratch;
+    glm::vec3 boundsCenter;
+    OcclusionQueries *occlusionQueries = NULL;
+    std::vector<int> queryHandles; // Query handle of each building
+
+    StaticMesh mesh;
+    InstanceStream sceneStream, shadowStream;
+    GLuint textureID, programID;
+    ShaderProgram *program;
+
+    void createStream(InstanceStream &stream, const VertexFormat &instanceFormat);
+    void updateStream(InstanceStream &stream, const RenderQueue &queue, OcclusionQueries *queries);
+};
+
+#endif // BUILDING_BATCH_H
@@ -1,11 +1,11 @@
 #include "flag.h"
 #include <render/shader.h>
+#include <render/gl_state.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include <GLFW/glfw3.h>
 #include <vector>
 #include <stb/stb_image.h> // Ensure this header is included for texture loading
 #include <iostream>
-#include "utils/lightInfo.h"
 
 GLuint LoadTexture2D(const char* texture_file_path) {
     int w, h, channels;
@@ -17,7 +17,7 @@ GLuint LoadTexture2D(const char* texture_file_path) {
     GLuint textureID;
     glGenTextures(1, &textureID);
 
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    glState.bindTexture(GL_TEXTURE_2D, textureID);
     // Set texture parameters here
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -77,31 +77,24 @@ void Flag::initializePole(glm::vec3 polePosition, glm::vec3 poleScale) {
         poleIndices.push_back(top2);
     }
 
-    glGenVertexArrays(1, &poleVAO);
-    glBindVertexArray(poleVAO);
+    // Position, UV and normal in the shared static geometry pool
+    const VertexFormat &format = staticGeometry.format();
+    poleMesh.initialize(staticGeometry, format.interleave(poleVertices.size(), {&poleVertices[0].x, &poleUVs[0].x, &poleNormals[0].x, NULL}),
+                        poleIndices.data(), static_cast<GLsizei>(poleIndices.size()));
 
-    glGenBuffers(1, &poleVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, poleVBO);
-    glBufferData(GL_ARRAY_BUFFER, poleVertices.size() * sizeof(glm::vec3), &poleVertices[0], GL_STATIC_DRAW);
-
-    glGenBuffers(1, &poleNormalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, poleNormalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, poleNormals.size() * sizeof(glm::vec3), &poleNormals[0], GL_STATIC_DRAW);
-
-    glGenBuffers(1, &poleEBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, poleEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, poleIndices.size() * sizeof(GLuint), &poleIndices[0], GL_STATIC_DRAW);
-
-
-    poleProgramID = LoadShadersFromFile("../project/objects/pole.vert", "../project/objects/pole.frag");
+    poleProgramID = AcquireShaderProgram("../project/objects/pole.vert", "../project/objects/pole.frag");
     if (poleProgramID == 0) {
         std::cerr << "Failed to load pole shaders." << std::endl;
     }
-    poleMVPMatrixID = glGetUniformLocation(poleProgramID, "MVP");
-    lightPositionID = glGetUniformLocation(poleProgramID, "lightPosition");
-    lightColorID = glGetUniformLocation(poleProgramID, "lightColor");
-    lightIntensityID = glGetUniformLocation(poleProgramID, "lightIntensity");
-    cameraPositionID = glGetUniformLocation(poleProgramID, "cameraPosition");
+    poleProgram = GetShaderProgram(poleProgramID);
+    poleModelMatrixID = poleProgram->location("modelMatrix");
+
+    // The pole samples the shadow map from unit 0, the shadow mask from unit 2
+    // and the local light atlas from unit 3
+    poleProgram->use();
+    poleProgram->setInt("shadowMap", 0);
+    poleProgram->setInt("shadowMask", 2);
+    poleProgram->setInt("shadowAtlas", 3);
 }
 
 
@@ -149,45 +142,27 @@ void Flag::initialize(glm::vec3 position, glm::vec3 scale, const char* texturePa
         }
     }
 
-    // Create VAO and VBOs
-    glGenVertexArrays(1, &vertexArrayID);
-    glBindVertexArray(vertexArrayID);
-
-    // Vertex buffer
-    glGenBuffers(1, &vertexBufferID);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
-
-    // UV buffer
-    glGenBuffers(1, &uvBufferID);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-    glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);
-
-    // Index buffer
-    glGenBuffers(1, &indexBufferID);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
-
-    // Unbind the VBOs for clarity
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    // Position and UV in the shared static geometry pool
+    const VertexFormat &format = staticGeometry.format();
+    mesh.initialize(staticGeometry, format.interleave(vertices.size(), {&vertices[0].x, &uvs[0].x, NULL, NULL}),
+                    indices.data(), static_cast<GLsizei>(indices.size()));
 
     // Load shaders
-    programID = LoadShadersFromFile("../project/objects/flag.vert", "../project/objects/flag.frag");
+    programID = AcquireShaderProgram("../project/objects/flag.vert", "../project/objects/flag.frag");
 
-    mvpMatrixID = glGetUniformLocation(programID, "MVP");
-    timeID = glGetUniformLocation(programID, "Time");
+    program = GetShaderProgram(programID);
+    modelMatrixID = program->location("modelMatrix");
+    timeID = program->location("Time");
 
     // Load texture
     textureID = LoadTexture2D(texturePath);
     if (textureID == 0) {
         std::cerr << "Failed to load flag texture." << std::endl;
     }
-    textureSamplerID = glGetUniformLocation(programID, "textureSampler");
-    lightPositionID = glGetUniformLocation(programID, "lightPosition");
-    lightColorID = glGetUniformLocation(programID, "lightColor");
-    lightIntensityID = glGetUniformLocation(programID, "lightIntensity");
-    cameraPositionID = glGetUniformLocation(programID, "cameraPosition");
+    program->use();
+    program->setInt("textureSampler", 0);
+    program->setInt("shadowMask", 2);
+    program->setInt("shadowAtlas", 3);
 
     // Store start time
     startTime = glfwGetTime();
@@ -214,8 +189,9 @@ void Flag::initialize(glm::vec3 position, glm::vec3 scale, const char* texturePa
     initializePole(polePosition, poleScale); // Initialize the pole
 }
 
-void Flag::renderFlagDepth(GLuint depthShaderProgramID, glm::mat4 lightSpaceMatrix) {
-    glUseProgram(depthShaderProgramID);
+void Flag::renderFlagDepth(GLuint depthShaderProgramID) {
+    ShaderProgram *depthProgram = GetShaderProgram(depthShaderProgramID);
+    depthProgram->use();
 
     // Model matrix
     glm::mat4 modelMatrix = glm::mat4(1.0f);
@@ -223,33 +199,20 @@ void Flag::renderFlagDepth(GLuint depthShaderProgramID, glm::mat4 lightSpaceMatr
     modelMatrix = glm::scale(modelMatrix, scale);
 
     // Set uniforms
-    glUniformMatrix4fv(glGetUniformLocation(depthShaderProgramID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(depthShaderProgramID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+    depthProgram->setMat4("modelMatrix", modelMatrix);
 
     float currentTime = glfwGetTime() - startTime;
-    glUniform1f(glGetUniformLocation(depthShaderProgramID, "Time"), currentTime);
+    depthProgram->setFloat("Time", currentTime);
 
-    // Bind VAO
-    glBindVertexArray(vertexArrayID);
-
-    // Enable vertex attribute array
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    // Draw elements
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-    glDrawElements(GL_TRIANGLES, numSegments * numSegments * 6, GL_UNSIGNED_INT, 0);
-
-    glDisableVertexAttribArray(0);
+    mesh.draw();
 }
 
 
 
 
 
-void Flag::render(glm::mat4 cameraMatrix, Light light, glm::vec3 cameraPosition) {
-    glUseProgram(programID);
+void Flag::render() {
+    program->use();
 
     // Model matrix
     glm::mat4 modelMatrix = glm::mat4(1.0f);
@@ -258,143 +221,89 @@ void Flag::render(glm::mat4 cameraMatrix, Light light, glm::vec3 cameraPosition)
 
 
 
-    // Normal matrix (transpose of the inverse of the upper-left 3x3 part of the model matrix)
-    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
-
-    // MVP matrix
-    glm::mat4 mvp = cameraMatrix * modelMatrix;
-    glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(programID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
-    glUniformMatrix3fv(glGetUniformLocation(programID, "normalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
+    program->setMat4(modelMatrixID, modelMatrix);
 
 
     // Time uniform
     float currentTime = glfwGetTime() - startTime;
-    glUniform1f(timeID, currentTime);
-
-    // Bind VAO
-    glBindVertexArray(vertexArrayID);
-
-    // Enable vertex attribute array for positions
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    // Enable vertex attribute array for UVs
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    program->setFloat(timeID, currentTime);
 
     // Bind the texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glUniform1i(textureSamplerID, 0);
+    glState.activeTexture(GL_TEXTURE0);
+    glState.bindTexture(GL_TEXTURE_2D, textureID);
 
-    glUniform3fv(glGetUniformLocation(programID, "lightDirection"), 1, &light.direction[0]);
-    glUniform3fv(glGetUniformLocation(programID, "lightColor"), 1, &light.color[0]);
-    glUniform3fv(glGetUniformLocation(programID, "cameraPosition"), 1, &cameraPosition[0]);
-    glUniform1f(glGetUniformLocation(programID, "lightIntensity"), light.intensity);
-
-
-    // Draw elements
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-    glDrawElements(GL_TRIANGLES, numSegments * numSegments * 6, GL_UNSIGNED_INT, 0);
-
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    mesh.draw();
 }
 
-void Flag::renderPoleDepth(GLuint depthShaderProgramID, glm::mat4 lightSpaceMatrix) {
-    glUseProgram(depthShaderProgramID);
+void Flag::renderPoleDepth(GLuint depthShaderProgramID) {
+    ShaderProgram *depthProgram = GetShaderProgram(depthShaderProgramID);
+    depthProgram->use();
 
     glm::mat4 poleModelMatrix = glm::mat4(1.0f);
     poleModelMatrix = glm::translate(poleModelMatrix, polePosition);
     poleModelMatrix = glm::scale(poleModelMatrix, poleScale);
 
-    // Set the light space matrix uniform
-    glUniformMatrix4fv(glGetUniformLocation(depthShaderProgramID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
-
     // Set the model matrix uniform
-    glUniformMatrix4fv(glGetUniformLocation(depthShaderProgramID, "modelMatrix"), 1, GL_FALSE, &poleModelMatrix[0][0]);
+    depthProgram->setMat4("modelMatrix", poleModelMatrix);
 
-    glBindVertexArray(poleVAO);
-
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, poleVBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, poleEBO);
-    glDrawElements(GL_TRIANGLES, 36 * 6, GL_UNSIGNED_INT, 0);
-
-    glDisableVertexAttribArray(0);
+    poleMesh.draw();
 }
 
 
-void Flag::renderPole(glm::mat4 cameraMatrix, Light light, glm::vec3 cameraPosition, glm::mat4 lightSpaceMatrix, GLuint shadowMap) {
-    glUseProgram(poleProgramID);
+void Flag::renderPole(GLuint shadowMap) {
+    poleProgram->use();
 
     glm::mat4 poleModelMatrix = glm::mat4(1.0f);
     poleModelMatrix = glm::translate(poleModelMatrix, polePosition);
     poleModelMatrix = glm::scale(poleModelMatrix, poleScale);
 
-    // Normal matrix (transpose of the inverse of the upper-left 3x3 part of the model matrix)
-    glm::mat3 poleNormalMatrix  = glm::transpose(glm::inverse(glm::mat3(poleModelMatrix)));
-
-    glm::mat4 poleMVP = cameraMatrix * poleModelMatrix;
-    glUniformMatrix4fv(poleMVPMatrixID, 1, GL_FALSE, &poleMVP[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(poleProgramID, "modelMatrix"), 1, GL_FALSE, &poleModelMatrix[0][0]);
-    glUniformMatrix3fv(glGetUniformLocation(poleProgramID, "normalMatrix"), 1, GL_FALSE, &poleNormalMatrix[0][0]);
+    poleProgram->setMat4(poleModelMatrixID, poleModelMatrix);
 
-    // Pass light space matrix
-    glUniformMatrix4fv(glGetUniformLocation(poleProgramID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+    glState.activeTexture(GL_TEXTURE0);
+    glState.bindTexture(GL_TEXTURE_2D_ARRAY, shadowMap);
 
-    glBindVertexArray(poleVAO);
-
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, poleVBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, poleUVBuffer);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    poleMesh.draw();
+}
 
-    glEnableVertexAttribArray(2); // Assuming location 2 for normals
-    glBindBuffer(GL_ARRAY_BUFFER, poleNormalBuffer);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
-    glUniform1i(glGetUniformLocation(poleProgramID, "shadowMap"), 0);
+BoundingBox Flag::getBounds() const {
+    // The cloth is the unit square in x/y; flag.vert displaces z by at most
+    // (0.35 + 0.15) * x
+    BoundingBox local(glm::vec3(0.0f, 0.0f, -0.5f), glm::vec3(1.0f, 1.0f, 0.5f));
+    return BoundingBox(position + scale * local.min, position + scale * local.max);
+}
 
-    // Pass lighting uniforms
-    glUniform3fv(glGetUniformLocation(poleProgramID, "lightDirection"), 1, &light.direction[0]);
-    glUniform3fv(glGetUniformLocation(poleProgramID, "lightColor"), 1, &light.color[0]);
-    glUniform3fv(glGetUniformLocation(poleProgramID, "cameraPosition"), 1, &cameraPosition[0]);
-    glUniform1f(glGetUniformLocation(poleProgramID, "lightIntensity"), light.intensity);
+BoundingBox Flag::getPoleBounds() const {
+    // Cylinder of radius 0.05 from y = 0 to 1
+    BoundingBox local(glm::vec3(-0.05f, 0.0f, -0.05f), glm::vec3(0.05f, 1.0f, 0.05f));
+    return BoundingBox(polePosition + poleScale * local.min, polePosition + poleScale * local.max);
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, poleEBO);
-    glDrawElements(GL_TRIANGLES, 36 * 6, GL_UNSIGNED_INT, 0);
+void Flag::submit(RenderQueue &queue, GLuint shadowMap) {
+    queue.submit(PASS_OPAQUE, poleProgramID, 0, poleMesh.vertexArray(), getPoleBounds(),
+                 [](void *object, GLuint argument) { static_cast<Flag *>(object)->renderPole(argument); }, this, shadowMap);
+    queue.submit(PASS_OPAQUE, programID, textureID, mesh.vertexArray(), getBounds(),
+                 [](void *object, GLuint) { static_cast<Flag *>(object)->render(); }, this);
+}
 
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+void Flag::submitPoleDepth(RenderQueue &queue, GLuint depthProgramID) {
+    queue.submit(PASS_DEPTH, depthProgramID, 0, poleMesh.vertexArray(), getPoleBounds(),
+                 [](void *object, GLuint argument) { static_cast<Flag *>(object)->renderPoleDepth(argument); }, this, depthProgramID);
 }
 
+void Flag::submitFlagDepth(RenderQueue &queue, GLuint flagDepthProgramID) {
+    queue.submit(PASS_DEPTH, flagDepthProgramID, 0, mesh.vertexArray(), getBounds(),
+                 [](void *object, GLuint argument) { static_cast<Flag *>(object)->renderFlagDepth(argument); }, this, flagDepthProgramID);
+}
 
 void Flag::cleanupPole() {
-    glDeleteBuffers(1, &poleVBO);
-    glDeleteBuffers(1, &poleUVBuffer);
-    glDeleteBuffers(1, &poleEBO);
-    glDeleteTextures(1, &poleTextureID);
-    glDeleteVertexArrays(1, &poleVAO);
-    glDeleteProgram(poleProgramID);
+    poleMesh.cleanup();
+    ReleaseShaderProgram(poleProgramID);
 }
 
 void Flag::cleanup() {
-    glDeleteBuffers(1, &vertexBufferID);
-    glDeleteBuffers(1, &uvBufferID);
-    glDeleteBuffers(1, &indexBufferID);
+    mesh.cleanup();
     glDeleteTextures(1, &textureID);
-    glDeleteVertexArrays(1, &vertexArrayID);
-    glDeleteProgram(programID);
+    ReleaseShaderProgram(programID);
     cleanupPole();
 }
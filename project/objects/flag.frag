@@ -9,10 +9,31 @@ out vec4 color;
 
 uniform sampler2D textureSampler;
 uniform sampler2D shadowMap; // Shadow map sampler
-uniform vec3 lightDirection;
-uniform vec3 lightColor;
-uniform vec3 cameraPosition;
-uniform float lightIntensity;
+
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
+layout(std140) uniform LightBlock {
+    vec3 lightDirection;
+    float lightIntensity;
+    vec3 lightPosition;
+    vec3 lightColor;
+};
+
+layout(std140) uniform CascadeBlock {
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
+    int cascadeCount;
+    int shadowTechnique;
+    int useShadowMask;
+};
+
+// Shadow term of the visible surface at each pixel, see shadow_mask.frag
+uniform sampler2D shadowMask;
+
+#include "../local_lighting.glsl"
 
 // Controls for translucency
 uniform float translucencyFactor = 0.5; // How much light passes through
@@ -20,6 +41,9 @@ uniform vec3 backLightColor = vec3(1.0, 1.0, 1.0); // Color of light passing thr
 
 // Function to calculate shadow factor
 float calculateShadow(vec4 fragPosLightSpace) {
+    if (useShadowMask != 0) {
+        return texelFetch(shadowMask, ivec2(gl_FragCoord.xy), 0).r;
+    }
     // Transform to normalized device coordinates
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     projCoords = projCoords * 0.5 + 0.5; // Transform to [0, 1] range
@@ -71,7 +95,7 @@ void main() {
     vec3 specularFront = specFront * lightColor * lightIntensity * specularScale * (1.0 - shadow); // Apply shadow
 
     // Combine front lighting
-    vec3 lightingFront = ambientFront + diffuseFront + specularFront;
+    vec3 lightingFront = ambientFront + diffuseFront + specularFront + localLighting(fragPosition, surfaceNormal);
 
     // Simulate translucency (light passing through)
     float diffBack = max(dot(-surfaceNormal, lightDir), 0.0);
@@ -3,33 +3,45 @@
 
 #include <glad/gl.h>
 #include <glm/glm.hpp>
-#include "utils/lightInfo.h"
+#include <render/shader_program.h>
+#include <render/render_queue.h>
+#include <render/geometry_pool.h>
+#include <render/frustum_culling.h>
 
 class Flag {
 public:
     // Initialization and rendering methods for the flag
     void initialize(glm::vec3 position, glm::vec3 scale, const char* texturePath);
-    void render(glm::mat4 cameraMatrix, Light light, glm::vec3 cameraPosition);
-    void renderFlagDepth(GLuint depthShaderProgramID, glm::mat4 lightSpaceMatrix);
+    // Camera, light and light-space matrix come from the frame uniform blocks
+    void render();
+    void renderFlagDepth(GLuint depthShaderProgramID);
     void cleanup();
 
     // Initialization and rendering methods for the pole
     void initializePole(glm::vec3 polePosition, glm::vec3 poleScale);
-    void renderPole(glm::mat4 cameraMatrix, Light light, glm::vec3 cameraPosition, glm::mat4 lightSpaceMatrix, GLuint shadowMap);
-    void renderPoleDepth(GLuint depthShaderProgramID, glm::mat4 lightSpaceMatrix);
+    void renderPole(GLuint shadowMap);
+    void renderPoleDepth(GLuint depthShaderProgramID);
     void cleanupPole();
 
+    // Queue the flag and its pole
+    void submit(RenderQueue &queue, GLuint shadowMap);
+    // The pole is a static caster and the waving cloth a dynamic one, so the
+    // shadow pass queues them separately
+    void submitPoleDepth(RenderQueue &queue, GLuint depthProgramID);
+    void submitFlagDepth(RenderQueue &queue, GLuint flagDepthProgramID);
+
+    // World boxes of the waving cloth and of the pole
+    BoundingBox getBounds() const;
+    BoundingBox getPoleBounds() const;
+
 private:
     // Variables for the flag
-    GLuint vertexArrayID;
-    GLuint vertexBufferID;
-    GLuint uvBufferID;
-    GLuint indexBufferID;
+    StaticMesh mesh;
     GLuint programID;
-    GLuint mvpMatrixID;
-    GLuint timeID;
+    ShaderProgram *program;
+    GLint modelMatrixID;
+    GLint timeID;
     GLuint textureID;
-    GLuint textureSamplerID, lightPositionID, lightColorID, lightIntensityID, lightDirectionID, cameraPositionID;
 
     glm::vec3 position;
     glm::vec3 scale;
@@ -38,15 +50,10 @@ private:
     int numSegments;
 
     // Variables for the pole
-    GLuint poleVAO;
-    GLuint poleNormalBuffer;
-    GLuint poleVBO;
-    GLuint poleUVBuffer;
-    GLuint poleEBO;
+    StaticMesh poleMesh;
     GLuint poleProgramID;
-    GLuint poleTextureID;
-    GLuint poleMVPMatrixID;
-    GLuint poleTextureSamplerID;
+    ShaderProgram *poleProgram;
+    GLint poleModelMatrixID;
 
     glm::vec3 polePosition;
     glm::vec3 poleScale;
@@ -7,9 +7,12 @@ out vec2 UV;
 out vec3 fragNormal;
 out vec3 fragPosition;
 
-uniform mat4 MVP;
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
 uniform mat4 modelMatrix;
-uniform mat3 normalMatrix;
 uniform float Time;
 
 void main() {
@@ -31,9 +34,11 @@ void main() {
     vec3 normal = vec3(0.0, 0.0, 1.0);
 
     // Output data
+    mat3 normalMatrix = transpose(inverse(mat3(modelMatrix)));
+    vec4 worldPosition = modelMatrix * vec4(pos, 1.0);
     fragNormal = normalize(normalMatrix * normal);
-    fragPosition = vec3(modelMatrix * vec4(pos, 1.0));
+    fragPosition = vec3(worldPosition);
     UV = vertexUV;
 
-    gl_Position = MVP * vec4(pos, 1.0);
+    gl_Position = vpMatrix * worldPosition;
 }
@@ -3,7 +3,17 @@
 layout(location = 0) in vec3 inPosition;
 
 // Uniforms
-uniform mat4 lightSpaceMatrix;
+#ifdef CAMERA_DEPTH
+layout(std140) uniform CameraBlock {
+    mat4 depthMatrix;
+    vec3 cameraPosition;
+};
+#else
+layout(std140) uniform ShadowBlock {
+    mat4 depthMatrix;
+};
+#endif
+
 uniform mat4 modelMatrix;
 uniform float Time;
 
@@ -27,7 +37,7 @@ void main() {
 
     // Transform to light space
     vec4 worldPosition = modelMatrix * vec4(pos, 1.0);
-    fragPosLightSpace = lightSpaceMatrix * worldPosition;
+    fragPosLightSpace = depthMatrix * worldPosition;
 
     gl_Position = fragPosLightSpace;
 }
@@ -1,13 +1,12 @@
-#include <utils/lightInfo.h>
-
 #include "Floor.h"
+#include <render/gl_state.h>
 
 GLuint Floor::LoadTextureTileBox(const char* texture_file_path) {
     int w, h, channels;
     uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, 3);
     GLuint texture;
     glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    glState.bindTexture(GL_TEXTURE_2D, texture);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -29,123 +28,79 @@ void Floor::initialize(glm::vec3 position, glm::vec3 scale, const char* textureP
     this->position = position;
     this->scale = scale;
 
-    glGenVertexArrays(1, &vertexArrayID);
-    glBindVertexArray(vertexArrayID);
-
-    glGenBuffers(1, &vertexBufferID);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &uvBufferID);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &indexBufferID);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
+    // Position and UV; the quad lives in the shared static geometry pool
+    const VertexFormat &format = staticGeometry.format();
+    mesh.initialize(staticGeometry, format.interleave(4, {vertex_buffer_data, uv_buffer_data, NULL, NULL}), index_buffer_data, 6);
 
     // Load texture for the floor
     textureID = LoadTextureTileBox(texturePath);
 
     // Load shaders
-    programID = LoadShadersFromFile("../project/objects/floor.vert", "../project/objects/floor.frag");
+    programID = AcquireShaderProgram("../project/objects/floor.vert", "../project/objects/floor.frag");
     if (programID == 0) {
         std::cerr << "Failed to load floor shaders." << std::endl;
     }
-    mvpMatrixID = glGetUniformLocation(programID, "MVP");
-    textureSamplerID = glGetUniformLocation(programID, "textureSampler");
-
-    lightPositionID = glGetUniformLocation(programID, "lightPosition");
-    lightColorID = glGetUniformLocation(programID, "lightColor");
-    lightIntensityID = glGetUniformLocation(programID, "lightIntensity");
-    cameraPositionID = glGetUniformLocation(programID, "cameraPosition");
-    lightSpaceMatrixID = glGetUniformLocation(programID, "lightSpaceMatrix");
-    shadowMapID = glGetUniformLocation(programID, "shadowMap");
+    program = GetShaderProgram(programID);
+    modelMatrixID = program->location("modelMatrix");
+
+    // Sampler units never change, so they are set once here
+    program->use();
+    program->setInt("textureSampler", 0);
+    program->setInt("shadowMap", 1);
+    program->setInt("shadowMask", 2);
+    program->setInt("shadowAtlas", 3);
 }
 
-void Floor::render(glm::mat4 cameraMatrix,glm::mat4 lightSpaceMatrix, GLuint depthMap, Light light, glm::vec3 cameraPosition) {
-    glUseProgram(programID);
-
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-
-    // Set the light space matrix uniform
-    glUniformMatrix4fv(lightSpaceMatrixID, 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+void Floor::render(GLuint depthMap) {
+    program->use();
 
     // Bind the depth map to texture unit 1
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glUniform1i(shadowMapID, 1);
+    glState.activeTexture(GL_TEXTURE1);
+    glState.bindTexture(GL_TEXTURE_2D_ARRAY, depthMap);
 
     glm::mat4 modelMatrix = glm::mat4(1.0f);
     modelMatrix = glm::translate(modelMatrix, position);
     modelMatrix = glm::scale(modelMatrix, scale);
 
-    glUniformMatrix4fv(glGetUniformLocation(programID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
-    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
-    glUniformMatrix3fv(glGetUniformLocation(programID, "normalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
-
-    glm::mat4 mvp = cameraMatrix * modelMatrix;
-    glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glUniform1i(textureSamplerID, 0);
+    program->setMat4(modelMatrixID, modelMatrix);
 
-    // Send lighting properties
-    glUniform3fv(lightPositionID, 1, &light.position[0]);
-    glUniform3fv(lightColorID, 1, &light.color[0]);
-    glUniform1f(lightIntensityID, light.intensity);
-    glUniform3fv(cameraPositionID, 1, &cameraPosition[0]);
+    glState.activeTexture(GL_TEXTURE0);
+    glState.bindTexture(GL_TEXTURE_2D, textureID);
 
-
-    // Pass light direction to the shader
-    glUniform3fv(glGetUniformLocation(programID, "lightDirection"), 1, &light.direction[0]);
-
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    mesh.draw();
 }
 
-void Floor::renderDepth(GLuint shaderProgramID, glm::mat4 lightSpaceMatrix) {
-    glUseProgram(shaderProgramID);
-
-    // Set uniforms
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+void Floor::renderDepth(GLuint shaderProgramID) {
+    ShaderProgram *depthProgram = GetShaderProgram(shaderProgramID);
+    depthProgram->use();
 
     glm::mat4 modelMatrix = glm::mat4(1.0f);
     modelMatrix = glm::translate(modelMatrix, position);
     modelMatrix = glm::scale(modelMatrix, scale);
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
-
-    glBindVertexArray(vertexArrayID);
+    depthProgram->setMat4("modelMatrix", modelMatrix);
 
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+    mesh.draw();
+}
 
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
+void Floor::submit(RenderQueue &queue, GLuint depthMap) {
+    queue.submit(PASS_OPAQUE, programID, textureID, mesh.vertexArray(), position,
+                 [](void *object, GLuint argument) { static_cast<Floor *>(object)->render(argument); }, this, depthMap);
+}
 
-    glDisableVertexAttribArray(0);
+void Floor::submitDepth(RenderQueue &queue, GLuint shaderProgramID) {
+    queue.submit(PASS_DEPTH, shaderProgramID, 0, mesh.vertexArray(), position,
+                 [](void *object, GLuint argument) { static_cast<Floor *>(object)->renderDepth(argument); }, this, shaderProgramID);
 }
 
+BoundingBox Floor::getBounds() const {
+    // The quad lies in the y = 0 plane of its model space
+    glm::vec3 halfSize(scale.x, 0.0f, scale.z);
+    return BoundingBox(position - halfSize, position + halfSize);
+}
 
 void Floor::cleanup() {
-    glDeleteBuffers(1, &vertexBufferID);
-    glDeleteBuffers(1, &uvBufferID);
-    glDeleteBuffers(1, &indexBufferID);
-    glDeleteVertexArrays(1, &vertexArrayID);
+    mesh.cleanup();
     glDeleteTextures(1, &textureID);
-    glDeleteProgram(programID);
+    ReleaseShaderProgram(programID);
 }
@@ -3,20 +3,88 @@
 in vec2 UV;
 in vec3 fragPosition;
 in vec3 fragNormal;
-in vec4 fragPosLightSpace;
 
 out vec4 finalColor;
 
 uniform sampler2D textureSampler;
-uniform sampler2D shadowMap;
-uniform vec3 lightDirection;
-uniform vec3 lightColor;
-uniform vec3 lightPosition;
-uniform vec3 cameraPosition;
-uniform float lightIntensity;
+uniform sampler2DArray shadowMap; // One layer per cascade
+
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
+layout(std140) uniform LightBlock {
+    vec3 lightDirection;
+    float lightIntensity;
+    vec3 lightPosition;
+    vec3 lightColor;
+};
+
+// Shadow cascades; cascadeSplits holds the far view depth of each
+layout(std140) uniform CascadeBlock {
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
+    int cascadeCount;
+    int shadowTechnique; // 0: PCF, 1: VSM, 2: EVSM
+    int useShadowMask;
+};
+
+// Shadow term of the visible surface at each pixel, see shadow_mask.frag
+uniform sampler2D shadowMask;
+
+#include "../local_lighting.glsl"
+
+// Position in the clip space of the cascade covering the fragment; the
+// cascade is chosen by view depth and returned in layer
+vec4 cascadePosition(vec3 position, out float layer) {
+    float viewDepth = 1.0 / gl_FragCoord.w;
+    int cascade = 0;
+    while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    layer = float(cascade);
+    return cascadeMatrices[cascade] * vec4(position, 1.0);
+}
+
+// Exponents of the EVSM warp, as in shadow_moments.frag
+const vec2 EVSMExponents = vec2(40.0, 5.0);
+
+// Upper bound on the lit fraction from the mean and mean square of the
+// occluder depth (Chebyshev); its tail is cut off to reduce light bleeding
+float chebyshevUpperBound(vec2 moments, float depth, float minVariance) {
+    if (depth <= moments.x) {
+        return 1.0;
+    }
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    return clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+}
+
+// Shadow factor from one filtered fetch of the VSM or EVSM moments
+float momentShadow(vec3 projCoords, float layer) {
+    vec4 moments = texture(shadowMap, vec3(projCoords.xy, layer));
+    if (shadowTechnique == 1) {
+        return 1.0 - chebyshevUpperBound(moments.xy, projCoords.z, 0.00002);
+    }
+    float warped = 2.0 * projCoords.z - 1.0;
+    float positive = exp(EVSMExponents.x * warped);
+    float negative = -exp(-EVSMExponents.y * warped);
+    // The minimum variance is scaled by the slope of each warp
+    float positiveVariance = 0.00002 * EVSMExponents.x * EVSMExponents.x * positive * positive;
+    float negativeVariance = 0.00002 * EVSMExponents.y * EVSMExponents.y * negative * negative;
+    return 1.0 - min(chebyshevUpperBound(moments.xy, positive, positiveVariance),
+                     chebyshevUpperBound(moments.zw, negative, negativeVariance));
+}
 
 // Function to compute shadow using PCF
-float PCFShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
+float PCFShadowCalculation(vec3 position, vec3 normal, vec3 lightDir) {
+    if (useShadowMask != 0) {
+        return texelFetch(shadowMask, ivec2(gl_FragCoord.xy), 0).r;
+    }
+    float layer;
+    vec4 fragPosLightSpace = cascadePosition(position, layer);
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     projCoords = projCoords * 0.5 + 0.5; // Transform to [0,1] range
 
@@ -25,6 +93,9 @@ float PCFShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
     projCoords.y < 0.0 || projCoords.y > 1.0) {
         return 0.0; // Outside shadow map
     }
+    if (shadowTechnique != 0) {
+        return momentShadow(projCoords, layer);
+    }
 
     float shadow = 0.0;
     float closestDepth;
@@ -32,14 +103,14 @@ float PCFShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
     float bias = max(0.005 * (1.0 - dot(normal, lightDir)), 0.001);
 
     // PCF kernel (5x5)
-    vec2 texelSize = 1.0 / textureSize(shadowMap, 0); // Size of one texel
+    vec2 texelSize = 1.0 / textureSize(shadowMap, 0).xy; // Size of one texel
     int kernelSize = 2; // Half the size of the 5x5 kernel: range [-2, 2]
     int totalSamples = 0;
 
     for (int x = -kernelSize; x <= kernelSize; ++x) {
         for (int y = -kernelSize; y <= kernelSize; ++y) {
             vec2 offset = vec2(float(x), float(y)) * texelSize;
-            closestDepth = texture(shadowMap, projCoords.xy + offset).r;
+            closestDepth = texture(shadowMap, vec3(projCoords.xy + offset, layer)).r;
             shadow += currentDepth - bias > closestDepth ? 1.0 : 0.0;
             totalSamples++;
         }
@@ -53,7 +124,7 @@ float PCFShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
 void main() {
     vec3 normal = normalize(fragNormal);
     vec3 lightDir = normalize(-lightDirection);
-    float shadow = PCFShadowCalculation(fragPosLightSpace, normal, lightDir);
+    float shadow = PCFShadowCalculation(fragPosition, normal, lightDir);
 
     // Lighting calculations...
     float diff = max(dot(normal, lightDir), 0.0);
@@ -66,7 +137,7 @@ void main() {
     vec3 diffuse = diff * lightColor * lightIntensity;
     vec3 specular = spec * lightColor * lightIntensity;
 
-    vec3 finalLighting = ambient + (1.0 - shadow) * (diffuse + specular);
+    vec3 finalLighting = ambient + (1.0 - shadow) * (diffuse + specular) + localLighting(fragPosition, normal);
 
     vec3 materialColor = texture(textureSampler, UV).rgb;
     finalColor = vec4(finalLighting * materialColor, 1.0);
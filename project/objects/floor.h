@@ -2,11 +2,14 @@
 #define FLOOR_H
 
 #include <glm/glm.hpp>
-#include "utils/lightInfo.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <glad/gl.h>
 #include <iostream>
 #include <render/shader.h>
+#include <render/shader_program.h>
+#include <render/render_queue.h>
+#include <render/geometry_pool.h>
+#include <render/frustum_culling.h>
 #include <stb/stb_image.h>
 
 class Floor {
@@ -15,10 +18,16 @@ public:
     glm::vec3 scale;    // Size of the floor
 
     void initialize(glm::vec3 position, glm::vec3 scale, const char* texturePath);
-    void render(glm::mat4 cameraMatrix,glm::mat4 lightSpaceMatrix, GLuint depthMap, Light light, glm::vec3 cameraPosition);
-    void renderDepth(GLuint shaderProgramID, glm::mat4 lightSpaceMatrix);
+    // Camera, light and light-space matrix come from the frame uniform blocks
+    void render(GLuint depthMap);
+    void renderDepth(GLuint shaderProgramID);
+    void submit(RenderQueue &queue, GLuint depthMap);
+    void submitDepth(RenderQueue &queue, GLuint shaderProgramID);
     void cleanup();
 
+    // World box of the floor plane
+    BoundingBox getBounds() const;
+
 private:
     GLfloat vertex_buffer_data[12] = {
         -1.0f, 0.0f, -1.0f,
@@ -39,10 +48,10 @@ private:
         0.0f, 1.0f
     };
 
-    GLuint vertexArrayID, vertexBufferID, indexBufferID, uvBufferID, textureID, programID;
-    GLuint mvpMatrixID, textureSamplerID, lightPositionID, lightColorID, lightIntensityID, lightDirectionID, cameraPositionID;
-    GLuint lightSpaceMatrixID;
-    GLuint shadowMapID;
+    StaticMesh mesh;
+    GLuint textureID, programID;
+    ShaderProgram *program;
+    GLint modelMatrixID;
 
 
     GLuint LoadTextureTileBox(const char* texture_file_path);
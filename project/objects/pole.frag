@@ -2,17 +2,87 @@
 
 in vec3 fragNormal;       // Normal in world space
 in vec3 fragPosition;     // Position in world space
-in vec4 fragPosLightSpace; // Position in light's clip space
 
 out vec4 FragColor;
 
-uniform vec3 lightDirection;   // Direction of the light (normalized)
-uniform vec3 lightColor;       // Light color
-uniform vec3 cameraPosition;   // Camera position for specular calculations
-uniform float lightIntensity;  // Light intensity
-uniform sampler2D shadowMap;   // Shadow map
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
+layout(std140) uniform LightBlock {
+    vec3 lightDirection;
+    float lightIntensity;
+    vec3 lightPosition;
+    vec3 lightColor;
+};
+
+uniform sampler2DArray shadowMap;   // Shadow map, one layer per cascade
+
+// Shadow cascades; cascadeSplits holds the far view depth of each
+layout(std140) uniform CascadeBlock {
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
+    int cascadeCount;
+    int shadowTechnique; // 0: PCF, 1: VSM, 2: EVSM
+    int useShadowMask;
+};
+
+// Shadow term of the visible surface at each pixel, see shadow_mask.frag
+uniform sampler2D shadowMask;
+
+#include "../local_lighting.glsl"
+
+// Position in the clip space of the cascade covering the fragment; the
+// cascade is chosen by view depth and returned in layer
+vec4 cascadePosition(vec3 position, out float layer) {
+    float viewDepth = 1.0 / gl_FragCoord.w;
+    int cascade = 0;
+    while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    layer = float(cascade);
+    return cascadeMatrices[cascade] * vec4(position, 1.0);
+}
+
+// Exponents of the EVSM warp, as in shadow_moments.frag
+const vec2 EVSMExponents = vec2(40.0, 5.0);
+
+// Upper bound on the lit fraction from the mean and mean square of the
+// occluder depth (Chebyshev); its tail is cut off to reduce light bleeding
+float chebyshevUpperBound(vec2 moments, float depth, float minVariance) {
+    if (depth <= moments.x) {
+        return 1.0;
+    }
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    return clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+}
+
+// Shadow factor from one filtered fetch of the VSM or EVSM moments
+float momentShadow(vec3 projCoords, float layer) {
+    vec4 moments = texture(shadowMap, vec3(projCoords.xy, layer));
+    if (shadowTechnique == 1) {
+        return 1.0 - chebyshevUpperBound(moments.xy, projCoords.z, 0.00002);
+    }
+    float warped = 2.0 * projCoords.z - 1.0;
+    float positive = exp(EVSMExponents.x * warped);
+    float negative = -exp(-EVSMExponents.y * warped);
+    // The minimum variance is scaled by the slope of each warp
+    float positiveVariance = 0.00002 * EVSMExponents.x * EVSMExponents.x * positive * positive;
+    float negativeVariance = 0.00002 * EVSMExponents.y * EVSMExponents.y * negative * negative;
+    return 1.0 - min(chebyshevUpperBound(moments.xy, positive, positiveVariance),
+                     chebyshevUpperBound(moments.zw, negative, negativeVariance));
+}
+
+float ShadowCalculation(vec3 position, vec3 normal, vec3 lightDir) {
+    if (useShadowMask != 0) {
+        return mix(1.0, 0.2, texelFetch(shadowMask, ivec2(gl_FragCoord.xy), 0).r);
+    }
+    float layer;
+    vec4 fragPosLightSpace = cascadePosition(position, layer);
 
-float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
     // Transform light space position to NDC
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     projCoords = projCoords * 0.5 + 0.5; // Map from [-1, 1] to [0, 1]
@@ -21,8 +91,11 @@ float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
     if (projCoords.x < 0.0 || projCoords.x > 1.0 || projCoords.y < 0.0 || projCoords.y > 1.0 || projCoords.z > 1.0) {
         return 1.0; // Fully lit if outside shadow map
     }
+    if (shadowTechnique != 0) {
+        return mix(1.0, 0.2, momentShadow(projCoords, layer));
+    }
 
-    float closestDepth = texture(shadowMap, projCoords.xy).r; // Depth from shadow map
+    float closestDepth = texture(shadowMap, vec3(projCoords.xy, layer)).r; // Depth from shadow map
     float currentDepth = projCoords.z;
 
     // Bias to prevent shadow acne
@@ -39,7 +112,7 @@ void main() {
     vec3 lightDir = normalize(-lightDirection);
 
     // Calculate shadow
-    float shadow = ShadowCalculation(fragPosLightSpace, normal, lightDir);
+    float shadow = ShadowCalculation(fragPosition, normal, lightDir);
 
     // Diffuse lighting
     float diff = max(dot(normal, lightDir), 0.0);
@@ -56,7 +129,7 @@ void main() {
     vec3 specular = spec * lightColor * lightIntensity;
 
     // Combine shadow with lighting
-    vec3 finalColor = ambient + shadow * (diffuse + specular);
+    vec3 finalColor = ambient + shadow * (diffuse + specular) + localLighting(fragPosition, normal);
 
     // Set the pole color and apply lighting
     vec3 baseColor = vec3(0.69, 0.77, 0.87); // Gray color for the pole
@@ -5,20 +5,20 @@ layout(location = 2) in vec3 normal;    // Vertex normal
 
 out vec3 fragNormal;       // Normal in world space
 out vec3 fragPosition;     // Position in world space
-out vec4 fragPosLightSpace; // Position in light's clip space
 
-uniform mat4 MVP;
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
 uniform mat4 modelMatrix;
-uniform mat3 normalMatrix;
-uniform mat4 lightSpaceMatrix; // Light space transformation matrix
 
 void main() {
-    gl_Position = MVP * vec4(position, 1.0);
+    vec4 worldPosition = modelMatrix * vec4(position, 1.0);
+    gl_Position = vpMatrix * worldPosition;
 
     // Transform position and normal to world space
-    fragPosition = vec3(modelMatrix * vec4(position, 1.0));
+    mat3 normalMatrix = transpose(inverse(mat3(modelMatrix)));
+    fragPosition = vec3(worldPosition);
     fragNormal = normalize(normalMatrix * normal);
-
-    // Calculate light space position
-    fragPosLightSpace = lightSpaceMatrix * vec4(position, 1.0);
 }
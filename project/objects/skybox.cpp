@@ -1,6 +1,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <render/shader.h>
+#include <render/gl_state.h>
 #include "skybox.h"
 #include <iostream>
 #include <stb/stb_image.h>
@@ -10,7 +11,7 @@ GLuint LoadTextureSkyBox(const char *texture_file_path) {
 	uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, 3);
 	GLuint texture;
 	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
+	glState.bindTexture(GL_TEXTURE_2D, texture);
 
 	// Set texture wrapping to prevent seams
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); // No repeating, clamp to edge
@@ -176,42 +177,21 @@ const GLfloat SkyBox::uv_buffer_data[48] = {
 		this->position = position;
 		this->scale = scale;
 
-		// Create a vertex array object
-		glGenVertexArrays(1, &vertexArrayID);
-		glBindVertexArray(vertexArrayID);
-
-		// Create a vertex buffer object to store the vertex data
-		glGenBuffers(1, &vertexBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
-
-		// Create a vertex buffer object to store the color data
-        // TODO:
-		glGenBuffers(1, &colorBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(color_buffer_data), color_buffer_data, GL_STATIC_DRAW);
-		// TODO: Create a vertex buffer object to store the UV data
-		// --------------------------------------------------------
-        // --------------------------------------------------------
-		glGenBuffers(1, &uvBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data,
-	GL_STATIC_DRAW);
-
-		// Create an index buffer object to store the index data that defines triangle faces
-		glGenBuffers(1, &indexBufferID);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
+		// Position, UV and color in the shared static geometry pool
+		const VertexFormat &format = staticGeometry.format();
+		mesh.initialize(staticGeometry, format.interleave(24, {vertex_buffer_data, uv_buffer_data, NULL, color_buffer_data}),
+						index_buffer_data, 36);
 
 		// Create and compile our GLSL program from the shaders
-		programID = LoadShadersFromFile("../project/box2.vert", "../project/box2.frag");
+		programID = AcquireShaderProgram("../project/box2.vert", "../project/box2.frag");
 		if (programID == 0)
 		{
 			std::cerr << "Failed to load shaders." << std::endl;
 		}
 
 		// Get a handle for our "MVP" uniform
-		mvpMatrixID = glGetUniformLocation(programID, "MVP");
+		program = GetShaderProgram(programID);
+		mvpMatrixID = program->location("MVP");
 
         // TODO: Load a texture
         // --------------------
@@ -221,23 +201,13 @@ const GLfloat SkyBox::uv_buffer_data[48] = {
         // TODO: Get a handle to texture sampler
         // -------------------------------------
         // -------------------------------------
-		textureSamplerID = glGetUniformLocation(programID,"textureSampler");
+		textureSamplerID = program->location("textureSampler");
 	}
 
 	void SkyBox::render(glm::mat4 cameraMatrix) {
-		glUseProgram(programID);
+		program->use();
 
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-
-		glDisable(GL_CULL_FACE);
+		glState.disable(GL_CULL_FACE);
 
 		// TODO: Model transform
 		// ----------------------
@@ -250,40 +220,31 @@ const GLfloat SkyBox::uv_buffer_data[48] = {
 
 		// Set model-view-projection matrix
 		glm::mat4 mvp = cameraMatrix * modelMatrix;
-		glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
+		program->setMat4(mvpMatrixID, mvp);
 
 		// TODO: Enable UV buffer and texture sampler
 		// ------------------------------------------
 		// ------------------------------------------
 		// Bind skybox texture
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureID);  // Bind skybox texture
-		glUniform1i(textureSamplerID, 0);
-
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
+		glState.activeTexture(GL_TEXTURE0);
+		glState.bindTexture(GL_TEXTURE_2D, textureID);  // Bind skybox texture
+		program->setInt(textureSamplerID, 0);
 
 		// Draw the box
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			36,    			   // number of indices
-			GL_UNSIGNED_INT,   // type
-			(void*)0           // element array buffer offset
-		);
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		mesh.draw();
+	}
+
+	void SkyBox::submit(RenderQueue &queue, const glm::mat4 &cameraMatrix) {
+		queuedCameraMatrix = cameraMatrix;
+		queue.submit(PASS_SKY, programID, textureID, mesh.vertexArray(), position,
+					 [](void *object, GLuint) {
+						 SkyBox *skybox = static_cast<SkyBox *>(object);
+						 skybox->render(skybox->queuedCameraMatrix);
+					 }, this);
 	}
 
 	void SkyBox::cleanup() {
-		glDeleteBuffers(1, &vertexBufferID);
-		glDeleteBuffers(1, &colorBufferID);
-		glDeleteBuffers(1, &indexBufferID);
-		glDeleteVertexArrays(1, &vertexArrayID);
-		//glDeleteBuffers(1, &uvBufferID);
+		mesh.cleanup();
 		//glDeleteTextures(1, &textureID);
-		glDeleteProgram(programID);
+		ReleaseShaderProgram(programID);
 	}
@@ -5,6 +5,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <string>
+#include <render/shader_program.h>
+#include <render/render_queue.h>
+#include <render/geometry_pool.h>
 
 class SkyBox {
 public:
@@ -13,12 +16,17 @@ public:
 
     void initialize(glm::vec3 position, glm::vec3 scale);
     void render(glm::mat4 cameraMatrix);
+    void submit(RenderQueue &queue, const glm::mat4 &cameraMatrix);
     void cleanup();
     void printPosition();
 
 private:
-    GLuint vertexArrayID, vertexBufferID, indexBufferID, colorBufferID, uvBufferID, textureID;
-    GLuint mvpMatrixID, textureSamplerID, programID;
+    StaticMesh mesh;
+    GLuint textureID;
+    GLuint programID;
+    ShaderProgram *program;
+    GLint mvpMatrixID, textureSamplerID;
+    glm::mat4 queuedCameraMatrix; // Camera matrix of the packet submitted this frame
 
     static const GLfloat vertex_buffer_data[72];
     static const GLfloat color_buffer_data[72];
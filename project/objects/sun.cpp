@@ -1,4 +1,5 @@
 #include "Sun.h"
+#include <render/gl_state.h>
 
 void Sun::generateSphere(int stacks, int slices) {
     for (int i = 0; i <= stacks; ++i) {
@@ -44,38 +45,25 @@ void Sun::initialize(glm::vec3 position, float radius, glm::vec3 lightColor, con
     // Generate sphere geometry
     generateSphere(36, 36); // Adjust stacks and slices for quality
 
-    // Generate and bind VAO
-    glGenVertexArrays(1, &sunVAO);
-    glBindVertexArray(sunVAO);
-
-    // Generate and bind VBO for vertices
-    glGenBuffers(1, &sunVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, sunVBO);
-    glBufferData(GL_ARRAY_BUFFER, sunVertices.size() * sizeof(glm::vec3), &sunVertices[0], GL_STATIC_DRAW);
-
-    // Generate and bind UV buffer
-    glGenBuffers(1, &sunUVBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, sunUVBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sunUVs.size() * sizeof(glm::vec2), &sunUVs[0], GL_STATIC_DRAW);
-
-    // Generate and bind EBO for indices
-    glGenBuffers(1, &sunEBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sunEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sunIndices.size() * sizeof(GLuint), &sunIndices[0], GL_STATIC_DRAW);
+    // Position and UV in the shared static geometry pool
+    const VertexFormat &format = staticGeometry.format();
+    mesh.initialize(staticGeometry, format.interleave(sunVertices.size(), {&sunVertices[0].x, &sunUVs[0].x, NULL, NULL}),
+                    sunIndices.data(), static_cast<GLsizei>(sunIndices.size()));
 
     // Load shaders
-    sunProgramID = LoadShadersFromFile(vertexShaderPath.c_str(), fragmentShaderPath.c_str());
+    sunProgramID = AcquireShaderProgram(vertexShaderPath.c_str(), fragmentShaderPath.c_str());
     if (sunProgramID == 0) {
         std::cerr << "Failed to load sun shaders." << std::endl;
     }
 
     // Get shader uniform locations
-    sunMVPMatrixID = glGetUniformLocation(sunProgramID, "MVP");
-    sunLightColorID = glGetUniformLocation(sunProgramID, "lightColor");
+    sunProgram = GetShaderProgram(sunProgramID);
+    sunMVPMatrixID = sunProgram->location("MVP");
+    sunLightColorID = sunProgram->location("lightColor");
 }
 
 void Sun::render(glm::mat4 cameraMatrix) {
-    glUseProgram(sunProgramID);
+    sunProgram->use();
 
     // Create model matrix
     glm::mat4 sunModelMatrix = glm::mat4(1.0f);
@@ -83,31 +71,12 @@ void Sun::render(glm::mat4 cameraMatrix) {
 
     // Calculate MVP matrix
     glm::mat4 sunMVP = cameraMatrix * sunModelMatrix;
-    glUniformMatrix4fv(sunMVPMatrixID, 1, GL_FALSE, &sunMVP[0][0]);
+    sunProgram->setMat4(sunMVPMatrixID, sunMVP);
 
     // Set light color uniform
-    glUniform3fv(sunLightColorID, 1, &lightColor[0]);
-
-    // Bind VAO
-    glBindVertexArray(sunVAO);
-
-    // Enable vertex attribute 0 for positions
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, sunVBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    sunProgram->setVec3(sunLightColorID, lightColor);
 
-    // Enable vertex attribute 1 for UVs
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, sunUVBuffer);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-    // Bind EBO and draw the sphere
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sunEBO);
-    glDrawElements(GL_TRIANGLES, sunIndices.size(), GL_UNSIGNED_INT, 0);
-
-    // Disable vertex attributes
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    mesh.draw();
 }
 
 void Sun::updatePosition(const glm::vec3& newPosition) {
@@ -115,10 +84,16 @@ void Sun::updatePosition(const glm::vec3& newPosition) {
 }
 
 
+void Sun::submit(RenderQueue &queue, const glm::mat4 &cameraMatrix) {
+    queuedCameraMatrix = cameraMatrix;
+    queue.submit(PASS_OPAQUE, sunProgramID, 0, mesh.vertexArray(), position,
+                 [](void *object, GLuint) {
+                     Sun *sun = static_cast<Sun *>(object);
+                     sun->render(sun->queuedCameraMatrix);
+                 }, this);
+}
+
 void Sun::cleanup() {
-    glDeleteBuffers(1, &sunVBO);
-    glDeleteBuffers(1, &sunUVBuffer);
-    glDeleteBuffers(1, &sunEBO);
-    glDeleteVertexArrays(1, &sunVAO);
-    glDeleteProgram(sunProgramID);
+    mesh.cleanup();
+    ReleaseShaderProgram(sunProgramID);
 }
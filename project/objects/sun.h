@@ -6,12 +6,16 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
 #include <render/shader.h>
+#include <render/shader_program.h>
+#include <render/render_queue.h>
+#include <render/geometry_pool.h>
 #include <iostream>
 
 class Sun {
 public:
     void initialize(glm::vec3 position, float radius, glm::vec3 lightColor, const std::string& vertexShaderPath, const std::string& fragmentShaderPath);
     void render(glm::mat4 cameraMatrix);
+    void submit(RenderQueue &queue, const glm::mat4 &cameraMatrix);
     void cleanup();
     void updatePosition(const glm::vec3& newPosition);
 
@@ -19,9 +23,12 @@ private:
     glm::vec3 position;
     float radius;
     glm::vec3 lightColor;
+    glm::mat4 queuedCameraMatrix; // Camera matrix of the packet submitted this frame
 
-    GLuint sunVAO, sunVBO, sunUVBuffer, sunEBO, sunProgramID;
-    GLuint sunMVPMatrixID, sunLightColorID;
+    StaticMesh mesh;
+    GLuint sunProgramID;
+    ShaderProgram *sunProgram;
+    GLint sunMVPMatrixID, sunLightColorID;
 
     std::vector<glm::vec3> sunVertices;
     std::vector<glm::vec2> sunUVs;
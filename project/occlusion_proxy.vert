@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec3 aPos; // Unit cube corner in [-1, 1]
+
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
+uniform vec3 boxCenter;
+uniform vec3 boxExtent;
+
+void main() {
+    gl_Position = vpMatrix * vec4(boxCenter + aPos * boxExtent, 1.0);
+}
@@ -1,30 +1,148 @@
 #include "Particle.h"
+#include <render/render_stats.h>
+#include <render/gl_state.h>
+#include <render/shader.h>
+#include <chrono>
+#include <cmath>
 #include <cstdlib> // For random number generation
 #include <iostream>
 
+const char *ParticleSimulationName(ParticleSimulation simulation) {
+    switch (simulation) {
+    case PARTICLES_FEEDBACK:
+        return "transform feedback";
+    case PARTICLES_ANALYTIC:
+        return "analytic";
+    default:
+        return "CPU";
+    }
+}
+
 // Constructor
 ParticleSystem::ParticleSystem(int maxParticles, GLuint shaderProgramID)
-    : shaderProgramID(shaderProgramID) {
-    particles.resize(maxParticles);
+    : count(maxParticles), shaderProgramID(shaderProgramID), center(0.0f) {
+    updateProgramID = AcquireShaderProgram("../project/particles/particle_update.vert", "../project/depth.frag",
+                                           std::vector<std::string>(), {"outState"});
+    if (updateProgramID == 0) {
+        std::cerr << "Failed to load particle update shaders." << std::endl;
+    } else {
+        updateProgram = GetShaderProgram(updateProgramID);
+        pathStartID = updateProgram->location("pathStart");
+        pathDeltaID = updateProgram->location("pathDelta");
+        lifeStepID = updateProgram->location("lifeStep");
+        phaseID = updateProgram->location("phase");
+    }
+    analyticProgramID = AcquireShaderProgram("../project/particles/particle.vert", "../project/particles/particle.frag",
+                                             {"ANALYTIC_MOTION"});
+    if (analyticProgramID == 0) {
+        std::cerr << "Failed to load analytic particle shaders." << std::endl;
+    } else {
+        analyticProgram = GetShaderProgram(analyticProgramID);
+        analyticPathStartID = analyticProgram->location("pathStart");
+        analyticPathDeltaID = analyticProgram->location("pathDelta");
+        analyticProgressID = analyticProgram->location("progress");
+        analyticPhaseID = analyticProgram->location("phase");
+    }
+    createBuffers();
+}
+
+void ParticleSystem::createBuffers() {
+    life.assign(count, 0.0f);
+    offsetX.assign(count, 0.0f);
+    offsetY.assign(count, 0.0f);
+    offsetZ.assign(count, 0.0f);
+    positions.assign(3 * count, 0.0f);
 
-    // Generate VAO and VBO
+    // One buffer holds the streams back to back: x, y, z, size, then RGBA color
     glGenVertexArrays(1, &particleVAO);
     glGenBuffers(1, &particleVBO);
-    glBindVertexArray(particleVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Particle) * particles.size(), nullptr, GL_DYNAMIC_DRAW);
+    glState.bindVertexArray(particleVAO);
+    glState.bindBuffer(GL_ARRAY_BUFFER, particleVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 8 * count, nullptr, GL_DYNAMIC_DRAW);
+
+    for (GLuint axis = 0; axis < 3; ++axis) { // Position
+        glState.enableVertexAttribArray(axis);
+        glVertexAttribPointer(axis, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)(sizeof(float) * axis * count));
+    }
+
+    glState.enableVertexAttribArray(3); // Size
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)(sizeof(float) * 3 * count));
+
+    glState.enableVertexAttribArray(4); // Color
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(sizeof(float) * 4 * count));
+
+    // Back to front order for the sorted draw
+    glGenBuffers(1, &indexVBO);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * count, nullptr, GL_STREAM_DRAW);
+    framesSinceSort = 0;
+    sorted = false;
+
+    glGenBuffers(1, &seedVBO);
+    glState.bindBuffer(GL_ARRAY_BUFFER, seedVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * count, nullptr, GL_STATIC_DRAW);
+
+    // Analytic path: the seeds and the fixed attributes
+    glGenVertexArrays(1, &analyticVAO);
+    glState.bindVertexArray(analyticVAO);
+    glState.enableVertexAttribArray(0); // Offset and starting progress
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+    glState.bindBuffer(GL_ARRAY_BUFFER, particleVBO);
+    glState.enableVertexAttribArray(3); // Size
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)(sizeof(float) * 3 * count));
+    glState.enableVertexAttribArray(4); // Color
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(sizeof(float) * 4 * count));
 
-    // Enable vertex attributes
-    glEnableVertexAttribArray(0); // Position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, position));
+    // Transform feedback path: the state pair, read with the seed offsets
+    glGenBuffers(2, stateVBOs);
+    glGenVertexArrays(2, updateVAOs);
+    glGenVertexArrays(2, renderVAOs);
+    for (int i = 0; i < 2; ++i) {
+        glState.bindBuffer(GL_ARRAY_BUFFER, stateVBOs[i]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * count, nullptr, GL_DYNAMIC_COPY);
 
-    glEnableVertexAttribArray(1); // Color
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, color));
+        glState.bindVertexArray(updateVAOs[i]);
+        glState.enableVertexAttribArray(0); // Position and progress
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glState.bindBuffer(GL_ARRAY_BUFFER, seedVBO);
+        glState.enableVertexAttribArray(1); // Offset
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
 
-    glEnableVertexAttribArray(2); // Size
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, size));
+        glState.bindVertexArray(renderVAOs[i]);
+        glState.bindBuffer(GL_ARRAY_BUFFER, stateVBOs[i]);
+        for (GLuint axis = 0; axis < 3; ++axis) { // Position
+            glState.enableVertexAttribArray(axis);
+            glVertexAttribPointer(axis, 1, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)(sizeof(float) * axis));
+        }
+        glState.bindBuffer(GL_ARRAY_BUFFER, particleVBO);
+        glState.enableVertexAttribArray(3); // Size
+        glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)(sizeof(float) * 3 * count));
+        glState.enableVertexAttribArray(4); // Color
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(sizeof(float) * 4 * count));
+    }
+    currentState = 0;
 
-    glBindVertexArray(0);
+    glState.bindVertexArray(0);
+}
+
+void ParticleSystem::deleteBuffers() {
+    glDeleteBuffers(1, &particleVBO);
+    glDeleteVertexArrays(1, &particleVAO);
+    glDeleteBuffers(1, &indexVBO);
+    glDeleteBuffers(1, &seedVBO);
+    glDeleteVertexArrays(1, &analyticVAO);
+    glDeleteBuffers(2, stateVBOs);
+    glDeleteVertexArrays(2, updateVAOs);
+    glDeleteVertexArrays(2, renderVAOs);
+    glState.invalidate(); // The deleted names may still be tracked as bound
+    particleVBO = 0;
+    particleVAO = 0;
+    indexVBO = 0;
+    seedVBO = 0;
+    analyticVAO = 0;
+    stateVBOs[0] = stateVBOs[1] = 0;
+    updateVAOs[0] = updateVAOs[1] = 0;
+    renderVAOs[0] = renderVAOs[1] = 0;
 }
 
 // Destructor
@@ -34,68 +152,231 @@ ParticleSystem::~ParticleSystem() {
 
 // Initialize particles
 void ParticleSystem::initialize(glm::vec3 start, glm::vec3 end) {
-    for (size_t i = 0; i < particles.size(); ++i) {
-        float t = static_cast<float>(i) / particles.size(); // Evenly distribute particles
-        particles[i].position = glm::mix(start, end, t);    // Interpolate position
-        particles[i].velocity = glm::normalize(end - start) * 10.0f; // Constant velocity
-        particles[i].color = glm::vec4(0.2f, 0.8f, 1.0f, 1.0f);       // Cyan color
-        particles[i].size = 5.0f + static_cast<float>(rand()) / RAND_MAX * 5.0f;
-        particles[i].life = t; // Use 'life' to store progress along the path
+    center = (start + end) * 0.5f;
+    std::vector<float> sizes(count), colors(4 * count);
+    for (size_t i = 0; i < count; ++i) {
+        float t = static_cast<float>(i) / count; // Evenly distribute particles
+        life[i] = t; // Use 'life' to store progress along the path
+        glm::vec3 position = glm::mix(start, end, t); // Interpolate position
+        positions[i] = position.x;
+        positions[count + i] = position.y;
+        positions[2 * count + i] = position.z;
+        sizes[i] = 5.0f + static_cast<float>(rand()) / RAND_MAX * 5.0f;
+        glm::vec4 cyan(0.2f, 0.8f, 1.0f, 1.0f);
+        for (int c = 0; c < 4; ++c) {
+            colors[4 * i + c] = cyan[c];
+        }
 
         // Assign random offset
-        particles[i].randomOffset = glm::vec3(
-            (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 2.0f, // Small X offset
-            (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 2.0f, // Small Y offset
-            (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 2.0f  // Small Z offset
-        );
+        offsetX[i] = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 2.0f; // Small X offset
+        offsetY[i] = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 2.0f; // Small Y offset
+        offsetZ[i] = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 2.0f; // Small Z offset
+    }
+
+    glState.bindBuffer(GL_ARRAY_BUFFER, particleVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * positions.size(), positions.data());
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * 3 * count, sizeof(float) * count, sizes.data());
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * 4 * count, sizeof(float) * colors.size(), colors.data());
+    uploadSeeds();
+    analyticProgress = 0.0;
+    if (simulation == PARTICLES_FEEDBACK) {
+        uploadState();
     }
 }
 
-void ParticleSystem::update(float deltaTime, glm::vec3 start, glm::vec3 end) {
-    for (auto &particle : particles) {
-        // Increment progress along the path
-        particle.life += deltaTime * 0.1f; // Adjust speed factor as needed
-        if (particle.life >= 1.0f) {
-            particle.life -= 1.0f; // Wrap around to the start of the path
+void ParticleSystem::resize(int maxParticles, glm::vec3 start, glm::vec3 end) {
+    deleteBuffers();
+    count = maxParticles;
+    createBuffers();
+    initialize(start, end);
+}
+
+void ParticleSystem::uploadState() {
+    std::vector<glm::vec4> state(count);
+    for (size_t i = 0; i < count; ++i) {
+        state[i] = glm::vec4(positions[i], positions[count + i], positions[2 * count + i], life[i]);
+    }
+    glState.bindBuffer(GL_ARRAY_BUFFER, stateVBOs[currentState]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec4) * count, state.data());
+}
+
+void ParticleSystem::downloadState() {
+    std::vector<glm::vec4> state(count);
+    glState.bindBuffer(GL_ARRAY_BUFFER, stateVBOs[currentState]);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec4) * count, state.data());
+    for (size_t i = 0; i < count; ++i) {
+        positions[i] = state[i].x;
+        positions[count + i] = state[i].y;
+        positions[2 * count + i] = state[i].z;
+        life[i] = state[i].w;
+    }
+    glState.bindBuffer(GL_ARRAY_BUFFER, particleVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * positions.size(), positions.data());
+}
+
+void ParticleSystem::uploadSeeds() {
+    std::vector<glm::vec4> seeds(count);
+    for (size_t i = 0; i < count; ++i) {
+        seeds[i] = glm::vec4(offsetX[i], offsetY[i], offsetZ[i], life[i]);
+    }
+    glState.bindBuffer(GL_ARRAY_BUFFER, seedVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec4) * count, seeds.data());
+}
+
+void ParticleSystem::setSimulation(ParticleSimulation mode) {
+    if (mode == simulation || (mode == PARTICLES_FEEDBACK && updateProgram == NULL) ||
+        (mode == PARTICLES_ANALYTIC && analyticProgram == NULL)) {
+        return;
+    }
+
+    // Bring the progress back to the CPU streams, then hand it to the new mode
+    if (simulation == PARTICLES_FEEDBACK) {
+        downloadState();
+    } else if (simulation == PARTICLES_ANALYTIC) {
+        float progress = static_cast<float>(analyticProgress);
+        for (size_t i = 0; i < count; ++i) {
+            float current = life[i] + progress;
+            life[i] = current >= 1.0f ? current - 1.0f : current;
         }
+    }
+    if (mode == PARTICLES_FEEDBACK) {
+        uploadState();
+    } else if (mode == PARTICLES_ANALYTIC) {
+        uploadSeeds();
+        analyticProgress = 0.0;
+    }
+    simulation = mode;
+}
+
+GLuint ParticleSystem::currentVAO() const {
+    switch (simulation) {
+    case PARTICLES_FEEDBACK:
+        return renderVAOs[currentState];
+    case PARTICLES_ANALYTIC:
+        return analyticVAO;
+    default:
+        return particleVAO;
+    }
+}
 
-        // Base position along the main wave path
-        glm::vec3 basePosition = glm::mix(start, end, particle.life);
+void ParticleSystem::update(float deltaTime, glm::vec3 start, glm::vec3 end) {
+    auto updateStart = std::chrono::high_resolution_clock::now();
+    center = (start + end) * 0.5f;
 
-        // Apply per-particle random offset
-        glm::vec3 offset = particle.randomOffset;
+    // One time sample for the whole frame, reduced while still in double so
+    // the float phase keeps its precision however long the app runs
+    path.start = start;
+    path.delta = end - start;
+    path.lifeStep = deltaTime * 0.1f; // Adjust speed factor as needed
+    path.phase = static_cast<float>(std::fmod(glfwGetTime(), 6.283185307179586));
 
-        // Optionally, make the offset dynamic (e.g., oscillating or noise-based)
-        offset += glm::vec3(
-            sin(glfwGetTime() + particle.life * 10.0f) * 0.5f,  // Dynamic X
-            cos(glfwGetTime() + particle.life * 15.0f) * 0.5f,  // Dynamic Y
-            0.0f                                                // No Z oscillation
-        );
+    if (simulation == PARTICLES_ANALYTIC) {
+        // Nothing per particle; the vertex shader takes the progress as a uniform
+        analyticProgress = std::fmod(analyticProgress + path.lifeStep, 1.0);
+    } else if (simulation == PARTICLES_FEEDBACK) {
+        // Read the current state, capture the next one into the other buffer
+        updateProgram->use();
+        updateProgram->setVec3(pathStartID, path.start);
+        updateProgram->setVec3(pathDeltaID, path.delta);
+        updateProgram->setFloat(lifeStepID, path.lifeStep);
+        updateProgram->setFloat(phaseID, path.phase);
+        glState.enable(GL_RASTERIZER_DISCARD);
+        glState.bindVertexArray(updateVAOs[currentState]);
+        glState.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, stateVBOs[1 - currentState]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, count);
+        glEndTransformFeedback();
+        glState.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glState.disable(GL_RASTERIZER_DISCARD);
+        glState.bindVertexArray(0);
+        renderStats.drawCalls++;
+        currentState = 1 - currentState;
+    } else {
+        ParticleStreams streams;
+        streams.life = life.data();
+        streams.offsetX = offsetX.data();
+        streams.offsetY = offsetY.data();
+        streams.offsetZ = offsetZ.data();
+        streams.positionX = positions.data();
+        streams.positionY = positions.data() + count;
+        streams.positionZ = positions.data() + 2 * count;
+        streams.count = count;
+        UpdateParticles(streams, path);
 
-        // Update position with both base and offset
-        particle.position = basePosition + offset;
+        // Only the positions changed
+        glState.bindBuffer(GL_ARRAY_BUFFER, particleVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * positions.size(), positions.data());
     }
+    renderStats.particleTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - updateStart).count();
+}
 
-    // Update particle buffer
-    glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Particle) * particles.size(), particles.data());
+void ParticleSystem::setDepthSortInterval(int frames) {
+    if (frames != sortInterval) {
+        sortInterval = frames;
+        framesSinceSort = 0;
+    }
 }
 
+void ParticleSystem::sortByDepth(const glm::vec3 &viewPosition, WorkerPool *workers) {
+    sorted = sortInterval > 0 && simulation == PARTICLES_CPU;
+    if (!sorted) {
+        framesSinceSort = 0;
+        return;
+    }
+    int framesSincePrevious = framesSinceSort;
+    framesSinceSort = (framesSinceSort + 1) % sortInterval;
+    if (framesSincePrevious > 0) {
+        return; // The index buffer still holds the previous order
+    }
+    auto sortStart = std::chrono::high_resolution_clock::now();
+    const float *x = positions.data(), *y = x + count, *z = y + count;
+    depthSort.sort(x, y, z, count, viewPosition, workers);
 
+    glState.bindVertexArray(particleVAO);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(uint32_t) * count, depthSort.order().data());
+    glState.bindVertexArray(0);
+    renderStats.particleSortTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sortStart).count();
+}
 
 // Render particles
-void ParticleSystem::render(glm::mat4 vpMatrix) {
-    glUseProgram(shaderProgramID);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "vpMatrix"), 1, GL_FALSE, &vpMatrix[0][0]);
+void ParticleSystem::render() {
+    if (simulation == PARTICLES_ANALYTIC) {
+        // Both systems share the program, so the path is set per draw
+        analyticProgram->use();
+        analyticProgram->setVec3(analyticPathStartID, path.start);
+        analyticProgram->setVec3(analyticPathDeltaID, path.delta);
+        analyticProgram->setFloat(analyticProgressID, static_cast<float>(analyticProgress));
+        analyticProgram->setFloat(analyticPhaseID, path.phase);
+    } else {
+        glState.useProgram(shaderProgramID);
+    }
 
-    glBindVertexArray(particleVAO);
-    glDrawArrays(GL_POINTS, 0, particles.size());
-    glBindVertexArray(0);
+    glState.bindVertexArray(currentVAO());
+    if (sorted) {
+        glDrawElements(GL_POINTS, count, GL_UNSIGNED_INT, (void*)0);
+    } else {
+        glDrawArrays(GL_POINTS, 0, count);
+    }
+    renderStats.drawCalls++;
+    glState.bindVertexArray(0);
 }
 
+void ParticleSystem::submit(RenderQueue &queue) {
+    queue.submit(PASS_TRANSPARENT, simulation == PARTICLES_ANALYTIC ? analyticProgramID : shaderProgramID, 0, currentVAO(), center,
+                 [](void *object, GLuint) { static_cast<ParticleSystem *>(object)->render(); }, this);
+}
 
 // Cleanup resources
 void ParticleSystem::cleanup() {
-    glDeleteBuffers(1, &particleVBO);
-    glDeleteVertexArrays(1, &particleVAO);
+    deleteBuffers();
+    if (updateProgramID != 0) {
+        ReleaseShaderProgram(updateProgramID);
+        updateProgramID = 0;
+        updateProgram = NULL;
+    }
+    if (analyticProgramID != 0) {
+        ReleaseShaderProgram(analyticProgramID);
+        analyticProgramID = 0;
+        analyticProgram = NULL;
+    }
 }
@@ -5,23 +5,89 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <vector>
+#include <render/render_queue.h>
+#include <render/shader_program.h>
+#include <particles/particle_kernel.h>
+#include <particles/particle_sort.h>
 
-// Particle data structure
-struct Particle {
-    glm::vec3 position; // Position of the particle
-    glm::vec3 velocity; // Velocity of the particle
-    glm::vec4 color;    // Color (RGBA)
-    float size;         // Size of the particle
-    float life;         // Remaining life of the particle (0 = dead)
-    glm::vec3 randomOffset;   // Unique random offset for more dynamic movement
+// Where the particle motion is computed
+enum ParticleSimulation {
+    PARTICLES_CPU = 0,      // SIMD kernels of particle_kernel.h; positions uploaded every frame
+    PARTICLES_FEEDBACK = 1, // Update shader and transform feedback; the state stays on the GPU
+    PARTICLES_ANALYTIC = 2, // particle.vert evaluates the motion from seeds and the frame time
+    PARTICLE_SIMULATION_COUNT
 };
 
-// Particle system class
+const char *ParticleSimulationName(ParticleSimulation simulation);
+
+// Particle system class. The motion can be computed in three places:
+//
+// - CPU: the state lives in structure-of-arrays streams updated by the SIMD
+//   kernels, and the positions are uploaded every frame.
+// - Feedback: the state lives in a pair of buffers of (position, progress).
+//   Every frame particle_update.vert reads one and transform feedback writes
+//   the other, so nothing is uploaded after initialization.
+// - Analytic: a particle's position is a pure function of its seed (random
+//   offset and starting progress), the path and the progress made since the
+//   seeds were written. The seeds are uploaded once; each frame only sets the
+//   path, progress and phase uniforms, and there is no update pass at all.
+//
+// Size and color never change and are uploaded once for every mode.
+//
+// In the CPU mode the particles can also be drawn back to front through an
+// index buffer sorted by ParticleDepthSort. The other modes keep the
+// positions on the GPU and draw unsorted.
 class ParticleSystem {
 private:
-    std::vector<Particle> particles;
+    size_t count;
+    std::vector<float> life;                       // Progress along the path
+    std::vector<float> offsetX, offsetY, offsetZ;  // Unique random offset for more dynamic movement
+    std::vector<float> positions;                  // All x, then all y, then all z
     GLuint particleVAO, particleVBO; // OpenGL buffer IDs
     GLuint shaderProgramID;          // Shader program for particles
+    glm::vec3 center;                // Middle of the current path, used for sorting
+
+    ParticleSimulation simulation = PARTICLES_CPU;
+    ParticlePath path; // Inputs of the latest update
+
+    // Random offset and starting progress per particle, read by the update
+    // shader and the analytic vertex shader
+    GLuint seedVBO = 0;
+
+    // Transform feedback simulation
+    GLuint stateVBOs[2] = {0, 0};
+    GLuint updateVAOs[2] = {0, 0}; // Read state i for the update
+    GLuint renderVAOs[2] = {0, 0}; // Draw state i
+    int currentState = 0;          // State buffer holding the latest positions
+    GLuint updateProgramID = 0;
+    ShaderProgram *updateProgram = NULL;
+    GLint pathStartID, pathDeltaID, lifeStepID, phaseID;
+
+    // Analytic simulation
+    GLuint analyticVAO = 0;
+    GLuint analyticProgramID = 0;
+    ShaderProgram *analyticProgram = NULL;
+    GLint analyticPathStartID, analyticPathDeltaID, analyticProgressID, analyticPhaseID;
+    double analyticProgress = 0.0; // Progress made since the seeds were written, in [0, 1)
+
+    // Depth sorting
+    ParticleDepthSort depthSort;
+    GLuint indexVBO = 0;   // Element buffer of particleVAO
+    int sortInterval = 0;  // Frames per full sort; 0 disables sorting
+    int framesSinceSort = 0;
+    bool sorted = false;   // The index buffer holds a back to front order
+
+    void createBuffers();
+    void deleteBuffers();
+
+    // Copy the state between the CPU streams and the current state buffer
+    void uploadState();
+    void downloadState();
+
+    // Writes the offsets and the current progress as the seeds
+    void uploadSeeds();
+
+    GLuint currentVAO() const;
 
 public:
     // Constructor
@@ -33,11 +99,30 @@ public:
     // Initialize particles
     void initialize(glm::vec3 start, glm::vec3 end);
 
+    // Reallocates for a new particle count and restarts them on the path
+    void resize(int maxParticles, glm::vec3 start, glm::vec3 end);
+    int size() const { return static_cast<int>(count); }
+
+    // Moves the simulation; particles continue where they are
+    void setSimulation(ParticleSimulation mode);
+    ParticleSimulation getSimulation() const { return simulation; }
+
     // Update particles
     void update(float deltaTime, glm::vec3 start, glm::vec3 end);
 
+    // Radix sorts the particles every frames frames and draws the previous
+    // order on the frames between; 0 draws them unsorted
+    void setDepthSortInterval(int frames);
+
+    // Orders the particles back to front for this frame; call after update().
+    // workers may be NULL.
+    void sortByDepth(const glm::vec3 &viewPosition, WorkerPool *workers);
+
     // Render particles
-    void render(glm::mat4 vpMatrix);
+    void render(); // View-projection comes from the camera uniform block
+
+    // Queue the particles for the transparent pass
+    void submit(RenderQueue &queue);
 
     // Cleanup resources
     void cleanup();
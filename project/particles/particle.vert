@@ -1,14 +1,44 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec4 aColor;
-layout (location = 2) in float aSize;
+// Positions arrive as separate x, y and z streams, as the update writes them.
+// With ANALYTIC_MOTION they are computed here instead, from seeds written once
+// and the path and progress of the frame; the motion matches UpdateParticles.
+#ifdef ANALYTIC_MOTION
+layout (location = 0) in vec4 aSeed; // xyz random offset, w progress when the seeds were written
+#else
+layout (location = 0) in float aPositionX;
+layout (location = 1) in float aPositionY;
+layout (location = 2) in float aPositionZ;
+#endif
+layout (location = 3) in float aSize;
+layout (location = 4) in vec4 aColor;
 
 out vec4 particleColor;
 
-uniform mat4 vpMatrix;
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
+#ifdef ANALYTIC_MOTION
+uniform vec3 pathStart;
+uniform vec3 pathDelta;
+uniform float progress; // Progress made since the seeds were written, in [0, 1)
+uniform float phase;
+
+vec3 particlePosition() {
+    float life = aSeed.w + progress;
+    life = life >= 1.0 ? life - 1.0 : life;
+    vec3 wobble = vec3(sin(phase + life * 10.0), cos(phase + life * 15.0), 0.0) * 0.5;
+    return pathStart + pathDelta * life + aSeed.xyz + wobble;
+}
+#else
+vec3 particlePosition() {
+    return vec3(aPositionX, aPositionY, aPositionZ);
+}
+#endif
 
 void main() {
     particleColor = aColor;
-    gl_Position = vpMatrix * vec4(aPos, 1.0);
+    gl_Position = vpMatrix * vec4(particlePosition(), 1.0);
     gl_PointSize = aSize; // Control particle size
 }
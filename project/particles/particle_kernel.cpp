@@ -0,0 +1,203 @@
+#include "particle_kernel.h"
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLE_SSE 1
+#endif
+
+// The AVX2 kernel is compiled for its own target, so the rest of the build
+// keeps the baseline instruction set; MSVC would need /arch:AVX2 for the file
+#if defined(PARTICLE_SSE) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define PARTICLE_AVX2 1
+#endif
+
+// Sine after reducing by whole multiples of pi: x = q pi + r, |r| <= pi / 2, and
+// sin(x) = (-1)^q sin(r). Pi is split in two so the reduction stays exact
+// for the small arguments the particles use. The odd Taylor polynomial to r^9
+// is accurate to about 4e-6 over the reduced range.
+static const float InversePi = 0.318309886f;
+static const float PiHigh = 3.140625f;
+static const float PiLow = 9.67653589793e-4f;
+static const float Sine3 = -1.66666667e-1f;
+static const float Sine5 = 8.33333333e-3f;
+static const float Sine7 = -1.98412698e-4f;
+static const float Sine9 = 2.75573192e-6f;
+static const float HalfPi = 1.57079633f;
+
+// Path progress multipliers of the x and y wobble, and its amplitude
+static const float WobbleX = 10.0f;
+static const float WobbleY = 15.0f;
+static const float WobbleAmplitude = 0.5f;
+
+static inline float SineApproximation(float x)
+{
+    float scaled = x * InversePi;
+    float q = static_cast<float>(static_cast<int32_t>(scaled + (scaled >= 0.0f ? 0.5f : -0.5f)));
+    float r = (x - q * PiHigh) - q * PiLow;
+    float r2 = r * r;
+    float s = r + r * r2 * (Sine3 + r2 * (Sine5 + r2 * (Sine7 + r2 * Sine9)));
+    return (static_cast<int32_t>(q) & 1) ? -s : s;
+}
+
+static void UpdateScalar(const ParticleStreams &streams, const ParticlePath &path, size_t first)
+{
+    for (size_t i = first; i < streams.count; i++) {
+        float life = streams.life[i] + path.lifeStep;
+        life = life >= 1.0f ? life - 1.0f : life;
+        streams.life[i] = life;
+        float wobbleX = WobbleAmplitude * SineApproximation(path.phase + life * WobbleX);
+        float wobbleY = WobbleAmplitude * SineApproximation(path.phase + life * WobbleY + HalfPi); // cos
+        streams.positionX[i] = path.start.x + path.delta.x * life + streams.offsetX[i] + wobbleX;
+        streams.positionY[i] = path.start.y + path.delta.y * life + streams.offsetY[i] + wobbleY;
+        streams.positionZ[i] = path.start.z + path.delta.z * life + streams.offsetZ[i];
+    }
+}
+
+#if defined(PARTICLE_SSE)
+static inline __m128 SineApproximation(__m128 x)
+{
+    __m128i q = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(InversePi))); // Rounds to nearest
+    __m128 qf = _mm_cvtepi32_ps(q);
+    __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(qf, _mm_set1_ps(PiHigh))), _mm_mul_ps(qf, _mm_set1_ps(PiLow)));
+    __m128 r2 = _mm_mul_ps(r, r);
+    __m128 p = _mm_add_ps(_mm_set1_ps(Sine7), _mm_mul_ps(r2, _mm_set1_ps(Sine9)));
+    p = _mm_add_ps(_mm_set1_ps(Sine5), _mm_mul_ps(r2, p));
+    p = _mm_add_ps(_mm_set1_ps(Sine3), _mm_mul_ps(r2, p));
+    __m128 s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), p));
+    __m128 sign = _mm_castsi128_ps(_mm_slli_epi32(q, 31)); // Odd q flips the sign bit
+    return _mm_xor_ps(s, sign);
+}
+
+static size_t UpdateSSE(const ParticleStreams &streams, const ParticlePath &path)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 step = _mm_set1_ps(path.lifeStep);
+    const __m128 phase = _mm_set1_ps(path.phase);
+    const __m128 cosinePhase = _mm_set1_ps(path.phase + HalfPi);
+    const __m128 amplitude = _mm_set1_ps(WobbleAmplitude);
+    size_t i = 0;
+    for (; i + 4 <= streams.count; i += 4) {
+        __m128 life = _mm_add_ps(_mm_loadu_ps(streams.life + i), step);
+        life = _mm_sub_ps(life, _mm_and_ps(_mm_cmpge_ps(life, one), one));
+        _mm_storeu_ps(streams.life + i, life);
+
+        __m128 wobbleX = SineApproximation(_mm_add_ps(phase, _mm_mul_ps(life, _mm_set1_ps(WobbleX))));
+        __m128 wobbleY = SineApproximation(_mm_add_ps(cosinePhase, _mm_mul_ps(life, _mm_set1_ps(WobbleY))));
+        __m128 x = _mm_add_ps(_mm_set1_ps(path.start.x), _mm_mul_ps(_mm_set1_ps(path.delta.x), life));
+        __m128 y = _mm_add_ps(_mm_set1_ps(path.start.y), _mm_mul_ps(_mm_set1_ps(path.delta.y), life));
+        __m128 z = _mm_add_ps(_mm_set1_ps(path.start.z), _mm_mul_ps(_mm_set1_ps(path.delta.z), life));
+        x = _mm_add_ps(_mm_add_ps(x, _mm_loadu_ps(streams.offsetX + i)), _mm_mul_ps(amplitude, wobbleX));
+        y = _mm_add_ps(_mm_add_ps(y, _mm_loadu_ps(streams.offsetY + i)), _mm_mul_ps(amplitude, wobbleY));
+        z = _mm_add_ps(z, _mm_loadu_ps(streams.offsetZ + i));
+        _mm_storeu_ps(streams.positionX + i, x);
+        _mm_storeu_ps(streams.positionY + i, y);
+        _mm_storeu_ps(streams.positionZ + i, z);
+    }
+    return i;
+}
+#endif
+
+#if defined(PARTICLE_AVX2)
+__attribute__((target("avx2,fma")))
+static inline __m256 SineApproximation(__m256 x)
+{
+    __m256i q = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(InversePi)));
+    __m256 qf = _mm256_cvtepi32_ps(q);
+    __m256 r = _mm256_fnmadd_ps(qf, _mm256_set1_ps(PiLow), _mm256_fnmadd_ps(qf, _mm256_set1_ps(PiHigh), x));
+    __m256 r2 = _mm256_mul_ps(r, r);
+    __m256 p = _mm256_fmadd_ps(r2, _mm256_set1_ps(Sine9), _mm256_set1_ps(Sine7));
+    p = _mm256_fmadd_ps(r2, p, _mm256_set1_ps(Sine5));
+    p = _mm256_fmadd_ps(r2, p, _mm256_set1_ps(Sine3));
+    __m256 s = _mm256_fmadd_ps(_mm256_mul_ps(r, r2), p, r);
+    return _mm256_xor_ps(s, _mm256_castsi256_ps(_mm256_slli_epi32(q, 31)));
+}
+
+__attribute__((target("avx2,fma")))
+static size_t UpdateAVX2(const ParticleStreams &streams, const ParticlePath &path)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 step = _mm256_set1_ps(path.lifeStep);
+    const __m256 phase = _mm256_set1_ps(path.phase);
+    const __m256 cosinePhase = _mm256_set1_ps(path.phase + HalfPi);
+    const __m256 amplitude = _mm256_set1_ps(WobbleAmplitude);
+    size_t i = 0;
+    for (; i + 8 <= streams.count; i += 8) {
+        __m256 life = _mm256_add_ps(_mm256_loadu_ps(streams.life + i), step);
+        life = _mm256_sub_ps(life, _mm256_and_ps(_mm256_cmp_ps(life, one, _CMP_GE_OQ), one));
+        _mm256_storeu_ps(streams.life + i, life);
+
+        __m256 wobbleX = SineApproximation(_mm256_fmadd_ps(life, _mm256_set1_ps(WobbleX), phase));
+        __m256 wobbleY = SineApproximation(_mm256_fmadd_ps(life, _mm256_set1_ps(WobbleY), cosinePhase));
+        __m256 x = _mm256_fmadd_ps(_mm256_set1_ps(path.delta.x), life, _mm256_set1_ps(path.start.x));
+        __m256 y = _mm256_fmadd_ps(_mm256_set1_ps(path.delta.y), life, _mm256_set1_ps(path.start.y));
+        __m256 z = _mm256_fmadd_ps(_mm256_set1_ps(path.delta.z), life, _mm256_set1_ps(path.start.z));
+        x = _mm256_fmadd_ps(amplitude, wobbleX, _mm256_add_ps(x, _mm256_loadu_ps(streams.offsetX + i)));
+        y = _mm256_fmadd_ps(amplitude, wobbleY, _mm256_add_ps(y, _mm256_loadu_ps(streams.offsetY + i)));
+        z = _mm256_add_ps(z, _mm256_loadu_ps(streams.offsetZ + i));
+        _mm256_storeu_ps(streams.positionX + i, x);
+        _mm256_storeu_ps(streams.positionY + i, y);
+        _mm256_storeu_ps(streams.positionZ + i, z);
+    }
+    return i;
+}
+#endif
+
+const char *ParticleKernelName(ParticleKernel kernel)
+{
+    switch (kernel) {
+    case PARTICLE_KERNEL_SSE: return "SSE";
+    case PARTICLE_KERNEL_AVX2: return "AVX2";
+    default: return "scalar";
+    }
+}
+
+bool ParticleKernelSupported(ParticleKernel kernel)
+{
+    switch (kernel) {
+    case PARTICLE_KERNEL_SCALAR:
+        return true;
+#if defined(PARTICLE_SSE)
+    case PARTICLE_KERNEL_SSE:
+        return true;
+#endif
+#if defined(PARTICLE_AVX2)
+    case PARTICLE_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    default:
+        return false;
+    }
+}
+
+ParticleKernel BestParticleKernel()
+{
+    static const ParticleKernel best = [] {
+        int kernel = PARTICLE_KERNEL_COUNT - 1;
+        while (!ParticleKernelSupported(static_cast<ParticleKernel>(kernel))) {
+            kernel--;
+        }
+        return static_cast<ParticleKernel>(kernel);
+    }();
+    return best;
+}
+
+void UpdateParticles(const ParticleStreams &streams, const ParticlePath &path, ParticleKernel kernel)
+{
+    // The vector kernels stop at the last whole register; the scalar loop finishes
+    size_t done = 0;
+#if defined(PARTICLE_AVX2)
+    if (kernel == PARTICLE_KERNEL_AVX2) {
+        done = UpdateAVX2(streams, path);
+    }
+#endif
+#if defined(PARTICLE_SSE)
+    if (kernel == PARTICLE_KERNEL_SSE) {
+        done = UpdateSSE(streams, path);
+    }
+#endif
+    UpdateScalar(streams, path, done);
+}
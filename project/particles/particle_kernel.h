@@ -0,0 +1,46 @@
+#ifndef PARTICLE_KERNEL_H
+#define PARTICLE_KERNEL_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+
+// Particle state as structure-of-arrays streams, one float per particle in
+// each, so the update loads and stores whole SIMD registers of one field
+struct ParticleStreams {
+    float *life;               // Progress along the path in [0, 1)
+    const float *offsetX, *offsetY, *offsetZ; // Fixed random offset from the path
+    float *positionX, *positionY, *positionZ; // Written by the update
+    size_t count;
+};
+
+// Path the particles travel and the per-frame inputs of the update
+struct ParticlePath {
+    glm::vec3 start;
+    glm::vec3 delta;  // End minus start
+    float lifeStep;   // Progress added this frame
+    float phase;      // Frame time, reduced to [0, 2 pi)
+};
+
+// Implementations of the update, picked at run time
+enum ParticleKernel {
+    PARTICLE_KERNEL_SCALAR,
+    PARTICLE_KERNEL_SSE,  // 4 particles per step
+    PARTICLE_KERNEL_AVX2, // 8 particles per step, with FMA
+    PARTICLE_KERNEL_COUNT
+};
+
+const char *ParticleKernelName(ParticleKernel kernel);
+
+// Whether the kernel was compiled in and the CPU can run it
+bool ParticleKernelSupported(ParticleKernel kernel);
+
+// Widest supported kernel; detected once
+ParticleKernel BestParticleKernel();
+
+// Advances every particle along the path and writes its position: the base
+// point at its progress, plus its offset, plus a wobble of sin and cos of the
+// phase and progress. All kernels use the same polynomial sine, accurate to
+// about 4e-6, so they agree to rounding.
+void UpdateParticles(const ParticleStreams &streams, const ParticlePath &path, ParticleKernel kernel = BestParticleKernel());
+
+#endif // PARTICLE_KERNEL_H
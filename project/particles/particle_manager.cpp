@@ -0,0 +1,255 @@
+#include "particle_manager.h"
+#include <render/gl_state.h>
+#include <render/render_stats.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+
+void ParticleManager::initialize(const int capacities[PARTICLE_BLEND_COUNT], GLuint programID) {
+    shaderProgramID = programID;
+    emitters.reserve(MaxEmitters);
+
+    int total = 0;
+    for (int blend = 0; blend < PARTICLE_BLEND_COUNT; ++blend) {
+        segments[blend].first = total;
+        segments[blend].capacity = capacities[blend];
+        segments[blend].alive = 0;
+        total += capacities[blend];
+    }
+    positionX.assign(total, 0.0f);
+    positionY.assign(total, 0.0f);
+    positionZ.assign(total, 0.0f);
+    velocityX.assign(total, 0.0f);
+    velocityY.assign(total, 0.0f);
+    velocityZ.assign(total, 0.0f);
+    age.assign(total, 0.0f);
+    lifetime.assign(total, 0.0f);
+    emitterOf.assign(total, 0);
+    vertices.resize(total);
+
+    glGenVertexArrays(1, &vertexArrayID);
+    glGenBuffers(1, &vertexBufferID);
+    glState.bindVertexArray(vertexArrayID);
+    glState.bindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(ParticleVertex) * total, nullptr, GL_STREAM_DRAW);
+
+    for (GLuint axis = 0; axis < 3; ++axis) { // Position
+        glState.enableVertexAttribArray(axis);
+        glVertexAttribPointer(axis, 1, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (void*)(sizeof(float) * axis));
+    }
+    glState.enableVertexAttribArray(3); // Size
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (void*)offsetof(ParticleVertex, size));
+    glState.enableVertexAttribArray(4); // Color
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (void*)offsetof(ParticleVertex, color));
+
+    // Back to front order for the alpha draw
+    glGenBuffers(1, &indexBufferID);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * capacities[PARTICLE_BLEND_ALPHA], nullptr, GL_STREAM_DRAW);
+    sorted = false;
+    glState.bindVertexArray(0);
+}
+
+int ParticleManager::addEmitter(const EmitterDesc &desc) {
+    if (emitters.size() >= MaxEmitters) {
+        return -1;
+    }
+    Emitter emitter;
+    emitter.desc = desc;
+    emitters.push_back(emitter);
+    return static_cast<int>(emitters.size()) - 1;
+}
+
+int ParticleManager::aliveCount() const {
+    int alive = 0;
+    for (const Segment &segment : segments) {
+        alive += segment.alive;
+    }
+    return alive;
+}
+
+float ParticleManager::randomUnit() {
+    return static_cast<float>(random() - random.min()) / (static_cast<float>(random.max() - random.min()) + 1.0f);
+}
+
+void ParticleManager::spawn(int emitterIndex, int count) {
+    const EmitterDesc &desc = emitters[emitterIndex].desc;
+    Segment &segment = segments[desc.blend];
+
+    // Basis around the emission direction for picking velocities in the cone
+    glm::vec3 axis = glm::normalize(desc.direction);
+    glm::vec3 helper = std::abs(axis.y) < 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 tangent = glm::normalize(glm::cross(helper, axis));
+    glm::vec3 bitangent = glm::cross(axis, tangent);
+    float cosSpread = std::cos(desc.spread);
+
+    for (int n = 0; n < count; ++n) {
+        if (segment.alive == segment.capacity) {
+            dropped += count - n;
+            return;
+        }
+        int i = segment.first + segment.alive++;
+
+        glm::vec3 offset(0.0f);
+        if (desc.shape == EMITTER_BOX) {
+            offset = (glm::vec3(randomUnit(), randomUnit(), randomUnit()) * 2.0f - 1.0f) * desc.extent;
+        } else if (desc.shape == EMITTER_SPHERE) {
+            do { // Rejection sampling keeps the density uniform
+                offset = glm::vec3(randomUnit(), randomUnit(), randomUnit()) * 2.0f - 1.0f;
+            } while (glm::dot(offset, offset) > 1.0f);
+            offset *= desc.extent.x;
+        }
+        positionX[i] = desc.position.x + offset.x;
+        positionY[i] = desc.position.y + offset.y;
+        positionZ[i] = desc.position.z + offset.z;
+
+        // Uniform over the spherical cap of half angle spread
+        float cosTheta = 1.0f - randomUnit() * (1.0f - cosSpread);
+        float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+        float phi = 6.2831853f * randomUnit();
+        glm::vec3 velocity = (axis * cosTheta + (tangent * std::cos(phi) + bitangent * std::sin(phi)) * sinTheta) * desc.speed;
+        velocityX[i] = velocity.x;
+        velocityY[i] = velocity.y;
+        velocityZ[i] = velocity.z;
+
+        age[i] = 0.0f;
+        lifetime[i] = desc.lifetime + desc.lifetimeVariance * randomUnit();
+        emitterOf[i] = static_cast<uint16_t>(emitterIndex);
+    }
+}
+
+void ParticleManager::copyParticle(int from, int to) {
+    positionX[to] = positionX[from];
+    positionY[to] = positionY[from];
+    positionZ[to] = positionZ[from];
+    velocityX[to] = velocityX[from];
+    velocityY[to] = velocityY[from];
+    velocityZ[to] = velocityZ[from];
+    age[to] = age[from];
+    lifetime[to] = lifetime[from];
+    emitterOf[to] = emitterOf[from];
+}
+
+void ParticleManager::kill(Segment &segment, int index) {
+    int last = segment.first + --segment.alive;
+    if (index != last) {
+        copyParticle(last, index);
+    }
+}
+
+void ParticleManager::update(float deltaTime) {
+    auto updateStart = std::chrono::high_resolution_clock::now();
+    sorted = false;
+
+    for (size_t e = 0; e < emitters.size(); ++e) {
+        Emitter &emitter = emitters[e];
+        int count = emitter.pendingBurst;
+        emitter.pendingBurst = 0;
+        if (emitter.active) {
+            // A long stall can owe no more than the segment holds
+            float capacity = static_cast<float>(segments[emitter.desc.blend].capacity);
+            emitter.spawnDebt = std::min(emitter.spawnDebt + emitter.desc.rate * deltaTime, capacity);
+            int due = static_cast<int>(emitter.spawnDebt);
+            emitter.spawnDebt -= due;
+            count += due;
+        }
+        if (count > 0) {
+            spawn(static_cast<int>(e), count);
+        }
+    }
+
+    glState.bindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+    for (Segment &segment : segments) {
+        // A killed particle is replaced by the last one, which still has to be
+        // updated, so the index only advances past survivors
+        int i = segment.first;
+        while (i < segment.first + segment.alive) {
+            age[i] += deltaTime;
+            if (age[i] >= lifetime[i]) {
+                kill(segment, i);
+                continue;
+            }
+            const EmitterDesc &desc = emitters[emitterOf[i]].desc;
+            velocityX[i] += desc.acceleration.x * deltaTime;
+            velocityY[i] += desc.acceleration.y * deltaTime;
+            velocityZ[i] += desc.acceleration.z * deltaTime;
+            positionX[i] += velocityX[i] * deltaTime;
+            positionY[i] += velocityY[i] * deltaTime;
+            positionZ[i] += velocityZ[i] * deltaTime;
+
+            ParticleVertex &vertex = vertices[i];
+            vertex.position = glm::vec3(positionX[i], positionY[i], positionZ[i]);
+            vertex.size = desc.size;
+            vertex.color = glm::mix(desc.startColor, desc.endColor, age[i] / lifetime[i]);
+            segment.bounds = i == segment.first ? BoundingBox(vertex.position, vertex.position)
+                                                : BoundingBox(glm::min(segment.bounds.min, vertex.position), glm::max(segment.bounds.max, vertex.position));
+            ++i;
+        }
+
+        if (segment.alive > 0) {
+            glBufferSubData(GL_ARRAY_BUFFER, sizeof(ParticleVertex) * segment.first, sizeof(ParticleVertex) * segment.alive,
+                            vertices.data() + segment.first);
+        }
+    }
+    renderStats.particleTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - updateStart).count();
+}
+
+void ParticleManager::sortByDepth(const glm::vec3 &viewPosition, WorkerPool *workers) {
+    const Segment &segment = segments[PARTICLE_BLEND_ALPHA];
+    if (segment.alive == 0) {
+        return;
+    }
+    auto sortStart = std::chrono::high_resolution_clock::now();
+    depthSort.sort(positionX.data() + segment.first, positionY.data() + segment.first, positionZ.data() + segment.first, segment.alive,
+                   viewPosition, workers);
+    sorted = true;
+
+    glState.bindVertexArray(vertexArrayID);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(uint32_t) * segment.alive, depthSort.order().data());
+    glState.bindVertexArray(0);
+    renderStats.particleSortTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sortStart).count();
+}
+
+void ParticleManager::draw(void *object, GLuint blend) {
+    ParticleManager *manager = static_cast<ParticleManager *>(object);
+    const Segment &segment = manager->segments[blend];
+    glState.useProgram(manager->shaderProgramID);
+    glState.bindVertexArray(manager->vertexArrayID);
+
+    // The transparent pass is set up for alpha blending; additive particles
+    // also leave depth alone, since their order does not matter
+    if (blend == PARTICLE_BLEND_ADDITIVE) {
+        glState.blendFunc(GL_SRC_ALPHA, GL_ONE);
+        glState.depthMask(GL_FALSE);
+    }
+    if (blend == PARTICLE_BLEND_ALPHA && manager->sorted) {
+        glDrawElementsBaseVertex(GL_POINTS, segment.alive, GL_UNSIGNED_INT, (void*)0, segment.first);
+    } else {
+        glDrawArrays(GL_POINTS, segment.first, segment.alive);
+    }
+    renderStats.drawCalls++;
+    if (blend == PARTICLE_BLEND_ADDITIVE) {
+        glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glState.depthMask(GL_TRUE);
+    }
+    glState.bindVertexArray(0);
+}
+
+void ParticleManager::submit(RenderQueue &queue) {
+    for (int blend = 0; blend < PARTICLE_BLEND_COUNT; ++blend) {
+        if (segments[blend].alive > 0) {
+            queue.submit(PASS_TRANSPARENT, shaderProgramID, 0, vertexArrayID, segments[blend].bounds, draw, this, blend);
+        }
+    }
+}
+
+void ParticleManager::cleanup() {
+    glDeleteBuffers(1, &vertexBufferID);
+    glDeleteBuffers(1, &indexBufferID);
+    glDeleteVertexArrays(1, &vertexArrayID);
+    glState.invalidate();
+    vertexBufferID = 0;
+    indexBufferID = 0;
+    vertexArrayID = 0;
+}
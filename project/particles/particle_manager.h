@@ -0,0 +1,143 @@
+#ifndef PARTICLE_MANAGER_H
+#define PARTICLE_MANAGER_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <render/frustum_culling.h>
+#include <render/render_queue.h>
+#include <particles/particle_sort.h>
+
+// How a particle is composited; the manager draws every mode with one call
+enum ParticleBlend {
+    PARTICLE_BLEND_ALPHA = 0,    // Over what is behind, e.g. smoke
+    PARTICLE_BLEND_ADDITIVE = 1, // Adds light, e.g. sparks; order independent
+    PARTICLE_BLEND_COUNT
+};
+
+// Volume new particles start in, around the emitter position
+enum EmitterShape {
+    EMITTER_POINT = 0,
+    EMITTER_SPHERE = 1, // Radius extent.x
+    EMITTER_BOX = 2,    // Half size extent
+};
+
+struct EmitterDesc {
+    glm::vec3 position = glm::vec3(0.0f);
+    EmitterShape shape = EMITTER_POINT;
+    glm::vec3 extent = glm::vec3(0.0f);
+    glm::vec3 direction = glm::vec3(0.0f, 1.0f, 0.0f); // Of the initial velocity, normalized
+    float spread = 0.3f;        // Half angle in radians of the cone the velocity is picked in
+    float speed = 10.0f;        // Initial speed, world units per second
+    glm::vec3 acceleration = glm::vec3(0.0f); // E.g. gravity or buoyancy
+    float rate = 0.0f;          // Particles per second; zero for burst-only emitters
+    float lifetime = 2.0f;      // Seconds
+    float lifetimeVariance = 0.0f; // Up to this much is added at random
+    float size = 4.0f;          // Pixels
+    glm::vec4 startColor = glm::vec4(1.0f);
+    glm::vec4 endColor = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f); // Reached at the end of the lifetime
+    ParticleBlend blend = PARTICLE_BLEND_ALPHA;
+};
+
+// Emitters sharing one fixed pool of particles. All memory is allocated by
+// initialize(): the pool is split into one segment per blend mode, and the
+// live particles of a segment are kept packed at its start, so a particle is
+// spawned by appending and killed by moving the segment's last particle into
+// its slot. Both are O(1) and never allocate. Spawns that find their segment
+// full are dropped and counted.
+//
+// Every segment is uploaded as one range of a single vertex buffer and drawn
+// with one call; the vertex layout matches particle.vert. The alpha segment
+// can be drawn back to front through an index buffer sorted by
+// ParticleDepthSort. Kills move particles between slots, so its order only
+// holds for the frame it was sorted in.
+//
+// The path-following ParticleSystems are not emitters of the pool. Their
+// particles never die and can be simulated on the GPU, by transform feedback
+// or analytically, which a pool spawned and killed on the CPU cannot host, so
+// they keep their own buffers and draws.
+class ParticleManager {
+public:
+    static const int MaxEmitters = 32;
+
+    // capacities holds the number of particles of each blend mode
+    void initialize(const int capacities[PARTICLE_BLEND_COUNT], GLuint shaderProgramID);
+    void cleanup();
+
+    // Returns the emitter handle, or -1 when MaxEmitters are in use
+    int addEmitter(const EmitterDesc &desc);
+
+    // The description may be changed at any time, e.g. to move the emitter;
+    // living particles keep the blend mode they were spawned with
+    EmitterDesc &emitter(int handle) { return emitters[handle].desc; }
+    void setActive(int handle, bool active) { emitters[handle].active = active; }
+
+    // Spawns count particles at the next update, on top of the rate
+    void burst(int handle, int count) { emitters[handle].pendingBurst += count; }
+
+    // Spawns, ages, moves and kills particles, then uploads the live ranges
+    void update(float deltaTime);
+
+    // Orders the alpha blended particles back to front for this frame; call
+    // after update(). workers may be NULL.
+    void sortByDepth(const glm::vec3 &viewPosition, WorkerPool *workers);
+
+    // Queues one packet per blend mode with live particles
+    void submit(RenderQueue &queue);
+
+    int capacity() const { return static_cast<int>(age.size()); }
+    int aliveCount() const;
+    int droppedCount() const { return dropped; } // Spawns lost to a full segment since initialize
+
+private:
+    struct Emitter {
+        EmitterDesc desc;
+        bool active = true;
+        float spawnDebt = 0.0f; // Fraction of a particle owed by the rate
+        int pendingBurst = 0;
+    };
+
+    struct Segment {
+        int first = 0;    // Pool index of the first slot
+        int capacity = 0;
+        int alive = 0;    // Live particles occupy [first, first + alive)
+        BoundingBox bounds;
+    };
+
+    struct ParticleVertex {
+        glm::vec3 position;
+        float size;
+        glm::vec4 color;
+    };
+
+    std::vector<Emitter> emitters; // Reserved for MaxEmitters
+    Segment segments[PARTICLE_BLEND_COUNT];
+    int dropped = 0;
+
+    // Pool, one slot per particle
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> velocityX, velocityY, velocityZ;
+    std::vector<float> age, lifetime;
+    std::vector<uint16_t> emitterOf;
+    std::vector<ParticleVertex> vertices; // Staging copy of the vertex buffer
+
+    std::minstd_rand random;
+    GLuint vertexArrayID = 0, vertexBufferID = 0;
+    GLuint shaderProgramID = 0;
+
+    // Depth sorting of the alpha segment
+    ParticleDepthSort depthSort;
+    GLuint indexBufferID = 0; // Element buffer of vertexArrayID, indices relative to the segment
+    bool sorted = false;      // The index buffer holds this frame's order
+
+    float randomUnit(); // Uniform in [0, 1)
+    void spawn(int emitterIndex, int count);
+    void kill(Segment &segment, int index);
+    void copyParticle(int from, int to);
+
+    static void draw(void *object, GLuint blend);
+};
+
+#endif // PARTICLE_MANAGER_H
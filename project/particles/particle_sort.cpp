@@ -0,0 +1,106 @@
+#include "particle_sort.h"
+#include <render/worker_pool.h>
+#include <algorithm>
+#include <cmath>
+
+// Calls job(chunk, begin, end) for every chunk of [0, count), in parallel when
+// the pool is given
+template <typename Job>
+static void RunChunks(WorkerPool *workers, int chunks, size_t count, const Job &job) {
+    size_t chunkSize = (count + chunks - 1) / chunks;
+    auto run = [&](int chunk) {
+        size_t begin = std::min(count, chunk * chunkSize);
+        job(chunk, begin, std::min(count, begin + chunkSize));
+    };
+    if (workers && chunks > 1) {
+        workers->run(chunks, run);
+    } else {
+        for (int chunk = 0; chunk < chunks; ++chunk) {
+            run(chunk);
+        }
+    }
+}
+
+void ParticleDepthSort::sort(const float *x, const float *y, const float *z, size_t count, const glm::vec3 &viewPosition,
+                             WorkerPool *workers) {
+    distances.resize(count);
+    keys.resize(count);
+    scratchKeys.resize(count);
+    indices.resize(count);
+    scratchIndices.resize(count);
+    if (count == 0) {
+        return;
+    }
+    int chunks = workers && count >= MinParallelCount ? workers->size() + 1 : 1;
+    histograms.resize(256 * chunks);
+    chunkNearest.resize(chunks);
+    chunkFarthest.resize(chunks);
+
+    // Distances and their range
+    RunChunks(workers, chunks, count, [&](int chunk, size_t begin, size_t end) {
+        float nearest = INFINITY, farthest = 0.0f;
+        for (size_t i = begin; i < end; ++i) {
+            float dx = x[i] - viewPosition.x, dy = y[i] - viewPosition.y, dz = z[i] - viewPosition.z;
+            float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+            distances[i] = distance;
+            nearest = std::min(nearest, distance);
+            farthest = std::max(farthest, distance);
+        }
+        chunkNearest[chunk] = nearest;
+        chunkFarthest[chunk] = farthest;
+    });
+    float nearest = *std::min_element(chunkNearest.begin(), chunkNearest.end());
+    float farthest = *std::max_element(chunkFarthest.begin(), chunkFarthest.end());
+    float scale = farthest > nearest ? 65535.0f / (farthest - nearest) : 0.0f;
+
+    // Farther points get smaller keys, so ascending order is back to front
+    RunChunks(workers, chunks, count, [&](int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            keys[i] = static_cast<uint16_t>((farthest - distances[i]) * scale + 0.5f);
+            indices[i] = static_cast<uint32_t>(i);
+        }
+    });
+
+    uint16_t *sourceKeys = keys.data(), *destinationKeys = scratchKeys.data();
+    uint32_t *sourceIndices = indices.data(), *destinationIndices = scratchIndices.data();
+    for (int shift = 0; shift < 16; shift += 8) {
+        RunChunks(workers, chunks, count, [&](int chunk, size_t begin, size_t end) {
+            uint32_t *counts = &histograms[256 * chunk];
+            std::fill(counts, counts + 256, 0);
+            for (size_t i = begin; i < end; ++i) {
+                counts[(sourceKeys[i] >> shift) & 0xFF]++;
+            }
+        });
+
+        // Offsets in digit-major, chunk-minor order keep the pass stable
+        uint32_t offset = 0;
+        bool singleDigit = false;
+        for (int digit = 0; digit < 256; ++digit) {
+            uint32_t digitStart = offset;
+            for (int chunk = 0; chunk < chunks; ++chunk) {
+                uint32_t digitCount = histograms[256 * chunk + digit];
+                histograms[256 * chunk + digit] = offset;
+                offset += digitCount;
+            }
+            singleDigit = singleDigit || offset - digitStart == count;
+        }
+        if (singleDigit) {
+            continue; // Every key has the same digit; the pass would only copy
+        }
+
+        RunChunks(workers, chunks, count, [&](int chunk, size_t begin, size_t end) {
+            uint32_t *offsets = &histograms[256 * chunk];
+            for (size_t i = begin; i < end; ++i) {
+                uint32_t destination = offsets[(sourceKeys[i] >> shift) & 0xFF]++;
+                destinationKeys[destination] = sourceKeys[i];
+                destinationIndices[destination] = sourceIndices[i];
+            }
+        });
+        std::swap(sourceKeys, destinationKeys);
+        std::swap(sourceIndices, destinationIndices);
+    }
+    if (sourceIndices != indices.data()) {
+        indices.swap(scratchIndices);
+        keys.swap(scratchKeys);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef PARTICLE_SORT_H
+#define PARTICLE_SORT_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class WorkerPool;
+
+// Back to front order of points for alpha blending. sort() quantizes the
+// distances to the viewer to 16-bit keys over their current range and runs an
+// LSD radix sort of two 8-bit passes. Every pass splits the points into one
+// chunk per job: the jobs count the digits of their chunk in parallel, a
+// prefix sum over (digit, chunk) gives every chunk its output offsets, and the
+// jobs scatter in parallel. Chunks keep their order, so each pass is stable.
+//
+// There is no incremental fix-up for the frames between full sorts: insertion
+// passes over the previous order, serial or chunked on the pool, measured
+// slower than sort() itself on the particle paths, since dense points swap
+// places by many positions every frame. Callers that sort less often than
+// every frame keep drawing the previous order instead; --bench-sort shows how
+// far that order is off after a frame of movement.
+class ParticleDepthSort {
+public:
+    static const size_t MinParallelCount = 16384; // Fewer points are sorted on the caller alone
+
+    // Sorts the indices [0, count) by decreasing distance from viewPosition;
+    // workers may be NULL
+    void sort(const float *x, const float *y, const float *z, size_t count, const glm::vec3 &viewPosition, WorkerPool *workers);
+
+    // Farthest first
+    const std::vector<uint32_t> &order() const { return indices; }
+
+private:
+    std::vector<float> distances;
+    std::vector<uint16_t> keys, scratchKeys;
+    std::vector<uint32_t> indices, scratchIndices;
+    std::vector<uint32_t> histograms; // 256 counts per chunk, then turned into offsets
+    std::vector<float> chunkNearest, chunkFarthest;
+};
+
+#endif // PARTICLE_SORT_H
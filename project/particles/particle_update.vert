@@ -0,0 +1,20 @@
+#version 330 core
+// One particle per vertex, for the GPU path of ParticleSystem. The new state
+// is captured by transform feedback into the other buffer of the pair; the
+// motion is the same as UpdateParticles in particle_kernel.cpp.
+layout (location = 0) in vec4 state; // xyz position, w progress along the path
+layout (location = 1) in vec3 offset;
+
+uniform vec3 pathStart;
+uniform vec3 pathDelta;
+uniform float lifeStep;
+uniform float phase;
+
+out vec4 outState;
+
+void main() {
+    float life = state.w + lifeStep;
+    life = life >= 1.0 ? life - 1.0 : life;
+    vec3 wobble = vec3(sin(phase + life * 10.0), cos(phase + life * 15.0), 0.0) * 0.5;
+    outState = vec4(pathStart + pathDelta * life + offset + wobble, life);
+}
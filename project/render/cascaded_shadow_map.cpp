@@ -0,0 +1,58 @@
+#include "cascaded_shadow_map.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cmath>
+
+GLuint CreateDepthArray(GLsizei resolution, int layers, GLuint *framebuffers)
+{
+	// 24-bit depth is plenty for light frustums fitted to the view
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glState.bindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, layers, 0,
+				 GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	float borderColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+
+	glGenFramebuffers(layers, framebuffers);
+	for (int layer = 0; layer < layers; layer++) {
+		glState.bindFramebuffer(GL_FRAMEBUFFER, framebuffers[layer]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textureID, 0, layer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+	glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+	return textureID;
+}
+
+void CascadedShadowMap::initialize(int count, GLsizei mapResolution)
+{
+	cascadeCount = std::max(1, std::min(count, MaxCascades));
+	resolution = mapResolution;
+	textureID = CreateDepthArray(resolution, cascadeCount, framebufferIDs);
+}
+
+void CascadedShadowMap::updateSplits(float zNear, float zFar)
+{
+	nearDepth = zNear;
+	for (int i = 1; i <= cascadeCount; i++) {
+		float fraction = static_cast<float>(i) / cascadeCount;
+		float logarithmic = zNear * std::pow(zFar / zNear, fraction);
+		float uniform = zNear + (zFar - zNear) * fraction;
+		splits[i - 1] = SplitLambda * logarithmic + (1.0f - SplitLambda) * uniform;
+	}
+}
+
+void CascadedShadowMap::cleanup()
+{
+	glDeleteFramebuffers(cascadeCount, framebufferIDs);
+	glDeleteTextures(1, &textureID);
+	glState.invalidate(); // The deleted names may still be tracked as bound
+	textureID = 0;
+	cascadeCount = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef CASCADED_SHADOW_MAP_H
+#define CASCADED_SHADOW_MAP_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "shadow_frustum.h"
+
+// Directional shadow map split into cascades along the view direction. Each
+// cascade covers one slice of the camera frustum with its own light frustum,
+// fitted by a ShadowFrustum, and is one layer of a depth texture array.
+// Receivers pick the cascade by the view depth of the fragment, so texels
+// are spent where they cover the fewest pixels on screen.
+//
+// Splits follow the practical scheme: each split blends the logarithmic and
+// the uniform split positions, weighted by SplitLambda.
+class CascadedShadowMap {
+public:
+    static constexpr int MaxCascades = 4;           // Matches the receiver shaders
+    static constexpr float SplitLambda = 0.8f;      // 1 is fully logarithmic
+
+    void initialize(int cascadeCount, GLsizei resolution);
+    void cleanup();
+
+    // Places the splits between the camera's near plane and the far end of the shadows
+    void updateSplits(float zNear, float zFar);
+
+    int count() const { return cascadeCount; }
+    GLsizei size() const { return resolution; }
+    GLuint texture() const { return textureID; }
+    GLuint framebuffer(int cascade) const { return framebufferIDs[cascade]; }
+
+    // View depth range of a cascade
+    float splitNear(int cascade) const { return cascade == 0 ? nearDepth : splits[cascade - 1]; }
+    float splitFar(int cascade) const { return splits[cascade]; }
+
+    ShadowFrustum &frustum(int cascade) { return frustums[cascade]; }
+    const ShadowFrustum &frustum(int cascade) const { return frustums[cascade]; }
+
+private:
+    int cascadeCount = 0;
+    GLsizei resolution = 0;
+    GLuint textureID = 0;
+    GLuint framebufferIDs[MaxCascades] = {};
+    float nearDepth = 0.0f;
+    float splits[MaxCascades] = {};
+    ShadowFrustum frustums[MaxCascades];
+};
+
+// Depth texture array with one framebuffer per layer; used for the cascades
+// and for their static cache
+GLuint CreateDepthArray(GLsizei resolution, int layers, GLuint *framebuffers);
+
+#endif // CASCADED_SHADOW_MAP_H
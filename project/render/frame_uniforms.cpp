@@ -0,0 +1,102 @@
+#include "frame_uniforms.h"
+#include "gl_state.h"
+
+static GLuint CreateUniformBuffer(GLsizeiptr size, GLuint binding)
+{
+	GLuint bufferID;
+	glGenBuffers(1, &bufferID);
+	glState.bindBuffer(GL_UNIFORM_BUFFER, bufferID);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glState.bindBufferBase(GL_UNIFORM_BUFFER, binding, bufferID);
+	return bufferID;
+}
+
+static void UpdateUniformBuffer(GLuint bufferID, const void *data, GLsizeiptr size)
+{
+	glState.bindBuffer(GL_UNIFORM_BUFFER, bufferID);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+}
+
+void FrameUniforms::initialize()
+{
+	cameraBufferID = CreateUniformBuffer(sizeof(CameraBlock), CAMERA_BLOCK_BINDING);
+	lightBufferID = CreateUniformBuffer(sizeof(LightBlock), LIGHT_BLOCK_BINDING);
+	shadowBufferID = CreateUniformBuffer(sizeof(ShadowBlock), SHADOW_BLOCK_BINDING);
+	cascadeBufferID = CreateUniformBuffer(sizeof(CascadeBlock), CASCADE_BLOCK_BINDING);
+	localLightBufferID = CreateUniformBuffer(sizeof(LocalLightBlock), LOCAL_LIGHT_BLOCK_BINDING);
+	glState.bindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void FrameUniforms::updateCamera(const glm::mat4 &vpMatrix, const glm::vec3 &cameraPosition)
+{
+	CameraBlock block = {};
+	block.vpMatrix = vpMatrix;
+	block.cameraPosition = cameraPosition;
+	UpdateUniformBuffer(cameraBufferID, &block, sizeof(block));
+}
+
+void FrameUniforms::updateLight(const Light &light)
+{
+	LightBlock block = {};
+	block.lightDirection = light.direction;
+	block.lightIntensity = light.intensity;
+	block.lightPosition = light.position;
+	block.lightColor = light.color;
+	UpdateUniformBuffer(lightBufferID, &block, sizeof(block));
+}
+
+void FrameUniforms::updateShadow(const glm::mat4 &lightSpaceMatrix)
+{
+	ShadowBlock block = {};
+	block.lightSpaceMatrix = lightSpaceMatrix;
+	UpdateUniformBuffer(shadowBufferID, &block, sizeof(block));
+}
+
+void FrameUniforms::updateCascades(const glm::mat4 *matrices, const float *splits, int count, int shadowTechnique, bool useShadowMask)
+{
+	CascadeBlock block = {};
+	for (int i = 0; i < count; i++) {
+		block.cascadeMatrices[i] = matrices[i];
+		block.cascadeSplits[i] = splits[i];
+	}
+	block.cascadeCount = count;
+	block.shadowTechnique = shadowTechnique;
+	block.useShadowMask = useShadowMask ? 1 : 0;
+	UpdateUniformBuffer(cascadeBufferID, &block, sizeof(block));
+}
+
+void FrameUniforms::updateLocalLights(const LocalLightBlock &block)
+{
+	UpdateUniformBuffer(localLightBufferID, &block, sizeof(block));
+}
+
+void FrameUniforms::cleanup()
+{
+	glDeleteBuffers(1, &cameraBufferID);
+	glDeleteBuffers(1, &lightBufferID);
+	glDeleteBuffers(1, &shadowBufferID);
+	glDeleteBuffers(1, &cascadeBufferID);
+	glDeleteBuffers(1, &localLightBufferID);
+	cameraBufferID = lightBufferID = shadowBufferID = cascadeBufferID = localLightBufferID = 0;
+}
+
+void BindFrameUniformBlocks(GLuint programID)
+{
+	static const struct {
+		const char *name;
+		GLuint binding;
+	} blocks[] = {
+		{"CameraBlock", CAMERA_BLOCK_BINDING},
+		{"LightBlock", LIGHT_BLOCK_BINDING},
+		{"ShadowBlock", SHADOW_BLOCK_BINDING},
+		{"CascadeBlock", CASCADE_BLOCK_BINDING},
+		{"LocalLightBlock", LOCAL_LIGHT_BLOCK_BINDING},
+	};
+
+	for (const auto &block : blocks) {
+		GLuint blockIndex = glGetUniformBlockIndex(programID, block.name);
+		if (blockIndex != GL_INVALID_INDEX) {
+			glUniformBlockBinding(programID, blockIndex, block.binding);
+		}
+	}
+}
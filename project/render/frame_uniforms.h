@@ -0,0 +1,94 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "utils/lightInfo.h"
+
+// Fixed binding points of the per-frame uniform blocks. Every program built by
+// render/shader.cpp has its blocks attached to these points after linking.
+enum FrameUniformBinding {
+    CAMERA_BLOCK_BINDING = 0,
+    LIGHT_BLOCK_BINDING = 1,
+    SHADOW_BLOCK_BINDING = 2,
+    CASCADE_BLOCK_BINDING = 3,
+    LOCAL_LIGHT_BLOCK_BINDING = 4
+};
+
+// CPU mirrors of the std140 blocks. A vec3 followed by a float shares one
+// 16-byte slot, so the padding below matches the GLSL layout exactly:
+//
+//   layout(std140) uniform CameraBlock { mat4 vpMatrix; vec3 cameraPosition; };
+//   layout(std140) uniform LightBlock  { vec3 lightDirection; float lightIntensity;
+//                                        vec3 lightPosition; vec3 lightColor; };
+//   layout(std140) uniform ShadowBlock { mat4 lightSpaceMatrix; };
+//   layout(std140) uniform CascadeBlock { mat4 cascadeMatrices[4]; vec4 cascadeSplits;
+//                                         int cascadeCount; int shadowTechnique;
+//                                         int useShadowMask; };
+//   layout(std140) uniform LocalLightBlock { LocalLight lights[8]; mat4 shadowMatrices[24];
+//                                            vec4 shadowTiles[24]; int lightCount; };
+struct CameraBlock {
+    glm::mat4 vpMatrix;
+    glm::vec3 cameraPosition;
+    float padding0;
+};
+
+struct LightBlock {
+    glm::vec3 lightDirection;
+    float lightIntensity;
+    glm::vec3 lightPosition;
+    float padding0;
+    glm::vec3 lightColor;
+    float padding1;
+};
+
+struct ShadowBlock {
+    glm::mat4 lightSpaceMatrix;
+};
+
+struct CascadeBlock {
+    glm::mat4 cascadeMatrices[4];
+    glm::vec4 cascadeSplits; // Far view depth of each cascade
+    int cascadeCount;
+    int shadowTechnique; // ShadowTechnique of render/shadow_filter.h
+    int useShadowMask;   // Receivers read the screen-space mask of render/shadow_mask.h
+    int padding0;
+};
+
+// Spot or point light of render/local_lights.h, packed into whole vec4s
+struct LocalLightData {
+    glm::vec4 positionRange;  // xyz position, w range
+    glm::vec4 directionType;  // xyz spot direction, w LightType
+    glm::vec4 colorIntensity; // xyz color, w intensity
+    glm::vec4 coneShadow;     // Cosines of the outer and inner cone, first shadow tile or -1
+};
+
+struct LocalLightBlock {
+    LocalLightData lights[8];
+    glm::mat4 shadowMatrices[24]; // Light matrix of each atlas tile
+    glm::vec4 shadowTiles[24];    // Offset and size of each tile in atlas UV, w 1 once rendered
+    int lightCount;
+    int padding0[3];
+};
+
+// Owns one uniform buffer per block, bound once to its binding point. The main
+// loop updates each block once per frame instead of every object re-uploading
+// the same camera and light state.
+class FrameUniforms {
+public:
+    void initialize();
+    void updateCamera(const glm::mat4 &vpMatrix, const glm::vec3 &cameraPosition);
+    void updateLight(const Light &light);
+    void updateShadow(const glm::mat4 &lightSpaceMatrix);
+    void updateCascades(const glm::mat4 *matrices, const float *splits, int count, int shadowTechnique, bool useShadowMask);
+    void updateLocalLights(const LocalLightBlock &block);
+    void cleanup();
+
+private:
+    GLuint cameraBufferID = 0, lightBufferID = 0, shadowBufferID = 0, cascadeBufferID = 0, localLightBufferID = 0;
+};
+
+// Attaches whichever of the frame blocks the program declares to their binding points.
+void BindFrameUniformBlocks(GLuint programID);
+
+#endif // FRAME_UNIFORMS_H
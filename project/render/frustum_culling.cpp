@@ -0,0 +1,253 @@
+#include "frustum_culling.h"
+#include "render_stats.h"
+
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_SSE 1
+#endif
+
+// The AVX loop is compiled for its own target and only taken when the CPU
+// reports AVX, so the rest of the build keeps the baseline instruction set
+#if defined(CULLING_SSE) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CULLING_AVX 1
+#endif
+
+// Padding granularity of the SoA streams; covers every code path below
+static const size_t StreamAlignment = 8;
+
+BoundingBox BoundingBox::transformed(const glm::mat4 &matrix) const
+{
+	glm::vec3 c = glm::vec3(matrix * glm::vec4(center(), 1.0f));
+	glm::vec3 e = extent();
+	glm::vec3 newExtent;
+	for (int row = 0; row < 3; row++) {
+		newExtent[row] = std::fabs(matrix[0][row]) * e.x + std::fabs(matrix[1][row]) * e.y + std::fabs(matrix[2][row]) * e.z;
+	}
+	return BoundingBox(c - newExtent, c + newExtent);
+}
+
+Frustum::Frustum()
+{
+	for (glm::vec4 &plane : planes) {
+		plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+}
+
+Frustum::Frustum(const glm::mat4 &m)
+{
+	// Gribb-Hartmann: each plane is the last row of the matrix plus or minus
+	// one of the others; glm matrices are indexed [column][row]
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	planes[0] = row3 + row0;
+	planes[1] = row3 - row0;
+	planes[2] = row3 + row1;
+	planes[3] = row3 - row1;
+	planes[4] = row3 + row2;
+	planes[5] = row3 - row2;
+	for (glm::vec4 &plane : planes) {
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f) {
+			plane /= length;
+		}
+	}
+}
+
+bool Frustum::intersects(const BoundingBox &box) const
+{
+	glm::vec3 c = box.center();
+	glm::vec3 e = box.extent();
+	for (const glm::vec4 &plane : planes) {
+		glm::vec3 n(plane);
+		if (glm::dot(n, c) + glm::dot(glm::abs(n), e) + plane.w < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+FrustumTest Frustum::classify(const BoundingBox &box) const
+{
+	glm::vec3 c = box.center();
+	glm::vec3 e = box.extent();
+	FrustumTest result = FRUSTUM_INSIDE;
+	for (const glm::vec4 &plane : planes) {
+		glm::vec3 n(plane);
+		float distance = glm::dot(n, c) + plane.w;
+		float radius = glm::dot(glm::abs(n), e);
+		if (distance + radius < 0.0f) {
+			return FRUSTUM_OUTSIDE;
+		}
+		if (distance - radius < 0.0f) {
+			result = FRUSTUM_INTERSECTS;
+		}
+	}
+	return result;
+}
+
+void CullingSet::clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+	count = 0;
+}
+
+void CullingSet::reserve(size_t boxCount)
+{
+	size_t padded = (boxCount + StreamAlignment - 1) / StreamAlignment * StreamAlignment;
+	for (std::vector<float> *stream : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ}) {
+		stream->reserve(padded);
+	}
+}
+
+uint32_t CullingSet::add(const BoundingBox &box)
+{
+	uint32_t index = static_cast<uint32_t>(count++);
+	if (count > centerX.size()) {
+		size_t padded = centerX.size() + StreamAlignment;
+		for (std::vector<float> *stream : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ}) {
+			stream->resize(padded, 0.0f);
+		}
+	}
+	set(index, box);
+	return index;
+}
+
+void CullingSet::set(uint32_t index, const BoundingBox &box)
+{
+	glm::vec3 c = box.center();
+	glm::vec3 e = box.extent();
+	centerX[index] = c.x;
+	centerY[index] = c.y;
+	centerZ[index] = c.z;
+	extentX[index] = e.x;
+	extentY[index] = e.y;
+	extentZ[index] = e.z;
+}
+
+// A box is outside when even its corner furthest along the plane normal,
+// centre + |normal| . extent, lies behind the plane. The smallest such
+// distance over the six planes decides visibility. The vector loops stop at
+// the last whole register and return where the scalar loop has to continue.
+struct CullingStreams {
+	const float *centerX, *centerY, *centerZ;
+	const float *extentX, *extentY, *extentZ;
+	size_t count;
+};
+
+#if defined(CULLING_AVX)
+__attribute__((target("avx")))
+static size_t CullAVX(const CullingStreams &boxes, const Frustum &frustum, std::vector<uint32_t> &visible)
+{
+	size_t base = 0;
+	for (; base + 8 <= boxes.count; base += 8) {
+		__m256 cx = _mm256_loadu_ps(boxes.centerX + base);
+		__m256 cy = _mm256_loadu_ps(boxes.centerY + base);
+		__m256 cz = _mm256_loadu_ps(boxes.centerZ + base);
+		__m256 ex = _mm256_loadu_ps(boxes.extentX + base);
+		__m256 ey = _mm256_loadu_ps(boxes.extentY + base);
+		__m256 ez = _mm256_loadu_ps(boxes.extentZ + base);
+
+		__m256 nearest = _mm256_set1_ps(INFINITY);
+		for (const glm::vec4 &plane : frustum.planes) {
+			__m256 distance = _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)), _mm256_set1_ps(plane.w));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(cy, _mm256_set1_ps(plane.y)));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(cz, _mm256_set1_ps(plane.z)));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(ex, _mm256_set1_ps(std::fabs(plane.x))));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(ey, _mm256_set1_ps(std::fabs(plane.y))));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(ez, _mm256_set1_ps(std::fabs(plane.z))));
+			nearest = _mm256_min_ps(nearest, distance);
+		}
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(nearest, _mm256_setzero_ps(), _CMP_GE_OQ));
+		for (int lane = 0; lane < 8; lane++) {
+			if (mask & (1 << lane)) {
+				visible.push_back(static_cast<uint32_t>(base + lane));
+			}
+		}
+	}
+	return base;
+}
+#endif
+
+#if defined(CULLING_SSE)
+static size_t CullSSE(const CullingStreams &boxes, const Frustum &frustum, std::vector<uint32_t> &visible)
+{
+	size_t base = 0;
+	for (; base + 4 <= boxes.count; base += 4) {
+		__m128 cx = _mm_loadu_ps(boxes.centerX + base);
+		__m128 cy = _mm_loadu_ps(boxes.centerY + base);
+		__m128 cz = _mm_loadu_ps(boxes.centerZ + base);
+		__m128 ex = _mm_loadu_ps(boxes.extentX + base);
+		__m128 ey = _mm_loadu_ps(boxes.extentY + base);
+		__m128 ez = _mm_loadu_ps(boxes.extentZ + base);
+
+		__m128 nearest = _mm_set1_ps(INFINITY);
+		for (const glm::vec4 &plane : frustum.planes) {
+			__m128 distance = _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_set1_ps(plane.w));
+			distance = _mm_add_ps(distance, _mm_mul_ps(cy, _mm_set1_ps(plane.y)));
+			distance = _mm_add_ps(distance, _mm_mul_ps(cz, _mm_set1_ps(plane.z)));
+			distance = _mm_add_ps(distance, _mm_mul_ps(ex, _mm_set1_ps(std::fabs(plane.x))));
+			distance = _mm_add_ps(distance, _mm_mul_ps(ey, _mm_set1_ps(std::fabs(plane.y))));
+			distance = _mm_add_ps(distance, _mm_mul_ps(ez, _mm_set1_ps(std::fabs(plane.z))));
+			nearest = _mm_min_ps(nearest, distance);
+		}
+		int mask = _mm_movemask_ps(_mm_cmpge_ps(nearest, _mm_setzero_ps()));
+		for (int lane = 0; lane < 4; lane++) {
+			if (mask & (1 << lane)) {
+				visible.push_back(static_cast<uint32_t>(base + lane));
+			}
+		}
+	}
+	return base;
+}
+#endif
+
+size_t CullingSet::cull(const Frustum &frustum, std::vector<uint32_t> &visible, RenderStats *stats) const
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	size_t before = visible.size();
+
+	CullingStreams boxes = {centerX.data(), centerY.data(), centerZ.data(), extentX.data(), extentY.data(), extentZ.data(), count};
+	size_t base = 0;
+#if defined(CULLING_AVX)
+	static const bool hasAVX = __builtin_cpu_supports("avx");
+	if (hasAVX) {
+		base = CullAVX(boxes, frustum, visible);
+	}
+#endif
+#if defined(CULLING_SSE)
+	if (base == 0) { // No AVX, or fewer boxes than one AVX register
+		base = CullSSE(boxes, frustum, visible);
+	}
+#endif
+	for (; base < count; base++) {
+		float nearest = INFINITY;
+		for (const glm::vec4 &plane : frustum.planes) {
+			float distance = centerX[base] * plane.x + centerY[base] * plane.y + centerZ[base] * plane.z + plane.w
+						   + extentX[base] * std::fabs(plane.x) + extentY[base] * std::fabs(plane.y) + extentZ[base] * std::fabs(plane.z);
+			nearest = std::fmin(nearest, distance);
+		}
+		if (nearest >= 0.0f) {
+			visible.push_back(static_cast<uint32_t>(base));
+		}
+	}
+
+	size_t visibleCount = visible.size() - before;
+	if (stats) {
+		stats->objectsVisible += static_cast<int>(visibleCount);
+		stats->objectsCulled += static_cast<int>(count - visibleCount);
+		stats->cullingTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+	return visibleCount;
+}
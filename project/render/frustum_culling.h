@@ -0,0 +1,69 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Axis-aligned box in world space
+struct BoundingBox {
+    glm::vec3 min, max;
+
+    BoundingBox() : min(0.0f), max(0.0f) {}
+    BoundingBox(const glm::vec3 &min, const glm::vec3 &max) : min(min), max(max) {}
+
+    glm::vec3 center() const { return 0.5f * (min + max); }
+    glm::vec3 extent() const { return 0.5f * (max - min); }
+
+    // Box enclosing this one after an affine transform
+    BoundingBox transformed(const glm::mat4 &matrix) const;
+};
+
+enum FrustumTest {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECTS,
+    FRUSTUM_INSIDE
+};
+
+// Clip planes of a view-projection matrix as (normal, distance) with normals
+// pointing into the volume: left, right, bottom, top, near, far
+struct Frustum {
+    glm::vec4 planes[6];
+
+    Frustum();  // Accepts everything
+    explicit Frustum(const glm::mat4 &viewProjection);
+
+    // Conservative: boxes straddling a corner of the frustum may pass
+    bool intersects(const BoundingBox &box) const;
+    // Also reports boxes entirely inside, whose contents need no further tests
+    FrustumTest classify(const BoundingBox &box) const;
+};
+
+struct RenderStats;
+
+// Boxes kept as structure-of-arrays centre and extent streams so cull() tests
+// a full SIMD register of boxes against each plane at once: AVX when the CPU
+// supports it, otherwise SSE, with a scalar loop for the remainder. The
+// streams are padded to a multiple of the widest register.
+class CullingSet {
+public:
+    void clear();
+    void reserve(size_t boxCount);
+    uint32_t add(const BoundingBox &box); // Returns the box's index
+    void set(uint32_t index, const BoundingBox &box);
+
+    size_t size() const { return count; }
+
+    // Appends the index of every box intersecting the frustum to visible in
+    // increasing order and returns how many were appended. Adds to the culling
+    // counters of stats when given.
+    size_t cull(const Frustum &frustum, std::vector<uint32_t> &visible, RenderStats *stats = NULL) const;
+
+private:
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    size_t count = 0;
+};
+
+#endif // FRUSTUM_CULLING_H
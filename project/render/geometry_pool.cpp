@@ -0,0 +1,286 @@
+#include "geometry_pool.h"
+#include "gl_state.h"
+#include "render_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+GeometryPool staticGeometry(VertexFormat().add(0, 3).add(1, 2).add(2, 3).add(3, 3), 16384, 65536);
+GeometryPool skinnedGeometry(VertexFormat().add(0, 3).add(1, 3).add(2, 2).add(3, 4, GL_UNSIGNED_SHORT).add(4, 4), 16384, 65536);
+
+void RangeAllocator::reset(GLsizei capacity, GLsizei used)
+{
+	freeBlocks.clear();
+	totalSize = capacity;
+	usedSize = used;
+	if (used < capacity) {
+		freeBlocks[used] = capacity - used;
+	}
+}
+
+GLint RangeAllocator::allocate(GLsizei size)
+{
+	for (auto it = freeBlocks.begin(); it != freeBlocks.end(); ++it) {
+		if (it->second < size) {
+			continue;
+		}
+		GLint offset = it->first;
+		GLsizei remaining = it->second - size;
+		freeBlocks.erase(it);
+		if (remaining > 0) {
+			freeBlocks[offset + size] = remaining;
+		}
+		usedSize += size;
+		return offset;
+	}
+	return -1;
+}
+
+void RangeAllocator::free(GLint offset, GLsizei size)
+{
+	usedSize -= size;
+	auto next = freeBlocks.lower_bound(offset);
+
+	// Merge with the following block
+	if (next != freeBlocks.end() && next->first == offset + size) {
+		size += next->second;
+		next = freeBlocks.erase(next);
+	}
+	// Merge with the preceding block
+	if (next != freeBlocks.begin()) {
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset) {
+			previous->second += size;
+			return;
+		}
+	}
+	freeBlocks[offset] = size;
+}
+
+GeometryPool::GeometryPool(const VertexFormat &format, GLsizei initialVertices, GLsizei initialIndices)
+	: vertexFormat(format), initialVertices(initialVertices), initialIndices(initialIndices)
+{
+}
+
+void GeometryPool::attachBuffers(GLuint vertexArray) const
+{
+	glState.bindVertexArray(vertexArray);
+	glState.bindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+	vertexFormat.apply();
+	glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+}
+
+int GeometryPool::allocate(const void *vertices, GLsizei vertexCount, const GLuint *indices, GLsizei indexCount)
+{
+	if (vertexArrayID == 0) {
+		glGenVertexArrays(1, &vertexArrayID);
+		compact(initialVertices, initialIndices);
+	}
+
+	GLint baseVertex = vertexSpace.allocate(vertexCount);
+	GLint firstIndex = indexSpace.allocate(indexCount);
+	if (baseVertex < 0 || firstIndex < 0) {
+		// Undo the half that succeeded, then pack and grow until the mesh fits
+		if (baseVertex >= 0) vertexSpace.free(baseVertex, vertexCount);
+		if (firstIndex >= 0) indexSpace.free(firstIndex, indexCount);
+
+		GLsizei vertexCapacity = vertexSpace.capacity();
+		while (vertexCapacity < vertexSpace.used() + vertexCount) vertexCapacity *= 2;
+		GLsizei indexCapacity = indexSpace.capacity();
+		while (indexCapacity < indexSpace.used() + indexCount) indexCapacity *= 2;
+		compact(vertexCapacity, indexCapacity);
+
+		baseVertex = vertexSpace.allocate(vertexCount);
+		firstIndex = indexSpace.allocate(indexCount);
+		if (baseVertex < 0 || firstIndex < 0) {
+			fprintf(stderr, "Geometry pool cannot fit %d vertices and %d indices\n", vertexCount, indexCount);
+			return -1;
+		}
+	}
+
+	glState.bindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+	glBufferSubData(GL_ARRAY_BUFFER, GLintptr(baseVertex) * vertexFormat.stride(), GLsizeiptr(vertexCount) * vertexFormat.stride(), vertices);
+	// The element binding belongs to the VAO, so upload through the pool's own
+	glState.bindVertexArray(vertexArrayID);
+	glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, GLintptr(firstIndex) * sizeof(GLuint), GLsizeiptr(indexCount) * sizeof(GLuint), indices);
+	glState.bindVertexArray(0);
+
+	GeometryRange range = {baseVertex, vertexCount, firstIndex, indexCount, true};
+	int handle;
+	if (!freeHandles.empty()) {
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+		ranges[handle] = range;
+	} else {
+		handle = static_cast<int>(ranges.size());
+		ranges.push_back(range);
+	}
+	return handle;
+}
+
+void GeometryPool::free(int handle)
+{
+	if (handle < 0 || handle >= static_cast<int>(ranges.size()) || !ranges[handle].live) {
+		return;
+	}
+	GeometryRange &range = ranges[handle];
+	vertexSpace.free(range.baseVertex, range.vertexCount);
+	indexSpace.free(range.firstIndex, range.indexCount);
+	range.live = false;
+	freeHandles.push_back(handle);
+}
+
+void GeometryPool::compact(GLsizei minVertices, GLsizei minIndices)
+{
+	if (vertexArrayID == 0) {
+		return; // Nothing allocated yet
+	}
+
+	GLsizei vertexCapacity = std::max(minVertices, vertexSpace.capacity());
+	GLsizei indexCapacity = std::max(minIndices, indexSpace.capacity());
+	GLsizeiptr stride = vertexFormat.stride();
+
+	GLuint newVertexBuffer, newIndexBuffer;
+	glGenBuffers(1, &newVertexBuffer);
+	glState.bindBuffer(GL_COPY_WRITE_BUFFER, newVertexBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertexCapacity * stride, NULL, GL_STATIC_DRAW);
+	glGenBuffers(1, &newIndexBuffer);
+	glState.bindBuffer(GL_COPY_WRITE_BUFFER, newIndexBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, indexCapacity * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+
+	// Copy every live mesh to the front of the new buffers in handle order;
+	// base-vertex drawing keeps the index values themselves unchanged
+	GLint vertexEnd = 0, indexEnd = 0;
+	for (GeometryRange &range : ranges) {
+		if (!range.live) {
+			continue;
+		}
+		glState.bindBuffer(GL_COPY_READ_BUFFER, vertexBufferID);
+		glState.bindBuffer(GL_COPY_WRITE_BUFFER, newVertexBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, range.baseVertex * stride, vertexEnd * stride, range.vertexCount * stride);
+		glState.bindBuffer(GL_COPY_READ_BUFFER, indexBufferID);
+		glState.bindBuffer(GL_COPY_WRITE_BUFFER, newIndexBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, range.firstIndex * sizeof(GLuint), indexEnd * sizeof(GLuint), range.indexCount * sizeof(GLuint));
+
+		range.baseVertex = vertexEnd;
+		range.firstIndex = indexEnd;
+		vertexEnd += range.vertexCount;
+		indexEnd += range.indexCount;
+	}
+
+	glDeleteBuffers(1, &vertexBufferID);
+	glDeleteBuffers(1, &indexBufferID);
+	glState.invalidate();
+	vertexBufferID = newVertexBuffer;
+	indexBufferID = newIndexBuffer;
+	vertexSpace.reset(vertexCapacity, vertexEnd);
+	indexSpace.reset(indexCapacity, indexEnd);
+
+	// Point every VAO at the new buffers
+	attachBuffers(vertexArrayID);
+	for (const ExtraVertexArray &extra : extraVertexArrays) {
+		attachBuffers(extra.vertexArray);
+		glState.bindBuffer(GL_ARRAY_BUFFER, extra.buffer);
+		extra.format.apply();
+	}
+	glState.bindVertexArray(0);
+}
+
+void GeometryPool::draw(int handle, GLenum mode) const
+{
+	const GeometryRange &range = ranges[handle];
+	glState.bindVertexArray(vertexArrayID);
+	glDrawElementsBaseVertex(mode, range.indexCount, GL_UNSIGNED_INT,
+							 (void*)(range.firstIndex * sizeof(GLuint)), range.baseVertex);
+	renderStats.drawCalls++;
+}
+
+void GeometryPool::drawInstanced(int handle, GLuint vertexArray, GLsizei instanceCount) const
+{
+	const GeometryRange &range = ranges[handle];
+	glState.bindVertexArray(vertexArray);
+	glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT,
+									  (void*)(range.firstIndex * sizeof(GLuint)), instanceCount, range.baseVertex);
+	renderStats.drawCalls++;
+	renderStats.instancesDrawn += instanceCount;
+}
+
+GLuint GeometryPool::createVertexArray(const VertexFormat &extraFormat, GLuint extraBuffer)
+{
+	ExtraVertexArray extra = {0, extraFormat, extraBuffer};
+	glGenVertexArrays(1, &extra.vertexArray);
+	attachBuffers(extra.vertexArray);
+	glState.bindBuffer(GL_ARRAY_BUFFER, extraBuffer);
+	extraFormat.apply();
+	glState.bindVertexArray(0);
+
+	extraVertexArrays.push_back(extra);
+	return extra.vertexArray;
+}
+
+void GeometryPool::releaseVertexArray(GLuint vertexArray)
+{
+	for (size_t i = 0; i < extraVertexArrays.size(); i++) {
+		if (extraVertexArrays[i].vertexArray == vertexArray) {
+			glDeleteVertexArrays(1, &vertexArray);
+			glState.invalidate();
+			extraVertexArrays.erase(extraVertexArrays.begin() + i);
+			return;
+		}
+	}
+}
+
+void GeometryPool::printStats(const char *name) const
+{
+	int meshes = static_cast<int>(ranges.size() - freeHandles.size());
+	printf("%s geometry: %d meshes, %d/%d vertices, %d/%d indices\n", name, meshes,
+		   vertexSpace.used(), vertexSpace.capacity(), indexSpace.used(), indexSpace.capacity());
+}
+
+void GeometryPool::cleanup()
+{
+	for (const ExtraVertexArray &extra : extraVertexArrays) {
+		glDeleteVertexArrays(1, &extra.vertexArray);
+	}
+	extraVertexArrays.clear();
+	glDeleteBuffers(1, &vertexBufferID);
+	glDeleteBuffers(1, &indexBufferID);
+	glDeleteVertexArrays(1, &vertexArrayID);
+	glState.invalidate();
+	vertexArrayID = vertexBufferID = indexBufferID = 0;
+	vertexSpace.reset(0);
+	indexSpace.reset(0);
+	ranges.clear();
+	freeHandles.clear();
+}
+
+void StaticMesh::initialize(GeometryPool &geometryPool, const std::vector<GLfloat> &vertices, const GLuint *indices, GLsizei indexCount)
+{
+	pool = &geometryPool;
+	GLsizei vertexCount = static_cast<GLsizei>(vertices.size() * sizeof(GLfloat) / pool->format().stride());
+	handle = pool->allocate(vertices.data(), vertexCount, indices, indexCount);
+}
+
+void StaticMesh::draw() const
+{
+	if (handle >= 0) {
+		pool->draw(handle);
+	}
+}
+
+void StaticMesh::drawInstanced(GLuint vertexArray, GLsizei instanceCount) const
+{
+	if (handle >= 0) {
+		pool->drawInstanced(handle, vertexArray, instanceCount);
+	}
+}
+
+void StaticMesh::cleanup()
+{
+	if (pool) {
+		pool->free(handle);
+	}
+	handle = -1;
+}
@@ -0,0 +1,107 @@
+#ifndef GEOMETRY_POOL_H
+#define GEOMETRY_POOL_H
+
+#include <glad/gl.h>
+#include <map>
+#include <vector>
+#include "vertex_format.h"
+
+// First-fit allocator over [0, capacity) in elements. Freed blocks are merged
+// with their neighbours.
+class RangeAllocator {
+public:
+    void reset(GLsizei capacity, GLsizei used = 0);
+    GLint allocate(GLsizei size); // -1 when no free block is large enough
+    void free(GLint offset, GLsizei size);
+
+    GLsizei capacity() const { return totalSize; }
+    GLsizei used() const { return usedSize; }
+
+private:
+    std::map<GLint, GLsizei> freeBlocks; // Offset -> size
+    GLsizei totalSize = 0, usedSize = 0;
+};
+
+// Location of one mesh inside a GeometryPool. Indices are local to the mesh
+// and offset by baseVertex at draw time.
+struct GeometryRange {
+    GLint baseVertex;
+    GLsizei vertexCount;
+    GLint firstIndex;
+    GLsizei indexCount;
+    bool live;
+};
+
+// Suballocates meshes of one vertex format from a single vertex buffer and a
+// single 32-bit index buffer, all wired into one VAO, so consecutive draws from
+// the pool need no VAO or buffer switches. Buffers are created on the first
+// allocation and grow by doubling. Meshes are referred to by handles, which
+// stay valid across compaction.
+class GeometryPool {
+public:
+    GeometryPool(const VertexFormat &format, GLsizei initialVertices, GLsizei initialIndices);
+
+    // Copies vertexCount vertices laid out in the pool's format and the indices;
+    // returns a handle, or -1 on failure
+    int allocate(const void *vertices, GLsizei vertexCount, const GLuint *indices, GLsizei indexCount);
+    void free(int handle);
+
+    // Packs live meshes to the front of the buffers, resizing them to at least
+    // the given capacities
+    void compact(GLsizei minVertices = 0, GLsizei minIndices = 0);
+
+    void draw(int handle, GLenum mode = GL_TRIANGLES) const;
+    void drawInstanced(int handle, GLuint vertexArray, GLsizei instanceCount) const;
+
+    // VAO reading the pool's vertices plus a second buffer described by
+    // extraFormat (e.g. per-instance data); kept up to date across compaction
+    GLuint createVertexArray(const VertexFormat &extraFormat, GLuint extraBuffer);
+    void releaseVertexArray(GLuint vertexArray);
+
+    const GeometryRange &range(int handle) const { return ranges[handle]; }
+    const VertexFormat &format() const { return vertexFormat; }
+    GLuint vertexArray() const { return vertexArrayID; }
+
+    void printStats(const char *name) const;
+    void cleanup();
+
+private:
+    struct ExtraVertexArray {
+        GLuint vertexArray;
+        VertexFormat format;
+        GLuint buffer;
+    };
+
+    VertexFormat vertexFormat;
+    GLsizei initialVertices, initialIndices;
+    GLuint vertexArrayID = 0, vertexBufferID = 0, indexBufferID = 0;
+    RangeAllocator vertexSpace, indexSpace;
+    std::vector<GeometryRange> ranges;
+    std::vector<int> freeHandles;
+    std::vector<ExtraVertexArray> extraVertexArrays;
+
+    void attachBuffers(GLuint vertexArray) const;
+};
+
+// Position (0), UV (1), normal (2), color (3); shared by every static mesh
+extern GeometryPool staticGeometry;
+
+// Position (0), normal (1), UV (2), joints (3), weights (4) for skinned glTF meshes
+extern GeometryPool skinnedGeometry;
+
+// Static mesh living in a GeometryPool
+class StaticMesh {
+public:
+    void initialize(GeometryPool &pool, const std::vector<GLfloat> &vertices, const GLuint *indices, GLsizei indexCount);
+    void draw() const;
+    void drawInstanced(GLuint vertexArray, GLsizei instanceCount) const;
+    void cleanup();
+
+    GLuint vertexArray() const { return pool ? pool->vertexArray() : 0; }
+
+private:
+    GeometryPool *pool = NULL;
+    int handle = -1;
+};
+
+#endif // GEOMETRY_POOL_H
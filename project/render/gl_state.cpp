@@ -0,0 +1,213 @@
+#include "gl_state.h"
+#include "render_stats.h"
+
+GLStateCache glState;
+
+bool GLStateCache::filter(bool redundant)
+{
+	if (redundant) {
+		renderStats.stateChangesFiltered++;
+	} else {
+		renderStats.stateChanges++;
+	}
+	return redundant;
+}
+
+void GLStateCache::invalidate()
+{
+	program = UNKNOWN;
+	vertexArray = UNKNOWN;
+	buffers.clear();
+	drawFramebuffer = readFramebuffer = UNKNOWN;
+	requestedUnit = GL_TEXTURE0;
+	activeUnit = UNKNOWN;
+	for (auto &unit : textures) {
+		unit.clear();
+	}
+	vertexArrays.clear();
+	capabilities.clear();
+	blendSource = blendDestination = UNKNOWN;
+	depthFunction = UNKNOWN;
+	colorWriteMask = depthWriteMask = -1;
+	viewportRect[0] = viewportRect[1] = viewportRect[2] = viewportRect[3] = -1;
+}
+
+void GLStateCache::useProgram(GLuint newProgram)
+{
+	if (filter(program == newProgram)) return;
+	glUseProgram(newProgram);
+	program = newProgram;
+}
+
+void GLStateCache::bindVertexArray(GLuint newVertexArray)
+{
+	if (filter(vertexArray == newVertexArray)) return;
+	glBindVertexArray(newVertexArray);
+	vertexArray = newVertexArray;
+}
+
+GLStateCache::VertexArrayState &GLStateCache::currentVertexArray()
+{
+	// With an unknown VAO bound nothing about its contents can be trusted
+	if (vertexArray == UNKNOWN) {
+		static VertexArrayState unknown;
+		unknown = VertexArrayState();
+		return unknown;
+	}
+	return vertexArrays[vertexArray];
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+	if (target == GL_ELEMENT_ARRAY_BUFFER) {
+		// The element binding is part of the vertex array object
+		VertexArrayState &state = currentVertexArray();
+		if (filter(state.elementBuffer == buffer)) return;
+		glBindBuffer(target, buffer);
+		state.elementBuffer = buffer;
+		return;
+	}
+
+	auto it = buffers.find(target);
+	if (filter(it != buffers.end() && it->second == buffer)) return;
+	glBindBuffer(target, buffer);
+	buffers[target] = buffer;
+}
+
+void GLStateCache::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	// Indexed binds are rare (setup only) and also replace the generic binding
+	renderStats.stateChanges++;
+	glBindBufferBase(target, index, buffer);
+	buffers[target] = buffer;
+}
+
+void GLStateCache::bindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	bool drawMatches = drawFramebuffer == framebuffer;
+	bool readMatches = readFramebuffer == framebuffer;
+	bool redundant = (target == GL_DRAW_FRAMEBUFFER && drawMatches) ||
+					 (target == GL_READ_FRAMEBUFFER && readMatches) ||
+					 (target == GL_FRAMEBUFFER && drawMatches && readMatches);
+	if (filter(redundant)) return;
+	glBindFramebuffer(target, framebuffer);
+	if (target != GL_READ_FRAMEBUFFER) drawFramebuffer = framebuffer;
+	if (target != GL_DRAW_FRAMEBUFFER) readFramebuffer = framebuffer;
+}
+
+void GLStateCache::activeTexture(GLenum unit)
+{
+	requestedUnit = unit;
+}
+
+void GLStateCache::bindTexture(GLenum target, GLuint texture)
+{
+	int unitIndex = static_cast<int>(requestedUnit - GL_TEXTURE0);
+	bool tracked = unitIndex >= 0 && unitIndex < MAX_TEXTURE_UNITS;
+	if (tracked) {
+		auto it = textures[unitIndex].find(target);
+		if (filter(it != textures[unitIndex].end() && it->second == texture)) return;
+	}
+
+	if (activeUnit != requestedUnit) {
+		glActiveTexture(requestedUnit);
+		activeUnit = requestedUnit;
+		renderStats.stateChanges++;
+	}
+	glBindTexture(target, texture);
+	if (tracked) {
+		textures[unitIndex][target] = texture;
+	} else {
+		renderStats.stateChanges++;
+	}
+}
+
+void GLStateCache::setAttribute(GLuint index, bool enabled)
+{
+	VertexArrayState &state = currentVertexArray();
+	uint32_t bit = index < 32 ? 1u << index : 0u;
+	bool known = (state.knownAttributes & bit) != 0;
+	if (filter(known && ((state.enabledAttributes & bit) != 0) == enabled)) return;
+
+	if (enabled) {
+		glEnableVertexAttribArray(index);
+		state.enabledAttributes |= bit;
+	} else {
+		glDisableVertexAttribArray(index);
+		state.enabledAttributes &= ~bit;
+	}
+	state.knownAttributes |= bit;
+}
+
+void GLStateCache::enableVertexAttribArray(GLuint index)
+{
+	setAttribute(index, true);
+}
+
+void GLStateCache::disableVertexAttribArray(GLuint index)
+{
+	setAttribute(index, false);
+}
+
+void GLStateCache::setCapability(GLenum capability, bool enabled)
+{
+	auto it = capabilities.find(capability);
+	if (filter(it != capabilities.end() && it->second == enabled)) return;
+	if (enabled) {
+		glEnable(capability);
+	} else {
+		glDisable(capability);
+	}
+	capabilities[capability] = enabled;
+}
+
+void GLStateCache::enable(GLenum capability)
+{
+	setCapability(capability, true);
+}
+
+void GLStateCache::disable(GLenum capability)
+{
+	setCapability(capability, false);
+}
+
+void GLStateCache::blendFunc(GLenum sourceFactor, GLenum destinationFactor)
+{
+	if (filter(blendSource == sourceFactor && blendDestination == destinationFactor)) return;
+	glBlendFunc(sourceFactor, destinationFactor);
+	blendSource = sourceFactor;
+	blendDestination = destinationFactor;
+}
+
+void GLStateCache::depthFunc(GLenum function)
+{
+	if (filter(depthFunction == function)) return;
+	glDepthFunc(function);
+	depthFunction = function;
+}
+
+void GLStateCache::colorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+	GLint mask = (red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0);
+	if (filter(colorWriteMask == mask)) return;
+	glColorMask(red, green, blue, alpha);
+	colorWriteMask = mask;
+}
+
+void GLStateCache::depthMask(GLboolean flag)
+{
+	GLint mask = flag ? 1 : 0;
+	if (filter(depthWriteMask == mask)) return;
+	glDepthMask(flag);
+	depthWriteMask = mask;
+}
+
+void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if (filter(viewportRect[0] == x && viewportRect[1] == y && viewportRect[2] == width && viewportRect[3] == height)) return;
+	glViewport(x, y, width, height);
+	viewportRect[0] = x;
+	viewportRect[1] = y;
+	viewportRect[2] = width;
+	viewportRect[3] = height;
+}
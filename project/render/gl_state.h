@@ -0,0 +1,78 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/gl.h>
+#include <cstdint>
+#include <unordered_map>
+
+// Thin shadow of the GL binding and fixed-function state. Every function
+// mirrors the GL call of the same name and only reaches the driver when the
+// tracked value actually changes; issued and filtered calls are counted in
+// renderStats. State starts out unknown, so the first call of each kind is
+// always issued.
+//
+// All rendering code must go through glState for the state it tracks, otherwise
+// the shadow goes stale. Call invalidate() after touching tracked state
+// directly or deleting an object that may still be bound.
+class GLStateCache {
+public:
+    static const int MAX_TEXTURE_UNITS = 16;
+
+    GLStateCache() { invalidate(); }
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vertexArray);
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void bindFramebuffer(GLenum target, GLuint framebuffer);
+
+    // The unit switch is deferred until a texture actually has to be bound there
+    void activeTexture(GLenum unit);
+    void bindTexture(GLenum target, GLuint texture);
+
+    // Attribute enables live in the bound vertex array and are tracked per VAO
+    void enableVertexAttribArray(GLuint index);
+    void disableVertexAttribArray(GLuint index);
+
+    void enable(GLenum capability);
+    void disable(GLenum capability);
+    void blendFunc(GLenum sourceFactor, GLenum destinationFactor);
+    void depthFunc(GLenum function);
+    void colorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+    void depthMask(GLboolean flag);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    void invalidate();
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    struct VertexArrayState {
+        GLuint elementBuffer = UNKNOWN;
+        uint32_t knownAttributes = 0;   // Bit set when the enable state of the attribute is known
+        uint32_t enabledAttributes = 0;
+    };
+
+    GLuint program;
+    GLuint vertexArray;
+    std::unordered_map<GLenum, GLuint> buffers; // Every target except GL_ELEMENT_ARRAY_BUFFER
+    GLuint drawFramebuffer, readFramebuffer;
+    GLenum requestedUnit, activeUnit;
+    std::unordered_map<GLenum, GLuint> textures[MAX_TEXTURE_UNITS];
+    std::unordered_map<GLuint, VertexArrayState> vertexArrays;
+    std::unordered_map<GLenum, bool> capabilities;
+    GLenum blendSource, blendDestination;
+    GLenum depthFunction;
+    GLint colorWriteMask; // RGBA bits, -1 when unknown
+    GLint depthWriteMask; // -1 when unknown
+    GLint viewportRect[4];
+
+    VertexArrayState &currentVertexArray();
+    void setAttribute(GLuint index, bool enabled);
+    void setCapability(GLenum capability, bool enabled);
+    bool filter(bool redundant);
+};
+
+extern GLStateCache glState;
+
+#endif // GL_STATE_H
@@ -0,0 +1,233 @@
+#include "local_lights.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+// Views of the six tiles of a point light, in the order the receivers pick
+// them by the major axis of the light-to-fragment vector: +X, -X, +Y, -Y, +Z, -Z
+static const glm::vec3 PointFaceDirections[6] = {
+	glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+	glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+};
+static const glm::vec3 PointFaceUps[6] = {
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+};
+
+// Near plane of the light projections, in world units
+static const float LightNear = 1.0f;
+
+// A tile grows once the light covers GrowRatio times its size in pixels and
+// shrinks below ShrinkRatio times, so small camera moves never reallocate it
+static const float GrowRatio = 1.5f;
+static const float ShrinkRatio = 0.5f;
+
+// Power of two nearest to pixels, within the tile size limits; 0 for no tile
+static int TileSizeFor(float pixels)
+{
+	if (pixels <= 0.0f) {
+		return 0;
+	}
+	int size = 1 << static_cast<int>(std::lround(std::log2(std::max(pixels, 1.0f))));
+	return std::min(std::max(size, static_cast<int>(ShadowAtlas::MinTile)), static_cast<int>(LocalLights::MaxTile));
+}
+
+void LocalLights::initialize()
+{
+	atlas.initialize();
+}
+
+int LocalLights::add(const Light &light)
+{
+	int tileCount = light.castsShadows ? (light.type == LIGHT_POINT ? 6 : 1) : 0;
+	if (light.type == LIGHT_DIRECTIONAL || count() == MaxLights || static_cast<int>(tiles.size()) + tileCount > MaxShadowTiles) {
+		return -1;
+	}
+	lights.emplace_back(light, static_cast<int>(tiles.size()), tileCount);
+	tiles.resize(tiles.size() + tileCount);
+	return count() - 1;
+}
+
+void LocalLights::updateMatrices(LocalLight &local)
+{
+	const Light &light = local.light;
+	for (int i = 0; i < local.tileCount; i++) {
+		glm::mat4 matrix;
+		if (light.type == LIGHT_SPOT) {
+			glm::vec3 up = std::abs(light.direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+			matrix = glm::perspective(2.0f * light.outerCone, 1.0f, LightNear, light.range) *
+					 glm::lookAt(light.position, light.position + light.direction, up);
+		} else {
+			matrix = glm::perspective(glm::radians(90.0f), 1.0f, LightNear, light.range) *
+					 glm::lookAt(light.position, light.position + PointFaceDirections[i], PointFaceUps[i]);
+		}
+
+		// A moved or re-aimed light has to redraw its shadows
+		Tile &tile = tiles[local.firstTile + i];
+		if (tile.matrix != matrix) {
+			tile.matrix = matrix;
+			tile.rendered = false;
+		}
+	}
+}
+
+void LocalLights::resize(LocalLight &local, int size)
+{
+	// All tiles of a light share one size; step down until all of them fit
+	for (; size >= ShadowAtlas::MinTile; size /= 2) {
+		int allocated = 0;
+		for (; allocated < local.tileCount; allocated++) {
+			ShadowTile region = atlas.allocate(size);
+			if (region.size == 0) {
+				break;
+			}
+			tiles[local.firstTile + allocated].region = region;
+		}
+		if (allocated == local.tileCount) {
+			break;
+		}
+		for (int i = 0; i < allocated; i++) {
+			atlas.release(tiles[local.firstTile + i].region);
+			tiles[local.firstTile + i].region = ShadowTile();
+		}
+	}
+	local.tileSize = size >= ShadowAtlas::MinTile ? size : 0;
+	for (int i = 0; i < local.tileCount; i++) {
+		tiles[local.firstTile + i].rendered = false;
+	}
+}
+
+void LocalLights::update(const glm::mat4 &viewProjection, const glm::vec3 &cameraPosition, float screenHeight, float fovY,
+						 const UniformGrid &dynamicCasters)
+{
+	frame++;
+	Frustum frustum(viewProjection);
+	float projectionScale = screenHeight / std::tan(0.5f * fovY);
+
+	// Importance: height in pixels of the light's sphere of influence on screen,
+	// at most the whole screen, which it also covers once the camera is inside
+	std::vector<int> order;
+	for (int i = 0; i < count(); i++) {
+		LocalLight &local = lights[i];
+		BoundingBox reach(local.light.position - glm::vec3(local.light.range), local.light.position + glm::vec3(local.light.range));
+		local.importance = 0.0f;
+		if (local.tileCount > 0 && frustum.intersects(reach)) {
+			float distance = glm::length(local.light.position - cameraPosition);
+			local.importance = distance > local.light.range ? std::min(projectionScale * local.light.range / distance, screenHeight) : screenHeight;
+		}
+		updateMatrices(local);
+
+		// The grid narrows the casters down to the light's range, then each
+		// tile keeps those inside its own view
+		casterHandles.clear();
+		dynamicCasters.querySphere(local.light.position, local.light.range, casterHandles);
+		for (int t = local.firstTile; t < local.firstTile + local.tileCount; t++) {
+			Frustum tileFrustum(tiles[t].matrix);
+			tiles[t].nearDynamicCaster = false;
+			for (uint32_t handle : casterHandles) {
+				tiles[t].nearDynamicCaster = tiles[t].nearDynamicCaster || tileFrustum.intersects(dynamicCasters.bounds(handle));
+			}
+		}
+		order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [this](int a, int b) { return lights[a].importance > lights[b].importance; });
+
+	// Free the tiles of every light whose size changes, then hand out tiles in
+	// order of importance so the atlas fills up with the lights that matter most
+	std::vector<int> resized;
+	for (int i : order) {
+		LocalLight &local = lights[i];
+		// Past the tile size limits the size cannot change, so neither can the
+		// hysteresis band
+		float importance = local.importance;
+		if (importance > 0.0f) {
+			importance = glm::clamp(importance, static_cast<float>(ShadowAtlas::MinTile), static_cast<float>(MaxTile));
+		}
+		bool change = local.requestedSize == 0 ? importance > 0.0f
+					  : importance == 0.0f || importance > GrowRatio * local.requestedSize || importance < ShrinkRatio * local.requestedSize;
+		if (change) {
+			local.requestedSize = TileSizeFor(importance);
+			for (int t = 0; t < local.tileCount; t++) {
+				atlas.release(tiles[local.firstTile + t].region);
+				tiles[local.firstTile + t].region = ShadowTile();
+			}
+			local.tileSize = 0;
+			resized.push_back(i);
+		}
+	}
+	for (int i : resized) {
+		resize(lights[i], lights[i].requestedSize);
+	}
+
+	// New tiles first, then those a moving caster may have changed, by
+	// importance and time since their last render
+	scheduled.clear();
+	std::vector<std::pair<float, int>> candidates;
+	for (const LocalLight &local : lights) {
+		for (int t = local.firstTile; t < local.firstTile + local.tileCount && local.tileSize > 0; t++) {
+			if (!tiles[t].rendered) {
+				candidates.push_back(std::make_pair(1e9f + local.importance, t));
+			} else if (tiles[t].nearDynamicCaster) {
+				candidates.push_back(std::make_pair(local.importance * static_cast<float>(frame - tiles[t].lastRendered), t));
+			}
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, int> &a, const std::pair<float, int> &b) {
+		return a.first > b.first;
+	});
+	for (size_t i = 0; i < candidates.size() && static_cast<int>(i) < UpdateBudget; i++) {
+		Tile &tile = tiles[candidates[i].second];
+		tile.rendered = true;
+		tile.lastRendered = frame;
+		scheduled.push_back(candidates[i].second);
+	}
+}
+
+const glm::mat4 &LocalLights::beginTile(int i)
+{
+	const Tile &tile = tiles[scheduled[i]];
+	atlas.beginTile(tile.region);
+	return tile.matrix;
+}
+
+void LocalLights::fillBlock(LocalLightBlock &block) const
+{
+	block = {};
+	for (int i = 0; i < count(); i++) {
+		const LocalLight &local = lights[i];
+		const Light &light = local.light;
+		LocalLightData &data = block.lights[i];
+		data.positionRange = glm::vec4(light.position, light.range);
+		data.directionType = glm::vec4(light.direction, static_cast<float>(light.type));
+		data.colorIntensity = glm::vec4(light.color, light.intensity);
+		data.coneShadow = glm::vec4(std::cos(light.outerCone), std::cos(light.innerCone),
+									local.tileSize > 0 ? static_cast<float>(local.firstTile) : -1.0f, 0.0f);
+	}
+	for (size_t t = 0; t < tiles.size(); t++) {
+		const Tile &tile = tiles[t];
+		block.shadowMatrices[t] = tile.matrix;
+		block.shadowTiles[t] = glm::vec4(tile.region.x, tile.region.y, tile.region.size, 0.0f) / static_cast<float>(ShadowAtlas::Size);
+		block.shadowTiles[t].w = tile.rendered ? 1.0f : 0.0f;
+	}
+	block.lightCount = count();
+}
+
+int LocalLights::tileCount() const
+{
+	int allocated = 0;
+	for (const Tile &tile : tiles) {
+		allocated += tile.region.size > 0 ? 1 : 0;
+	}
+	return allocated;
+}
+
+void LocalLights::cleanup()
+{
+	atlas.cleanup();
+	lights.clear();
+	tiles.clear();
+	scheduled.clear();
+}
@@ -0,0 +1,89 @@
+#ifndef LOCAL_LIGHTS_H
+#define LOCAL_LIGHTS_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "frame_uniforms.h"
+#include "frustum_culling.h"
+#include "shadow_atlas.h"
+#include "spatial_index.h"
+#include "utils/lightInfo.h"
+
+// Spot and point lights besides the sun, shadowed through one ShadowAtlas.
+// A spot light takes one tile and a point light six, one per axis direction.
+//
+// Every frame each light is given an importance, the height in pixels its
+// sphere of influence covers on screen, and its tiles are sized to match:
+// the nearest power of two, with some hysteresis so a light at the edge of a
+// step does not reallocate every frame. When the atlas runs out, the least
+// important lights get smaller tiles or none.
+//
+// Re-rendering every tile each frame would cost one depth pass per tile, so
+// only UpdateBudget tiles are rendered per frame: new tiles first, then tiles
+// whose view holds a dynamic caster, oldest and most important first.
+// Everything else keeps the depth it was last rendered with.
+class LocalLights {
+public:
+    static const int MaxLights = 8;
+    static const int MaxShadowTiles = 24;
+    static const int UpdateBudget = 8; // Tiles rendered per frame
+    static const int MaxTile = 512;    // Texels per side of the largest tile
+
+    void initialize();
+    void cleanup();
+
+    // Returns the light index, or -1 when the light or its tiles do not fit
+    int add(const Light &light);
+    Light &light(int index) { return lights[index].light; }
+    int count() const { return static_cast<int>(lights.size()); }
+
+    // Sizes and allocates the tiles for the view and picks the tiles to
+    // render this frame. dynamicCasters indexes the moving casters.
+    void update(const glm::mat4 &viewProjection, const glm::vec3 &cameraPosition, float screenHeight, float fovY,
+                const UniformGrid &dynamicCasters);
+
+    // Tiles picked by update(); beginTile() prepares the atlas for tile i of
+    // them and returns the light matrix to render it with
+    int scheduledCount() const { return static_cast<int>(scheduled.size()); }
+    const glm::mat4 &beginTile(int i);
+    void endTiles() { atlas.endTiles(); }
+
+    // Light and tile data for the LocalLightBlock
+    void fillBlock(LocalLightBlock &block) const;
+
+    GLuint atlasTexture() const { return atlas.texture(); }
+    int tileCount() const;
+    float atlasUsage() const { return atlas.usedTexels() / float(ShadowAtlas::Size * ShadowAtlas::Size); }
+
+private:
+    struct Tile {
+        ShadowTile region;
+        glm::mat4 matrix;
+        bool rendered = false;
+        uint32_t lastRendered = 0; // Frame of the last render
+        bool nearDynamicCaster = false;
+    };
+
+    struct LocalLight {
+        Light light;
+        int firstTile; // Index of the first of its tiles in tiles
+        int tileCount;
+        int tileSize = 0;      // Size of each of its tiles
+        int requestedSize = 0; // Size asked for; tileSize is smaller when the atlas was full
+        float importance = 0.0f;
+
+        LocalLight(const Light &l, int first, int count) : light(l), firstTile(first), tileCount(count) {}
+    };
+
+    ShadowAtlas atlas;
+    std::vector<LocalLight> lights;
+    std::vector<Tile> tiles;
+    std::vector<int> scheduled; // Indices into tiles
+    std::vector<uint32_t> casterHandles;
+    uint32_t frame = 0;
+
+    void updateMatrices(LocalLight &local);
+    void resize(LocalLight &local, int size);
+};
+
+#endif // LOCAL_LIGHTS_H
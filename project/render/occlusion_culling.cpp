@@ -0,0 +1,246 @@
+#include "occlusion_culling.h"
+#include "render_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+// Corner i of a box takes max.x when bit 0 is set, max.y for bit 1, max.z for bit 2
+static glm::vec3 BoxCorner(const BoundingBox &box, int i)
+{
+	return glm::vec3((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+}
+
+// Two counter-clockwise triangles per face, seen from outside the box
+static const int BoxTriangles[12][3] = {
+	{0, 4, 6}, {0, 6, 2}, // -X
+	{1, 3, 7}, {1, 7, 5}, // +X
+	{0, 1, 5}, {0, 5, 4}, // -Y
+	{2, 6, 7}, {2, 7, 3}, // +Y
+	{0, 2, 3}, {0, 3, 1}, // -Z
+	{4, 5, 7}, {4, 7, 6}, // +Z
+};
+
+// Projects the corners of box to buffer space. Fails when a corner lies in
+// front of the near plane, where the projection cannot be trusted.
+static bool ProjectBox(const glm::mat4 &viewProjection, const BoundingBox &box, glm::vec3 corners[8])
+{
+	for (int i = 0; i < 8; i++) {
+		glm::vec4 clip = viewProjection * glm::vec4(BoxCorner(box, i), 1.0f);
+		if (clip.w <= 0.0f || clip.z < -clip.w) {
+			return false;
+		}
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		corners[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * OcclusionCuller::Width,
+							   (ndc.y * 0.5f + 0.5f) * OcclusionCuller::Height,
+							   ndc.z * 0.5f + 0.5f);
+	}
+	return true;
+}
+
+void OcclusionCuller::initialize(WorkerPool *workerPool)
+{
+	workers = workerPool;
+	depth.assign(Width * Height, 1.0f);
+	tileMaxDepth.assign(TilesX * TilesY, 1.0f);
+}
+
+void OcclusionCuller::renderOccluders(const glm::mat4 &matrix, const std::vector<BoundingBox> &occluders)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	viewProjection = matrix;
+
+	triangles.clear();
+	for (const BoundingBox &box : occluders) {
+		glm::vec3 corners[8];
+		if (!ProjectBox(viewProjection, box, corners)) {
+			continue;
+		}
+		for (const int *indices : BoxTriangles) {
+			ScreenTriangle triangle;
+			triangle.v[0] = corners[indices[0]];
+			triangle.v[1] = corners[indices[1]];
+			triangle.v[2] = corners[indices[2]];
+			glm::vec2 ab = glm::vec2(triangle.v[1] - triangle.v[0]);
+			glm::vec2 ac = glm::vec2(triangle.v[2] - triangle.v[0]);
+			if (ab.x * ac.y - ab.y * ac.x <= 0.0f) {
+				continue; // Back facing or degenerate
+			}
+			glm::vec3 low = glm::min(triangle.v[0], glm::min(triangle.v[1], triangle.v[2]));
+			glm::vec3 high = glm::max(triangle.v[0], glm::max(triangle.v[1], triangle.v[2]));
+			triangle.minX = std::max(0, static_cast<int>(std::floor(low.x)));
+			triangle.minY = std::max(0, static_cast<int>(std::floor(low.y)));
+			triangle.maxX = std::min(Width - 1, static_cast<int>(std::floor(high.x)));
+			triangle.maxY = std::min(Height - 1, static_cast<int>(std::floor(high.y)));
+			if (triangle.minX <= triangle.maxX && triangle.minY <= triangle.maxY) {
+				triangles.push_back(triangle);
+			}
+		}
+	}
+	hasOccluders = !triangles.empty();
+
+	if (hasOccluders) {
+		// One band of whole tile rows per job; every band bins the triangles itself
+		int bandCount = std::min(TilesY, workers ? workers->size() + 1 : 1);
+		int bandHeight = (TilesY + bandCount - 1) / bandCount * TileSize;
+		auto job = [this, bandHeight](int band) {
+			rasterizeBand(band * bandHeight, std::min(Height, (band + 1) * bandHeight));
+		};
+		if (workers) {
+			workers->run(bandCount, job);
+		} else {
+			job(0);
+		}
+	}
+	renderStats.occlusionTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void OcclusionCuller::rasterizeBand(int firstRow, int lastRow)
+{
+	std::fill(depth.begin() + firstRow * Width, depth.begin() + lastRow * Width, 1.0f);
+	for (const ScreenTriangle &triangle : triangles) {
+		if (triangle.maxY >= firstRow && triangle.minY < lastRow) {
+			rasterizeTriangle(triangle, firstRow, lastRow);
+		}
+	}
+
+	for (int tileY = firstRow / TileSize; tileY < lastRow / TileSize; tileY++) {
+		for (int tileX = 0; tileX < TilesX; tileX++) {
+			const float *row = &depth[tileY * TileSize * Width + tileX * TileSize];
+#if defined(OCCLUSION_SSE)
+			__m128 farthest = _mm_setzero_ps();
+			for (int y = 0; y < TileSize; y++, row += Width) {
+				farthest = _mm_max_ps(farthest, _mm_max_ps(_mm_loadu_ps(row), _mm_loadu_ps(row + 4)));
+			}
+			farthest = _mm_max_ps(farthest, _mm_movehl_ps(farthest, farthest));
+			farthest = _mm_max_ss(farthest, _mm_shuffle_ps(farthest, farthest, 1));
+			tileMaxDepth[tileY * TilesX + tileX] = _mm_cvtss_f32(farthest);
+#else
+			float farthest = 0.0f;
+			for (int y = 0; y < TileSize; y++, row += Width) {
+				for (int x = 0; x < TileSize; x++) {
+					farthest = std::max(farthest, row[x]);
+				}
+			}
+			tileMaxDepth[tileY * TilesX + tileX] = farthest;
+#endif
+		}
+	}
+}
+
+void OcclusionCuller::rasterizeTriangle(const ScreenTriangle &triangle, int firstRow, int lastRow)
+{
+	const glm::vec3 &a = triangle.v[0], &b = triangle.v[1], &c = triangle.v[2];
+
+	// Edge functions A * x + B * y + C, non-negative inside a counter-clockwise triangle
+	float edgeA[3], edgeB[3], edgeC[3];
+	const glm::vec3 *from[3] = {&a, &b, &c}, *to[3] = {&b, &c, &a};
+	for (int e = 0; e < 3; e++) {
+		edgeA[e] = from[e]->y - to[e]->y;
+		edgeB[e] = to[e]->x - from[e]->x;
+		edgeC[e] = -(edgeA[e] * from[e]->x + edgeB[e] * from[e]->y);
+	}
+
+	// Post-projection depth is affine in screen space
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	float depthDx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+	float depthDy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+	float depthC = a.z - depthDx * a.x - depthDy * a.y;
+
+	int rowStart = std::max(triangle.minY, firstRow);
+	int rowEnd = std::min(triangle.maxY, lastRow - 1);
+	int columnStart = triangle.minX & ~3;
+	for (int y = rowStart; y <= rowEnd; y++) {
+		float py = y + 0.5f;
+		float *row = &depth[y * Width];
+#if defined(OCCLUSION_SSE)
+		const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		const __m128 zero = _mm_setzero_ps();
+		__m128 rowEdge0 = _mm_set1_ps(edgeB[0] * py + edgeC[0]);
+		__m128 rowEdge1 = _mm_set1_ps(edgeB[1] * py + edgeC[1]);
+		__m128 rowEdge2 = _mm_set1_ps(edgeB[2] * py + edgeC[2]);
+		__m128 rowDepth = _mm_set1_ps(depthDy * py + depthC);
+		for (int x = columnStart; x <= triangle.maxX; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets);
+			__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(edgeA[0])), rowEdge0), zero);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(edgeA[1])), rowEdge1), zero));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(edgeA[2])), rowEdge2), zero));
+			if (_mm_movemask_ps(inside) == 0) {
+				continue;
+			}
+			__m128 z = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(depthDx)), rowDepth);
+			__m128 current = _mm_loadu_ps(row + x);
+			__m128 nearest = _mm_min_ps(current, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+		}
+#else
+		for (int x = columnStart; x <= triangle.maxX; x++) {
+			float px = x + 0.5f;
+			if (edgeA[0] * px + edgeB[0] * py + edgeC[0] >= 0.0f &&
+				edgeA[1] * px + edgeB[1] * py + edgeC[1] >= 0.0f &&
+				edgeA[2] * px + edgeB[2] * py + edgeC[2] >= 0.0f) {
+				row[x] = std::min(row[x], depthDx * px + depthDy * py + depthC);
+			}
+		}
+#endif
+	}
+}
+
+bool OcclusionCuller::isVisible(const BoundingBox &box) const
+{
+	if (!enabled || !hasOccluders) {
+		return true;
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	bool visible = false;
+
+	glm::vec3 corners[8];
+	if (!ProjectBox(viewProjection, box, corners)) {
+		visible = true; // Reaches past the near plane, so it surrounds the camera
+	} else {
+		glm::vec3 low = corners[0], high = corners[0];
+		for (int i = 1; i < 8; i++) {
+			low = glm::min(low, corners[i]);
+			high = glm::max(high, corners[i]);
+		}
+		int x0 = std::max(0, static_cast<int>(std::floor(low.x)));
+		int y0 = std::max(0, static_cast<int>(std::floor(low.y)));
+		int x1 = std::min(Width - 1, static_cast<int>(std::floor(high.x)));
+		int y1 = std::min(Height - 1, static_cast<int>(std::floor(high.y)));
+		float nearestDepth = low.z;
+		if (x0 > x1 || y0 > y1) {
+			visible = true; // Off screen; leave it to frustum culling
+		}
+
+		for (int tileY = y0 / TileSize; !visible && tileY <= y1 / TileSize; tileY++) {
+			for (int tileX = x0 / TileSize; !visible && tileX <= x1 / TileSize; tileX++) {
+				if (nearestDepth > tileMaxDepth[tileY * TilesX + tileX]) {
+					continue; // Behind every occluder pixel in the tile
+				}
+				int rowEnd = std::min(y1, tileY * TileSize + TileSize - 1);
+				int columnStart = std::max(x0, tileX * TileSize);
+				int columnEnd = std::min(x1, tileX * TileSize + TileSize - 1);
+				for (int y = std::max(y0, tileY * TileSize); !visible && y <= rowEnd; y++) {
+					const float *row = &depth[y * Width];
+					for (int x = columnStart; x <= columnEnd; x++) {
+						if (row[x] >= nearestDepth) {
+							visible = true;
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if (!visible) {
+		renderStats.objectsOccluded++;
+	}
+	renderStats.occlusionTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return visible;
+}
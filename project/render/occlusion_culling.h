@@ -0,0 +1,61 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "frustum_culling.h"
+#include "worker_pool.h"
+
+// Software occlusion culling against a small CPU depth buffer. Each frame the
+// caller rasterizes a handful of large occluder boxes (SSE, four pixels per
+// step) into a Width x Height buffer split into horizontal bands, one job per
+// band on the worker pool. Every band then reduces its 8x8 tiles to their
+// farthest depth. isVisible() rejects boxes whose nearest depth lies behind
+// the farthest occluder depth in every tile they cover, falling back to a
+// per-pixel test for tiles where that is not conclusive.
+//
+// Unlike full masked occlusion culling, tiles keep plain depth rather than
+// coverage masks with two depth layers; at this resolution the difference
+// is a few partially covered tiles.
+class OcclusionCuller {
+public:
+    static const int Width = 256;
+    static const int Height = 192;
+    static const int TileSize = 8;
+
+    void initialize(WorkerPool *workers);
+
+    void setEnabled(bool enable) { enabled = enable; }
+    bool isEnabled() const { return enabled; }
+
+    // Clears the buffer and renders the occluders seen through viewProjection.
+    // Boxes crossing the near plane are skipped, which is always conservative.
+    void renderOccluders(const glm::mat4 &viewProjection, const std::vector<BoundingBox> &occluders);
+
+    // False only for boxes hidden behind the last renderOccluders() call.
+    // Adds to the occlusion counters of renderStats.
+    bool isVisible(const BoundingBox &box) const;
+
+private:
+    static const int TilesX = Width / TileSize;
+    static const int TilesY = Height / TileSize;
+
+    // Occluder triangle in buffer space: x and y in pixels, z in [0, 1]
+    struct ScreenTriangle {
+        glm::vec3 v[3];
+        int minX, maxX, minY, maxY;
+    };
+
+    WorkerPool *workers = NULL;
+    bool enabled = true;
+    bool hasOccluders = false;
+    glm::mat4 viewProjection;
+    std::vector<float> depth;        // Row major, row 0 at the bottom of the screen
+    std::vector<float> tileMaxDepth; // Farthest depth in each 8x8 tile
+    std::vector<ScreenTriangle> triangles;
+
+    void rasterizeBand(int firstRow, int lastRow);
+    void rasterizeTriangle(const ScreenTriangle &triangle, int firstRow, int lastRow);
+};
+
+#endif // OCCLUSION_CULLING_H
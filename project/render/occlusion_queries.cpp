@@ -0,0 +1,177 @@
+#include "occlusion_queries.h"
+#include "gl_state.h"
+#include "render_stats.h"
+#include "shader.h"
+
+#include <iostream>
+
+// Proxies are grown a little so they never z-fight with the geometry they stand for
+static const float ProxyMargin = 0.5f;
+
+static const GLfloat ProxyVertices[24] = {
+	-1.0f, -1.0f, -1.0f,
+	1.0f, -1.0f, -1.0f,
+	-1.0f, 1.0f, -1.0f,
+	1.0f, 1.0f, -1.0f,
+	-1.0f, -1.0f, 1.0f,
+	1.0f, -1.0f, 1.0f,
+	-1.0f, 1.0f, 1.0f,
+	1.0f, 1.0f, 1.0f,
+};
+
+// Counter-clockwise seen from outside, so the proxy survives back-face culling
+static const GLuint ProxyIndices[36] = {
+	0, 4, 6, 0, 6, 2, // -X
+	1, 3, 7, 1, 7, 5, // +X
+	0, 1, 5, 0, 5, 4, // -Y
+	2, 6, 7, 2, 7, 3, // +Y
+	0, 2, 3, 0, 3, 1, // -Z
+	4, 5, 7, 4, 7, 6, // +Z
+};
+
+void OcclusionQueries::initialize()
+{
+	proxy.initialize(staticGeometry, staticGeometry.format().interleave(8, {ProxyVertices, NULL, NULL, NULL}), ProxyIndices, 36);
+
+	programID = AcquireShaderProgram("../project/occlusion_proxy.vert", "../project/depth.frag");
+	if (programID == 0) {
+		std::cerr << "Failed to load occlusion proxy shaders." << std::endl;
+		return;
+	}
+	program = GetShaderProgram(programID);
+	boxCenterID = program->location("boxCenter");
+	boxExtentID = program->location("boxExtent");
+}
+
+int OcclusionQueries::add()
+{
+	QueryObject object;
+	glGenQueries(MaxPending, object.queries);
+	objects.push_back(object);
+	return static_cast<int>(objects.size()) - 1;
+}
+
+void OcclusionQueries::beginFrame()
+{
+	frame++;
+	for (QueryObject &object : objects) {
+		// Queries finish in order, so stop at the first one still in flight
+		while (object.pending > 0) {
+			GLuint oldest = object.queries[object.first];
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(oldest, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				break;
+			}
+			GLuint samplesPassed = 0;
+			glGetQueryObjectuiv(oldest, GL_QUERY_RESULT, &samplesPassed);
+			object.visible = samplesPassed != 0;
+			object.first = (object.first + 1) % MaxPending;
+			object.pending--;
+			if (object.visible) {
+				renderStats.queriesVisible++;
+			} else {
+				renderStats.queriesOccluded++;
+			}
+		}
+	}
+}
+
+bool OcclusionQueries::isVisible(int handle, const BoundingBox &box)
+{
+	if (!enabled) {
+		return true;
+	}
+	QueryObject &object = objects[handle];
+	if (object.lastSeen + 1 < frame) {
+		object.visible = true; // Back in view; its old result no longer applies
+	}
+	object.lastSeen = frame;
+	object.box = box;
+	return object.visible;
+}
+
+void OcclusionQueries::beginDraw(int handle, const BoundingBox &box)
+{
+	if (isVisible(handle, box)) {
+		return;
+	}
+
+	// Render conditionally on a fresh query, or on the newest one in flight
+	// when there is no room for another
+	QueryObject &object = objects[handle];
+	GLuint condition;
+	if (object.pending < MaxPending) {
+		condition = query(object);
+	} else {
+		condition = object.queries[(object.first + object.pending - 1) % MaxPending];
+	}
+	glBeginConditionalRender(condition, GL_QUERY_WAIT);
+	object.conditional = true;
+	renderStats.conditionalDraws++;
+}
+
+void OcclusionQueries::endDraw(int handle)
+{
+	QueryObject &object = objects[handle];
+	if (object.conditional) {
+		glEndConditionalRender();
+		object.conditional = false;
+	}
+}
+
+void OcclusionQueries::issueQueries(const glm::vec3 &cameraPosition)
+{
+	if (!enabled) {
+		return;
+	}
+	for (size_t i = 0; i < objects.size(); i++) {
+		QueryObject &object = objects[i];
+		if (object.lastSeen != frame || object.lastQueried == frame || object.pending == MaxPending) {
+			continue;
+		}
+		if (object.visible && (frame + i) % VisibleInterval != 0) {
+			continue;
+		}
+		// From inside the box the proxy would be clipped away by the near plane
+		glm::vec3 low = object.box.min - glm::vec3(ProxyMargin + 1.0f);
+		glm::vec3 high = object.box.max + glm::vec3(ProxyMargin + 1.0f);
+		if (glm::all(glm::greaterThanEqual(cameraPosition, low)) && glm::all(glm::lessThanEqual(cameraPosition, high))) {
+			object.visible = true;
+			continue;
+		}
+		query(object);
+	}
+}
+
+GLuint OcclusionQueries::query(QueryObject &object)
+{
+	// Proxies only test depth; they must neither write it nor show up on screen
+	program->use();
+	program->setVec3(boxCenterID, object.box.center());
+	program->setVec3(boxExtentID, object.box.extent() + glm::vec3(ProxyMargin));
+	glState.colorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glState.depthMask(GL_FALSE);
+
+	GLuint id = object.queries[(object.first + object.pending) % MaxPending];
+	glBeginQuery(GL_ANY_SAMPLES_PASSED, id);
+	proxy.draw();
+	glEndQuery(GL_ANY_SAMPLES_PASSED);
+	object.pending++;
+	object.lastQueried = frame;
+	renderStats.queriesIssued++;
+
+	glState.depthMask(GL_TRUE);
+	glState.colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	return id;
+}
+
+void OcclusionQueries::cleanup()
+{
+	for (QueryObject &object : objects) {
+		glDeleteQueries(MaxPending, object.queries);
+	}
+	objects.clear();
+	proxy.cleanup();
+	ReleaseShaderProgram(programID);
+}
@@ -0,0 +1,76 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "frustum_culling.h"
+#include "geometry_pool.h"
+#include "shader_program.h"
+
+// Hardware occlusion queries with temporal coherence, after CHC++. Every
+// registered object keeps the visibility from its last finished
+// GL_ANY_SAMPLES_PASSED query; results are collected without waiting, so they
+// arrive one or two frames late. Objects that re-enter the view are assumed
+// visible. Occluded objects are queried every frame and visible ones only
+// every VisibleInterval frames, to notice when they become hidden.
+//
+// Objects drawn one at a time can go through beginDraw()/endDraw(): while an
+// object is believed occluded its proxy box is queried on the spot and the
+// object is drawn under conditional rendering, so the GPU drops it without
+// the CPU ever waiting on a result.
+class OcclusionQueries {
+public:
+    static const int MaxPending = 2;      // Queries in flight per object
+    static const int VisibleInterval = 4; // Frames between queries of a visible object
+
+    void initialize();
+    void cleanup();
+
+    void setEnabled(bool enable) { enabled = enable; }
+    bool isEnabled() const { return enabled; }
+
+    // Registers an object and returns its handle
+    int add();
+
+    // Starts a frame and collects every finished result
+    void beginFrame();
+
+    // Last known visibility of an object that passed frustum culling this
+    // frame; box is the world box its proxy is drawn with
+    bool isVisible(int handle, const BoundingBox &box);
+
+    // Wraps the draw of a single object. Between beginDraw() and endDraw() an
+    // occluded object renders conditionally on its newest query.
+    void beginDraw(int handle, const BoundingBox &box);
+    void endDraw(int handle);
+
+    // Queries the proxies of the objects seen this frame that are due. Call
+    // once the scene is drawn, so the proxies are tested against all of it.
+    void issueQueries(const glm::vec3 &cameraPosition);
+
+private:
+    struct QueryObject {
+        GLuint queries[MaxPending];
+        int first = 0;   // Oldest query in flight
+        int pending = 0; // Queries in flight
+        bool visible = true;
+        bool conditional = false;
+        uint32_t lastSeen = 0, lastQueried = 0;
+        BoundingBox box;
+    };
+
+    bool enabled = false;
+    uint32_t frame = 1;
+    std::vector<QueryObject> objects;
+
+    StaticMesh proxy; // Unit cube in the static geometry pool
+    GLuint programID = 0;
+    ShaderProgram *program = NULL;
+    GLint boxCenterID, boxExtentID;
+
+    // Issues a query on the object's proxy box and returns it
+    GLuint query(QueryObject &object);
+};
+
+#endif // OCCLUSION_QUERIES_H
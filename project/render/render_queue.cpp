@@ -0,0 +1,167 @@
+#include "render_queue.h"
+#include "gl_state.h"
+#include "render_stats.h"
+
+#include <cstring>
+#include <utility>
+
+void RadixSortByKey(std::vector<SortEntry> &entries, std::vector<SortEntry> &scratch)
+{
+	size_t count = entries.size();
+	if (count < 2) {
+		return;
+	}
+	scratch.resize(count);
+
+	// Bits that differ between any two keys; bytes without such bits need no pass
+	uint64_t varyingBits = 0;
+	for (size_t i = 1; i < count; i++) {
+		varyingBits |= entries[i].key ^ entries[0].key;
+	}
+
+	SortEntry *source = entries.data();
+	SortEntry *destination = scratch.data();
+	for (int shift = 0; shift < 64; shift += 8) {
+		if (((varyingBits >> shift) & 0xFF) == 0) {
+			continue;
+		}
+
+		size_t offsets[256] = {0};
+		for (size_t i = 0; i < count; i++) {
+			offsets[(source[i].key >> shift) & 0xFF]++;
+		}
+		size_t total = 0;
+		for (size_t &offset : offsets) {
+			size_t bucketSize = offset;
+			offset = total;
+			total += bucketSize;
+		}
+		for (size_t i = 0; i < count; i++) {
+			destination[offsets[(source[i].key >> shift) & 0xFF]++] = source[i];
+		}
+		std::swap(source, destination);
+	}
+
+	if (source != entries.data()) {
+		std::memcpy(entries.data(), source, count * sizeof(SortEntry));
+	}
+}
+
+uint64_t RenderQueue::makeKey(RenderPass pass, GLuint program, GLuint texture, GLuint vertexArray, float distance)
+{
+	uint32_t distanceBits;
+	distance = distance > 0.0f ? distance : 0.0f;
+	std::memcpy(&distanceBits, &distance, sizeof(distanceBits));
+	uint64_t depth = distanceBits >> 8;  // Top 24 bits keep the order of non-negative floats
+
+	uint64_t state = (uint64_t(program & 0x3FF) << 20) | (uint64_t(texture & 0x3FF) << 10) | uint64_t(vertexArray & 0x3FF);
+	uint64_t key = uint64_t(pass) << 61;
+	if (pass == PASS_TRANSPARENT) {
+		key |= ((0xFFFFFFull - depth) << 37) | (state << 7);
+	} else {
+		key |= (state << 31) | (depth << 7);
+	}
+	return key;
+}
+
+void RenderQueue::begin(const glm::vec3 &position, const glm::mat4 &viewProjection)
+{
+	viewPosition = position;
+	frustum = Frustum(viewProjection);
+	packets.clear();
+	entries.clear();
+	packetBounds.clear();
+	boundedBoxes.clear();
+	boundedEntries.clear();
+}
+
+void RenderQueue::submit(RenderPass pass, GLuint program, GLuint texture, GLuint vertexArray,
+						 const glm::vec3 &center, DrawFunction draw, void *object, GLuint argument)
+{
+	SortEntry entry;
+	entry.key = makeKey(pass, program, texture, vertexArray, glm::length(center - viewPosition));
+	entry.index = static_cast<uint32_t>(packets.size());
+	entries.push_back(entry);
+
+	DrawPacket packet;
+	packet.draw = draw;
+	packet.object = object;
+	packet.argument = argument;
+	packets.push_back(packet);
+}
+
+void RenderQueue::submit(RenderPass pass, GLuint program, GLuint texture, GLuint vertexArray,
+						 const BoundingBox &bounds, DrawFunction draw, void *object, GLuint argument)
+{
+	packetBounds.add(bounds);
+	boundedBoxes.push_back(bounds);
+	boundedEntries.push_back(static_cast<uint32_t>(entries.size()));
+	submit(pass, program, texture, vertexArray, bounds.center(), draw, object, argument);
+}
+
+void RenderQueue::applyPassState(RenderPass pass)
+{
+	switch (pass) {
+	case PASS_SKY:
+		// The sky may land exactly on already-written depth
+		glState.depthFunc(GL_LEQUAL);
+		glState.disable(GL_BLEND);
+		glState.disable(GL_PROGRAM_POINT_SIZE);
+		break;
+	case PASS_TRANSPARENT:
+		glState.depthFunc(GL_LESS);
+		glState.enable(GL_BLEND);
+		glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glState.enable(GL_PROGRAM_POINT_SIZE); // Particles size their points in the shader
+		break;
+	default:
+		glState.depthFunc(GL_LESS);
+		glState.disable(GL_BLEND);
+		glState.disable(GL_PROGRAM_POINT_SIZE);
+		break;
+	}
+}
+
+void RenderQueue::execute()
+{
+	// Drop bounded packets outside the frustum or behind occluders by flagging
+	// their entries with an invalid index, then compacting the entry list
+	if (packetBounds.size() > 0) {
+		visibleBounds.clear();
+		packetBounds.cull(frustum, visibleBounds, cullingStats);
+		size_t next = 0;
+		for (size_t box = 0; box < boundedEntries.size(); box++) {
+			if (next < visibleBounds.size() && visibleBounds[next] == box) {
+				next++;
+				if (occlusionCuller && !occlusionCuller->isVisible(boundedBoxes[box])) {
+					entries[boundedEntries[box]].index = UINT32_MAX;
+				}
+			} else {
+				entries[boundedEntries[box]].index = UINT32_MAX;
+			}
+		}
+		size_t kept = 0;
+		for (const SortEntry &entry : entries) {
+			if (entry.index != UINT32_MAX) {
+				entries[kept++] = entry;
+			}
+		}
+		entries.resize(kept);
+	}
+
+	RadixSortByKey(entries, scratch);
+
+	int currentPass = -1;
+	for (const SortEntry &entry : entries) {
+		int pass = static_cast<int>(entry.key >> 61);
+		if (pass != currentPass) {
+			applyPassState(static_cast<RenderPass>(pass));
+			currentPass = pass;
+		}
+		const DrawPacket &packet = packets[entry.index];
+		packet.draw(packet.object, packet.argument);
+	}
+	renderStats.packetsSubmitted += static_cast<int>(entries.size());
+
+	applyPassState(PASS_OPAQUE);
+}
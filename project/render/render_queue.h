@@ -0,0 +1,100 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "frustum_culling.h"
+#include "occlusion_culling.h"
+
+// Passes in submission order. The pass occupies the top bits of every sort key,
+// so a single sorted queue can hold several passes.
+enum RenderPass {
+    PASS_DEPTH = 0,       // Shadow map
+    PASS_OPAQUE = 1,      // Lit geometry, front to back
+    PASS_SKY = 2,         // Skybox after opaque geometry so it is mostly depth-rejected
+    PASS_TRANSPARENT = 3  // Blended geometry, back to front
+};
+
+// Entry sorted by RadixSortByKey; index refers back into the caller's array
+struct SortEntry {
+    uint64_t key;
+    uint32_t index;
+};
+
+// Stable LSD radix sort on the 64-bit keys, 8 bits per pass. Byte positions
+// where every key agrees are skipped. scratch is resized as needed.
+void RadixSortByKey(std::vector<SortEntry> &entries, std::vector<SortEntry> &scratch);
+
+// Callback executing one packet; object and argument come from the packet
+typedef void (*DrawFunction)(void *object, GLuint argument);
+
+struct DrawPacket {
+    DrawFunction draw;
+    void *object;
+    GLuint argument; // Texture or program the callback needs, e.g. the shadow map
+};
+
+// Per-frame list of draw packets. Objects submit packets with the state they
+// will bind, the queue builds the sort key and execute() issues them grouped by
+// program, texture and VAO: front to back for opaque passes, back to front for
+// transparent ones. Pass-wide blend and depth state is applied at pass boundaries.
+// Packets submitted with a bounding box are frustum culled together, in one
+// SIMD batch, at the start of execute(), and then tested against the occlusion
+// culler if one is attached.
+//
+// Key layout (most significant first):
+//   opaque-like:  pass:3 | program:10 | texture:10 | vao:10 | depth:24 | unused:7
+//   transparent:  pass:3 | ~depth:24  | program:10 | texture:10 | vao:10 | unused:7
+// GL names are truncated to 10 bits, which only affects grouping, never order
+// between passes. Depth is the view distance's float bits, which sort like
+// integers for non-negative values.
+class RenderQueue {
+public:
+    // Clears the queue; distances are measured from viewPosition and bounded
+    // packets are culled against the frustum of viewProjection
+    void begin(const glm::vec3 &viewPosition, const glm::mat4 &viewProjection);
+
+    // Packet that is always drawn, sorted by the distance to center
+    void submit(RenderPass pass, GLuint program, GLuint texture, GLuint vertexArray,
+                const glm::vec3 &center, DrawFunction draw, void *object, GLuint argument = 0);
+    // Packet dropped when bounds lies outside the frustum
+    void submit(RenderPass pass, GLuint program, GLuint texture, GLuint vertexArray,
+                const BoundingBox &bounds, DrawFunction draw, void *object, GLuint argument = 0);
+
+    // Kept across frames; NULL disables occlusion culling for this queue
+    void setOcclusionCuller(const OcclusionCuller *culler) { occlusionCuller = culler; }
+    const OcclusionCuller *getOcclusionCuller() const { return occlusionCuller; }
+
+    // Kept across frames; culling in this queue, including the instances
+    // objects cull against its frustum, is counted in stats when given
+    void setCullingStats(RenderStats *stats) { cullingStats = stats; }
+    RenderStats *getCullingStats() const { return cullingStats; }
+
+    // Sorts and issues every packet, then restores the opaque pass state
+    void execute();
+
+    int size() const { return static_cast<int>(packets.size()); }
+    const glm::vec3 &getViewPosition() const { return viewPosition; }
+    const Frustum &getFrustum() const { return frustum; }
+
+    static uint64_t makeKey(RenderPass pass, GLuint program, GLuint texture, GLuint vertexArray, float distance);
+
+private:
+    glm::vec3 viewPosition;
+    Frustum frustum;
+    const OcclusionCuller *occlusionCuller = NULL;
+    RenderStats *cullingStats = NULL;
+    std::vector<DrawPacket> packets;
+    std::vector<SortEntry> entries, scratch;
+
+    CullingSet packetBounds;
+    std::vector<BoundingBox> boundedBoxes; // Same order as packetBounds
+    std::vector<uint32_t> boundedEntries; // Entry of each box in packetBounds
+    std::vector<uint32_t> visibleBounds;
+
+    static void applyPassState(RenderPass pass);
+};
+
+#endif // RENDER_QUEUE_H
@@ -0,0 +1,3 @@
+#include "render_stats.h"
+
+RenderStats renderStats;
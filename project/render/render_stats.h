@@ -0,0 +1,56 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+// Per-frame renderer counters, reset at the start of every frame and
+// summarised once per second by the main loop.
+struct RenderStats {
+    int drawCalls = 0;      // glDraw* calls issued this frame
+    int instancesDrawn = 0; // Instances submitted through instanced draws
+    int uniformUploads = 0;        // glUniform* calls issued through ShaderProgram
+    int uniformUploadsSkipped = 0; // Uploads dropped because the value was unchanged
+    int stateChanges = 0;          // Binds and enables that reached GL through glState
+    int stateChangesFiltered = 0;  // Redundant binds and enables dropped by glState
+    int packetsSubmitted = 0;      // Draw packets executed by render queues
+    int objectsVisible = 0;        // Bounding boxes that passed frustum culling in the scene pass
+    int objectsCulled = 0;         // Bounding boxes rejected by frustum culling in the scene pass
+    double cullingTime = 0.0;      // Milliseconds spent frustum culling for the scene pass
+    int objectsOccluded = 0;       // Frustum survivors hidden behind software occluders
+    double occlusionTime = 0.0;    // Milliseconds rasterizing occluders and testing boxes
+    int queriesIssued = 0;         // Hardware occlusion queries begun this frame
+    int queriesVisible = 0;        // Query results collected this frame that saw samples pass
+    int queriesOccluded = 0;       // Query results collected this frame with no samples passed
+    int conditionalDraws = 0;      // Draws left to the GPU under conditional rendering
+    int shadowFullUpdates = 0;        // Frames that re-rendered the static shadow casters
+    int shadowIncrementalUpdates = 0; // Frames that reused the cached static shadow depth
+    int shadowTileUpdates = 0;        // Local light shadow atlas tiles rendered this frame
+    double particleTime = 0.0;        // Milliseconds the CPU spent updating or dispatching particles
+    double particleSortTime = 0.0;    // Milliseconds spent depth sorting particles
+
+    void reset() {
+        drawCalls = 0;
+        instancesDrawn = 0;
+        uniformUploads = 0;
+        uniformUploadsSkipped = 0;
+        stateChanges = 0;
+        stateChangesFiltered = 0;
+        packetsSubmitted = 0;
+        objectsVisible = 0;
+        objectsCulled = 0;
+        cullingTime = 0.0;
+        objectsOccluded = 0;
+        occlusionTime = 0.0;
+        queriesIssued = 0;
+        queriesVisible = 0;
+        queriesOccluded = 0;
+        conditionalDraws = 0;
+        shadowFullUpdates = 0;
+        shadowIncrementalUpdates = 0;
+        shadowTileUpdates = 0;
+        particleTime = 0.0;
+        particleSortTime = 0.0;
+    }
+};
+
+extern RenderStats renderStats;
+
+#endif // RENDER_STATS_H
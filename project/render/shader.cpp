@@ -1,178 +1,387 @@
 #include "shader.h"
+#include "frame_uniforms.h"
+#include "shader_program.h"
+#include "gl_state.h"
 
-#include <string> 
-#include <iostream> 
+#include <string>
+#include <iostream>
 #include <fstream>
-#include <sstream> 
+#include <sstream>
 #include <vector>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <memory>
+#include <filesystem>
+#include <cstdint>
+#include <GLFW/glfw3.h>
 
-GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path)
+// GL_ARB_get_program_binary is not part of the generated GL 3.3 loader, so its entry points
+// and enums are resolved by hand when the driver advertises the extension.
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+typedef void (GLAD_API_PTR *PFNGLGETPROGRAMBINARYPROC_)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (GLAD_API_PTR *PFNGLPROGRAMBINARYPROC_)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (GLAD_API_PTR *PFNGLPROGRAMPARAMETERIPROC_)(GLuint program, GLenum pname, GLint value);
+
+static PFNGLGETPROGRAMBINARYPROC_ glGetProgramBinary_ = NULL;
+static PFNGLPROGRAMBINARYPROC_ glProgramBinary_ = NULL;
+static PFNGLPROGRAMPARAMETERIPROC_ glProgramParameteri_ = NULL;
+
+static bool binaryCacheEnabled = false;
+static std::string binaryCacheDirectory;
+static std::string driverString; // Vendor, renderer and version the cached binaries were built with
+static ShaderCacheStats cacheStats = {0, 0, 0, 0.0};
+
+// Stats for one program build, filled by CompileAndLinkProgram
+struct ProgramBuildInfo {
+	double compileMs;
+	double linkMs;
+	bool fromCache;
+};
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start)
 {
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if (VertexShaderStream.is_open())
+// Reads a shader source and expands its #include "file" lines, with the file
+// found next to the including one. GLSL has no includes of its own; this is
+// how receivers share code such as local_lighting.glsl. A #line directive
+// after each expansion keeps compile errors pointing at the right line.
+static bool ReadShaderFile(const char *file_path, std::string &code, int depth = 0)
+{
+	std::ifstream ShaderStream(file_path, std::ios::in);
+	if (!ShaderStream.is_open())
 	{
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
+		return false;
 	}
-	else
+	code.clear();
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(ShaderStream, line))
 	{
-		printf("Vertex shader not found %s.\n", vertex_file_path);
-		return 0;
+		lineNumber++;
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+		{
+			code += line + "\n";
+			continue;
+		}
+		size_t open = line.find('"', start);
+		size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+		if (close == std::string::npos || depth >= 8)
+		{
+			printf("Bad #include in %s line %d\n", file_path, lineNumber);
+			return false;
+		}
+		std::string includePath = (std::filesystem::path(file_path).parent_path() / line.substr(open + 1, close - open - 1)).string();
+		std::string included;
+		if (!ReadShaderFile(includePath.c_str(), included, depth + 1))
+		{
+			printf("Shader include not found %s, from %s\n", includePath.c_str(), file_path);
+			return false;
+		}
+		code += included + "#line " + std::to_string(lineNumber + 1) + "\n";
 	}
+	ShaderStream.close();
+	return true;
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if (FragmentShaderStream.is_open())
+// Inserts one "#define" line per entry right after the #version directive
+static std::string InjectDefines(const std::string &code, const std::vector<std::string> &defines)
+{
+	if (defines.empty())
 	{
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+		return code;
 	}
-	else
+
+	std::string defineBlock;
+	for (const std::string &define : defines)
 	{
-		printf("Fragment shader not found %s.\n", fragment_file_path);
-		return 0;
+		defineBlock += "#define " + define + "\n";
 	}
 
+	size_t versionPos = code.find("#version");
+	if (versionPos == std::string::npos)
+	{
+		return defineBlock + code;
+	}
+	size_t lineEnd = code.find('\n', versionPos);
+	if (lineEnd == std::string::npos)
+	{
+		return code + "\n" + defineBlock;
+	}
+	return code.substr(0, lineEnd + 1) + defineBlock + code.substr(lineEnd + 1);
+}
+
+static GLuint CompileShader(GLenum type, const std::string &code, const char *file_path)
+{
+	const char *typeName = type == GL_VERTEX_SHADER ? "vertex" : "fragment";
+	GLuint ShaderID = glCreateShader(type);
+
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
-	// Compile Vertex Shader
-	printf("Compiling vertex shader : %s\n", vertex_file_path);
-	char const *VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-	glCompileShader(VertexShaderID);
+	if (file_path)
+		printf("Compiling %s shader : %s\n", typeName, file_path);
+	else
+		printf("Compiling %s shader\n", typeName);
+	char const *SourcePointer = code.c_str();
+	glShaderSource(ShaderID, 1, &SourcePointer, NULL);
+	glCompileShader(ShaderID);
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
+	// Check the shader
+	glGetShaderiv(ShaderID, GL_COMPILE_STATUS, &Result);
 	if (!Result) {
-		printf("Error compiling vertex shader : %s\n", vertex_file_path);
-		glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if (file_path)
+			printf("Error compiling %s shader : %s\n", typeName, file_path);
+		else
+			printf("Error compiling %s shader\n", typeName);
+		glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 		if (InfoLogLength > 0) {
-			std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-			printf("%s\n", &VertexShaderErrorMessage[0]);
+			std::vector<char> ShaderErrorMessage(InfoLogLength + 1);
+			glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+			printf("%s\n", &ShaderErrorMessage[0]);
 		}
+		glDeleteShader(ShaderID);
 		return 0;
 	}
 
-	// Compile Fragment Shader
-	printf("Compiling fragment shader : %s\n", fragment_file_path);
-	char const *FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-	glCompileShader(FragmentShaderID);
+	return ShaderID;
+}
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	if (!Result) {
-		printf("Error compiling fragment shader : %s\n", fragment_file_path);
-		glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0)
-		{
-			std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-			printf("%s\n", &FragmentShaderErrorMessage[0]);
-		}
-		return 0;
+// ---------------------------------------------------------------------------
+// Program binary cache
+// ---------------------------------------------------------------------------
+
+static const uint32_t BINARY_CACHE_MAGIC = 0x42505247; // "GRPB"
+static const uint32_t BINARY_CACHE_VERSION = 1;
+
+// 64-bit FNV-1a, chained so several strings can feed one hash
+static uint64_t HashString(const std::string &text, uint64_t hash = 14695981039346656037ULL)
+{
+	for (unsigned char c : text) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
 	}
+	return hash;
+}
 
-	// Link the program
-	printf("Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+static std::string BinaryCachePath(uint64_t sourceHash)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(HashString(driverString, sourceHash)));
+	return binaryCacheDirectory + "/" + name;
+}
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	if (!Result) {
-		printf("Error linking program\n");
-		glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0)
-		{
-			std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
-			glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-			printf("%s\n", &ProgramErrorMessage[0]);
-		}
+bool InitShaderBinaryCache(const char *directory)
+{
+	binaryCacheEnabled = false;
+
+	if (!glfwExtensionSupported("GL_ARB_get_program_binary")) {
+		printf("Program binary cache disabled: GL_ARB_get_program_binary not supported\n");
+		return false;
+	}
+
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	glGetProgramBinary_ = (PFNGLGETPROGRAMBINARYPROC_)glfwGetProcAddress("glGetProgramBinary");
+	glProgramBinary_ = (PFNGLPROGRAMBINARYPROC_)glfwGetProcAddress("glProgramBinary");
+	glProgramParameteri_ = (PFNGLPROGRAMPARAMETERIPROC_)glfwGetProcAddress("glProgramParameteri");
+	if (formatCount == 0 || !glGetProgramBinary_ || !glProgramBinary_ || !glProgramParameteri_) {
+		printf("Program binary cache disabled: driver exposes no binary formats\n");
+		return false;
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	if (error) {
+		printf("Program binary cache disabled: cannot create %s\n", directory);
+		return false;
+	}
+
+	driverString = std::string((const char *)glGetString(GL_VENDOR)) + "|" +
+				   (const char *)glGetString(GL_RENDERER) + "|" +
+				   (const char *)glGetString(GL_VERSION);
+	binaryCacheDirectory = directory;
+	binaryCacheEnabled = true;
+	printf("Program binary cache enabled in %s\n", directory);
+	return true;
+}
+
+ShaderCacheStats GetShaderCacheStats()
+{
+	return cacheStats;
+}
+
+// Restores a program from the cache, or returns 0 when there is no valid binary for this
+// source and driver. Stale or corrupt entries are rejected and later overwritten.
+static GLuint LoadCachedProgram(uint64_t sourceHash)
+{
+	std::ifstream file(BinaryCachePath(sourceHash), std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
 		return 0;
 	}
 
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
+	uint32_t magic = 0, version = 0, driverLength = 0, binaryLength = 0;
+	uint64_t storedHash = 0;
+	GLenum binaryFormat = 0;
+	file.read((char *)&magic, sizeof(magic));
+	file.read((char *)&version, sizeof(version));
+	file.read((char *)&storedHash, sizeof(storedHash));
+	file.read((char *)&driverLength, sizeof(driverLength));
 
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	bool valid = file && magic == BINARY_CACHE_MAGIC && version == BINARY_CACHE_VERSION &&
+				 storedHash == sourceHash && driverLength == driverString.size();
+	std::string storedDriver(valid ? driverLength : 0, '\0');
+	if (valid) {
+		file.read(&storedDriver[0], driverLength);
+		file.read((char *)&binaryFormat, sizeof(binaryFormat));
+		file.read((char *)&binaryLength, sizeof(binaryLength));
+		valid = file && storedDriver == driverString && binaryLength > 0;
+	}
+
+	std::vector<char> binary(valid ? binaryLength : 0);
+	if (valid) {
+		file.read(binary.data(), binaryLength);
+		valid = static_cast<bool>(file);
+	}
 
+	GLuint ProgramID = 0;
+	if (valid) {
+		ProgramID = glCreateProgram();
+		glProgramBinary_(ProgramID, binaryFormat, binary.data(), binaryLength);
+
+		// The driver may still refuse a binary that looks fine on disk
+		GLint Result = GL_FALSE;
+		glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+		if (!Result) {
+			glDeleteProgram(ProgramID);
+			ProgramID = 0;
+			valid = false;
+		}
+	}
+
+	if (!valid) {
+		cacheStats.binaryRejected++;
+	}
 	return ProgramID;
 }
 
-GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode)
+static void SaveCachedProgram(GLuint ProgramID, uint64_t sourceHash)
 {
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	GLint binaryLength = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+	if (binaryLength <= 0) {
+		return;
+	}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	std::vector<char> binary(binaryLength);
+	GLenum binaryFormat = 0;
+	GLsizei written = 0;
+	glGetProgramBinary_(ProgramID, binaryLength, &written, &binaryFormat, binary.data());
+	if (written <= 0) {
+		return;
+	}
 
-	// Compile Vertex Shader
-	printf("Compiling vertex shader\n");
-	char const *VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-	glCompileShader(VertexShaderID);
+	std::ofstream file(BinaryCachePath(sourceHash), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		return;
+	}
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	if (!Result) {
-		printf("Error compiling vertex shader\n");
-		glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0) {
-			std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-			printf("%s\n", &VertexShaderErrorMessage[0]);
+	uint32_t driverLength = static_cast<uint32_t>(driverString.size());
+	uint32_t length = static_cast<uint32_t>(written);
+	file.write((const char *)&BINARY_CACHE_MAGIC, sizeof(BINARY_CACHE_MAGIC));
+	file.write((const char *)&BINARY_CACHE_VERSION, sizeof(BINARY_CACHE_VERSION));
+	file.write((const char *)&sourceHash, sizeof(sourceHash));
+	file.write((const char *)&driverLength, sizeof(driverLength));
+	file.write(driverString.data(), driverLength);
+	file.write((const char *)&binaryFormat, sizeof(binaryFormat));
+	file.write((const char *)&length, sizeof(length));
+	file.write(binary.data(), length);
+}
+
+// Compiles and links a program, going through the binary cache when it is enabled
+static GLuint CompileAndLinkProgram(const std::string &VertexShaderCode, const std::string &FragmentShaderCode,
+									const char *vertex_file_path, const char *fragment_file_path,
+									const std::vector<std::string> &feedbackVaryings, ProgramBuildInfo *info)
+{
+	auto compileStart = std::chrono::steady_clock::now();
+	ProgramBuildInfo localInfo;
+	if (!info) info = &localInfo;
+	info->compileMs = 0.0;
+	info->linkMs = 0.0;
+	info->fromCache = false;
+
+	// The cache is keyed on the final sources, so injected defines are covered too
+	uint64_t sourceHash = HashString(FragmentShaderCode, HashString(VertexShaderCode));
+	for (const std::string &varying : feedbackVaryings) {
+		sourceHash = HashString(varying, sourceHash);
+	}
+	if (binaryCacheEnabled) {
+		GLuint CachedProgramID = LoadCachedProgram(sourceHash);
+		if (CachedProgramID != 0) {
+			info->linkMs = ElapsedMs(compileStart);
+			info->fromCache = true;
+			cacheStats.binaryHits++;
+			cacheStats.buildMs += info->linkMs;
+			if (vertex_file_path && fragment_file_path)
+				printf("Loaded program binary : %s + %s\n", vertex_file_path, fragment_file_path);
+			else
+				printf("Loaded program binary\n");
+			BindFrameUniformBlocks(CachedProgramID);
+			return CachedProgramID;
 		}
+	}
+
+	// Compile Vertex Shader
+	GLuint VertexShaderID = CompileShader(GL_VERTEX_SHADER, VertexShaderCode, vertex_file_path);
+	if (VertexShaderID == 0) {
 		return 0;
 	}
 
 	// Compile Fragment Shader
-	printf("Compiling fragment shader\n");
-	char const *FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	if (!Result) {
-		printf("Error compiling fragment shader\n");
-		glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0)
-		{
-			std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-			printf("%s\n", &FragmentShaderErrorMessage[0]);
-		}
+	GLuint FragmentShaderID = CompileShader(GL_FRAGMENT_SHADER, FragmentShaderCode, fragment_file_path);
+	if (FragmentShaderID == 0) {
+		glDeleteShader(VertexShaderID);
 		return 0;
 	}
 
+	info->compileMs = ElapsedMs(compileStart);
+	auto linkStart = std::chrono::steady_clock::now();
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
 	// Link the program
 	printf("Linking program\n");
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if (binaryCacheEnabled) {
+		glProgramParameteri_(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	if (!feedbackVaryings.empty()) {
+		std::vector<const char *> names;
+		for (const std::string &varying : feedbackVaryings) {
+			names.push_back(varying.c_str());
+		}
+		glTransformFeedbackVaryings(ProgramID, static_cast<GLsizei>(names.size()), names.data(), GL_INTERLEAVED_ATTRIBS);
+	}
 	glLinkProgram(ProgramID);
 
 	// Check the program
 	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+
+	glDetachShader(ProgramID, VertexShaderID);
+	glDetachShader(ProgramID, FragmentShaderID);
+
+	glDeleteShader(VertexShaderID);
+	glDeleteShader(FragmentShaderID);
+
 	if (!Result) {
 		printf("Error linking program\n");
 		glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
@@ -182,14 +391,188 @@ GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentS
 			glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 			printf("%s\n", &ProgramErrorMessage[0]);
 		}
+		glDeleteProgram(ProgramID);
 		return 0;
 	}
 
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
+	info->linkMs = ElapsedMs(linkStart);
+	cacheStats.compiled++;
+	cacheStats.buildMs += info->compileMs + info->linkMs;
 
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	if (binaryCacheEnabled) {
+		SaveCachedProgram(ProgramID, sourceHash);
+	}
 
+	BindFrameUniformBlocks(ProgramID);
 	return ProgramID;
 }
+
+static GLuint LoadProgramFromFiles(const char *vertex_file_path, const char *fragment_file_path,
+								   const std::vector<std::string> &defines, const std::vector<std::string> &feedbackVaryings,
+								   ProgramBuildInfo *info)
+{
+	// Read the Vertex Shader code from the file
+	std::string VertexShaderCode;
+	if (!ReadShaderFile(vertex_file_path, VertexShaderCode))
+	{
+		printf("Vertex shader not found %s.\n", vertex_file_path);
+		return 0;
+	}
+
+	// Read the Fragment Shader code from the file
+	std::string FragmentShaderCode;
+	if (!ReadShaderFile(fragment_file_path, FragmentShaderCode))
+	{
+		printf("Fragment shader not found %s.\n", fragment_file_path);
+		return 0;
+	}
+
+	return CompileAndLinkProgram(InjectDefines(VertexShaderCode, defines), InjectDefines(FragmentShaderCode, defines),
+								 vertex_file_path, fragment_file_path, feedbackVaryings, info);
+}
+
+GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path)
+{
+	return LoadProgramFromFiles(vertex_file_path, fragment_file_path, std::vector<std::string>(), std::vector<std::string>(), NULL);
+}
+
+GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path, const std::vector<std::string> &defines)
+{
+	return LoadProgramFromFiles(vertex_file_path, fragment_file_path, defines, std::vector<std::string>(), NULL);
+}
+
+GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode)
+{
+	return CompileAndLinkProgram(VertexShaderCode, FragmentShaderCode, NULL, NULL, std::vector<std::string>(), NULL);
+}
+
+// ---------------------------------------------------------------------------
+// Program registry
+// ---------------------------------------------------------------------------
+
+struct ProgramKey {
+	std::string vertexPath;
+	std::string fragmentPath;
+	std::vector<std::string> defines;
+	std::vector<std::string> feedbackVaryings;
+
+	bool operator==(const ProgramKey &other) const {
+		return vertexPath == other.vertexPath && fragmentPath == other.fragmentPath && defines == other.defines &&
+			   feedbackVaryings == other.feedbackVaryings;
+	}
+};
+
+struct ProgramKeyHash {
+	size_t operator()(const ProgramKey &key) const {
+		std::hash<std::string> hasher;
+		size_t hash = hasher(key.vertexPath);
+		auto combine = [&hash](size_t value) {
+			hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+		};
+		combine(hasher(key.fragmentPath));
+		for (const std::string &define : key.defines) {
+			combine(hasher(define));
+		}
+		for (const std::string &varying : key.feedbackVaryings) {
+			combine(hasher(varying));
+		}
+		return hash;
+	}
+};
+
+struct ProgramEntry {
+	GLuint programID;
+	int refCount;
+	int acquireCount; // Total acquisitions, including the ones served from the registry
+	ProgramBuildInfo build;
+	std::unique_ptr<ShaderProgram> program; // Uniform table and shadow values shared by all users
+};
+
+static std::unordered_map<ProgramKey, ProgramEntry, ProgramKeyHash> programRegistry;
+static std::unordered_map<GLuint, ProgramKey> programKeys;
+
+GLuint AcquireShaderProgram(const char *vertex_file_path, const char *fragment_file_path, const std::vector<std::string> &defines,
+							const std::vector<std::string> &feedbackVaryings)
+{
+	ProgramKey key;
+	key.vertexPath = vertex_file_path;
+	key.fragmentPath = fragment_file_path;
+	key.defines = defines;
+	key.feedbackVaryings = feedbackVaryings;
+
+	auto it = programRegistry.find(key);
+	if (it != programRegistry.end()) {
+		it->second.refCount++;
+		it->second.acquireCount++;
+		return it->second.programID;
+	}
+
+	ProgramEntry entry;
+	entry.programID = LoadProgramFromFiles(vertex_file_path, fragment_file_path, defines, feedbackVaryings, &entry.build);
+	if (entry.programID == 0) {
+		return 0;
+	}
+	entry.refCount = 1;
+	entry.acquireCount = 1;
+
+	if (entry.build.fromCache)
+		printf("Program %s + %s: binary loaded in %.2f ms\n", vertex_file_path, fragment_file_path, entry.build.linkMs);
+	else
+		printf("Program %s + %s: compile %.2f ms, link %.2f ms\n",
+			   vertex_file_path, fragment_file_path, entry.build.compileMs, entry.build.linkMs);
+
+	entry.program.reset(new ShaderProgram(entry.programID));
+
+	GLuint programID = entry.programID;
+	programRegistry[key] = std::move(entry);
+	programKeys[programID] = key;
+	return programID;
+}
+
+ShaderProgram *GetShaderProgram(GLuint programID)
+{
+	auto keyIt = programKeys.find(programID);
+	if (keyIt == programKeys.end()) {
+		return NULL;
+	}
+	return programRegistry.find(keyIt->second)->second.program.get();
+}
+
+void ReleaseShaderProgram(GLuint programID)
+{
+	auto keyIt = programKeys.find(programID);
+	if (keyIt == programKeys.end()) {
+		return;
+	}
+
+	auto it = programRegistry.find(keyIt->second);
+	if (--it->second.refCount > 0) {
+		return;
+	}
+
+	glDeleteProgram(programID);
+	glState.invalidate(); // The name may be handed out again
+	programRegistry.erase(it);
+	programKeys.erase(keyIt);
+}
+
+void PrintShaderRegistryStats()
+{
+	double totalMs = 0.0;
+	int totalAcquires = 0;
+	for (const auto &item : programRegistry) {
+		const ProgramEntry &entry = item.second;
+		printf("  %s + %s", item.first.vertexPath.c_str(), item.first.fragmentPath.c_str());
+		for (const std::string &define : item.first.defines) {
+			printf(" [%s]", define.c_str());
+		}
+		if (entry.build.fromCache)
+			printf(": binary %.2f ms, %d users\n", entry.build.linkMs, entry.acquireCount);
+		else
+			printf(": compile %.2f ms, link %.2f ms, %d users\n", entry.build.compileMs, entry.build.linkMs, entry.acquireCount);
+		totalMs += entry.build.compileMs + entry.build.linkMs;
+		totalAcquires += entry.acquireCount;
+	}
+	printf("Shader registry: %d programs built for %d requests, %.2f ms total\n",
+		   static_cast<int>(programRegistry.size()), totalAcquires, totalMs);
+}
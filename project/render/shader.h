@@ -3,9 +3,45 @@
 
 #include <glad/gl.h>
 #include <string>
+#include <vector>
 
 GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path);
 
+GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path, const std::vector<std::string> &defines);
+
 GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode);
 
+// Enables the on-disk program binary cache in the given directory when the driver exposes
+// GL_ARB_get_program_binary. Must be called after the GL functions are loaded; returns false
+// (and keeps compiling from source) when binaries are unsupported.
+bool InitShaderBinaryCache(const char *directory);
+
+struct ShaderCacheStats {
+	int binaryHits;      // Programs restored from a cached binary
+	int binaryRejected;  // Cached binaries that failed validation and were rebuilt
+	int compiled;        // Programs compiled and linked from source
+	double buildMs;      // Total time spent creating programs
+};
+
+ShaderCacheStats GetShaderCacheStats();
+
+// Process-wide program registry. Programs are keyed by (vertex path, fragment path, defines,
+// feedback varyings), compiled once and shared; every Acquire must be paired with a Release, and
+// the program is deleted when its last user releases it. Named feedback varyings are captured
+// by transform feedback, interleaved in the given order.
+GLuint AcquireShaderProgram(const char *vertex_file_path, const char *fragment_file_path,
+                            const std::vector<std::string> &defines = std::vector<std::string>(),
+                            const std::vector<std::string> &feedbackVaryings = std::vector<std::string>());
+
+void ReleaseShaderProgram(GLuint programID);
+
+class ShaderProgram;
+
+// Uniform wrapper of a program obtained from AcquireShaderProgram, NULL for any other id.
+// Valid until the program's last user releases it.
+ShaderProgram *GetShaderProgram(GLuint programID);
+
+// Prints one line per registered program with its compile/link time and user count.
+void PrintShaderRegistryStats();
+
 #endif
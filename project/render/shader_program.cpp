@@ -0,0 +1,106 @@
+#include "shader_program.h"
+#include "render_stats.h"
+#include "gl_state.h"
+
+#include <cstring>
+
+ShaderProgram::ShaderProgram(GLuint programID) : programID(programID)
+{
+	GLint uniformCount = 0, maxNameLength = 0;
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &uniformCount);
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	std::vector<char> nameBuffer(maxNameLength + 1);
+	for (GLint i = 0; i < uniformCount; i++) {
+		GLint size = 0;
+		GLenum type = 0;
+		GLsizei nameLength = 0;
+		glGetActiveUniform(programID, i, static_cast<GLsizei>(nameBuffer.size()), &nameLength, &size, &type, nameBuffer.data());
+		std::string name(nameBuffer.data(), nameLength);
+
+		// Members of uniform blocks have no location and are fed by buffers instead
+		GLint location = glGetUniformLocation(programID, name.c_str());
+		if (location < 0) {
+			continue;
+		}
+		locations[name] = location;
+
+		// Arrays are reported as "name[0]"; also register the bare name
+		size_t bracket = name.find('[');
+		if (bracket != std::string::npos) {
+			locations[name.substr(0, bracket)] = location;
+		}
+	}
+}
+
+void ShaderProgram::use() const
+{
+	glState.useProgram(programID);
+}
+
+GLint ShaderProgram::location(const std::string &name) const
+{
+	auto it = locations.find(name);
+	return it == locations.end() ? -1 : it->second;
+}
+
+bool ShaderProgram::changed(GLint location, const void *data, size_t size)
+{
+	UniformShadow &shadow = shadows[location];
+	if (shadow.valid && shadow.bytes.size() == size && std::memcmp(shadow.bytes.data(), data, size) == 0) {
+		renderStats.uniformUploadsSkipped++;
+		return false;
+	}
+
+	shadow.bytes.assign(static_cast<const unsigned char *>(data), static_cast<const unsigned char *>(data) + size);
+	shadow.valid = true;
+	renderStats.uniformUploads++;
+	return true;
+}
+
+void ShaderProgram::setInt(GLint location, GLint value)
+{
+	if (location >= 0 && changed(location, &value, sizeof(value))) {
+		glUniform1i(location, value);
+	}
+}
+
+void ShaderProgram::setFloat(GLint location, GLfloat value)
+{
+	if (location >= 0 && changed(location, &value, sizeof(value))) {
+		glUniform1f(location, value);
+	}
+}
+
+void ShaderProgram::setVec3(GLint location, const glm::vec3 &value)
+{
+	if (location >= 0 && changed(location, &value[0], sizeof(value))) {
+		glUniform3fv(location, 1, &value[0]);
+	}
+}
+
+void ShaderProgram::setMat3(GLint location, const glm::mat3 &value)
+{
+	if (location >= 0 && changed(location, &value[0][0], sizeof(value))) {
+		glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+}
+
+void ShaderProgram::setMat4(GLint location, const glm::mat4 &value)
+{
+	if (location >= 0 && changed(location, &value[0][0], sizeof(value))) {
+		glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+}
+
+void ShaderProgram::setMat4Array(GLint location, const glm::mat4 *values, GLsizei count)
+{
+	if (location >= 0 && count > 0 && changed(location, &values[0][0][0], sizeof(glm::mat4) * count)) {
+		glUniformMatrix4fv(location, count, GL_FALSE, &values[0][0][0]);
+	}
+}
+
+void ShaderProgram::invalidate()
+{
+	shadows.clear();
+}
@@ -0,0 +1,61 @@
+#ifndef SHADER_PROGRAM_H
+#define SHADER_PROGRAM_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Wraps a linked program. All active uniforms are resolved once at construction
+// into a name table, and the last value uploaded to every location is shadowed
+// so that setting an unchanged value does not reach the driver. Upload and skip
+// counts are recorded in renderStats.
+//
+// Uniform state belongs to the program, so one wrapper is shared by every user
+// of a program (see GetShaderProgram in render/shader.h). The set* functions
+// assume the program is the one currently bound with glUseProgram.
+class ShaderProgram {
+public:
+    explicit ShaderProgram(GLuint programID);
+
+    GLuint id() const { return programID; }
+    void use() const;
+
+    // Location of an active uniform, -1 when the program does not use it.
+    // Arrays can be looked up with or without the "[0]" suffix.
+    GLint location(const std::string &name) const;
+
+    void setInt(GLint location, GLint value);
+    void setFloat(GLint location, GLfloat value);
+    void setVec3(GLint location, const glm::vec3 &value);
+    void setMat3(GLint location, const glm::mat3 &value);
+    void setMat4(GLint location, const glm::mat4 &value);
+    void setMat4Array(GLint location, const glm::mat4 *values, GLsizei count);
+
+    // Name-based variants for cold paths; hot paths should keep the location
+    void setInt(const std::string &name, GLint value) { setInt(location(name), value); }
+    void setFloat(const std::string &name, GLfloat value) { setFloat(location(name), value); }
+    void setVec3(const std::string &name, const glm::vec3 &value) { setVec3(location(name), value); }
+    void setMat3(const std::string &name, const glm::mat3 &value) { setMat3(location(name), value); }
+    void setMat4(const std::string &name, const glm::mat4 &value) { setMat4(location(name), value); }
+    void setMat4Array(const std::string &name, const glm::mat4 *values, GLsizei count) { setMat4Array(location(name), values, count); }
+
+    // Forgets every shadowed value, e.g. after uniforms were set behind the wrapper's back
+    void invalidate();
+
+private:
+    struct UniformShadow {
+        bool valid = false;
+        std::vector<unsigned char> bytes;
+    };
+
+    GLuint programID;
+    std::unordered_map<std::string, GLint> locations;
+    std::unordered_map<GLint, UniformShadow> shadows;
+
+    // Returns true when the value differs from the shadow (and records it)
+    bool changed(GLint location, const void *data, size_t size);
+};
+
+#endif // SHADER_PROGRAM_H
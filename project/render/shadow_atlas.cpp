@@ -0,0 +1,122 @@
+#include "shadow_atlas.h"
+#include "gl_state.h"
+
+#include <algorithm>
+
+int ShadowAtlas::levelOf(int size)
+{
+	int level = 0;
+	for (int nodeSize = Size; nodeSize > size; nodeSize /= 2) {
+		level++;
+	}
+	return level;
+}
+
+void ShadowAtlas::initialize()
+{
+	glGenTextures(1, &textureID);
+	glState.bindTexture(GL_TEXTURE_2D, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, Size, Size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+	glGenFramebuffers(1, &framebufferID);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textureID, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	ShadowTile root;
+	root.size = Size;
+	freeNodes.assign(levelOf(MinTile) + 1, {});
+	freeNodes[0].push_back(root);
+	used = 0;
+}
+
+ShadowTile ShadowAtlas::allocate(int size)
+{
+	int target = levelOf(std::max(size, static_cast<int>(MinTile)));
+
+	// Smallest free node that holds the tile
+	int level = target;
+	while (level >= 0 && freeNodes[level].empty()) {
+		level--;
+	}
+	if (level < 0) {
+		return ShadowTile();
+	}
+	ShadowTile node = freeNodes[level].back();
+	freeNodes[level].pop_back();
+
+	// Split it down to the requested size, keeping the first quarter each time
+	while (level < target) {
+		node.size /= 2;
+		level++;
+		for (int i = 1; i < 4; i++) {
+			ShadowTile sibling = node;
+			sibling.x += (i & 1) * node.size;
+			sibling.y += (i >> 1) * node.size;
+			freeNodes[level].push_back(sibling);
+		}
+	}
+	used += node.size * node.size;
+	return node;
+}
+
+void ShadowAtlas::release(const ShadowTile &tile)
+{
+	if (tile.size == 0) {
+		return;
+	}
+	used -= tile.size * tile.size;
+
+	// Merge with the three siblings for as long as they are all free
+	ShadowTile node = tile;
+	for (int level = levelOf(node.size); level > 0; level--) {
+		std::vector<ShadowTile> &nodes = freeNodes[level];
+		int parentX = node.x - node.x % (2 * node.size);
+		int parentY = node.y - node.y % (2 * node.size);
+		auto isSibling = [&](const ShadowTile &other) {
+			return other.x - other.x % (2 * node.size) == parentX && other.y - other.y % (2 * node.size) == parentY;
+		};
+		if (std::count_if(nodes.begin(), nodes.end(), isSibling) < 3) {
+			nodes.push_back(node);
+			return;
+		}
+		nodes.erase(std::remove_if(nodes.begin(), nodes.end(), isSibling), nodes.end());
+		node.x = parentX;
+		node.y = parentY;
+		node.size *= 2;
+	}
+	freeNodes[0].push_back(node);
+}
+
+void ShadowAtlas::beginTile(const ShadowTile &tile)
+{
+	glState.bindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+	glState.viewport(tile.x, tile.y, tile.size, tile.size);
+	glState.enable(GL_SCISSOR_TEST);
+	glScissor(tile.x, tile.y, tile.size, tile.size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void ShadowAtlas::endTiles()
+{
+	glState.disable(GL_SCISSOR_TEST);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowAtlas::cleanup()
+{
+	glDeleteFramebuffers(1, &framebufferID);
+	glDeleteTextures(1, &textureID);
+	glState.invalidate(); // The deleted names may still be tracked as bound
+	framebufferID = textureID = 0;
+	freeNodes.clear();
+	used = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/gl.h>
+#include <vector>
+
+// Square region of the atlas, in texels; size 0 when nothing was allocated
+struct ShadowTile {
+    int x = 0, y = 0, size = 0;
+};
+
+// One large depth texture shared by the shadows of all local lights. Tiles
+// are power-of-two squares handed out by a quadtree buddy allocator: a free
+// node is split into four when a smaller tile is needed, and four free
+// siblings merge back into their parent when released, so tiles of any mix of
+// sizes can come and go without fragmenting the atlas for good.
+//
+// The texture compares depth in hardware, so receivers sample it through a
+// sampler2DShadow and get bilinear PCF from a single fetch.
+class ShadowAtlas {
+public:
+    static const int Size = 2048;  // Texels per side
+    static const int MinTile = 64;
+
+    void initialize();
+    void cleanup();
+
+    // Tile of size texels, a power of two up to Size; size 0 when the atlas is full
+    ShadowTile allocate(int size);
+    void release(const ShadowTile &tile);
+
+    // Texels covered by allocated tiles
+    int usedTexels() const { return used; }
+
+    // Binds the atlas and limits drawing and clearing to tile, then clears it
+    void beginTile(const ShadowTile &tile);
+    void endTiles();
+
+    GLuint texture() const { return textureID; }
+
+private:
+    GLuint textureID = 0, framebufferID = 0;
+    int used = 0;
+
+    // Free nodes per quadtree level; level 0 is the whole atlas
+    std::vector<std::vector<ShadowTile>> freeNodes;
+
+    static int levelOf(int size);
+};
+
+#endif // SHADOW_ATLAS_H
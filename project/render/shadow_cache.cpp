@@ -0,0 +1,51 @@
+#include "shadow_cache.h"
+#include "gl_state.h"
+#include "render_stats.h"
+
+void ShadowCache::initialize(GLsizei mapResolution, int layers)
+{
+	resolution = mapResolution;
+	layerCount = layers;
+	textureID = CreateDepthArray(resolution, layerCount, framebufferIDs);
+	invalidate();
+}
+
+void ShadowCache::invalidate()
+{
+	for (bool &layerValid : valid) {
+		layerValid = false;
+	}
+}
+
+bool ShadowCache::beginUpdate(int layer, const glm::mat4 &lightSpaceMatrix)
+{
+	if (valid[layer] && lightSpaceMatrix == cachedMatrices[layer]) {
+		renderStats.shadowIncrementalUpdates++;
+		return false;
+	}
+	valid[layer] = true;
+	cachedMatrices[layer] = lightSpaceMatrix;
+	renderStats.shadowFullUpdates++;
+
+	glState.bindFramebuffer(GL_FRAMEBUFFER, framebufferIDs[layer]);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	return true;
+}
+
+void ShadowCache::copyTo(int layer, GLuint framebuffer)
+{
+	glState.bindFramebuffer(GL_READ_FRAMEBUFFER, framebufferIDs[layer]);
+	glState.bindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+	glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void ShadowCache::cleanup()
+{
+	glDeleteFramebuffers(layerCount, framebufferIDs);
+	glDeleteTextures(1, &textureID);
+	glState.invalidate(); // The deleted names may still be tracked as bound
+	textureID = 0;
+	layerCount = 0;
+	invalidate();
+}
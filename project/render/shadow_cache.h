@@ -0,0 +1,40 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "cascaded_shadow_map.h"
+
+// Depth maps holding only the static casters, one per shadow cascade. A
+// layer is re-rendered when its light matrix or the static scene changes; on
+// every other frame the cached depth is blitted into the cascade and only the
+// dynamic casters are drawn on top. Full and incremental updates are counted
+// per layer in renderStats.
+class ShadowCache {
+public:
+    // Matches the format and layout of the cascades it is copied into
+    void initialize(GLsizei resolution, int layers);
+    void cleanup();
+
+    // Forces a full update of every layer on the next frame, e.g. after
+    // static casters moved
+    void invalidate();
+
+    // True when the static casters of a layer have to be drawn for
+    // lightSpaceMatrix; the layer's framebuffer is then bound and cleared
+    bool beginUpdate(int layer, const glm::mat4 &lightSpaceMatrix);
+
+    // Copies the cached depth of a layer into framebuffer and leaves
+    // framebuffer bound
+    void copyTo(int layer, GLuint framebuffer);
+
+private:
+    GLuint framebufferIDs[CascadedShadowMap::MaxCascades] = {};
+    GLuint textureID = 0;
+    GLsizei resolution = 0;
+    int layerCount = 0;
+    bool valid[CascadedShadowMap::MaxCascades] = {};
+    glm::mat4 cachedMatrices[CascadedShadowMap::MaxCascades];
+};
+
+#endif // SHADOW_CACHE_H
@@ -0,0 +1,124 @@
+#include "shadow_filter.h"
+#include "gl_state.h"
+#include "render_stats.h"
+#include "shader.h"
+
+#include <iostream>
+
+const char *ShadowTechniqueName(ShadowTechnique technique)
+{
+	switch (technique) {
+	case SHADOW_VSM:
+		return "VSM";
+	case SHADOW_EVSM:
+		return "EVSM";
+	default:
+		return "PCF";
+	}
+}
+
+static void SetMomentParameters(GLenum target)
+{
+	// Moments are meant to be filtered, so linear filtering stands in for PCF
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void ShadowFilter::initialize(GLsizei mapResolution, int layers)
+{
+	resolution = mapResolution;
+	layerCount = layers;
+
+	momentsProgramID = AcquireShaderProgram("../project/fullscreen.vert", "../project/shadow_moments.frag");
+	blurProgramID = AcquireShaderProgram("../project/fullscreen.vert", "../project/shadow_blur.frag");
+	if (momentsProgramID == 0 || blurProgramID == 0) {
+		std::cerr << "Failed to load shadow filter shaders." << std::endl;
+		return;
+	}
+	momentsProgram = GetShaderProgram(momentsProgramID);
+	blurProgram = GetShaderProgram(blurProgramID);
+	layerID = momentsProgram->location("layer");
+	techniqueID = momentsProgram->location("technique");
+
+	momentsProgram->use();
+	momentsProgram->setInt("depthMap", 0);
+	blurProgram->use();
+	blurProgram->setInt("moments", 0);
+
+	glGenVertexArrays(1, &vertexArrayID);
+}
+
+void ShadowFilter::allocate()
+{
+	// 32-bit moments; EVSM squares exponentials that would overflow half floats
+	glGenTextures(1, &momentTextureID);
+	glState.bindTexture(GL_TEXTURE_2D_ARRAY, momentTextureID);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, resolution, resolution, layerCount, 0, GL_RGBA, GL_FLOAT, NULL);
+	SetMomentParameters(GL_TEXTURE_2D_ARRAY);
+
+	glGenTextures(1, &scratchTextureID);
+	glState.bindTexture(GL_TEXTURE_2D, scratchTextureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, resolution, resolution, 0, GL_RGBA, GL_FLOAT, NULL);
+	SetMomentParameters(GL_TEXTURE_2D);
+
+	glGenFramebuffers(1, &scratchFramebufferID);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, scratchFramebufferID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scratchTextureID, 0);
+
+	glGenFramebuffers(layerCount, framebufferIDs);
+	for (int layer = 0; layer < layerCount; layer++) {
+		glState.bindFramebuffer(GL_FRAMEBUFFER, framebufferIDs[layer]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentTextureID, 0, layer);
+	}
+	glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowFilter::update(GLuint depthArray, int layer, ShadowTechnique technique)
+{
+	if (momentsProgram == NULL) {
+		return;
+	}
+	if (momentTextureID == 0) {
+		allocate();
+	}
+
+	// Full-target passes; neither framebuffer has a depth attachment
+	glState.disable(GL_BLEND);
+	glState.bindVertexArray(vertexArrayID);
+	glState.activeTexture(GL_TEXTURE0);
+
+	// Depth to moments, blurred horizontally into the scratch texture
+	glState.bindFramebuffer(GL_FRAMEBUFFER, scratchFramebufferID);
+	momentsProgram->use();
+	momentsProgram->setFloat(layerID, static_cast<float>(layer));
+	momentsProgram->setInt(techniqueID, technique);
+	glState.bindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	// Vertical blur into the cascade's layer
+	glState.bindFramebuffer(GL_FRAMEBUFFER, framebufferIDs[layer]);
+	blurProgram->use();
+	glState.bindTexture(GL_TEXTURE_2D, scratchTextureID);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	glState.bindVertexArray(0);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+	renderStats.drawCalls += 2;
+}
+
+void ShadowFilter::cleanup()
+{
+	if (momentTextureID != 0) {
+		glDeleteFramebuffers(layerCount, framebufferIDs);
+		glDeleteFramebuffers(1, &scratchFramebufferID);
+		glDeleteTextures(1, &momentTextureID);
+		glDeleteTextures(1, &scratchTextureID);
+	}
+	glDeleteVertexArrays(1, &vertexArrayID);
+	glState.invalidate(); // The deleted names may still be tracked as bound
+	momentTextureID = scratchTextureID = scratchFramebufferID = vertexArrayID = 0;
+	ReleaseShaderProgram(momentsProgramID);
+	ReleaseShaderProgram(blurProgramID);
+}
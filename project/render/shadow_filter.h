@@ -0,0 +1,54 @@
+#ifndef SHADOW_FILTER_H
+#define SHADOW_FILTER_H
+
+#include <glad/gl.h>
+#include "cascaded_shadow_map.h"
+#include "shader_program.h"
+
+// How receivers turn the shadow cascades into a shadow factor. The values are
+// shared with the receiver shaders through the cascade uniform block.
+enum ShadowTechnique {
+    SHADOW_PCF = 0,  // 5x5 depth comparisons per fragment
+    SHADOW_VSM = 1,  // One filtered fetch of depth moments
+    SHADOW_EVSM = 2, // As VSM, on exponentially warped depth to reduce light bleeding
+    SHADOW_TECHNIQUE_COUNT
+};
+
+const char *ShadowTechniqueName(ShadowTechnique technique);
+
+// Builds filterable moment maps from the cascades for VSM and EVSM. After a
+// cascade is rendered, one pass converts its depth to moments and blurs them
+// horizontally into a scratch texture, and a second blurs them vertically
+// into the cascade's layer of the moment array. Receivers then sample the
+// moment array with hardware filtering instead of running PCF.
+//
+// The moment textures are allocated the first time a cascade is filtered, so
+// the PCF path costs no memory.
+class ShadowFilter {
+public:
+    void initialize(GLsizei resolution, int layers);
+    void cleanup();
+
+    // Converts one layer of the cascade depth array; leaves the viewport as is
+    // and framebuffer 0 bound
+    void update(GLuint depthArray, int layer, ShadowTechnique technique);
+
+    // Moment array, one layer per cascade
+    GLuint texture() const { return momentTextureID; }
+
+private:
+    GLsizei resolution = 0;
+    int layerCount = 0;
+    GLuint momentTextureID = 0, scratchTextureID = 0;
+    GLuint scratchFramebufferID = 0;
+    GLuint framebufferIDs[CascadedShadowMap::MaxCascades] = {};
+    GLuint vertexArrayID = 0; // Attribute-less; the pass vertices come from gl_VertexID
+
+    GLuint momentsProgramID = 0, blurProgramID = 0;
+    ShaderProgram *momentsProgram = NULL, *blurProgram = NULL;
+    GLint layerID, techniqueID;
+
+    void allocate();
+};
+
+#endif // SHADOW_FILTER_H
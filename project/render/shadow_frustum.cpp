@@ -0,0 +1,156 @@
+#include "shadow_frustum.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+// Corners of a box or frustum are indexed like BoxCorner in occlusion_culling.cpp:
+// bit 0 selects +x, bit 1 +y, bit 2 +z
+static const int HullFaces[6][4] = {
+	{0, 2, 6, 4}, {1, 3, 7, 5}, // -X, +X
+	{0, 1, 5, 4}, {2, 3, 7, 6}, // -Y, +Y
+	{0, 1, 3, 2}, {4, 5, 7, 6}, // -Z, +Z
+};
+
+// Sutherland-Hodgman: keeps the part of a convex polygon on the positive side of plane
+static void ClipPolygon(std::vector<glm::vec3> &polygon, const glm::vec4 &plane, std::vector<glm::vec3> &scratch)
+{
+	scratch.clear();
+	for (size_t i = 0; i < polygon.size(); i++) {
+		const glm::vec3 &a = polygon[i];
+		const glm::vec3 &b = polygon[(i + 1) % polygon.size()];
+		float da = glm::dot(glm::vec3(plane), a) + plane.w;
+		float db = glm::dot(glm::vec3(plane), b) + plane.w;
+		if (da >= 0.0f) {
+			scratch.push_back(a);
+		}
+		if ((da >= 0.0f) != (db >= 0.0f)) {
+			scratch.push_back(a + (b - a) * (da / (da - db)));
+		}
+	}
+	polygon.swap(scratch);
+}
+
+void ShadowFrustum::begin(const glm::vec3 &lightPosition, const glm::vec3 &lightTarget, const glm::mat4 &viewProjection)
+{
+	view = glm::lookAt(lightPosition, lightTarget, glm::vec3(0.0f, 1.0f, 0.0f));
+	cameraViewProjection = viewProjection;
+	cameraFrustum = Frustum(viewProjection);
+	hasReceivers = false;
+	casters.clear();
+}
+
+void ShadowFrustum::add(const BoundingBox &box, int roles)
+{
+	if ((roles & SHADOW_RECEIVER) && cameraFrustum.intersects(box)) {
+		receivers = hasReceivers ? BoundingBox(glm::min(receivers.min, box.min), glm::max(receivers.max, box.max)) : box;
+		hasReceivers = true;
+	}
+	if (roles & SHADOW_CASTER) {
+		casters.push_back(box.transformed(view));
+	}
+}
+
+bool ShadowFrustum::clipViewToReceivers(BoundingBox &region) const
+{
+	glm::mat4 inverse = glm::inverse(cameraViewProjection);
+	glm::vec3 frustumCorners[8], boxCorners[8];
+	for (int i = 0; i < 8; i++) {
+		glm::vec4 corner = inverse * glm::vec4((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f, 1.0f);
+		frustumCorners[i] = glm::vec3(corner) / corner.w;
+		boxCorners[i] = glm::vec3((i & 1) ? receivers.max.x : receivers.min.x,
+								  (i & 2) ? receivers.max.y : receivers.min.y,
+								  (i & 4) ? receivers.max.z : receivers.min.z);
+	}
+	glm::vec4 boxPlanes[6] = {
+		glm::vec4(1.0f, 0.0f, 0.0f, -receivers.min.x), glm::vec4(-1.0f, 0.0f, 0.0f, receivers.max.x),
+		glm::vec4(0.0f, 1.0f, 0.0f, -receivers.min.y), glm::vec4(0.0f, -1.0f, 0.0f, receivers.max.y),
+		glm::vec4(0.0f, 0.0f, 1.0f, -receivers.min.z), glm::vec4(0.0f, 0.0f, -1.0f, receivers.max.z),
+	};
+
+	// The intersection of two convex hulls is bounded by the faces of each
+	// clipped to the other, so its vertices are exactly those of the clipped faces
+	bool empty = true;
+	std::vector<glm::vec3> polygon, scratch;
+	for (int hull = 0; hull < 2; hull++) {
+		const glm::vec3 *corners = hull == 0 ? frustumCorners : boxCorners;
+		const glm::vec4 *planes = hull == 0 ? boxPlanes : cameraFrustum.planes;
+		for (const int *face : HullFaces) {
+			polygon.assign({corners[face[0]], corners[face[1]], corners[face[2]], corners[face[3]]});
+			for (int p = 0; p < 6 && !polygon.empty(); p++) {
+				ClipPolygon(polygon, planes[p], scratch);
+			}
+			for (const glm::vec3 &point : polygon) {
+				glm::vec3 lightPoint = glm::vec3(view * glm::vec4(point, 1.0f));
+				region = empty ? BoundingBox(lightPoint, lightPoint) : BoundingBox(glm::min(region.min, lightPoint), glm::max(region.max, lightPoint));
+				empty = false;
+			}
+		}
+	}
+	return !empty;
+}
+
+void ShadowFrustum::fit(int mapSize)
+{
+	BoundingBox casterBounds;
+	for (size_t i = 0; i < casters.size(); i++) {
+		casterBounds = i == 0 ? casters[i] : BoundingBox(glm::min(casterBounds.min, casters[i].min), glm::max(casterBounds.max, casters[i].max));
+	}
+
+	// Footprint in light space; the light looks down -z, so depth is -z
+	BoundingBox region;
+	glm::vec2 low(-1.0f), high(1.0f);
+	float nearDepth = 0.0f, farDepth = 1.0f;
+	if (hasReceivers && clipViewToReceivers(region)) {
+		low = glm::vec2(region.min);
+		high = glm::vec2(region.max);
+		if (!casters.empty()) {
+			// Where no caster stands over it nothing in view is shadowed. With no
+			// overlap at all, keep the view region and let culling empty the pass.
+			glm::vec2 shadowedLow = glm::max(low, glm::vec2(casterBounds.min));
+			glm::vec2 shadowedHigh = glm::min(high, glm::vec2(casterBounds.max));
+			if (shadowedLow.x <= shadowedHigh.x && shadowedLow.y <= shadowedHigh.y) {
+				low = shadowedLow;
+				high = shadowedHigh;
+			}
+		}
+		nearDepth = -region.max.z;
+		farDepth = -region.min.z;
+	} else if (!casters.empty()) {
+		// Nothing in view receives shadows; any box around the casters will do
+		low = glm::vec2(casterBounds.min);
+		high = glm::vec2(casterBounds.max);
+		nearDepth = -casterBounds.max.z;
+		farDepth = -casterBounds.min.z;
+	}
+
+	// Casters between the light and the region must still land in the map
+	for (const BoundingBox &caster : casters) {
+		if (caster.max.x >= low.x && caster.min.x <= high.x && caster.max.y >= low.y && caster.min.y <= high.y) {
+			nearDepth = std::min(nearDepth, -caster.max.z);
+		}
+	}
+
+	float needed = std::max(high.x - low.x, high.y - low.y);
+	if (fitted && view == fittedView && glm::all(glm::greaterThanEqual(low, windowLow)) && glm::all(glm::lessThanEqual(high, windowHigh)) &&
+		nearDepth >= windowNear && farDepth <= windowFar && windowHigh.x - windowLow.x <= RefitRatio * needed + 2.0f * SizeStep) {
+		return;
+	}
+
+	// Padded square window of whole SizeStep units around the footprint,
+	// moved in whole texels
+	float extent = (std::ceil(needed * (1.0f + Margin) / SizeStep) + 1.0f) * SizeStep;
+	float texel = extent / static_cast<float>(mapSize);
+	glm::vec2 origin = glm::floor((0.5f * (low + high) - 0.5f * extent) / texel) * texel;
+	nearDepth = std::floor(nearDepth / SizeStep) * SizeStep - SizeStep;
+	farDepth = std::ceil(farDepth / SizeStep) * SizeStep + SizeStep;
+
+	projection = glm::ortho(origin.x, origin.x + extent, origin.y, origin.y + extent, nearDepth, farDepth);
+	size = glm::vec3(extent, extent, farDepth - nearDepth);
+	fitted = true;
+	fittedView = view;
+	windowLow = origin;
+	windowHigh = origin + glm::vec2(extent);
+	windowNear = nearDepth;
+	windowFar = farDepth;
+}
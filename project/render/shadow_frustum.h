@@ -0,0 +1,69 @@
+#ifndef SHADOW_FRUSTUM_H
+#define SHADOW_FRUSTUM_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "frustum_culling.h"
+
+// Part an object plays in directional shadows; objects may be both
+enum ShadowRole {
+    SHADOW_CASTER = 1,   // Drawn into the shadow map
+    SHADOW_RECEIVER = 2, // Samples the shadow map
+};
+
+// Fits the orthographic light projection to what the current view needs
+// instead of a fixed box around the whole scene. The region that can show
+// shadows is the camera frustum clipped to the bounds of the visible
+// receivers; its light-space footprint is narrowed to where casters are, and
+// the near plane pulled back to the nearest caster over it. Casters outside
+// the result cannot shadow anything in view, so culling the depth pass
+// against the fitted matrix removes them.
+//
+// Width and height are rounded up to whole SizeStep units and the window is
+// moved in whole shadow texels, so edges do not shimmer as the camera moves.
+// Each new window is padded by Margin and kept for as long as the view still
+// fits inside it, so the matrix (and any shadow cache keyed on it) stays the
+// same over small camera movements.
+class ShadowFrustum {
+public:
+    static constexpr float SizeStep = 16.0f; // World units
+    static constexpr float Margin = 0.1f;    // Padding of a new window, relative to its size
+    static constexpr float RefitRatio = 1.5f; // Refit once the window is this much larger than needed
+
+    // Starts a fit for a light at lightPosition looking at lightTarget
+    void begin(const glm::vec3 &lightPosition, const glm::vec3 &lightTarget, const glm::mat4 &cameraViewProjection);
+
+    // roles is a mask of ShadowRole
+    void add(const BoundingBox &box, int roles);
+
+    // Computes the projection for a square shadow map of mapSize texels
+    void fit(int mapSize);
+
+    const glm::mat4 &getView() const { return view; }
+    const glm::mat4 &getProjection() const { return projection; }
+    glm::mat4 getMatrix() const { return projection * view; }
+
+    // Extent of the fitted box in world units: width, height, depth
+    glm::vec3 getSize() const { return size; }
+
+private:
+    glm::mat4 view, projection;
+    glm::mat4 cameraViewProjection;
+    Frustum cameraFrustum;
+    BoundingBox receivers; // World box around the visible receivers
+    bool hasReceivers = false;
+    std::vector<BoundingBox> casters; // Light-space boxes
+    glm::vec3 size;
+
+    // Current window in light space
+    bool fitted = false;
+    glm::mat4 fittedView;
+    glm::vec2 windowLow, windowHigh;
+    float windowNear, windowFar;
+
+    // Light-space box of the camera frustum clipped to the receiver box;
+    // false when they do not overlap
+    bool clipViewToReceivers(BoundingBox &region) const;
+};
+
+#endif // SHADOW_FRUSTUM_H
@@ -0,0 +1,141 @@
+#include "shadow_mask.h"
+#include "gl_state.h"
+#include "render_stats.h"
+#include "shader.h"
+
+#include <iostream>
+
+const char *ShadowMaskModeName(ShadowMaskMode mode)
+{
+	switch (mode) {
+	case SHADOW_MASK_FULL:
+		return "full resolution";
+	case SHADOW_MASK_HALF:
+		return "half resolution";
+	default:
+		return "off";
+	}
+}
+
+static GLuint CreateTexture(GLint internalFormat, GLsizei width, GLsizei height, GLenum format, GLenum type)
+{
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glState.bindTexture(GL_TEXTURE_2D, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return textureID;
+}
+
+static GLuint CreateFramebuffer(GLenum attachment, GLuint textureID)
+{
+	GLuint framebufferID;
+	glGenFramebuffers(1, &framebufferID);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, textureID, 0);
+	if (attachment == GL_DEPTH_ATTACHMENT) {
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+	return framebufferID;
+}
+
+void ShadowMask::initialize(GLsizei screenWidth, GLsizei screenHeight)
+{
+	width = screenWidth;
+	height = screenHeight;
+
+	maskProgramID = AcquireShaderProgram("../project/fullscreen.vert", "../project/shadow_mask.frag");
+	upsampleProgramID = AcquireShaderProgram("../project/fullscreen.vert", "../project/shadow_upsample.frag");
+	if (maskProgramID == 0 || upsampleProgramID == 0) {
+		std::cerr << "Failed to load shadow mask shaders." << std::endl;
+		return;
+	}
+	maskProgram = GetShaderProgram(maskProgramID);
+	upsampleProgram = GetShaderProgram(upsampleProgramID);
+	maskInverseID = maskProgram->location("inverseViewProjection");
+	upsampleInverseID = upsampleProgram->location("inverseViewProjection");
+
+	maskProgram->use();
+	maskProgram->setInt("depthMap", 0);
+	maskProgram->setInt("shadowMap", 1);
+	upsampleProgram->use();
+	upsampleProgram->setInt("depthMap", 0);
+	upsampleProgram->setInt("lowMask", 1);
+
+	// Prepass depth, the mask, and the half resolution target, which keeps the
+	// view depth next to the shadow term
+	depthTextureID = CreateTexture(GL_DEPTH_COMPONENT24, width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+	maskTextureID = CreateTexture(GL_R8, width, height, GL_RED, GL_UNSIGNED_BYTE);
+	lowTextureID = CreateTexture(GL_RG32F, width / 2, height / 2, GL_RG, GL_FLOAT);
+	prepassFramebufferID = CreateFramebuffer(GL_DEPTH_ATTACHMENT, depthTextureID);
+	maskFramebufferID = CreateFramebuffer(GL_COLOR_ATTACHMENT0, maskTextureID);
+	lowFramebufferID = CreateFramebuffer(GL_COLOR_ATTACHMENT0, lowTextureID);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenVertexArrays(1, &vertexArrayID);
+}
+
+void ShadowMask::beginPrepass()
+{
+	glState.bindFramebuffer(GL_FRAMEBUFFER, prepassFramebufferID);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void ShadowMask::render(GLuint shadowTexture, const glm::mat4 &viewProjection, bool halfResolution)
+{
+	if (maskProgram == NULL) {
+		return;
+	}
+	glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+
+	// Full-target passes; none of the color targets has a depth attachment
+	glState.disable(GL_BLEND);
+	glState.bindVertexArray(vertexArrayID);
+	glState.activeTexture(GL_TEXTURE0);
+	glState.bindTexture(GL_TEXTURE_2D, depthTextureID);
+
+	glState.bindFramebuffer(GL_FRAMEBUFFER, halfResolution ? lowFramebufferID : maskFramebufferID);
+	if (halfResolution) {
+		glState.viewport(0, 0, width / 2, height / 2);
+	}
+	maskProgram->use();
+	maskProgram->setMat4(maskInverseID, inverseViewProjection);
+	glState.activeTexture(GL_TEXTURE1);
+	glState.bindTexture(GL_TEXTURE_2D_ARRAY, shadowTexture);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	renderStats.drawCalls++;
+
+	if (halfResolution) {
+		glState.bindFramebuffer(GL_FRAMEBUFFER, maskFramebufferID);
+		glState.viewport(0, 0, width, height);
+		upsampleProgram->use();
+		upsampleProgram->setMat4(upsampleInverseID, inverseViewProjection);
+		glState.bindTexture(GL_TEXTURE_2D, lowTextureID);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		renderStats.drawCalls++;
+	}
+
+	glState.activeTexture(GL_TEXTURE0);
+	glState.bindVertexArray(0);
+	glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowMask::cleanup()
+{
+	glDeleteFramebuffers(1, &prepassFramebufferID);
+	glDeleteFramebuffers(1, &maskFramebufferID);
+	glDeleteFramebuffers(1, &lowFramebufferID);
+	glDeleteTextures(1, &depthTextureID);
+	glDeleteTextures(1, &maskTextureID);
+	glDeleteTextures(1, &lowTextureID);
+	glDeleteVertexArrays(1, &vertexArrayID);
+	glState.invalidate(); // The deleted names may still be tracked as bound
+	prepassFramebufferID = maskFramebufferID = lowFramebufferID = 0;
+	depthTextureID = maskTextureID = lowTextureID = vertexArrayID = 0;
+	ReleaseShaderProgram(maskProgramID);
+	ReleaseShaderProgram(upsampleProgramID);
+}
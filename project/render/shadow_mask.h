@@ -0,0 +1,54 @@
+#ifndef SHADOW_MASK_H
+#define SHADOW_MASK_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "shader_program.h"
+
+// Where receivers take their shadow term from
+enum ShadowMaskMode {
+    SHADOW_MASK_OFF = 0,  // Every receiver looks up the cascades itself
+    SHADOW_MASK_FULL = 1, // One lookup per pixel into the mask
+    SHADOW_MASK_HALF = 2, // As above at half resolution, upsampled by depth
+    SHADOW_MASK_MODE_COUNT
+};
+
+const char *ShadowMaskModeName(ShadowMaskMode mode);
+
+// Screen-space shadow mask. A depth prepass of the receivers is rendered
+// first; a full-screen pass then reconstructs the world position of every
+// pixel from that depth and evaluates the cascaded shadow term for it once.
+// Receivers fetch the mask at their pixel instead of running the lookup
+// themselves, so shadowing costs the same however much overdraw there is.
+//
+// At half resolution the mask pass also keeps the view depth of each sample,
+// and a second pass upsamples it to full size, weighting the samples by how
+// close their depth is to the pixel's.
+class ShadowMask {
+public:
+    static constexpr GLenum TextureUnit = GL_TEXTURE2; // Receivers sample the mask here
+
+    void initialize(GLsizei width, GLsizei height);
+    void cleanup();
+
+    // Binds and clears the depth prepass target
+    void beginPrepass();
+
+    // Fills the mask from the prepass and shadowTexture, the cascade depth or
+    // moment array. Leaves framebuffer 0 bound and the viewport at full size.
+    void render(GLuint shadowTexture, const glm::mat4 &viewProjection, bool halfResolution);
+
+    GLuint texture() const { return maskTextureID; }
+
+private:
+    GLsizei width = 0, height = 0;
+    GLuint depthTextureID = 0, maskTextureID = 0, lowTextureID = 0;
+    GLuint prepassFramebufferID = 0, maskFramebufferID = 0, lowFramebufferID = 0;
+    GLuint vertexArrayID = 0; // Attribute-less; the pass vertices come from gl_VertexID
+
+    GLuint maskProgramID = 0, upsampleProgramID = 0;
+    ShaderProgram *maskProgram = NULL, *upsampleProgram = NULL;
+    GLint maskInverseID, upsampleInverseID;
+};
+
+#endif // SHADOW_MASK_H
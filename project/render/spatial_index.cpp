@@ -0,0 +1,481 @@
+#include "spatial_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <utility>
+
+static const uint32_t MaxLeafSize = 4;    // Always split above this many boxes...
+static const uint32_t MaxSahLeafSize = 16; // ...and never keep more than this unless they coincide
+static const int MaxTreeDepth = 48;       // Bounds the traversal stacks below
+static const int BinCount = 16;
+static const float TraversalCost = 1.0f;  // Relative to one box test
+
+float DistanceSquared(const BoundingBox &box, const glm::vec3 &point)
+{
+	glm::vec3 outside = glm::max(glm::max(box.min - point, point - box.max), glm::vec3(0.0f));
+	return glm::dot(outside, outside);
+}
+
+static bool Overlaps(const glm::vec3 &minA, const glm::vec3 &maxA, const glm::vec3 &minB, const glm::vec3 &maxB)
+{
+	return minA.x <= maxB.x && maxA.x >= minB.x &&
+		   minA.y <= maxB.y && maxA.y >= minB.y &&
+		   minA.z <= maxB.z && maxA.z >= minB.z;
+}
+
+// Half the surface area; the factor cancels out of every SAH comparison
+static float HalfArea(const glm::vec3 &min, const glm::vec3 &max)
+{
+	glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+void BoundingVolumeHierarchy::build(const std::vector<BoundingBox> &boxes)
+{
+	primitiveBounds = boxes;
+	centroids.resize(boxes.size());
+	for (size_t i = 0; i < boxes.size(); i++) {
+		centroids[i] = boxes[i].center();
+	}
+	primitives.resize(boxes.size());
+	std::iota(primitives.begin(), primitives.end(), 0u);
+
+	nodes.clear();
+	treeDepth = 0;
+	if (boxes.empty()) {
+		return;
+	}
+	nodes.reserve(2 * boxes.size() - 1);
+	nodes.push_back(BvhNode());
+	buildNode(0, 0, static_cast<uint32_t>(boxes.size()), 0);
+}
+
+void BoundingVolumeHierarchy::buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, int level)
+{
+	treeDepth = std::max(treeDepth, level + 1);
+
+	glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+	glm::vec3 centroidMin(INFINITY), centroidMax(-INFINITY);
+	for (uint32_t i = first; i < first + count; i++) {
+		const BoundingBox &box = primitiveBounds[primitives[i]];
+		boundsMin = glm::min(boundsMin, box.min);
+		boundsMax = glm::max(boundsMax, box.max);
+		centroidMin = glm::min(centroidMin, centroids[primitives[i]]);
+		centroidMax = glm::max(centroidMax, centroids[primitives[i]]);
+	}
+	nodes[nodeIndex].min = boundsMin;
+	nodes[nodeIndex].max = boundsMax;
+	nodes[nodeIndex].offset = first;
+	nodes[nodeIndex].count = count;
+	if (count <= MaxLeafSize || level >= MaxTreeDepth) {
+		return;
+	}
+
+	// Bin centroids along each axis and sweep the bin boundaries for the split
+	// with the lowest expected cost
+	float bestCost = INFINITY;
+	int bestAxis = -1, bestSplit = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 1e-6f) {
+			continue;
+		}
+		float binScale = BinCount / extent;
+
+		uint32_t binCounts[BinCount] = {0};
+		glm::vec3 binMin[BinCount], binMax[BinCount];
+		std::fill(binMin, binMin + BinCount, glm::vec3(INFINITY));
+		std::fill(binMax, binMax + BinCount, glm::vec3(-INFINITY));
+		for (uint32_t i = first; i < first + count; i++) {
+			int bin = std::min(static_cast<int>((centroids[primitives[i]][axis] - centroidMin[axis]) * binScale), BinCount - 1);
+			binCounts[bin]++;
+			binMin[bin] = glm::min(binMin[bin], primitiveBounds[primitives[i]].min);
+			binMax[bin] = glm::max(binMax[bin], primitiveBounds[primitives[i]].max);
+		}
+
+		// rightCost[i]: boxes in bins i.. weighted by their combined area
+		float rightCost[BinCount];
+		glm::vec3 sweepMin(INFINITY), sweepMax(-INFINITY);
+		uint32_t sweepCount = 0;
+		for (int bin = BinCount - 1; bin > 0; bin--) {
+			sweepMin = glm::min(sweepMin, binMin[bin]);
+			sweepMax = glm::max(sweepMax, binMax[bin]);
+			sweepCount += binCounts[bin];
+			rightCost[bin] = sweepCount > 0 ? sweepCount * HalfArea(sweepMin, sweepMax) : 0.0f;
+		}
+		sweepMin = glm::vec3(INFINITY);
+		sweepMax = glm::vec3(-INFINITY);
+		sweepCount = 0;
+		for (int split = 1; split < BinCount; split++) {
+			sweepMin = glm::min(sweepMin, binMin[split - 1]);
+			sweepMax = glm::max(sweepMax, binMax[split - 1]);
+			sweepCount += binCounts[split - 1];
+			if (sweepCount == 0 || sweepCount == count) {
+				continue;
+			}
+			float cost = sweepCount * HalfArea(sweepMin, sweepMax) + rightCost[split];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	if (bestAxis < 0) {
+		return; // Every centroid coincides; nothing separates them
+	}
+	float splitCost = TraversalCost + bestCost / HalfArea(boundsMin, boundsMax);
+	if (splitCost >= static_cast<float>(count) && count <= MaxSahLeafSize) {
+		return;
+	}
+
+	float binScale = BinCount / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+	uint32_t *begin = primitives.data() + first;
+	uint32_t *middle = std::partition(begin, begin + count, [&](uint32_t primitive) {
+		int bin = std::min(static_cast<int>((centroids[primitive][bestAxis] - centroidMin[bestAxis]) * binScale), BinCount - 1);
+		return bin < bestSplit;
+	});
+	uint32_t leftCount = static_cast<uint32_t>(middle - begin);
+
+	uint32_t left = nodeIndex + 1;
+	nodes.push_back(BvhNode());
+	buildNode(left, first, leftCount, level + 1);
+	uint32_t right = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(BvhNode());
+	buildNode(right, first + leftCount, count - leftCount, level + 1);
+
+	nodes[nodeIndex].offset = right;
+	nodes[nodeIndex].count = 0;
+}
+
+void BoundingVolumeHierarchy::refit(const std::vector<BoundingBox> &boxes)
+{
+	primitiveBounds = boxes;
+	// Children always follow their parent, so a reverse sweep sees them first
+	for (size_t i = nodes.size(); i-- > 0;) {
+		BvhNode &node = nodes[i];
+		if (node.count > 0) {
+			node.min = glm::vec3(INFINITY);
+			node.max = glm::vec3(-INFINITY);
+			for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+				node.min = glm::min(node.min, primitiveBounds[primitives[p]].min);
+				node.max = glm::max(node.max, primitiveBounds[primitives[p]].max);
+			}
+		} else {
+			const BvhNode &left = nodes[i + 1];
+			const BvhNode &right = nodes[node.offset];
+			node.min = glm::min(left.min, right.min);
+			node.max = glm::max(left.max, right.max);
+		}
+	}
+}
+
+template <typename Overlaps, typename Accept>
+void BoundingVolumeHierarchy::traverse(Overlaps overlaps, Accept accept, std::vector<uint32_t> &results) const
+{
+	if (nodes.empty()) {
+		return;
+	}
+	// The top bit of a stack entry marks nodes already known to be inside
+	const uint32_t InsideFlag = 0x80000000u;
+	uint32_t stack[MaxTreeDepth + 2];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		uint32_t entry = stack[--top];
+		uint32_t nodeIndex = entry & ~InsideFlag;
+		const BvhNode &node = nodes[nodeIndex];
+		FrustumTest test = (entry & InsideFlag) ? FRUSTUM_INSIDE : overlaps(node.min, node.max);
+		if (test == FRUSTUM_OUTSIDE) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+				uint32_t primitive = primitives[p];
+				if (test == FRUSTUM_INSIDE || accept(primitiveBounds[primitive])) {
+					results.push_back(primitive);
+				}
+			}
+		} else {
+			uint32_t flag = test == FRUSTUM_INSIDE ? InsideFlag : 0;
+			stack[top++] = node.offset | flag;
+			stack[top++] = (nodeIndex + 1) | flag;
+		}
+	}
+}
+
+void BoundingVolumeHierarchy::queryFrustum(const Frustum &frustum, std::vector<uint32_t> &results) const
+{
+	traverse([&](const glm::vec3 &min, const glm::vec3 &max) { return frustum.classify(BoundingBox(min, max)); },
+			 [&](const BoundingBox &box) { return frustum.intersects(box); }, results);
+}
+
+void BoundingVolumeHierarchy::queryBox(const BoundingBox &query, std::vector<uint32_t> &results) const
+{
+	traverse([&](const glm::vec3 &min, const glm::vec3 &max) { return Overlaps(min, max, query.min, query.max) ? FRUSTUM_INTERSECTS : FRUSTUM_OUTSIDE; },
+			 [&](const BoundingBox &box) { return Overlaps(box.min, box.max, query.min, query.max); }, results);
+}
+
+void BoundingVolumeHierarchy::querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &results) const
+{
+	float radiusSquared = radius * radius;
+	traverse([&](const glm::vec3 &min, const glm::vec3 &max) { return DistanceSquared(BoundingBox(min, max), center) <= radiusSquared ? FRUSTUM_INTERSECTS : FRUSTUM_OUTSIDE; },
+			 [&](const BoundingBox &box) { return DistanceSquared(box, center) <= radiusSquared; }, results);
+}
+
+void BoundingVolumeHierarchy::queryNearest(const glm::vec3 &point, size_t k, std::vector<uint32_t> &results) const
+{
+	if (k == 0 || nodes.empty()) {
+		return;
+	}
+
+	// Best-first: open nodes nearest first, best holds the k closest boxes so
+	// far with the furthest on top
+	typedef std::pair<float, uint32_t> Candidate;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> open;
+	std::priority_queue<Candidate> best;
+	open.push(Candidate(DistanceSquared(BoundingBox(nodes[0].min, nodes[0].max), point), 0));
+	while (!open.empty()) {
+		Candidate candidate = open.top();
+		open.pop();
+		if (best.size() == k && candidate.first > best.top().first) {
+			break;
+		}
+		const BvhNode &node = nodes[candidate.second];
+		if (node.count > 0) {
+			for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+				float distance = DistanceSquared(primitiveBounds[primitives[p]], point);
+				if (best.size() < k) {
+					best.push(Candidate(distance, primitives[p]));
+				} else if (distance < best.top().first) {
+					best.pop();
+					best.push(Candidate(distance, primitives[p]));
+				}
+			}
+		} else {
+			for (uint32_t child : {candidate.second + 1, node.offset}) {
+				float distance = DistanceSquared(BoundingBox(nodes[child].min, nodes[child].max), point);
+				if (best.size() < k || distance <= best.top().first) {
+					open.push(Candidate(distance, child));
+				}
+			}
+		}
+	}
+
+	size_t start = results.size();
+	results.resize(start + best.size());
+	for (size_t i = results.size(); i-- > start;) {
+		results[i] = best.top().second;
+		best.pop();
+	}
+}
+
+UniformGrid::CellRange UniformGrid::cellsOf(const BoundingBox &box) const
+{
+	CellRange range;
+	range.x0 = static_cast<int>(std::floor(box.min.x / cellSize));
+	range.z0 = static_cast<int>(std::floor(box.min.z / cellSize));
+	range.x1 = static_cast<int>(std::floor(box.max.x / cellSize));
+	range.z1 = static_cast<int>(std::floor(box.max.z / cellSize));
+	return range;
+}
+
+static uint64_t CellKey(int x, int z)
+{
+	return (uint64_t(uint32_t(x)) << 32) | uint32_t(z);
+}
+
+void UniformGrid::link(uint32_t handle, const CellRange &range)
+{
+	for (int x = range.x0; x <= range.x1; x++) {
+		for (int z = range.z0; z <= range.z1; z++) {
+			cells[CellKey(x, z)].push_back(handle);
+		}
+	}
+	if (occupied.x0 > occupied.x1) {
+		occupied = range;
+	} else {
+		occupied.x0 = std::min(occupied.x0, range.x0);
+		occupied.z0 = std::min(occupied.z0, range.z0);
+		occupied.x1 = std::max(occupied.x1, range.x1);
+		occupied.z1 = std::max(occupied.z1, range.z1);
+	}
+}
+
+void UniformGrid::unlink(uint32_t handle, const CellRange &range)
+{
+	for (int x = range.x0; x <= range.x1; x++) {
+		for (int z = range.z0; z <= range.z1; z++) {
+			auto cell = cells.find(CellKey(x, z));
+			if (cell == cells.end()) {
+				continue;
+			}
+			std::vector<uint32_t> &handles = cell->second;
+			auto it = std::find(handles.begin(), handles.end(), handle);
+			if (it != handles.end()) {
+				*it = handles.back();
+				handles.pop_back();
+			}
+			if (handles.empty()) {
+				cells.erase(cell);
+			}
+		}
+	}
+}
+
+uint32_t UniformGrid::insert(const BoundingBox &box)
+{
+	uint32_t handle;
+	if (!freeHandles.empty()) {
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	} else {
+		handle = static_cast<uint32_t>(objects.size());
+		objects.push_back(Object());
+	}
+	Object &object = objects[handle];
+	object.box = box;
+	object.cells = cellsOf(box);
+	object.live = true;
+	link(handle, object.cells);
+	return handle;
+}
+
+void UniformGrid::update(uint32_t handle, const BoundingBox &box)
+{
+	Object &object = objects[handle];
+	CellRange range = cellsOf(box);
+	if (!(range == object.cells)) {
+		unlink(handle, object.cells);
+		link(handle, range);
+		object.cells = range;
+	}
+	object.box = box;
+}
+
+void UniformGrid::remove(uint32_t handle)
+{
+	if (handle >= objects.size() || !objects[handle].live) {
+		return;
+	}
+	unlink(handle, objects[handle].cells);
+	objects[handle].live = false;
+	freeHandles.push_back(handle);
+}
+
+template <typename Accept>
+void UniformGrid::visitCells(const CellRange &range, Accept accept) const
+{
+	// Cells outside the occupied area are empty; clamping keeps huge queries cheap
+	int x0 = std::max(range.x0, occupied.x0), x1 = std::min(range.x1, occupied.x1);
+	int z0 = std::max(range.z0, occupied.z0), z1 = std::min(range.z1, occupied.z1);
+	for (int x = x0; x <= x1; x++) {
+		for (int z = z0; z <= z1; z++) {
+			auto cell = cells.find(CellKey(x, z));
+			if (cell == cells.end()) {
+				continue;
+			}
+			for (uint32_t handle : cell->second) {
+				if (visitStamps[handle] != currentStamp) {
+					visitStamps[handle] = currentStamp;
+					accept(handle);
+				}
+			}
+		}
+	}
+}
+
+void UniformGrid::beginVisit() const
+{
+	visitStamps.resize(objects.size(), 0);
+	if (++currentStamp == 0) {
+		std::fill(visitStamps.begin(), visitStamps.end(), 0u);
+		currentStamp = 1;
+	}
+}
+
+void UniformGrid::queryFrustum(const Frustum &frustum, std::vector<uint32_t> &results) const
+{
+	for (uint32_t handle = 0; handle < objects.size(); handle++) {
+		if (objects[handle].live && frustum.intersects(objects[handle].box)) {
+			results.push_back(handle);
+		}
+	}
+}
+
+void UniformGrid::queryBox(const BoundingBox &query, std::vector<uint32_t> &results) const
+{
+	beginVisit();
+	visitCells(cellsOf(query), [&](uint32_t handle) {
+		const BoundingBox &box = objects[handle].box;
+		if (Overlaps(box.min, box.max, query.min, query.max)) {
+			results.push_back(handle);
+		}
+	});
+}
+
+void UniformGrid::querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &results) const
+{
+	float radiusSquared = radius * radius;
+	beginVisit();
+	visitCells(cellsOf(BoundingBox(center - glm::vec3(radius), center + glm::vec3(radius))), [&](uint32_t handle) {
+		if (DistanceSquared(objects[handle].box, center) <= radiusSquared) {
+			results.push_back(handle);
+		}
+	});
+}
+
+void UniformGrid::queryNearest(const glm::vec3 &point, size_t k, std::vector<uint32_t> &results) const
+{
+	if (k == 0 || size() == 0) {
+		return;
+	}
+
+	// Search square rings of cells around the point's cell. Cells in ring r are
+	// at least (r - 1) cells away, which bounds when the search can stop.
+	typedef std::pair<float, uint32_t> Candidate;
+	std::priority_queue<Candidate> best;
+	int centerX = static_cast<int>(std::floor(point.x / cellSize));
+	int centerZ = static_cast<int>(std::floor(point.z / cellSize));
+	int lastRing = std::max(std::max(std::abs(occupied.x0 - centerX), std::abs(occupied.x1 - centerX)),
+							std::max(std::abs(occupied.z0 - centerZ), std::abs(occupied.z1 - centerZ)));
+
+	beginVisit();
+	auto consider = [&](uint32_t handle) {
+		float distance = DistanceSquared(objects[handle].box, point);
+		if (best.size() < k) {
+			best.push(Candidate(distance, handle));
+		} else if (distance < best.top().first) {
+			best.pop();
+			best.push(Candidate(distance, handle));
+		}
+	};
+	for (int ring = 0; ring <= lastRing; ring++) {
+		if (best.size() == k) {
+			float ringDistance = (ring - 1) * cellSize;
+			if (ringDistance > 0.0f && ringDistance * ringDistance > best.top().first) {
+				break;
+			}
+		}
+		if (ring == 0) {
+			visitCells(CellRange{centerX, centerZ, centerX, centerZ}, consider);
+			continue;
+		}
+		// Top and bottom rows, then the left and right columns between them
+		visitCells(CellRange{centerX - ring, centerZ - ring, centerX + ring, centerZ - ring}, consider);
+		visitCells(CellRange{centerX - ring, centerZ + ring, centerX + ring, centerZ + ring}, consider);
+		visitCells(CellRange{centerX - ring, centerZ - ring + 1, centerX - ring, centerZ + ring - 1}, consider);
+		visitCells(CellRange{centerX + ring, centerZ - ring + 1, centerX + ring, centerZ + ring - 1}, consider);
+	}
+
+	size_t start = results.size();
+	results.resize(start + best.size());
+	for (size_t i = results.size(); i-- > start;) {
+		results[i] = best.top().second;
+		best.pop();
+	}
+}
@@ -0,0 +1,106 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "frustum_culling.h"
+
+// Node of a flattened BVH, 32 bytes so two share a cache line. Nodes are stored
+// depth first: an interior node's first child directly follows it.
+struct BvhNode {
+    glm::vec3 min;
+    uint32_t offset; // Leaf: first slot in the primitive list; interior: second child
+    glm::vec3 max;
+    uint32_t count;  // Primitives in a leaf, 0 for interior nodes
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode must stay 32 bytes");
+
+// Bounding volume hierarchy over static boxes, built top down with a binned
+// surface area heuristic. Queries report the indices of the boxes passed to
+// build(); k-nearest results are ordered nearest first by distance to the box.
+class BoundingVolumeHierarchy {
+public:
+    void build(const std::vector<BoundingBox> &boxes);
+    // Recomputes node bounds for moved boxes without changing the topology;
+    // boxes must have the same count and order as in build()
+    void refit(const std::vector<BoundingBox> &boxes);
+
+    void queryFrustum(const Frustum &frustum, std::vector<uint32_t> &results) const;
+    void queryBox(const BoundingBox &box, std::vector<uint32_t> &results) const;
+    void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &results) const;
+    void queryNearest(const glm::vec3 &point, size_t k, std::vector<uint32_t> &results) const;
+
+    size_t size() const { return primitiveBounds.size(); }
+    size_t nodeCount() const { return nodes.size(); }
+    int depth() const { return treeDepth; }
+
+private:
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> primitives;         // Box indices, grouped by leaf
+    std::vector<BoundingBox> primitiveBounds; // Indexed by box index
+    std::vector<glm::vec3> centroids;
+    int treeDepth = 0;
+
+    void buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, int level);
+    // overlaps(min, max) classifies a node; subtrees it reports as
+    // FRUSTUM_INSIDE are reported without calling accept
+    template <typename Overlaps, typename Accept>
+    void traverse(Overlaps overlaps, Accept accept, std::vector<uint32_t> &results) const;
+};
+
+// Hashed uniform grid over the xz plane for objects that move every frame.
+// update() only touches the cell lists when the object crosses a cell
+// boundary, so refitting a walking bot is usually just a box copy.
+class UniformGrid {
+public:
+    explicit UniformGrid(float cellSize = 50.0f) : cellSize(cellSize) {}
+
+    uint32_t insert(const BoundingBox &box); // Returns a handle
+    void update(uint32_t handle, const BoundingBox &box);
+    void remove(uint32_t handle);
+    const BoundingBox &bounds(uint32_t handle) const { return objects[handle].box; }
+
+    // Dynamic sets are small, so frustum queries test every live object
+    void queryFrustum(const Frustum &frustum, std::vector<uint32_t> &results) const;
+    void queryBox(const BoundingBox &box, std::vector<uint32_t> &results) const;
+    void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &results) const;
+    void queryNearest(const glm::vec3 &point, size_t k, std::vector<uint32_t> &results) const;
+
+    size_t size() const { return objects.size() - freeHandles.size(); }
+
+private:
+    struct CellRange {
+        int x0, z0, x1, z1;
+        bool operator==(const CellRange &other) const { return x0 == other.x0 && z0 == other.z0 && x1 == other.x1 && z1 == other.z1; }
+    };
+    struct Object {
+        BoundingBox box;
+        CellRange cells;
+        bool live;
+    };
+
+    float cellSize;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    std::vector<Object> objects;
+    std::vector<uint32_t> freeHandles;
+    CellRange occupied = {0, 0, -1, -1}; // Grows to cover every cell ever used
+
+    // Visit marks so objects spanning several cells are reported once
+    mutable std::vector<uint32_t> visitStamps;
+    mutable uint32_t currentStamp = 0;
+
+    CellRange cellsOf(const BoundingBox &box) const;
+    void link(uint32_t handle, const CellRange &range);
+    void unlink(uint32_t handle, const CellRange &range);
+    void beginVisit() const; // Marks every object unvisited for a new query
+    template <typename Accept>
+    void visitCells(const CellRange &range, Accept accept) const;
+};
+
+// Squared distance from point to the closest point of box, 0 inside
+float DistanceSquared(const BoundingBox &box, const glm::vec3 &point);
+
+#endif // SPATIAL_INDEX_H
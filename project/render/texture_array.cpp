@@ -0,0 +1,123 @@
+#include "texture_array.h"
+#include "gl_state.h"
+
+#include <stb/stb_image.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+struct LoadedImage {
+	int width, height;
+	unsigned char *pixels; // RGB8
+};
+
+static bool IsImageFile(const std::filesystem::path &path)
+{
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+	return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".bmp" || extension == ".tga";
+}
+
+// Bilinear resample of an RGB8 image to size x size
+static std::vector<unsigned char> ResizeRGB(const LoadedImage &image, int size)
+{
+	std::vector<unsigned char> result(size_t(size) * size * 3);
+	for (int y = 0; y < size; y++) {
+		float sourceY = std::max(0.0f, (y + 0.5f) * image.height / size - 0.5f);
+		int y0 = std::min(static_cast<int>(sourceY), image.height - 1);
+		int y1 = std::min(y0 + 1, image.height - 1);
+		float fy = sourceY - y0;
+
+		for (int x = 0; x < size; x++) {
+			float sourceX = std::max(0.0f, (x + 0.5f) * image.width / size - 0.5f);
+			int x0 = std::min(static_cast<int>(sourceX), image.width - 1);
+			int x1 = std::min(x0 + 1, image.width - 1);
+			float fx = sourceX - x0;
+
+			for (int c = 0; c < 3; c++) {
+				float top = image.pixels[(y0 * image.width + x0) * 3 + c] * (1.0f - fx) + image.pixels[(y0 * image.width + x1) * 3 + c] * fx;
+				float bottom = image.pixels[(y1 * image.width + x0) * 3 + c] * (1.0f - fx) + image.pixels[(y1 * image.width + x1) * 3 + c] * fx;
+				result[(size_t(y) * size + x) * 3 + c] = static_cast<unsigned char>(top * (1.0f - fy) + bottom * fy + 0.5f);
+			}
+		}
+	}
+	return result;
+}
+
+GLuint LoadTextureArrayFromDirectory(const std::string &directory, int *layerCount, int layerSize)
+{
+	*layerCount = 0;
+
+	std::vector<std::string> paths;
+	std::error_code error;
+	for (const auto &entry : std::filesystem::directory_iterator(directory, error)) {
+		if (entry.is_regular_file() && IsImageFile(entry.path())) {
+			paths.push_back(entry.path().string());
+		}
+	}
+	if (error) {
+		fprintf(stderr, "Cannot read texture directory %s: %s\n", directory.c_str(), error.message().c_str());
+		return 0;
+	}
+	std::sort(paths.begin(), paths.end());
+
+	std::vector<LoadedImage> images;
+	int largest = 0;
+	for (const std::string &path : paths) {
+		LoadedImage image;
+		int channels;
+		image.pixels = stbi_load(path.c_str(), &image.width, &image.height, &channels, 3);
+		if (!image.pixels) {
+			fprintf(stderr, "Failed to load texture %s\n", path.c_str());
+			continue;
+		}
+		largest = std::max(largest, std::max(image.width, image.height));
+		images.push_back(image);
+	}
+	if (images.empty()) {
+		fprintf(stderr, "No images found in %s\n", directory.c_str());
+		return 0;
+	}
+
+	int size = layerSize > 0 ? layerSize : largest;
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	if (static_cast<GLint>(images.size()) > maxLayers) {
+		fprintf(stderr, "%s has %d images, only the first %d fit in a texture array\n", directory.c_str(), (int)images.size(), maxLayers);
+		for (size_t i = maxLayers; i < images.size(); i++) {
+			stbi_image_free(images[i].pixels);
+		}
+		images.resize(maxLayers);
+	}
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glState.bindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, size, size, static_cast<GLsizei>(images.size()), 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+	// Rows of RGB8 data are not 4-byte aligned for arbitrary sizes
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t layer = 0; layer < images.size(); layer++) {
+		const LoadedImage &image = images[layer];
+		if (image.width == size && image.height == size) {
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, static_cast<GLint>(layer), size, size, 1, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+		} else {
+			std::vector<unsigned char> resized = ResizeRGB(image, size);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, static_cast<GLint>(layer), size, size, 1, GL_RGB, GL_UNSIGNED_BYTE, resized.data());
+		}
+		stbi_image_free(image.pixels);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+	*layerCount = static_cast<int>(images.size());
+	printf("Loaded %d texture layers (%dx%d) from %s\n", *layerCount, size, size, directory.c_str());
+	return texture;
+}
@@ -0,0 +1,13 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <glad/gl.h>
+#include <string>
+
+// Loads every image in directory (sorted by file name) into one RGB
+// GL_TEXTURE_2D_ARRAY with a full mip chain. Layers are resized to a common
+// square resolution: layerSize, or the largest image dimension when 0. Returns
+// 0 if no image could be loaded; layerCount receives the number of layers.
+GLuint LoadTextureArrayFromDirectory(const std::string &directory, int *layerCount, int layerSize = 0);
+
+#endif // TEXTURE_ARRAY_H
@@ -0,0 +1,74 @@
+#include "vertex_format.h"
+#include "gl_state.h"
+
+#include <iostream>
+
+static size_t TypeSize(GLenum type)
+{
+	switch (type) {
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return 1;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+	case GL_HALF_FLOAT:
+		return 2;
+	default:
+		return 4;
+	}
+}
+
+VertexFormat &VertexFormat::add(GLuint location, GLint components, GLenum type, GLboolean normalized)
+{
+	VertexAttribute attribute;
+	attribute.location = location;
+	attribute.components = components;
+	attribute.type = type;
+	attribute.normalized = normalized;
+	attribute.offset = vertexSize;
+	attributeList.push_back(attribute);
+
+	// Keep every attribute 4-byte aligned
+	vertexSize += (components * TypeSize(type) + 3) & ~size_t(3);
+	return *this;
+}
+
+void VertexFormat::apply() const
+{
+	for (const VertexAttribute &attribute : attributeList) {
+		glState.enableVertexAttribArray(attribute.location);
+		const void *offset = reinterpret_cast<const void *>(attribute.offset);
+		if (attribute.type == GL_FLOAT || attribute.type == GL_HALF_FLOAT || attribute.normalized) {
+			glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized, stride(), offset);
+		} else {
+			glVertexAttribIPointer(attribute.location, attribute.components, attribute.type, stride(), offset);
+		}
+		if (divisor != 0) {
+			glVertexAttribDivisor(attribute.location, divisor);
+		}
+	}
+}
+
+std::vector<GLfloat> VertexFormat::interleave(size_t vertexCount, const std::vector<const GLfloat *> &streams) const
+{
+	std::vector<GLfloat> vertices(vertexCount * vertexSize / sizeof(GLfloat));
+	if (streams.size() != attributeList.size()) {
+		std::cerr << "Vertex format has " << attributeList.size() << " attributes but got " << streams.size() << " streams" << std::endl;
+		return vertices;
+	}
+
+	size_t floatStride = vertexSize / sizeof(GLfloat);
+	for (size_t a = 0; a < attributeList.size(); a++) {
+		const VertexAttribute &attribute = attributeList[a];
+		if (streams[a] == NULL) {
+			continue;
+		}
+		size_t first = attribute.offset / sizeof(GLfloat);
+		for (size_t v = 0; v < vertexCount; v++) {
+			for (GLint c = 0; c < attribute.components; c++) {
+				vertices[v * floatStride + first + c] = streams[a][v * attribute.components + c];
+			}
+		}
+	}
+	return vertices;
+}
@@ -0,0 +1,45 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/gl.h>
+#include <cstddef>
+#include <vector>
+
+// One attribute of an interleaved vertex
+struct VertexAttribute {
+    GLuint location;
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    size_t offset; // Byte offset inside the vertex
+};
+
+// Layout of one interleaved vertex buffer. Meshes declare their attributes in
+// buffer order and apply() records them into the bound VAO once at setup, so
+// drawing only has to bind the VAO. A non-zero divisor makes every attribute
+// of the format per-instance.
+class VertexFormat {
+public:
+    explicit VertexFormat(GLuint divisor = 0) : divisor(divisor), vertexSize(0) {}
+
+    VertexFormat &add(GLuint location, GLint components, GLenum type = GL_FLOAT, GLboolean normalized = GL_FALSE);
+
+    GLsizei stride() const { return static_cast<GLsizei>(vertexSize); }
+    const std::vector<VertexAttribute> &attributes() const { return attributeList; }
+
+    // Enables and points every attribute at the buffer bound to GL_ARRAY_BUFFER.
+    // The target VAO must be bound.
+    void apply() const;
+
+    // Interleaves one tightly packed float stream per attribute, in declaration
+    // order, into a single array laid out by this format. A NULL stream leaves
+    // its attribute zeroed.
+    std::vector<GLfloat> interleave(size_t vertexCount, const std::vector<const GLfloat *> &streams) const;
+
+private:
+    GLuint divisor;
+    size_t vertexSize;
+    std::vector<VertexAttribute> attributeList;
+};
+
+#endif // VERTEX_FORMAT_H
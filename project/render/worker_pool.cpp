@@ -0,0 +1,74 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+
+void WorkerPool::start(int threadCount)
+{
+	stop();
+	if (threadCount <= 0) {
+		threadCount = std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+	}
+	stopping = false;
+	for (int i = 0; i < threadCount; i++) {
+		threads.emplace_back(&WorkerPool::workerLoop, this);
+	}
+}
+
+void WorkerPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+}
+
+void WorkerPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || (job && nextJob < jobCount); });
+		if (stopping) {
+			return;
+		}
+		// Jobs are coarse (a band of pixels, a slice of an array), so handing
+		// them out under the lock costs nothing measurable
+		int index = nextJob++;
+		const std::function<void(int)> *current = job;
+		lock.unlock();
+		(*current)(index);
+		lock.lock();
+		if (--pendingJobs == 0) {
+			finished.notify_all();
+		}
+	}
+}
+
+void WorkerPool::run(int jobCount, const std::function<void(int)> &function)
+{
+	if (jobCount <= 0) {
+		return;
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	job = &function;
+	this->jobCount = jobCount;
+	nextJob = 0;
+	pendingJobs = jobCount;
+	wake.notify_all();
+
+	// The calling thread works through the queue too
+	while (nextJob < this->jobCount) {
+		int index = nextJob++;
+		lock.unlock();
+		function(index);
+		lock.lock();
+		pendingJobs--;
+	}
+	finished.wait(lock, [this] { return pendingJobs == 0; });
+	job = NULL;
+	this->jobCount = 0;
+}
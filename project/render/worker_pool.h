@@ -0,0 +1,39 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for splitting per-frame CPU work into jobs.
+// run() hands out job indices to the workers and the calling thread and
+// returns once every job has finished, so callers need no extra barrier.
+class WorkerPool {
+public:
+    ~WorkerPool() { stop(); }
+
+    // Starts threadCount workers; 0 picks one less than the hardware threads,
+    // leaving a core for the render thread. The pool may have no workers, in
+    // which case run() executes every job on the caller.
+    void start(int threadCount = 0);
+    void stop();
+
+    // Calls job(i) for every i in [0, jobCount)
+    void run(int jobCount, const std::function<void(int)> &job);
+
+    int size() const { return static_cast<int>(threads.size()); }
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    const std::function<void(int)> *job = NULL;
+    int jobCount = 0, nextJob = 0, pendingJobs = 0;
+    bool stopping = false;
+
+    void workerLoop();
+};
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,21 @@
+#version 330 core
+
+in vec2 UV;
+
+out vec4 blurred;
+
+uniform sampler2D moments;
+
+// Gaussian weights of the 5-tap blur, centre first
+const float Weights[3] = float[](0.375, 0.25, 0.0625);
+
+// Vertical half of the separable blur
+void main() {
+    float texelHeight = 1.0 / float(textureSize(moments, 0).y);
+    blurred = Weights[0] * texture(moments, UV);
+    for (int i = 1; i < 3; i++) {
+        vec2 offset = vec2(0.0, float(i) * texelHeight);
+        blurred += Weights[i] * texture(moments, UV + offset);
+        blurred += Weights[i] * texture(moments, UV - offset);
+    }
+}
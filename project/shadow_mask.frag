@@ -0,0 +1,113 @@
+#version 330 core
+
+in vec2 UV;
+
+out vec2 mask; // Shadow term and view depth of the pixel
+
+uniform sampler2D depthMap;       // Depth prepass
+uniform sampler2DArray shadowMap; // Cascade depth, or moments for VSM and EVSM
+uniform mat4 inverseViewProjection;
+
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
+layout(std140) uniform LightBlock {
+    vec3 lightDirection;
+    float lightIntensity;
+    vec3 lightPosition;
+    vec3 lightColor;
+};
+
+// Shadow cascades; cascadeSplits holds the far view depth of each
+layout(std140) uniform CascadeBlock {
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
+    int cascadeCount;
+    int shadowTechnique; // 0: PCF, 1: VSM, 2: EVSM
+    int useShadowMask;
+};
+
+// Exponents of the EVSM warp, as in shadow_moments.frag
+const vec2 EVSMExponents = vec2(40.0, 5.0);
+
+// Upper bound on the lit fraction from the mean and mean square of the
+// occluder depth (Chebyshev); its tail is cut off to reduce light bleeding
+float chebyshevUpperBound(vec2 moments, float depth, float minVariance) {
+    if (depth <= moments.x) {
+        return 1.0;
+    }
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    return clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+}
+
+// Shadow factor from one filtered fetch of the VSM or EVSM moments
+float momentShadow(vec3 projCoords, float layer) {
+    vec4 moments = texture(shadowMap, vec3(projCoords.xy, layer));
+    if (shadowTechnique == 1) {
+        return 1.0 - chebyshevUpperBound(moments.xy, projCoords.z, 0.00002);
+    }
+    float warped = 2.0 * projCoords.z - 1.0;
+    float positive = exp(EVSMExponents.x * warped);
+    float negative = -exp(-EVSMExponents.y * warped);
+    // The minimum variance is scaled by the slope of each warp
+    float positiveVariance = 0.00002 * EVSMExponents.x * EVSMExponents.x * positive * positive;
+    float negativeVariance = 0.00002 * EVSMExponents.y * EVSMExponents.y * negative * negative;
+    return 1.0 - min(chebyshevUpperBound(moments.xy, positive, positiveVariance),
+                     chebyshevUpperBound(moments.zw, negative, negativeVariance));
+}
+
+// Same 5x5 PCF as the receivers
+float pcfShadow(vec3 projCoords, float layer, float bias) {
+    vec2 texelSize = 1.0 / textureSize(shadowMap, 0).xy;
+    float shadow = 0.0;
+    for (int x = -2; x <= 2; ++x) {
+        for (int y = -2; y <= 2; ++y) {
+            float closestDepth = texture(shadowMap, vec3(projCoords.xy + vec2(x, y) * texelSize, layer)).r;
+            shadow += projCoords.z - bias > closestDepth ? 1.0 : 0.0;
+        }
+    }
+    return shadow / 25.0;
+}
+
+// Evaluates the shadow term once for the visible surface of every pixel
+void main() {
+    float depth = texture(depthMap, UV).r;
+    if (depth >= 1.0) {
+        mask = vec2(0.0, 1.0e6); // Sky; nothing to shadow
+        return;
+    }
+
+    vec4 world = inverseViewProjection * vec4(vec3(UV, depth) * 2.0 - 1.0, 1.0);
+    vec3 position = world.xyz / world.w;
+    float viewDepth = (vpMatrix * vec4(position, 1.0)).w;
+    mask.y = viewDepth;
+
+    // Surface normal from the screen-space derivatives of the position, facing
+    // the camera; it only scales the bias
+    vec3 normal = normalize(cross(dFdx(position), dFdy(position)));
+    if (dot(normal, cameraPosition - position) < 0.0) {
+        normal = -normal;
+    }
+    vec3 lightDir = normalize(-lightDirection);
+
+    int cascade = 0;
+    while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    vec4 lightSpace = cascadeMatrices[cascade] * vec4(position, 1.0);
+    vec3 projCoords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+    if (any(lessThan(projCoords, vec3(0.0))) || any(greaterThan(projCoords, vec3(1.0)))) {
+        mask.x = 0.0; // Outside the cascade
+        return;
+    }
+
+    if (shadowTechnique != 0) {
+        mask.x = momentShadow(projCoords, float(cascade));
+    } else {
+        mask.x = pcfShadow(projCoords, float(cascade), max(0.005 * (1.0 - dot(normal, lightDir)), 0.001));
+    }
+}
@@ -0,0 +1,37 @@
+#version 330 core
+
+in vec2 UV;
+
+out vec4 moments;
+
+uniform sampler2DArray depthMap;
+uniform float layer;
+uniform int technique; // 1: VSM, 2: EVSM
+
+// Exponents of the EVSM warp; the largest that stay finite in 32-bit floats
+const vec2 EVSMExponents = vec2(40.0, 5.0);
+
+// Gaussian weights of the 5-tap blur, centre first
+const float Weights[3] = float[](0.375, 0.25, 0.0625);
+
+vec4 depthMoments(float depth) {
+    if (technique == 1) {
+        return vec4(depth, depth * depth, 0.0, 0.0);
+    }
+    float warped = 2.0 * depth - 1.0;
+    float positive = exp(EVSMExponents.x * warped);
+    float negative = -exp(-EVSMExponents.y * warped);
+    return vec4(positive, positive * positive, negative, negative * negative);
+}
+
+// Converts the depth to moments and blurs them horizontally; the moments are
+// not linear in depth, so they have to be taken before filtering
+void main() {
+    float texelWidth = 1.0 / float(textureSize(depthMap, 0).x);
+    moments = Weights[0] * depthMoments(texture(depthMap, vec3(UV, layer)).r);
+    for (int i = 1; i < 3; i++) {
+        vec2 offset = vec2(float(i) * texelWidth, 0.0);
+        moments += Weights[i] * depthMoments(texture(depthMap, vec3(UV + offset, layer)).r);
+        moments += Weights[i] * depthMoments(texture(depthMap, vec3(UV - offset, layer)).r);
+    }
+}
@@ -0,0 +1,44 @@
+#version 330 core
+
+in vec2 UV;
+
+out float mask;
+
+uniform sampler2D depthMap;  // Full resolution depth prepass
+uniform sampler2D lowMask;   // Half resolution shadow term and view depth
+uniform mat4 inverseViewProjection;
+
+layout(std140) uniform CameraBlock {
+    mat4 vpMatrix;
+    vec3 cameraPosition;
+};
+
+// Bilinear upsampling of the half resolution mask that ignores the samples
+// lying on another surface than the pixel, so shadows do not bleed across
+// silhouettes
+void main() {
+    float depth = texture(depthMap, UV).r;
+    if (depth >= 1.0) {
+        mask = 0.0;
+        return;
+    }
+    vec4 world = inverseViewProjection * vec4(vec3(UV, depth) * 2.0 - 1.0, 1.0);
+    float viewDepth = (vpMatrix * vec4(world.xyz / world.w, 1.0)).w;
+
+    ivec2 lowSize = textureSize(lowMask, 0);
+    vec2 texel = UV * vec2(lowSize) - 0.5;
+    ivec2 base = ivec2(floor(texel));
+    vec2 f = fract(texel);
+
+    // Samples are weighted down by their depth difference relative to the pixel
+    float total = 0.0, weightSum = 0.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        vec2 low = texelFetch(lowMask, clamp(base + offset, ivec2(0), lowSize - 1), 0).rg;
+        float bilinear = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+        float weight = bilinear / (abs(low.y - viewDepth) + 0.01 * viewDepth);
+        total += weight * low.x;
+        weightSum += weight;
+    }
+    mask = total / weightSum;
+}
@@ -3,15 +3,43 @@
 
 #include <glm/glm.hpp>
 
+enum LightType {
+    LIGHT_DIRECTIONAL, // The sun; shadowed by the cascades
+    LIGHT_SPOT,        // Shadowed by one atlas tile
+    LIGHT_POINT        // Shadowed by six atlas tiles, one per axis direction
+};
+
 struct Light {
+    LightType type = LIGHT_DIRECTIONAL;
     glm::vec3 direction;
     glm::vec3 position;
     glm::vec3 color;
     glm::vec3 look_at;
     float intensity;
+    float range = 0.0f;                          // Spot and point: distance at which the light has faded out
+    float innerCone = 0.0f, outerCone = 0.0f;    // Spot: half angles in radians of full and zero intensity
+    bool castsShadows = false;
 
     Light(glm::vec3 dir, glm::vec3 pos, glm::vec3 col, glm::vec3 lookat, float inten)
         : direction(dir), position(pos), color(col), intensity(inten), look_at(lookat){}
+
+    static Light spot(glm::vec3 pos, glm::vec3 dir, glm::vec3 col, float inten, float range, float innerAngle, float outerAngle) {
+        Light light(glm::normalize(dir), pos, col, pos + dir, inten);
+        light.type = LIGHT_SPOT;
+        light.range = range;
+        light.innerCone = innerAngle;
+        light.outerCone = outerAngle;
+        light.castsShadows = true;
+        return light;
+    }
+
+    static Light point(glm::vec3 pos, glm::vec3 col, float inten, float range) {
+        Light light(glm::vec3(0.0f, -1.0f, 0.0f), pos, col, pos, inten);
+        light.type = LIGHT_POINT;
+        light.range = range;
+        light.castsShadows = true;
+        return light;
+    }
 };
 
 #endif // LIGHTINFO_H